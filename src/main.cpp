@@ -1,39 +1,337 @@
 #include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/migration/migration.h"
+#include "storage/cas/cas.h"
+#include "storage/geojson_import/geojson_import.h"
+#include "storage/geojson_export/geojson_export.h"
 #include "utils/logger/logger.h"
+#include <algorithm>
+#include <array>
+#include <fstream>
 #include <iostream>
+#include <memory>
+#include <optional>
+#include <sstream>
+#include <string>
+#include <vector>
 
 using namespace geoversion;
 
+namespace {
+
+bool ensure_database(storage::MongoDBConnection& mongo) {
+    if (!mongo.test_connection()) {
+        utils::Logger::error("Failed to connect to MongoDB");
+        return false;
+    }
+
+    utils::Logger::info("MongoDB connection successful");
+
+    if (!mongo.is_initialized()) {
+        utils::Logger::warning("Database not initialized. Please run init_mongodb.js script first.");
+        utils::Logger::info("Attempting to create indexes...");
+
+        if (mongo.initialize_database()) {
+            utils::Logger::info("Database indexes created successfully");
+        } else {
+            utils::Logger::error("Failed to initialize database");
+            return false;
+        }
+    } else {
+        utils::Logger::info("Database is initialized");
+    }
+
+    return true;
+}
+
+int run_hash_migration(storage::MongoDBConnection& mongo, bool apply) {
+    storage::Migration migration(mongo);
+    storage::HashMigrationReport report = apply
+        ? migration.migrate_hashes()
+        : migration.verify_hashes();
+
+    utils::Logger::info(
+        "Scanned " + std::to_string(report.scanned) + " objects: " +
+        std::to_string(report.canonical) + " canonical, " +
+        std::to_string(report.legacy) + " legacy JSON, " +
+        std::to_string(report.unknown) + " unverifiable"
+    );
+
+    if (apply) {
+        utils::Logger::info(
+            "Migrated " + std::to_string(report.migrated) + ", re-encoded " +
+            std::to_string(report.reencoded) + ", merged " +
+            std::to_string(report.merged) + ", failed " + std::to_string(report.failed) +
+            ", updated " + std::to_string(report.references_updated) + " referencing documents, " +
+            std::to_string(report.references_failed) + " unreadable"
+        );
+        return report.failed == 0 && report.references_failed == 0 ? 0 : 1;
+    }
+
+    return report.unknown == 0 ? 0 : 1;
+}
+
+int run_envelope_backfill(storage::MongoDBConnection& mongo) {
+    storage::Migration migration(mongo);
+    storage::EnvelopeBackfillReport report = migration.backfill_envelopes();
+
+    utils::Logger::info(
+        "Scanned " + std::to_string(report.scanned) + " objects without envelope: " +
+        std::to_string(report.updated) + " updated, " +
+        std::to_string(report.skipped) + " without usable geometry, " +
+        std::to_string(report.failed) + " failed"
+    );
+
+    return report.failed == 0 ? 0 : 1;
+}
+
+struct ImportArgs {
+    std::string path;
+    storage::PrecisionOptions precision;
+    bool split_geometry = false;
+};
+
+// geoversion import <file> [--precision <grid>] [--blob|--blob-only]
+//                   [--split-geometry] [connection_string]
+bool parse_import_args(int argc, char* argv[], ImportArgs& args, int& arg_index) {
+    if (argc < 3) {
+        return false;
+    }
+    args.path = argv[2];
+    arg_index = argc;
+
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--precision" && i + 1 < argc) {
+            std::istringstream input(argv[++i]);
+            if (!(input >> args.precision.grid) || !(args.precision.grid > 0.0)) {
+                return false;
+            }
+            args.precision.enabled = true;
+        } else if (arg == "--blob") {
+            args.precision.encoding = storage::GeometryEncoding::GeoJSONAndBlob;
+        } else if (arg == "--blob-only") {
+            args.precision.encoding = storage::GeometryEncoding::Blob;
+        } else if (arg == "--split-geometry") {
+            args.split_geometry = true;
+        } else if (arg.rfind("--", 0) == 0) {
+            return false;
+        } else if (arg_index == argc) {
+            arg_index = i;
+        } else {
+            return false;
+        }
+    }
+    // Blobs only exist for quantized geometries.
+    return args.precision.enabled || args.precision.encoding == storage::GeometryEncoding::GeoJSON;
+}
+
+int run_import(storage::MongoDBConnection& mongo, const ImportArgs& args) {
+    const std::string& path = args.path;
+    storage::CAS cas(mongo);
+    cas.set_precision(args.precision);
+    // Geometries too large for one document are always chunked.
+    cas.set_geometry_cas(
+        std::make_shared<storage::GeometryCAS>(mongo),
+        args.split_geometry ? 0 : storage::GeometryCAS::kChunkThreshold
+    );
+
+    storage::GeoJSONImportOptions options;
+    options.pipeline.writer_threads = 2;
+    storage::GeoJSONImporter importer(cas, options);
+    importer.set_progress([](const storage::GeoJSONImportProgress& progress) {
+        double seconds = std::max(0.001, progress.elapsed.count() / 1000.0);
+        utils::Logger::info(
+            "Imported " + std::to_string(progress.features) + " features, " +
+            std::to_string(progress.bytes_read / (1024 * 1024)) + " of " +
+            std::to_string(progress.total_bytes / (1024 * 1024)) + " MB (" +
+            std::to_string(static_cast<uint64_t>(progress.features / seconds)) + " features/s)"
+        );
+    });
+
+    utils::Logger::info("Importing " + path);
+    storage::GeoJSONImportReport report = importer.import_file(path);
+
+    const storage::StoreManyStats& store = report.pipeline.store;
+    utils::Logger::info(
+        "Read " + std::to_string(report.features) + " features in " +
+        std::to_string(report.pipeline.elapsed.count()) + " ms: " +
+        std::to_string(store.inserted) + " inserted, " +
+        std::to_string(store.duplicates) + " already stored, " +
+        std::to_string(store.failed) + " failed, " +
+        std::to_string(report.without_geometry) + " without geometry"
+    );
+    for (const auto& stage : report.pipeline.stages) {
+        if (stage.rejected > 0) {
+            utils::Logger::warning(std::to_string(stage.rejected) + " features rejected at " + stage.name + " stage");
+        }
+    }
+
+    if (!report.ok) {
+        utils::Logger::error("Import stopped: " + report.error);
+        return 1;
+    }
+    return store.failed == 0 ? 0 : 1;
+}
+
+struct ExportArgs {
+    std::string output;
+    std::optional<std::array<double, 4>> bbox;
+    std::string hashes_path;
+    std::optional<storage::ExportCompression> compression;
+};
+
+// geoversion export <output|-> [--bbox min_lon,min_lat,max_lon,max_lat]
+//                   [--hashes <file>] [--gzip|--zstd] [connection_string]
+bool parse_export_args(int argc, char* argv[], ExportArgs& args, int& arg_index) {
+    if (argc < 3) {
+        return false;
+    }
+    args.output = argv[2];
+    arg_index = argc;
+
+    for (int i = 3; i < argc; ++i) {
+        std::string arg = argv[i];
+        if (arg == "--bbox" && i + 1 < argc) {
+            std::array<double, 4> bbox{};
+            std::istringstream input(argv[++i]);
+            char comma = ',';
+            if (!(input >> bbox[0] >> comma >> bbox[1] >> comma >> bbox[2] >> comma >> bbox[3])) {
+                return false;
+            }
+            args.bbox = bbox;
+        } else if (arg == "--hashes" && i + 1 < argc) {
+            args.hashes_path = argv[++i];
+        } else if (arg == "--gzip") {
+            args.compression = storage::ExportCompression::Gzip;
+        } else if (arg == "--zstd") {
+            args.compression = storage::ExportCompression::Zstd;
+        } else if (arg.rfind("--", 0) == 0) {
+            return false;
+        } else if (arg_index == argc) {
+            arg_index = i;
+        } else {
+            return false;
+        }
+    }
+    return !(args.bbox && !args.hashes_path.empty());
+}
+
+int run_export(storage::MongoDBConnection& mongo, const ExportArgs& args) {
+    storage::CAS cas(mongo);
+    cas.set_geometry_cas(std::make_shared<storage::GeometryCAS>(mongo));
+
+    storage::ExportCompression compression = args.compression
+        ? *args.compression
+        : storage::compression_from_path(args.output);
+    std::string error;
+    auto sink = storage::open_output_sink(args.output, compression, error);
+    if (!sink) {
+        utils::Logger::error("Cannot open export output: " + error);
+        return 1;
+    }
+
+    storage::GeoJSONExporter exporter(cas);
+    storage::GeoJSONExportReport report;
+    if (args.bbox) {
+        const auto& bbox = *args.bbox;
+        report = exporter.export_bbox(bbox[0], bbox[1], bbox[2], bbox[3], *sink);
+    } else if (!args.hashes_path.empty()) {
+        std::ifstream input(args.hashes_path);
+        if (!input) {
+            utils::Logger::error("Cannot open hash list " + args.hashes_path);
+            return 1;
+        }
+        std::vector<storage::HashId> hashes;
+        std::string line;
+        while (std::getline(input, line)) {
+            storage::HashId hash;
+            if (!line.empty() && storage::HashId::from_hex(line, hash)) {
+                hashes.push_back(hash);
+            }
+        }
+        report = exporter.export_hashes(hashes, *sink);
+    } else {
+        report = exporter.export_all(*sink);
+    }
+
+    if (!report.ok) {
+        utils::Logger::error("Export failed: " + report.error);
+        return 1;
+    }
+    utils::Logger::info(
+        "Exported " + std::to_string(report.features) + " features (" +
+        std::to_string(report.bytes / (1024 * 1024)) + " MB uncompressed) in " +
+        std::to_string(report.elapsed.count()) + " ms"
+    );
+    return 0;
+}
+
+}
+
 int main(int argc, char* argv[]) {
+    // With the export itself going to stdout, diagnostics move to stderr.
+    if (argc > 2 && std::string(argv[1]) == "export" && std::string(argv[2]) == "-") {
+        std::cout.rdbuf(std::cerr.rdbuf());
+    }
+
     utils::Logger::info("Starting GeoVersion Control System");
 
-    std::string connection_string = "mongodb://localhost:27017";
+    std::string command;
+    ImportArgs import_args;
+    ExportArgs export_args;
+    int arg_index = 1;
     if (argc > 1) {
-        connection_string = argv[1];
+        std::string first = argv[1];
+        if (first == "verify-hashes" || first == "migrate-hashes" || first == "backfill-envelopes") {
+            command = first;
+            ++arg_index;
+        } else if (first == "import") {
+            if (!parse_import_args(argc, argv, import_args, arg_index)) {
+                utils::Logger::error(
+                    "Usage: geoversion import <file> [--precision <grid>] [--blob|--blob-only] "
+                    "[--split-geometry] [connection_string]"
+                );
+                return 1;
+            }
+            command = first;
+        } else if (first == "export") {
+            if (!parse_export_args(argc, argv, export_args, arg_index)) {
+                utils::Logger::error(
+                    "Usage: geoversion export <output|-> [--bbox min_lon,min_lat,max_lon,max_lat] "
+                    "[--hashes <file>] [--gzip|--zstd] [connection_string]"
+                );
+                return 1;
+            }
+            command = first;
+        }
+    }
+
+    std::string connection_string = "mongodb://localhost:27017";
+    if (argc > arg_index) {
+        connection_string = argv[arg_index];
     }
 
     try {
-        storage::MongoDBConnection mongo(connection_string);
+        storage::MongoDBConnection mongo(connection_string, "geoversion", storage::ConnectionPoolOptions());
 
-        if (!mongo.test_connection()) {
-            utils::Logger::error("Failed to connect to MongoDB");
+        if (!ensure_database(mongo)) {
             return 1;
         }
 
-        utils::Logger::info("MongoDB connection successful");
-
-        if (!mongo.is_initialized()) {
-            utils::Logger::warning("Database not initialized. Please run init_mongodb.js script first.");
-            utils::Logger::info("Attempting to create indexes...");
-            
-            if (mongo.initialize_database()) {
-                utils::Logger::info("Database indexes created successfully");
-            } else {
-                utils::Logger::error("Failed to initialize database");
-                return 1;
-            }
-        } else {
-            utils::Logger::info("Database is initialized");
+        if (command == "verify-hashes") {
+            return run_hash_migration(mongo, false);
+        }
+        if (command == "migrate-hashes") {
+            return run_hash_migration(mongo, true);
+        }
+        if (command == "backfill-envelopes") {
+            return run_envelope_backfill(mongo);
+        }
+        if (command == "import") {
+            return run_import(mongo, import_args);
+        }
+        if (command == "export") {
+            return run_export(mongo, export_args);
         }
 
         utils::Logger::info("GeoVersion Control System ready");
@@ -6,8 +6,8 @@ db.createCollection('bpo_cas', {
             required: ['hash', 'geometry', 'attributes'],
             properties: {
                 hash: {
-                    bsonType: 'string',
-                    description: 'SHA-256 hash of the BPO content'
+                    bsonType: 'binData',
+                    description: 'SHA-256 hash of the BPO content (32 bytes)'
                 },
                 geometry: {
                     bsonType: 'object',
@@ -20,6 +20,129 @@ db.createCollection('bpo_cas', {
                 created_at: {
                     bsonType: 'date',
                     description: 'Creation timestamp'
+                },
+                last_stored_at: {
+                    bsonType: 'date',
+                    description: 'Time of the latest store, deduplicated ones included; guards against garbage collection'
+                },
+                envelope: {
+                    bsonType: 'object',
+                    required: ['min_lon', 'min_lat', 'max_lon', 'max_lat'],
+                    properties: {
+                        min_lon: { bsonType: 'double' },
+                        min_lat: { bsonType: 'double' },
+                        max_lon: { bsonType: 'double' },
+                        max_lat: { bsonType: 'double' }
+                    },
+                    description: 'Bounding box of the geometry'
+                },
+                centroid: {
+                    bsonType: 'object',
+                    required: ['lon', 'lat'],
+                    properties: {
+                        lon: { bsonType: 'double' },
+                        lat: { bsonType: 'double' }
+                    },
+                    description: 'Vertex centroid of the geometry'
+                },
+                geometry_q: {
+                    bsonType: 'binData',
+                    description: 'Quantized geometry (delta + zigzag + varint coordinates)'
+                },
+                geometry_encoding: {
+                    enum: ['q1', 'ref'],
+                    description: 'Set when geometry holds only an envelope: q1 keeps the full geometry in geometry_q, ref in bpo_geometries'
+                },
+                geometry_type: {
+                    bsonType: 'string',
+                    description: 'GeoJSON type of a geometry not stored in geometry'
+                },
+                geometry_hash: {
+                    bsonType: 'binData',
+                    description: 'Hash of the geometry in bpo_geometries (geometry_encoding ref)'
+                },
+                attributes_hash: {
+                    bsonType: 'binData',
+                    description: 'Hash of the attributes alone (geometry_encoding ref)'
+                }
+            }
+        }
+    }
+});
+
+db.createCollection('bpo_geometries', {
+    validator: {
+        $jsonSchema: {
+            bsonType: 'object',
+            required: ['hash'],
+            properties: {
+                hash: {
+                    bsonType: 'binData',
+                    description: 'SHA-256 hash of the geometry alone (32 bytes)'
+                },
+                geometry: {
+                    bsonType: 'object',
+                    description: 'GeoJSON geometry object, or its envelope when geometry_encoding is q1'
+                },
+                geometry_q: {
+                    bsonType: 'binData',
+                    description: 'Quantized geometry (delta + zigzag + varint coordinates)'
+                },
+                geometry_encoding: {
+                    enum: ['q1', 'chunked'],
+                    description: 'q1: geometry holds only an envelope and geometry_q the full geometry; chunked: positions live in bpo_geometry_chunks'
+                },
+                structure: {
+                    bsonType: 'binData',
+                    description: 'Type tags and counts of a chunked geometry'
+                },
+                positions: {
+                    bsonType: 'long',
+                    description: 'Number of positions of a chunked geometry'
+                },
+                chunks: {
+                    bsonType: 'array',
+                    items: { bsonType: 'binData' },
+                    description: 'Hashes of the position chunks, in order'
+                },
+                created_at: {
+                    bsonType: 'date',
+                    description: 'Creation timestamp'
+                },
+                last_stored_at: {
+                    bsonType: 'date',
+                    description: 'Time of the latest store, deduplicated ones included; guards against garbage collection'
+                }
+            }
+        }
+    }
+});
+
+db.createCollection('bpo_geometry_chunks', {
+    validator: {
+        $jsonSchema: {
+            bsonType: 'object',
+            required: ['hash', 'positions', 'data'],
+            properties: {
+                hash: {
+                    bsonType: 'binData',
+                    description: 'SHA-256 hash of the chunk data (32 bytes)'
+                },
+                positions: {
+                    bsonType: 'int',
+                    description: 'Number of positions in the chunk'
+                },
+                data: {
+                    bsonType: 'binData',
+                    description: 'Positions as consecutive x, y doubles'
+                },
+                created_at: {
+                    bsonType: 'date',
+                    description: 'Creation timestamp'
+                },
+                last_stored_at: {
+                    bsonType: 'date',
+                    description: 'Time of the latest store, deduplicated ones included; guards against garbage collection'
                 }
             }
         }
@@ -51,6 +174,10 @@ db.createCollection('situations', {
                 updated_at: {
                     bsonType: 'date',
                     description: 'Last update timestamp'
+                },
+                head_version_id: {
+                    bsonType: 'string',
+                    description: 'Latest committed version'
                 }
             }
         }
@@ -91,11 +218,92 @@ db.createCollection('situation_versions', {
                     description: 'Creation timestamp'
                 },
                 bpo_refs: {
+                    bsonType: 'array',
+                    items: {
+                        bsonType: 'binData'
+                    },
+                    description: 'Array of BPO hashes in this version (versions without ref_chunks)'
+                },
+                ref_count: {
+                    bsonType: 'long',
+                    description: 'Number of BPO hashes in this version'
+                },
+                ref_chunks: {
+                    bsonType: 'int',
+                    description: 'Number of situation_version_refs chunks holding the hashes'
+                },
+                merkle_root: {
+                    bsonType: 'binData',
+                    description: 'Root of the Merkle tree over the hashes in merkle_nodes'
+                },
+                delta_chain: {
                     bsonType: 'array',
                     items: {
                         bsonType: 'string'
                     },
-                    description: 'Array of BPO hashes in this version'
+                    description: 'Keyframe and versions whose version_deltas lead to this version (versions stored as deltas)'
+                },
+                chain_changes: {
+                    bsonType: 'long',
+                    description: 'Changes in the deltas since the keyframe'
+                }
+            }
+        }
+    }
+});
+
+db.createCollection('situation_version_refs', {
+    validator: {
+        $jsonSchema: {
+            bsonType: 'object',
+            required: ['version_id', 'seq', 'count', 'refs'],
+            properties: {
+                version_id: {
+                    bsonType: 'string',
+                    description: 'Version the hashes belong to'
+                },
+                seq: {
+                    bsonType: 'int',
+                    description: 'Position of the chunk within the version'
+                },
+                count: {
+                    bsonType: 'int',
+                    description: 'Number of hashes in the chunk'
+                },
+                refs: {
+                    bsonType: 'binData',
+                    description: 'Sorted BPO hashes, 32 bytes each, concatenated'
+                }
+            }
+        }
+    }
+});
+
+db.createCollection('merkle_nodes', {
+    validator: {
+        $jsonSchema: {
+            bsonType: 'object',
+            required: ['hash', 'leaf', 'level', 'entries'],
+            properties: {
+                hash: {
+                    bsonType: 'binData',
+                    description: 'SHA-256 hash of the node (32 bytes)'
+                },
+                leaf: {
+                    bsonType: 'bool',
+                    description: 'Leaf nodes list BPO hashes, others their children'
+                },
+                level: {
+                    bsonType: 'int',
+                    description: 'Length of the hash prefix the node covers'
+                },
+                count: {
+                    bsonType: 'long',
+                    description: 'Number of BPO hashes under the node'
+                },
+                entries: {
+                    bsonType: 'binData',
+                    description: 'Packed BPO hashes, or next prefix byte and child hash per child'
                 }
             }
         }
@@ -123,14 +331,14 @@ db.createCollection('version_deltas', {
                 added_bpos: {
                     bsonType: 'array',
                     items: {
-                        bsonType: 'string'
+                        bsonType: 'binData'
                     },
                     description: 'Array of added BPO hashes'
                 },
                 removed_bpos: {
                     bsonType: 'array',
                     items: {
-                        bsonType: 'string'
+                        bsonType: 'binData'
                     },
                     description: 'Array of removed BPO hashes'
                 },
@@ -139,11 +347,27 @@ db.createCollection('version_deltas', {
                     items: {
                         bsonType: 'object',
                         properties: {
-                            old_hash: { bsonType: 'string' },
-                            new_hash: { bsonType: 'string' }
+                            old_hash: { bsonType: 'binData' },
+                            new_hash: { bsonType: 'binData' }
                         }
                     },
                     description: 'Array of modified BPOs'
+                },
+                part: {
+                    bsonType: 'int',
+                    description: 'Position of this document among the parts of a large delta'
+                },
+                parts: {
+                    bsonType: 'int',
+                    description: 'Number of documents holding the delta'
+                },
+                identity_field: {
+                    bsonType: 'string',
+                    description: 'Attribute used to pair removed and added BPOs as modified'
+                },
+                created_at: {
+                    bsonType: 'date',
+                    description: 'Creation timestamp'
                 }
             }
         }
@@ -166,6 +390,24 @@ db.bpo_cas.createIndex(
     { name: 'hash_idx', unique: true }
 );
 
+// Envelope prefilter for bbox queries
+db.bpo_cas.createIndex(
+    { 'envelope.min_lon': 1, 'envelope.min_lat': 1, 'envelope.max_lon': 1, 'envelope.max_lat': 1 },
+    { name: 'envelope_idx' }
+);
+
+// Geometries shared by BPOs that differ only in attributes
+db.bpo_geometries.createIndex(
+    { 'hash': 1 },
+    { name: 'geometry_hash_idx', unique: true }
+);
+
+// Position chunks shared by versions of large geometries
+db.bpo_geometry_chunks.createIndex(
+    { 'hash': 1 },
+    { name: 'chunk_hash_idx', unique: true }
+);
+
 // Indexes for situations
 db.situations.createIndex(
     { 'situation_id': 1 },
@@ -183,6 +425,24 @@ db.situation_versions.createIndex(
     { name: 'situation_versions_lookup_idx' }
 );
 
+// Versions committed since a point in time, re-marked by the garbage collector
+db.situation_versions.createIndex(
+    { 'created_at': 1 },
+    { name: 'situation_versions_created_idx' }
+);
+
+// Ref chunks of a version, read in order
+db.situation_version_refs.createIndex(
+    { 'version_id': 1, 'seq': 1 },
+    { name: 'version_refs_idx', unique: true }
+);
+
+// Merkle nodes shared between versions
+db.merkle_nodes.createIndex(
+    { 'hash': 1 },
+    { name: 'merkle_hash_idx', unique: true }
+);
+
 // Index for version deltas
 db.version_deltas.createIndex(
     { 'delta_id': 1 },
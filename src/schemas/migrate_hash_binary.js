@@ -0,0 +1,39 @@
+print('Switching hash fields to binData validators...');
+
+// Hashes are stored as 32-byte BinData instead of 64-char hex strings.
+// Run this before `geoversion migrate-hashes`, which rewrites the data itself.
+function patchValidator(collectionName, patch) {
+    var infos = db.getCollectionInfos({ name: collectionName });
+    if (infos.length === 0 || !infos[0].options.validator) {
+        print('  ' + collectionName + ': no validator, skipped');
+        return;
+    }
+
+    var validator = infos[0].options.validator;
+    patch(validator.$jsonSchema.properties);
+
+    db.runCommand({
+        collMod: collectionName,
+        validator: validator,
+        validationLevel: 'moderate'
+    });
+    print('  ' + collectionName + ': validator updated');
+}
+
+patchValidator('bpo_cas', function(properties) {
+    properties.hash.bsonType = 'binData';
+    properties.hash.description = 'SHA-256 hash of the BPO content (32 bytes)';
+});
+
+patchValidator('situation_versions', function(properties) {
+    properties.bpo_refs.items.bsonType = 'binData';
+});
+
+patchValidator('version_deltas', function(properties) {
+    properties.added_bpos.items.bsonType = 'binData';
+    properties.removed_bpos.items.bsonType = 'binData';
+    properties.modified_bpos.items.properties.old_hash.bsonType = 'binData';
+    properties.modified_bpos.items.properties.new_hash.bsonType = 'binData';
+});
+
+print('Done. Now run: geoversion migrate-hashes <uri>');
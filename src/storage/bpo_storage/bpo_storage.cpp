@@ -1,284 +1,505 @@
 #include "bpo_storage.h"
+#include "storage/bpo_storage/coordinate_kernels.h"
+#include "storage/coordinate_codec/coordinate_codec.h"
 #include <bsoncxx/builder/stream/array.hpp>
+#include <bsoncxx/builder/concatenate.hpp>
 #include <bsoncxx/builder/stream/helpers.hpp>
 #include <bsoncxx/json.hpp>
 #include <bsoncxx/types.hpp>
+#include <cstring>
 #include <iostream>
 #include <chrono>
+#include <string_view>
 
 namespace geoversion {
 namespace storage {
 
-BPO::BPO() : geometry_type_(GeometryType::Unknown) {
-    bsoncxx::builder::stream::document empty_doc;
-    empty_doc << bsoncxx::builder::stream::finalize;
-    auto empty_view = empty_doc.view();
-    geometry_ = std::make_unique<bsoncxx::document::value>(empty_view);
-    attributes_ = std::make_unique<bsoncxx::document::value>(empty_view);
+namespace {
+
+constexpr size_t kRetainedScratchPositions = 1 << 20;
+
+// Per-thread scratch space, so validating from several ingest workers
+// neither allocates per call nor shares state.
+CoordinateBuffer& scratch_buffer() {
+    thread_local CoordinateBuffer buffer;
+    buffer.clear();
+    if (buffer.xs.capacity() > kRetainedScratchPositions) {
+        buffer.xs.shrink_to_fit();
+        buffer.ys.shrink_to_fit();
+    }
+    return buffer;
 }
 
-BPO::BPO(const bsoncxx::document::view& doc) {
-    if (doc["hash"]) {
-        hash_ = std::string(doc["hash"].get_string().value);
+bool append_position(const bsoncxx::array::view& position, CoordinateBuffer& buffer) {
+    auto it = position.begin();
+    if (it == position.end() || it->type() != bsoncxx::type::k_double) {
+        return false;
     }
-    
-    if (doc["geometry"]) {
-        geometry_ = std::make_unique<bsoncxx::document::value>(doc["geometry"].get_document().value);
-        geometry_type_ = parse_geometry_type(geometry_->view());
-    } else {
-        bsoncxx::builder::stream::document empty_doc;
-        empty_doc << bsoncxx::builder::stream::finalize;
-        geometry_ = std::make_unique<bsoncxx::document::value>(empty_doc.view());
-        geometry_type_ = GeometryType::Unknown;
+    double x = it->get_double().value;
+    ++it;
+    if (it == position.end() || it->type() != bsoncxx::type::k_double) {
+        return false;
     }
-    
-    if (doc["attributes"]) {
-        attributes_ = std::make_unique<bsoncxx::document::value>(doc["attributes"].get_document().value);
+    buffer.append(x, it->get_double().value);
+    return true;
+}
+
+bool append_positions(const bsoncxx::array::view& positions, size_t min_count, CoordinateBuffer& buffer) {
+    size_t count = 0;
+    for (auto&& position : positions) {
+        if (position.type() != bsoncxx::type::k_array ||
+            !append_position(position.get_array().value, buffer)) {
+            return false;
+        }
+        ++count;
+    }
+    return count >= min_count;
+}
+
+bool append_ring(const bsoncxx::array::view& ring, CoordinateBuffer& buffer) {
+    size_t begin = buffer.size();
+    if (!append_positions(ring, 4, buffer)) {
+        return false;
+    }
+    buffer.rings.emplace_back(begin, buffer.size());
+    return true;
+}
+
+bool append_polygon(const bsoncxx::array::view& rings, CoordinateBuffer& buffer) {
+    size_t count = 0;
+    for (auto&& ring : rings) {
+        if (ring.type() != bsoncxx::type::k_array || !append_ring(ring.get_array().value, buffer)) {
+            return false;
+        }
+        ++count;
+    }
+    return count > 0;
+}
+
+template <typename AppendMember>
+bool append_members(const bsoncxx::array::view& members, CoordinateBuffer& buffer, AppendMember append_member) {
+    size_t count = 0;
+    for (auto&& member : members) {
+        if (member.type() != bsoncxx::type::k_array || !append_member(member.get_array().value, buffer)) {
+            return false;
+        }
+        ++count;
+    }
+    return count > 0;
+}
+
+bool append_multipoint(const bsoncxx::array::view& coordinates, CoordinateBuffer& buffer) {
+    return append_positions(coordinates, 1, buffer);
+}
+
+bool append_linestring(const bsoncxx::array::view& coordinates, CoordinateBuffer& buffer) {
+    return append_positions(coordinates, 2, buffer);
+}
+
+bool append_multilinestring(const bsoncxx::array::view& coordinates, CoordinateBuffer& buffer) {
+    return append_members(coordinates, buffer, append_linestring);
+}
+
+bool append_multipolygon(const bsoncxx::array::view& coordinates, CoordinateBuffer& buffer) {
+    return append_members(coordinates, buffer, append_polygon);
+}
+
+using AppendCoordinates = bool (*)(const bsoncxx::array::view&, CoordinateBuffer&);
+
+// Indexed by GeometryType; collections and unknown types have no coordinates.
+constexpr AppendCoordinates kAppendCoordinates[] = {
+    append_position,
+    append_linestring,
+    append_polygon,
+    append_multipoint,
+    append_multilinestring,
+    append_multipolygon,
+    nullptr,
+    nullptr
+};
+
+static_assert(sizeof(kAppendCoordinates) / sizeof(kAppendCoordinates[0]) ==
+              static_cast<size_t>(GeometryType::Unknown) + 1,
+              "kAppendCoordinates must cover every GeometryType");
+
+struct GeometryTypeName {
+    std::string_view name;
+    GeometryType type;
+};
+
+constexpr GeometryTypeName kGeometryTypeNames[] = {
+    {"Point", GeometryType::Point},
+    {"LineString", GeometryType::LineString},
+    {"Polygon", GeometryType::Polygon},
+    {"MultiPoint", GeometryType::MultiPoint},
+    {"MultiLineString", GeometryType::MultiLineString},
+    {"MultiPolygon", GeometryType::MultiPolygon},
+    {"GeometryCollection", GeometryType::GeometryCollection}
+};
+
+bool append_coordinates(GeometryType type, const bsoncxx::array::view& coordinates, CoordinateBuffer& buffer) {
+    AppendCoordinates append = kAppendCoordinates[static_cast<size_t>(type)];
+    return append && append(coordinates, buffer);
+}
+
+bool append_geometry(const bsoncxx::document::view& geometry, CoordinateBuffer& buffer, size_t depth) {
+    GeometryType type = GeoJSONValidator::get_type(geometry);
+    if (type == GeometryType::Unknown) {
+        return false;
+    }
+
+    if (type == GeometryType::GeometryCollection) {
+        auto geometries = geometry["geometries"];
+        if (depth == 0 || !geometries || geometries.type() != bsoncxx::type::k_array) {
+            return false;
+        }
+        for (auto&& member : geometries.get_array().value) {
+            if (member.type() != bsoncxx::type::k_document ||
+                !append_geometry(member.get_document().value, buffer, depth - 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    auto coordinates = geometry["coordinates"];
+    if (!coordinates || coordinates.type() != bsoncxx::type::k_array) {
+        return false;
+    }
+    return append_coordinates(type, coordinates.get_array().value, buffer);
+}
+
+bool check_buffer(const CoordinateBuffer& buffer, const GeoJSONValidationOptions& options) {
+    if (!coordinates_in_range(buffer.xs.data(), buffer.ys.data(), buffer.size())) {
+        return false;
+    }
+    for (const auto& ring : buffer.rings) {
+        const double* xs = buffer.xs.data() + ring.first;
+        const double* ys = buffer.ys.data() + ring.first;
+        size_t count = ring.second - ring.first;
+        if (!ring_is_closed(xs, ys, count)) {
+            return false;
+        }
+        if (options.check_topology && ring_self_intersects(xs, ys, count)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool validate_as(GeometryType type, const bsoncxx::array::view& coordinates) {
+    CoordinateBuffer& buffer = scratch_buffer();
+    return append_coordinates(type, coordinates, buffer) && check_buffer(buffer, GeoJSONValidationOptions());
+}
+
+}
+
+BPO::BPO()
+    : buffer_size_(0),
+      borrowed_(false),
+      geometry_type_(GeometryType::Unknown),
+      validity_(kValidityUnknown) {
+}
+
+BPO::BPO(const bsoncxx::document::view& doc) : BPO() {
+    std::optional<bsoncxx::document::value> decoded;
+    read_document(doc, decoded);
+    assign(geometry_, attributes_);
+    decode(&doc);
+}
+
+BPO::BPO(const HashId& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) : BPO() {
+    hash_ = hash;
+    assign(geometry, attributes);
+    decode(nullptr);
+}
+
+BPO BPO::borrow(const bsoncxx::document::view& doc) {
+    BPO bpo;
+    std::optional<bsoncxx::document::value> decoded;
+    bpo.read_document(doc, decoded);
+    // A blob-encoded geometry has nothing in the source to borrow.
+    if (decoded) {
+        bpo.assign(bpo.geometry_, bpo.attributes_);
     } else {
-        bsoncxx::builder::stream::document empty_doc;
-        empty_doc << bsoncxx::builder::stream::finalize;
-        attributes_ = std::make_unique<bsoncxx::document::value>(empty_doc.view());
+        bpo.borrowed_ = true;
+    }
+    bpo.decode(&doc);
+    return bpo;
+}
+
+BPO::BPO(const BPO& other)
+    : hash_(other.hash_),
+      buffer_size_(0),
+      borrowed_(false),
+      geometry_type_(other.geometry_type_),
+      extent_(other.extent_),
+      validity_(other.validity_) {
+    assign(other.geometry_, other.attributes_);
+}
+
+BPO& BPO::operator=(const BPO& other) {
+    if (this != &other) {
+        hash_ = other.hash_;
+        assign(other.geometry_, other.attributes_);
+        geometry_type_ = other.geometry_type_;
+        extent_ = other.extent_;
+        validity_ = other.validity_;
     }
+    return *this;
+}
+
+BPO::BPO(BPO&& other) noexcept
+    : hash_(other.hash_),
+      buffer_(std::move(other.buffer_)),
+      buffer_size_(other.buffer_size_),
+      geometry_(other.geometry_),
+      attributes_(other.attributes_),
+      borrowed_(other.borrowed_),
+      geometry_type_(other.geometry_type_),
+      extent_(other.extent_),
+      validity_(other.validity_) {
+    other.reset_views();
 }
 
-BPO::BPO(const std::string& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes)
-    : hash_(hash), geometry_(std::make_unique<bsoncxx::document::value>(geometry)), attributes_(std::make_unique<bsoncxx::document::value>(attributes)) {
-    geometry_type_ = parse_geometry_type(geometry);
+BPO& BPO::operator=(BPO&& other) noexcept {
+    if (this != &other) {
+        hash_ = other.hash_;
+        buffer_ = std::move(other.buffer_);
+        buffer_size_ = other.buffer_size_;
+        geometry_ = other.geometry_;
+        attributes_ = other.attributes_;
+        borrowed_ = other.borrowed_;
+        geometry_type_ = other.geometry_type_;
+        extent_ = other.extent_;
+        validity_ = other.validity_;
+        other.reset_views();
+    }
+    return *this;
 }
 
-std::string BPO::get_hash() const {
+const HashId& BPO::get_hash() const {
     return hash_;
 }
 
 bsoncxx::document::view BPO::get_geometry() const {
-    return geometry_->view();
+    return geometry_;
 }
 
 bsoncxx::document::view BPO::get_attributes() const {
-    return attributes_->view();
+    return attributes_;
 }
 
 GeometryType BPO::get_geometry_type() const {
     return geometry_type_;
 }
 
-void BPO::set_hash(const std::string& hash) {
+const GeometryExtent& BPO::get_extent() const {
+    return extent_;
+}
+
+const Envelope& BPO::get_envelope() const {
+    return extent_.envelope;
+}
+
+bool BPO::is_borrowed() const {
+    return borrowed_;
+}
+
+void BPO::make_owned() {
+    if (borrowed_) {
+        assign(geometry_, attributes_);
+    }
+}
+
+size_t BPO::owned_bytes() const {
+    return buffer_size_;
+}
+
+void BPO::set_hash(const HashId& hash) {
     hash_ = hash;
 }
 
 void BPO::set_geometry(const bsoncxx::document::view& geometry) {
-    geometry_ = std::make_unique<bsoncxx::document::value>(geometry);
-    geometry_type_ = parse_geometry_type(geometry);
+    assign(geometry, attributes_);
+    decode(nullptr);
 }
 
 void BPO::set_attributes(const bsoncxx::document::view& attributes) {
-    attributes_ = std::make_unique<bsoncxx::document::value>(attributes);
+    assign(geometry_, attributes);
 }
 
 bsoncxx::document::value BPO::to_bson() const {
     bsoncxx::builder::stream::document builder;
-    builder << "hash" << hash_
-            << "geometry" << bsoncxx::types::b_document{*geometry_}
-            << "attributes" << bsoncxx::types::b_document{*attributes_}
+    builder << "hash" << hash_.to_bson()
+            << "geometry" << bsoncxx::types::b_document{geometry_}
+            << "attributes" << bsoncxx::types::b_document{attributes_}
             << "created_at" << bsoncxx::types::b_date{std::chrono::system_clock::now()};
     
+    if (extent_.is_valid()) {
+        builder << bsoncxx::builder::concatenate(extent_.to_bson().view());
+    }
+    
     return builder << bsoncxx::builder::stream::finalize;
 }
 
 bool BPO::is_valid() const {
-    if (hash_.empty()) {
+    if (hash_.is_null()) {
         return false;
     }
-    return validate_geometry(geometry_->view());
-}
-
-GeometryType BPO::parse_geometry_type(const bsoncxx::document::view& geometry) {
-    if (!geometry["type"]) {
-        return GeometryType::Unknown;
+    if (validity_ == kValidityUnknown) {
+        validity_ = GeoJSONValidator::validate(geometry_) ? kValid : kInvalid;
     }
-    
-    std::string type = std::string(geometry["type"].get_string().value);
-    
-    if (type == "Point") return GeometryType::Point;
-    if (type == "LineString") return GeometryType::LineString;
-    if (type == "Polygon") return GeometryType::Polygon;
-    if (type == "MultiPoint") return GeometryType::MultiPoint;
-    if (type == "MultiLineString") return GeometryType::MultiLineString;
-    if (type == "MultiPolygon") return GeometryType::MultiPolygon;
-    if (type == "GeometryCollection") return GeometryType::GeometryCollection;
-    
-    return GeometryType::Unknown;
+    return validity_ == kValid;
 }
 
-bool BPO::validate_geometry(const bsoncxx::document::view& geometry) const {
-    return GeoJSONValidator::validate(geometry);
+// Copies both documents into one allocation. The sources may point into
+// the current buffer, so it is replaced only after the copy.
+void BPO::assign(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) {
+    size_t geometry_size = geometry.length();
+    size_t attributes_size = attributes.length();
+
+    std::unique_ptr<uint8_t[]> buffer(new uint8_t[geometry_size + attributes_size]);
+    std::memcpy(buffer.get(), geometry.data(), geometry_size);
+    std::memcpy(buffer.get() + geometry_size, attributes.data(), attributes_size);
+
+    buffer_ = std::move(buffer);
+    buffer_size_ = geometry_size + attributes_size;
+    geometry_ = bsoncxx::document::view(buffer_.get(), geometry_size);
+    attributes_ = bsoncxx::document::view(buffer_.get() + geometry_size, attributes_size);
+    borrowed_ = false;
 }
 
-bool BPO::validate_point(const bsoncxx::document::view& geometry) const {
-    if (!geometry["type"] || !geometry["coordinates"]) {
-        return false;
+void BPO::read_document(const bsoncxx::document::view& doc, std::optional<bsoncxx::document::value>& decoded) {
+    hash_ = HashId();
+    if (doc["hash"]) {
+        HashId::from_bson(doc["hash"].get_value(), hash_);
     }
-    
-    std::string type = std::string(geometry["type"].get_string().value);
-    if (type != "Point") {
-        return false;
+
+    if (!read_stored_geometry(doc, geometry_, decoded)) {
+        geometry_ = bsoncxx::document::view();
     }
-    
-    auto coordinates = geometry["coordinates"].get_array().value;
-    return GeoJSONValidator::validate_point_coordinates(coordinates);
+
+    auto attributes = doc["attributes"];
+    attributes_ = attributes && attributes.type() == bsoncxx::type::k_document
+        ? attributes.get_document().value
+        : bsoncxx::document::view();
 }
 
-bool BPO::validate_linestring(const bsoncxx::document::view& geometry) const {
-    if (!geometry["type"] || !geometry["coordinates"]) {
-        return false;
-    }
-    
-    std::string type = std::string(geometry["type"].get_string().value);
-    if (type != "LineString") {
-        return false;
-    }
-    
-    auto coordinates = geometry["coordinates"].get_array().value;
-    return GeoJSONValidator::validate_linestring_coordinates(coordinates);
+void BPO::reset_views() {
+    buffer_size_ = 0;
+    geometry_ = bsoncxx::document::view();
+    attributes_ = bsoncxx::document::view();
+    borrowed_ = false;
 }
 
-bool BPO::validate_polygon(const bsoncxx::document::view& geometry) const {
-    if (!geometry["type"] || !geometry["coordinates"]) {
-        return false;
+// One walk over the geometry yields the flat coordinates, from which the
+// extent, vertex count and validity all follow. A persisted extent on a
+// stored document skips the walk; validity is then computed on demand.
+void BPO::decode(const bsoncxx::document::view* source) {
+    geometry_type_ = GeoJSONValidator::get_type(geometry_);
+    validity_ = kValidityUnknown;
+    extent_ = GeometryExtent();
+
+    if (geometry_type_ == GeometryType::Unknown) {
+        validity_ = kInvalid;
+        return;
     }
-    
-    std::string type = std::string(geometry["type"].get_string().value);
-    if (type != "Polygon") {
-        return false;
+    if (source && GeometryExtent::from_document(*source, extent_)) {
+        return;
     }
-    
-    auto coordinates = geometry["coordinates"].get_array().value;
-    return GeoJSONValidator::validate_polygon_coordinates(coordinates);
+
+    CoordinateBuffer& buffer = scratch_buffer();
+    if (GeoJSONValidator::extract_coordinates(geometry_, buffer) &&
+        check_buffer(buffer, GeoJSONValidationOptions())) {
+        validity_ = kValid;
+        if (buffer.size() > 0) {
+            CoordinateSummary summary = summarize_coordinates(buffer.xs.data(), buffer.ys.data(), buffer.size());
+            extent_.envelope = Envelope(summary.min_x, summary.min_y, summary.max_x, summary.max_y);
+            extent_.vertex_count = buffer.size();
+            extent_.centroid_x = summary.sum_x / static_cast<double>(buffer.size());
+            extent_.centroid_y = summary.sum_y / static_cast<double>(buffer.size());
+        }
+        return;
+    }
+
+    // Invalid geometries (integer coordinates, out-of-range values) still
+    // get an extent when one can be computed.
+    validity_ = kInvalid;
+    GeometryExtent::from_geometry(geometry_, extent_);
 }
 
 bool GeoJSONValidator::validate(const bsoncxx::document::view& geometry) {
-    if (!geometry["type"] || !geometry["coordinates"]) {
-        return false;
-    }
-    
-    std::string type = std::string(geometry["type"].get_string().value);
-    auto coordinates = geometry["coordinates"].get_array().value;
-    
-    if (type == "Point") {
-        return validate_point_coordinates(coordinates);
-    } else if (type == "LineString") {
-        return validate_linestring_coordinates(coordinates);
-    } else if (type == "Polygon") {
-        return validate_polygon_coordinates(coordinates);
-    }
-    
-    return false;
+    return validate(geometry, GeoJSONValidationOptions());
+}
+
+// Positions are first copied into flat x/y buffers in one pass over the
+// BSON; range and ring checks then run over contiguous doubles.
+bool GeoJSONValidator::validate(const bsoncxx::document::view& geometry, const GeoJSONValidationOptions& options) {
+    CoordinateBuffer& buffer = scratch_buffer();
+    return extract_coordinates(geometry, buffer, options.max_depth) && check_buffer(buffer, options);
+}
+
+bool GeoJSONValidator::extract_coordinates(const bsoncxx::document::view& geometry, CoordinateBuffer& buffer, size_t max_depth) {
+    return append_geometry(geometry, buffer, max_depth);
 }
 
 GeometryType GeoJSONValidator::get_type(const bsoncxx::document::view& geometry) {
-    if (!geometry["type"]) {
+    auto type_element = geometry["type"];
+    if (!type_element || type_element.type() != bsoncxx::type::k_string) {
         return GeometryType::Unknown;
     }
-    
-    std::string type = std::string(geometry["type"].get_string().value);
-    
-    if (type == "Point") return GeometryType::Point;
-    if (type == "LineString") return GeometryType::LineString;
-    if (type == "Polygon") return GeometryType::Polygon;
-    if (type == "MultiPoint") return GeometryType::MultiPoint;
-    if (type == "MultiLineString") return GeometryType::MultiLineString;
-    if (type == "MultiPolygon") return GeometryType::MultiPolygon;
-    if (type == "GeometryCollection") return GeometryType::GeometryCollection;
-    
+
+    auto value = type_element.get_string().value;
+    std::string_view name(value.data(), value.size());
+    for (const GeometryTypeName& entry : kGeometryTypeNames) {
+        if (entry.name == name) {
+            return entry.type;
+        }
+    }
     return GeometryType::Unknown;
 }
 
+const char* GeoJSONValidator::type_name(GeometryType type) {
+    for (const GeometryTypeName& entry : kGeometryTypeNames) {
+        if (entry.type == type) {
+            return entry.name.data();
+        }
+    }
+    return "Unknown";
+}
+
 bool GeoJSONValidator::validate_coordinates(const bsoncxx::document::view& geometry) {
-    if (!geometry["coordinates"]) {
+    auto coordinates = geometry["coordinates"];
+    if (!coordinates || coordinates.type() != bsoncxx::type::k_array) {
         return false;
     }
-    
-    auto coordinates = geometry["coordinates"].get_array().value;
-    std::string type = std::string(geometry["type"].get_string().value);
-    
-    if (type == "Point") {
-        return validate_point_coordinates(coordinates);
-    } else if (type == "LineString") {
-        return validate_linestring_coordinates(coordinates);
-    } else if (type == "Polygon") {
-        return validate_polygon_coordinates(coordinates);
-    }
-    
-    return false;
+    return validate_as(get_type(geometry), coordinates.get_array().value);
 }
 
 bool GeoJSONValidator::validate_point_coordinates(const bsoncxx::array::view& coordinates) {
-    if (coordinates.length() < 2) {
-        return false;
-    }
-    
-    auto it = coordinates.begin();
-    if (it == coordinates.end() || (*it).type() != bsoncxx::type::k_double) {
-        return false;
-    }
-    ++it;
-    if (it == coordinates.end() || (*it).type() != bsoncxx::type::k_double) {
-        return false;
-    }
-    
-    double lon = (*coordinates.begin()).get_double().value;
-    double lat = (*(++coordinates.begin())).get_double().value;
-    
-    return lon >= -180.0 && lon <= 180.0 && lat >= -90.0 && lat <= 90.0;
+    return validate_as(GeometryType::Point, coordinates);
 }
 
 bool GeoJSONValidator::validate_linestring_coordinates(const bsoncxx::array::view& coordinates) {
-    if (coordinates.length() < 2) {
-        return false;
-    }
-    
-    for (auto&& point : coordinates) {
-        if (point.type() != bsoncxx::type::k_array) {
-            return false;
-        }
-        auto point_array = point.get_array().value;
-        if (!validate_point_coordinates(point_array)) {
-            return false;
-        }
-    }
-    
-    return true;
+    return validate_as(GeometryType::LineString, coordinates);
 }
 
 bool GeoJSONValidator::validate_polygon_coordinates(const bsoncxx::array::view& coordinates) {
-    if (coordinates.length() == 0) {
-        return false;
-    }
-    
-    for (auto&& ring : coordinates) {
-        if (ring.type() != bsoncxx::type::k_array) {
-            return false;
-        }
-        auto ring_array = ring.get_array().value;
-        if (ring_array.length() < 4) {
-            return false;
-        }
-        
-        for (auto&& point : ring_array) {
-            if (point.type() != bsoncxx::type::k_array) {
-                return false;
-            }
-            auto point_array = point.get_array().value;
-            if (!validate_point_coordinates(point_array)) {
-                return false;
-            }
-        }
-    }
-    
-    return true;
+    return validate_as(GeometryType::Polygon, coordinates);
+}
+
+bool GeoJSONValidator::validate_multipoint_coordinates(const bsoncxx::array::view& coordinates) {
+    return validate_as(GeometryType::MultiPoint, coordinates);
 }
 
+bool GeoJSONValidator::validate_multilinestring_coordinates(const bsoncxx::array::view& coordinates) {
+    return validate_as(GeometryType::MultiLineString, coordinates);
+}
 
+bool GeoJSONValidator::validate_multipolygon_coordinates(const bsoncxx::array::view& coordinates) {
+    return validate_as(GeometryType::MultiPolygon, coordinates);
+}
 
 }
 }
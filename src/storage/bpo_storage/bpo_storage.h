@@ -1,13 +1,18 @@
 #pragma once
 
+#include "storage/hash_id/hash_id.h"
+#include "storage/spatial_index/envelope.h"
 #include <bsoncxx/document/view.hpp>
 #include <bsoncxx/document/value.hpp>
 #include <bsoncxx/builder/stream/document.hpp>
 #include <mongocxx/collection.hpp>
+#include <cstddef>
+#include <cstdint>
 #include <string>
 #include <vector>
 #include <map>
 #include <memory>
+#include <optional>
 
 namespace geoversion {
 namespace storage {
@@ -23,18 +28,37 @@ enum class GeometryType {
     Unknown
 };
 
+struct CoordinateBuffer;
+
+// Geometry and attributes live in one contiguous owned buffer, or, for a
+// BPO made with borrow(), are views into the source document (typically a
+// cursor batch) that must outlive it. Type, extent and validity are decoded
+// once on construction.
 class BPO {
 public:
     BPO();
     BPO(const bsoncxx::document::view& doc);
-    BPO(const std::string& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
+    BPO(const HashId& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
+
+    static BPO borrow(const bsoncxx::document::view& doc);
 
-    std::string get_hash() const;
+    BPO(const BPO& other);
+    BPO& operator=(const BPO& other);
+    BPO(BPO&& other) noexcept;
+    BPO& operator=(BPO&& other) noexcept;
+
+    const HashId& get_hash() const;
     bsoncxx::document::view get_geometry() const;
     bsoncxx::document::view get_attributes() const;
     GeometryType get_geometry_type() const;
+    const GeometryExtent& get_extent() const;
+    const Envelope& get_envelope() const;
+
+    bool is_borrowed() const;
+    void make_owned();
+    size_t owned_bytes() const;
 
-    void set_hash(const std::string& hash);
+    void set_hash(const HashId& hash);
     void set_geometry(const bsoncxx::document::view& geometry);
     void set_attributes(const bsoncxx::document::view& attributes);
 
@@ -42,26 +66,45 @@ public:
     bool is_valid() const;
 
 private:
-    std::string hash_;
-    std::unique_ptr<bsoncxx::document::value> geometry_;
-    std::unique_ptr<bsoncxx::document::value> attributes_;
+    static constexpr int8_t kValidityUnknown = -1;
+    static constexpr int8_t kInvalid = 0;
+    static constexpr int8_t kValid = 1;
+
+    HashId hash_;
+    std::unique_ptr<uint8_t[]> buffer_;
+    size_t buffer_size_;
+    bsoncxx::document::view geometry_;
+    bsoncxx::document::view attributes_;
+    bool borrowed_;
     GeometryType geometry_type_;
+    GeometryExtent extent_;
+    mutable int8_t validity_;
+
+    void assign(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
+    void read_document(const bsoncxx::document::view& doc, std::optional<bsoncxx::document::value>& decoded);
+    void reset_views();
+    void decode(const bsoncxx::document::view* source);
+};
 
-    GeometryType parse_geometry_type(const bsoncxx::document::view& geometry);
-    bool validate_geometry(const bsoncxx::document::view& geometry) const;
-    bool validate_point(const bsoncxx::document::view& geometry) const;
-    bool validate_linestring(const bsoncxx::document::view& geometry) const;
-    bool validate_polygon(const bsoncxx::document::view& geometry) const;
+struct GeoJSONValidationOptions {
+    bool check_topology = false;
+    size_t max_depth = 16;
 };
 
 class GeoJSONValidator {
 public:
     static bool validate(const bsoncxx::document::view& geometry);
+    static bool validate(const bsoncxx::document::view& geometry, const GeoJSONValidationOptions& options);
+    static bool extract_coordinates(const bsoncxx::document::view& geometry, CoordinateBuffer& buffer, size_t max_depth = 16);
     static GeometryType get_type(const bsoncxx::document::view& geometry);
+    static const char* type_name(GeometryType type);
     static bool validate_coordinates(const bsoncxx::document::view& geometry);
     static bool validate_point_coordinates(const bsoncxx::array::view& coordinates);
     static bool validate_linestring_coordinates(const bsoncxx::array::view& coordinates);
     static bool validate_polygon_coordinates(const bsoncxx::array::view& coordinates);
+    static bool validate_multipoint_coordinates(const bsoncxx::array::view& coordinates);
+    static bool validate_multilinestring_coordinates(const bsoncxx::array::view& coordinates);
+    static bool validate_multipolygon_coordinates(const bsoncxx::array::view& coordinates);
 };
 
 
@@ -0,0 +1,194 @@
+#include "coordinate_kernels.h"
+#include <algorithm>
+#include <numeric>
+
+#if defined(__AVX__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr double kMinLon = -180.0;
+constexpr double kMaxLon = 180.0;
+constexpr double kMinLat = -90.0;
+constexpr double kMaxLat = 90.0;
+
+bool in_range_scalar(const double* xs, const double* ys, size_t count) {
+    bool ok = true;
+    for (size_t i = 0; i < count; ++i) {
+        ok &= xs[i] >= kMinLon && xs[i] <= kMaxLon && ys[i] >= kMinLat && ys[i] <= kMaxLat;
+    }
+    return ok;
+}
+
+double orientation(double ax, double ay, double bx, double by, double cx, double cy) {
+    return (bx - ax) * (cy - ay) - (by - ay) * (cx - ax);
+}
+
+bool on_segment(double ax, double ay, double bx, double by, double px, double py) {
+    return std::min(ax, bx) <= px && px <= std::max(ax, bx) &&
+           std::min(ay, by) <= py && py <= std::max(ay, by);
+}
+
+bool segments_intersect(
+    double ax, double ay, double bx, double by,
+    double cx, double cy, double dx, double dy
+) {
+    double d1 = orientation(cx, cy, dx, dy, ax, ay);
+    double d2 = orientation(cx, cy, dx, dy, bx, by);
+    double d3 = orientation(ax, ay, bx, by, cx, cy);
+    double d4 = orientation(ax, ay, bx, by, dx, dy);
+
+    if (((d1 > 0 && d2 < 0) || (d1 < 0 && d2 > 0)) &&
+        ((d3 > 0 && d4 < 0) || (d3 < 0 && d4 > 0))) {
+        return true;
+    }
+    return (d1 == 0 && on_segment(cx, cy, dx, dy, ax, ay)) ||
+           (d2 == 0 && on_segment(cx, cy, dx, dy, bx, by)) ||
+           (d3 == 0 && on_segment(ax, ay, bx, by, cx, cy)) ||
+           (d4 == 0 && on_segment(ax, ay, bx, by, dx, dy));
+}
+
+}
+
+void CoordinateBuffer::clear() {
+    xs.clear();
+    ys.clear();
+    rings.clear();
+}
+
+size_t CoordinateBuffer::size() const {
+    return xs.size();
+}
+
+void CoordinateBuffer::append(double x, double y) {
+    xs.push_back(x);
+    ys.push_back(y);
+}
+
+bool coordinates_in_range(const double* xs, const double* ys, size_t count) {
+    size_t i = 0;
+
+#if defined(__AVX__)
+    const __m256d min_lon = _mm256_set1_pd(kMinLon);
+    const __m256d max_lon = _mm256_set1_pd(kMaxLon);
+    const __m256d min_lat = _mm256_set1_pd(kMinLat);
+    const __m256d max_lat = _mm256_set1_pd(kMaxLat);
+    __m256d ok = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    for (; i + 4 <= count; i += 4) {
+        __m256d x = _mm256_loadu_pd(xs + i);
+        __m256d y = _mm256_loadu_pd(ys + i);
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(x, min_lon, _CMP_GE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(x, max_lon, _CMP_LE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(y, min_lat, _CMP_GE_OQ));
+        ok = _mm256_and_pd(ok, _mm256_cmp_pd(y, max_lat, _CMP_LE_OQ));
+    }
+    if (_mm256_movemask_pd(ok) != 0x0F) {
+        return false;
+    }
+#elif defined(__SSE2__)
+    const __m128d min_lon = _mm_set1_pd(kMinLon);
+    const __m128d max_lon = _mm_set1_pd(kMaxLon);
+    const __m128d min_lat = _mm_set1_pd(kMinLat);
+    const __m128d max_lat = _mm_set1_pd(kMaxLat);
+    __m128d ok = _mm_castsi128_pd(_mm_set1_epi32(-1));
+    for (; i + 2 <= count; i += 2) {
+        __m128d x = _mm_loadu_pd(xs + i);
+        __m128d y = _mm_loadu_pd(ys + i);
+        ok = _mm_and_pd(ok, _mm_cmpge_pd(x, min_lon));
+        ok = _mm_and_pd(ok, _mm_cmple_pd(x, max_lon));
+        ok = _mm_and_pd(ok, _mm_cmpge_pd(y, min_lat));
+        ok = _mm_and_pd(ok, _mm_cmple_pd(y, max_lat));
+    }
+    if (_mm_movemask_pd(ok) != 0x03) {
+        return false;
+    }
+#endif
+
+    return in_range_scalar(xs + i, ys + i, count - i);
+}
+
+CoordinateSummary summarize_coordinates(const double* xs, const double* ys, size_t count) {
+    CoordinateSummary summary{xs[0], ys[0], xs[0], ys[0], 0.0, 0.0};
+    for (size_t i = 0; i < count; ++i) {
+        summary.min_x = xs[i] < summary.min_x ? xs[i] : summary.min_x;
+        summary.min_y = ys[i] < summary.min_y ? ys[i] : summary.min_y;
+        summary.max_x = xs[i] > summary.max_x ? xs[i] : summary.max_x;
+        summary.max_y = ys[i] > summary.max_y ? ys[i] : summary.max_y;
+        summary.sum_x += xs[i];
+        summary.sum_y += ys[i];
+    }
+    return summary;
+}
+
+bool ring_is_closed(const double* xs, const double* ys, size_t count) {
+    return count >= 4 && xs[0] == xs[count - 1] && ys[0] == ys[count - 1];
+}
+
+bool ring_self_intersects(const double* xs, const double* ys, size_t count) {
+    // Repeated consecutive vertices would make non-adjacent segments share
+    // an endpoint, so they are dropped first.
+    std::vector<double> rx;
+    std::vector<double> ry;
+    rx.reserve(count);
+    ry.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        if (!rx.empty() && rx.back() == xs[i] && ry.back() == ys[i]) {
+            continue;
+        }
+        rx.push_back(xs[i]);
+        ry.push_back(ys[i]);
+    }
+
+    size_t segments = rx.size() < 2 ? 0 : rx.size() - 1;
+    if (segments < 3) {
+        return false;
+    }
+
+    auto min_x = [&](uint32_t s) { return std::min(rx[s], rx[s + 1]); };
+    auto max_x = [&](uint32_t s) { return std::max(rx[s], rx[s + 1]); };
+    auto adjacent = [&](uint32_t a, uint32_t b) {
+        uint32_t low = std::min(a, b);
+        uint32_t high = std::max(a, b);
+        return high - low == 1 || (low == 0 && high == segments - 1);
+    };
+
+    std::vector<uint32_t> order(segments);
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return min_x(a) < min_x(b);
+    });
+
+    std::vector<uint32_t> active;
+    for (uint32_t s : order) {
+        double sweep = min_x(s);
+        active.erase(
+            std::remove_if(active.begin(), active.end(), [&](uint32_t a) { return max_x(a) < sweep; }),
+            active.end()
+        );
+
+        double s_min_y = std::min(ry[s], ry[s + 1]);
+        double s_max_y = std::max(ry[s], ry[s + 1]);
+        for (uint32_t a : active) {
+            if (adjacent(a, s)) {
+                continue;
+            }
+            if (std::max(ry[a], ry[a + 1]) < s_min_y || std::min(ry[a], ry[a + 1]) > s_max_y) {
+                continue;
+            }
+            if (segments_intersect(rx[a], ry[a], rx[a + 1], ry[a + 1], rx[s], ry[s], rx[s + 1], ry[s + 1])) {
+                return true;
+            }
+        }
+        active.push_back(s);
+    }
+    return false;
+}
+
+}
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+// Flat copy of a geometry's positions: xs/ys hold every position in
+// document order and rings records [begin, end) ranges of closed rings.
+struct CoordinateBuffer {
+    std::vector<double> xs;
+    std::vector<double> ys;
+    std::vector<std::pair<size_t, size_t>> rings;
+
+    void clear();
+    size_t size() const;
+    void append(double x, double y);
+};
+
+// True if every position is finite and within lon [-180, 180], lat [-90, 90].
+// NaN fails the comparisons, so it needs no separate check.
+bool coordinates_in_range(const double* xs, const double* ys, size_t count);
+
+struct CoordinateSummary {
+    double min_x;
+    double min_y;
+    double max_x;
+    double max_y;
+    double sum_x;
+    double sum_y;
+};
+
+// Bounds and coordinate sums in one pass; count must be non-zero. Sums are
+// accumulated in document order so centroids match GeometryExtent exactly.
+CoordinateSummary summarize_coordinates(const double* xs, const double* ys, size_t count);
+
+bool ring_is_closed(const double* xs, const double* ys, size_t count);
+
+// Sort-and-sweep over the ring's segments; adjacent segments sharing a
+// vertex do not count as intersecting.
+bool ring_self_intersects(const double* xs, const double* ys, size_t count);
+
+}
+}
@@ -0,0 +1,241 @@
+#include "canonical_hash.h"
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string_view>
+#include <stdexcept>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+enum Tag : uint8_t {
+    kTagDocument = 'D',
+    kTagArray = 'A',
+    kTagEnd = 'E',
+    kTagKey = 'K',
+    kTagInt = 'I',
+    kTagDouble = 'F',
+    kTagDecimal = 'M',
+    kTagString = 'S',
+    kTagBool = 'B',
+    kTagNull = 'N',
+    kTagDate = 'T',
+    kTagOid = 'O',
+    kTagBinary = 'X',
+    kTagRaw = 'R'
+};
+
+constexpr double kInt64Limit = 9223372036854775808.0;
+
+std::string_view key_of(const bsoncxx::document::element& element) {
+    auto key = element.key();
+    return std::string_view(key.data(), key.size());
+}
+
+}
+
+Sha256Stream::Sha256Stream() : ctx_(EVP_MD_CTX_new()), buffered_(0) {
+    if (!ctx_ || EVP_DigestInit_ex(ctx_, EVP_sha256(), nullptr) != 1) {
+        EVP_MD_CTX_free(ctx_);
+        throw std::runtime_error("Failed to initialize SHA-256 context");
+    }
+}
+
+Sha256Stream::~Sha256Stream() {
+    EVP_MD_CTX_free(ctx_);
+}
+
+void Sha256Stream::update(const void* data, size_t length) {
+    if (buffered_ + length > kBufferSize) {
+        flush();
+        if (length > kBufferSize) {
+            EVP_DigestUpdate(ctx_, data, length);
+            return;
+        }
+    }
+    std::memcpy(buffer_ + buffered_, data, length);
+    buffered_ += length;
+}
+
+void Sha256Stream::update_byte(uint8_t byte) {
+    if (buffered_ == kBufferSize) {
+        flush();
+    }
+    buffer_[buffered_++] = byte;
+}
+
+HashId Sha256Stream::finish() {
+    flush();
+    HashId digest;
+    unsigned int length = 0;
+    EVP_DigestFinal_ex(ctx_, digest.data(), &length);
+    return digest;
+}
+
+void Sha256Stream::flush() {
+    if (buffered_ > 0) {
+        EVP_DigestUpdate(ctx_, buffer_, buffered_);
+        buffered_ = 0;
+    }
+}
+
+void CanonicalHasher::append_document(Sha256Stream& stream, const bsoncxx::document::view& doc) {
+    stream.update_byte(kTagDocument);
+
+    bool sorted = true;
+    std::string_view previous;
+    bool first = true;
+    for (auto&& element : doc) {
+        std::string_view key = key_of(element);
+        if (!first && key <= previous) {
+            sorted = false;
+            break;
+        }
+        previous = key;
+        first = false;
+    }
+
+    if (sorted) {
+        for (auto&& element : doc) {
+            std::string_view key = key_of(element);
+            append_string(stream, kTagKey, key.data(), key.size());
+            append_value(stream, element.get_value());
+        }
+    } else {
+        std::vector<bsoncxx::document::element> elements(doc.begin(), doc.end());
+        std::stable_sort(elements.begin(), elements.end(), [](const auto& a, const auto& b) {
+            return key_of(a) < key_of(b);
+        });
+        for (size_t i = 0; i < elements.size(); ++i) {
+            std::string_view key = key_of(elements[i]);
+            if (i > 0 && key == key_of(elements[i - 1])) {
+                continue;
+            }
+            append_string(stream, kTagKey, key.data(), key.size());
+            append_value(stream, elements[i].get_value());
+        }
+    }
+
+    stream.update_byte(kTagEnd);
+}
+
+void CanonicalHasher::append_array(Sha256Stream& stream, const bsoncxx::array::view& array) {
+    stream.update_byte(kTagArray);
+    for (auto&& element : array) {
+        if (element.type() == bsoncxx::type::k_double) {
+            append_double(stream, element.get_double().value);
+        } else {
+            append_value(stream, element.get_value());
+        }
+    }
+    stream.update_byte(kTagEnd);
+}
+
+void CanonicalHasher::append_double(Sha256Stream& stream, double value) {
+    if (std::isfinite(value) && std::trunc(value) == value && std::fabs(value) < kInt64Limit) {
+        append_int64(stream, static_cast<int64_t>(value));
+        return;
+    }
+
+    uint64_t bits = 0;
+    if (std::isnan(value)) {
+        bits = 0x7ff8000000000000ULL;
+    } else {
+        std::memcpy(&bits, &value, sizeof(bits));
+    }
+    stream.update_byte(kTagDouble);
+    append_uint64(stream, bits);
+}
+
+void CanonicalHasher::append_int64(Sha256Stream& stream, int64_t value) {
+    stream.update_byte(kTagInt);
+    append_uint64(stream, static_cast<uint64_t>(value));
+}
+
+void CanonicalHasher::append_value(Sha256Stream& stream, const bsoncxx::types::bson_value::view& value) {
+    switch (value.type()) {
+        case bsoncxx::type::k_double:
+            append_double(stream, value.get_double().value);
+            break;
+        case bsoncxx::type::k_int32:
+            append_int64(stream, value.get_int32().value);
+            break;
+        case bsoncxx::type::k_int64:
+            append_int64(stream, value.get_int64().value);
+            break;
+        case bsoncxx::type::k_decimal128: {
+            auto decimal = value.get_decimal128().value;
+            stream.update_byte(kTagDecimal);
+            append_uint64(stream, decimal.high());
+            append_uint64(stream, decimal.low());
+            break;
+        }
+        case bsoncxx::type::k_string: {
+            auto text = value.get_string().value;
+            append_string(stream, kTagString, text.data(), text.size());
+            break;
+        }
+        case bsoncxx::type::k_document:
+            append_document(stream, value.get_document().value);
+            break;
+        case bsoncxx::type::k_array:
+            append_array(stream, value.get_array().value);
+            break;
+        case bsoncxx::type::k_bool:
+            stream.update_byte(kTagBool);
+            stream.update_byte(value.get_bool().value ? 1 : 0);
+            break;
+        case bsoncxx::type::k_null:
+            stream.update_byte(kTagNull);
+            break;
+        case bsoncxx::type::k_date:
+            stream.update_byte(kTagDate);
+            append_uint64(stream, static_cast<uint64_t>(value.get_date().to_int64()));
+            break;
+        case bsoncxx::type::k_oid:
+            stream.update_byte(kTagOid);
+            stream.update(value.get_oid().value.bytes(), value.get_oid().value.size());
+            break;
+        case bsoncxx::type::k_binary: {
+            auto binary = value.get_binary();
+            stream.update_byte(kTagBinary);
+            stream.update_byte(static_cast<uint8_t>(binary.sub_type));
+            append_uint64(stream, binary.size);
+            stream.update(binary.bytes, binary.size);
+            break;
+        }
+        default: {
+            bsoncxx::builder::basic::document wrapper;
+            wrapper.append(bsoncxx::builder::basic::kvp("v", value));
+            auto view = wrapper.view();
+            stream.update_byte(kTagRaw);
+            stream.update_byte(static_cast<uint8_t>(value.type()));
+            append_uint64(stream, view.length());
+            stream.update(view.data(), view.length());
+            break;
+        }
+    }
+}
+
+void CanonicalHasher::append_string(Sha256Stream& stream, uint8_t tag, const char* data, size_t length) {
+    stream.update_byte(tag);
+    append_uint64(stream, length);
+    stream.update(data, length);
+}
+
+void CanonicalHasher::append_uint64(Sha256Stream& stream, uint64_t value) {
+    unsigned char bytes[8];
+    for (int i = 0; i < 8; ++i) {
+        bytes[i] = static_cast<unsigned char>(value >> (8 * i));
+    }
+    stream.update(bytes, sizeof(bytes));
+}
+
+}
+}
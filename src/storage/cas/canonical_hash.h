@@ -0,0 +1,52 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include <bsoncxx/array/view.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <bsoncxx/types/bson_value/view.hpp>
+#include <openssl/evp.h>
+#include <cstddef>
+#include <cstdint>
+
+namespace geoversion {
+namespace storage {
+
+class Sha256Stream {
+public:
+    Sha256Stream();
+    ~Sha256Stream();
+
+    Sha256Stream(const Sha256Stream&) = delete;
+    Sha256Stream& operator=(const Sha256Stream&) = delete;
+
+    void update(const void* data, size_t length);
+    void update_byte(uint8_t byte);
+    HashId finish();
+
+private:
+    static constexpr size_t kBufferSize = 4096;
+
+    EVP_MD_CTX* ctx_;
+    unsigned char buffer_[kBufferSize];
+    size_t buffered_;
+
+    void flush();
+};
+
+// Canonical binary form: type-tagged values, document keys in byte order,
+// integral numbers encoded as int64 regardless of their BSON type.
+class CanonicalHasher {
+public:
+    static void append_document(Sha256Stream& stream, const bsoncxx::document::view& doc);
+    static void append_array(Sha256Stream& stream, const bsoncxx::array::view& array);
+    static void append_double(Sha256Stream& stream, double value);
+    static void append_int64(Sha256Stream& stream, int64_t value);
+
+private:
+    static void append_value(Sha256Stream& stream, const bsoncxx::types::bson_value::view& value);
+    static void append_string(Sha256Stream& stream, uint8_t tag, const char* data, size_t length);
+    static void append_uint64(Sha256Stream& stream, uint64_t value);
+};
+
+}
+}
@@ -1,55 +1,269 @@
 #include "cas.h"
+#include "canonical_hash.h"
 #include "storage/bpo_storage/bpo_storage.h"
+#include "storage/object_cache/object_cache.h"
+#include "storage/existence_filter/existence_filter.h"
+#include "storage/spatial_index/spatial_index.h"
+#include <bsoncxx/builder/concatenate.hpp>
 #include <bsoncxx/builder/stream/document.hpp>
 #include <bsoncxx/builder/basic/document.hpp>
 #include <bsoncxx/builder/basic/array.hpp>
 #include <bsoncxx/builder/basic/kvp.hpp>
 #include <bsoncxx/json.hpp>
 #include <bsoncxx/types.hpp>
-#include <openssl/sha.h>
-#include <sstream>
-#include <iomanip>
+#include <mongocxx/exception/bulk_write_exception.hpp>
+#include <mongocxx/options/insert.hpp>
 #include <iostream>
+#include <atomic>
 #include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <algorithm>
 
 namespace geoversion {
 namespace storage {
 
-CAS::CAS(mongocxx::collection collection) : collection_(collection) {
+namespace {
+
+constexpr int kDuplicateKeyError = 11000;
+
+}
+
+StoreManyStats& StoreManyStats::operator+=(const StoreManyStats& other) {
+    total += other.total;
+    inserted += other.inserted;
+    duplicates += other.duplicates;
+    failed += other.failed;
+    round_trips += other.round_trips;
+    elapsed += other.elapsed;
+    return *this;
+}
+
+CAS::CAS(mongocxx::collection collection, HashMode hash_mode)
+    : connection_(nullptr), collection_(collection), hash_mode_(hash_mode), split_min_bytes_(0), touch_interval_(kDefaultTouchInterval) {
+}
+
+CAS::CAS(MongoDBConnection& connection, HashMode hash_mode)
+    : connection_(&connection), hash_mode_(hash_mode), split_min_bytes_(0), touch_interval_(kDefaultTouchInterval) {
+}
+
+CAS::CollectionLease CAS::lease_collection() {
+    if (!connection_) {
+        return CollectionLease{std::nullopt, collection_};
+    }
+    ClientLease lease = connection_->acquire();
+    mongocxx::collection collection = lease.collection(kCollectionName);
+    return CollectionLease{std::move(lease), collection};
+}
+
+HashId CAS::compute_hash(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) {
+    if (precision_.enabled) {
+        bsoncxx::document::value snapped{bsoncxx::document::view()};
+        if (codec_.quantize(geometry, snapped)) {
+            return hash_by_mode(snapped.view(), attributes);
+        }
+    }
+    return hash_by_mode(geometry, attributes);
 }
 
-std::string CAS::compute_hash(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) {
+HashId CAS::hash_by_mode(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) {
+    if (hash_mode_ == HashMode::LegacyJson) {
+        return compute_legacy_hash(geometry, attributes);
+    }
+    return compute_canonical_hash(geometry, attributes);
+}
+
+HashId CAS::compute_canonical_hash(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) {
+    static constexpr char kDomain[] = "geoversion.bpo.v1";
+
+    Sha256Stream stream;
+    stream.update(kDomain, sizeof(kDomain));
+    CanonicalHasher::append_document(stream, geometry);
+    CanonicalHasher::append_document(stream, attributes);
+
+    return stream.finish();
+}
+
+HashId CAS::compute_attributes_hash(const bsoncxx::document::view& attributes) {
+    static constexpr char kDomain[] = "geoversion.attributes.v1";
+
+    Sha256Stream stream;
+    stream.update(kDomain, sizeof(kDomain));
+    CanonicalHasher::append_document(stream, attributes);
+
+    return stream.finish();
+}
+
+HashId CAS::compute_legacy_hash(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) {
     std::string serialized = serialize_for_hashing(geometry, attributes);
     return sha256_hash(serialized);
 }
 
-std::string CAS::compute_hash(const BPO& bpo) {
+HashMode CAS::get_hash_mode() const {
+    return hash_mode_;
+}
+
+void CAS::set_cache(std::shared_ptr<ObjectCache> cache) {
+    cache_ = std::move(cache);
+}
+
+std::shared_ptr<ObjectCache> CAS::get_cache() const {
+    return cache_;
+}
+
+void CAS::set_existence_filter(std::shared_ptr<ExistenceFilter> filter) {
+    existence_filter_ = std::move(filter);
+}
+
+std::shared_ptr<ExistenceFilter> CAS::get_existence_filter() const {
+    return existence_filter_;
+}
+
+void CAS::set_spatial_index(std::shared_ptr<SpatialIndex> index) {
+    spatial_index_ = std::move(index);
+}
+
+std::shared_ptr<SpatialIndex> CAS::get_spatial_index() const {
+    return spatial_index_;
+}
+
+void CAS::set_precision(const PrecisionOptions& options) {
+    precision_ = options;
+    codec_ = CoordinateCodec(options.grid);
+}
+
+const PrecisionOptions& CAS::get_precision() const {
+    return precision_;
+}
+
+void CAS::set_geometry_cas(std::shared_ptr<GeometryCAS> geometry_cas, size_t split_min_bytes) {
+    geometry_cas_ = std::move(geometry_cas);
+    split_min_bytes_ = split_min_bytes;
+}
+
+std::shared_ptr<GeometryCAS> CAS::get_geometry_cas() const {
+    return geometry_cas_;
+}
+
+void CAS::set_touch_interval(std::chrono::seconds interval) {
+    touch_interval_ = interval;
+}
+
+std::chrono::seconds CAS::get_touch_interval() const {
+    return touch_interval_;
+}
+
+bool CAS::definitely_missing(const HashId& hash) const {
+    return existence_filter_ && !existence_filter_->might_contain(hash);
+}
+
+HashId CAS::compute_hash(const BPO& bpo) {
     return compute_hash(bpo.get_geometry(), bpo.get_attributes());
 }
 
 bool CAS::store(const BPO& bpo) {
-    std::string hash = compute_hash(bpo);
-    
-    if (exists(hash)) {
+    return store(compute_hash(bpo), bpo.get_geometry(), bpo.get_attributes());
+}
+
+// A store that finds the object refreshes its last_stored_at, so the garbage
+// collector keeps it until the version referencing it is written. Only a
+// stale one is written; true if the object is there and fresh afterwards.
+bool CAS::touch(const HashId& hash) {
+    bsoncxx::builder::stream::document update;
+    update << "$set" << bsoncxx::builder::stream::open_document
+           << kLastStoredField << bsoncxx::types::b_date{std::chrono::system_clock::now()}
+           << bsoncxx::builder::stream::close_document;
+
+    auto collection = lease_collection();
+    auto filter = make_stale_filter(bsoncxx::types::bson_value::view{hash.to_bson()});
+    auto result = collection->update_one(filter.view(), update.view());
+    if (result && result->matched_count() > 0) {
         return true;
     }
-    
-    return store(hash, bpo.get_geometry(), bpo.get_attributes());
+    // Refreshed meanwhile by another store, or collected.
+    bsoncxx::builder::stream::document present;
+    present << "hash" << hash.to_bson();
+    return collection->find_one(present.view()).has_value();
 }
 
-bool CAS::store(const std::string& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) {
+bool CAS::touch_many(const std::vector<HashId>& hashes) {
+    bsoncxx::builder::stream::document update;
+    update << "$set" << bsoncxx::builder::stream::open_document
+           << kLastStoredField << bsoncxx::types::b_date{std::chrono::system_clock::now()}
+           << bsoncxx::builder::stream::close_document;
+
     try {
-        if (exists(hash)) {
-            return true;
+        auto collection = lease_collection();
+        for (size_t begin = 0; begin < hashes.size(); begin += kLookupChunkSize) {
+            size_t end = std::min(hashes.size(), begin + kLookupChunkSize);
+            bsoncxx::builder::basic::array in_array;
+            for (size_t i = begin; i < end; ++i) {
+                in_array.append(hashes[i].to_bson());
+            }
+            bsoncxx::builder::basic::document in_doc;
+            in_doc.append(bsoncxx::builder::basic::kvp("$in", in_array));
+            auto filter = make_stale_filter(bsoncxx::types::bson_value::view{bsoncxx::types::b_document{in_doc.view()}});
+            collection->update_many(filter.view(), update.view());
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error refreshing CAS objects: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool CAS::is_fresh(const bsoncxx::document::view& doc) const {
+    auto stored_at = doc[kLastStoredField];
+    return stored_at && stored_at.type() == bsoncxx::type::k_date &&
+           stored_at.get_date().value > std::chrono::system_clock::now().time_since_epoch() - touch_interval_;
+}
+
+bsoncxx::document::value CAS::make_stale_filter(const bsoncxx::types::bson_value::view& hash_match) const {
+    using bsoncxx::builder::basic::kvp;
+    bsoncxx::types::b_date threshold{std::chrono::system_clock::now() - touch_interval_};
+    return bsoncxx::builder::basic::make_document(
+        kvp("hash", hash_match),
+        kvp("$or", bsoncxx::builder::basic::make_array(
+            bsoncxx::builder::basic::make_document(kvp(kLastStoredField, bsoncxx::builder::basic::make_document(kvp("$lt", threshold)))),
+            bsoncxx::builder::basic::make_document(kvp(kLastStoredField, bsoncxx::builder::basic::make_document(kvp("$exists", false))))
+        ))
+    );
+}
+
+bool CAS::store(const HashId& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) {
+    try {
+        if (!definitely_missing(hash)) {
+            bsoncxx::builder::stream::document filter;
+            filter << "hash" << hash.to_bson();
+            bsoncxx::builder::stream::document projection;
+            projection << kLastStoredField << 1 << "_id" << 0;
+            mongocxx::options::find opts;
+            opts.projection(projection.view());
+
+            auto found = lease_collection()->find_one(filter.view(), opts);
+            if (found && (is_fresh(found->view()) || touch(hash))) {
+                return true;
+            }
         }
         
-        bsoncxx::builder::stream::document doc;
-        doc << "hash" << hash
-            << "geometry" << bsoncxx::types::b_document{bsoncxx::document::value(geometry)}
-            << "attributes" << bsoncxx::types::b_document{bsoncxx::document::value(attributes)}
-            << "created_at" << bsoncxx::types::b_date{std::chrono::system_clock::now()};
+        GeometryExtent extent;
+        GeometryExtent::from_geometry(geometry, extent);
         
-        collection_.insert_one(doc.view());
+        std::optional<GeometryRecord> geometry_record;
+        auto doc = make_document(hash, geometry, attributes, extent, geometry_record);
+        if (geometry_record && !geometry_cas_->store(*geometry_record)) {
+            return false;
+        }
+        lease_collection()->insert_one(doc.view());
+        if (cache_) {
+            cache_->clear_missing(hash);
+        }
+        if (existence_filter_) {
+            existence_filter_->add(hash);
+        }
+        index_envelope(hash, extent.envelope);
         return true;
     } catch (const std::exception& e) {
         std::cerr << "Error storing in CAS: " << e.what() << std::endl;
@@ -57,30 +271,460 @@ bool CAS::store(const std::string& hash, const bsoncxx::document::view& geometry
     }
 }
 
-std::unique_ptr<BPO> CAS::retrieve(const std::string& hash) {
+StoreManyResult CAS::store_many(const std::vector<BPO>& bpos) {
+    return store_many(bpos.data(), bpos.size());
+}
+
+StoreManyResult CAS::store_many(const BPO* bpos, size_t count) {
+    return store_many(bpos, nullptr, count);
+}
+
+// hashes, when given, must be compute_hash() of the matching BPOs; callers
+// that hashed on other threads pass them in to avoid hashing twice.
+StoreManyResult CAS::store_many(const BPO* bpos, const HashId* hashes, size_t count) {
+    auto start = std::chrono::steady_clock::now();
+
+    StoreManyResult result;
+    result.hashes.reserve(count);
+    result.statuses.assign(count, StoreStatus::Failed);
+    result.stats.total = count;
+
+    for (size_t i = 0; i < count; ++i) {
+        result.hashes.push_back(hashes ? hashes[i] : compute_hash(bpos[i]));
+    }
+
+    for (size_t begin = 0; begin < count; begin += kDefaultBatchSize) {
+        size_t end = std::min(count, begin + kDefaultBatchSize);
+        store_chunk(bpos, begin, end, result);
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        if (result.statuses[i] != StoreStatus::Failed) {
+            if (cache_) {
+                cache_->clear_missing(result.hashes[i]);
+            }
+            if (existence_filter_) {
+                existence_filter_->add(result.hashes[i]);
+            }
+        }
+        switch (result.statuses[i]) {
+            case StoreStatus::Inserted:
+                ++result.stats.inserted;
+                break;
+            case StoreStatus::Duplicate:
+                ++result.stats.duplicates;
+                break;
+            case StoreStatus::Failed:
+                ++result.stats.failed;
+                break;
+        }
+    }
+
+    result.stats.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start
+    );
+    return result;
+}
+
+StoreManyStats CAS::store_stream(
+    const std::function<bool(BPO&)>& next,
+    size_t batch_size,
+    const std::function<void(const StoreManyResult&)>& on_batch
+) {
+    StoreManyStats stats;
+    if (batch_size == 0) {
+        batch_size = kDefaultBatchSize;
+    }
+
+    std::vector<BPO> batch;
+    batch.reserve(batch_size);
+
+    auto flush = [&]() {
+        if (batch.empty()) {
+            return;
+        }
+        StoreManyResult result = store_many(batch);
+        stats += result.stats;
+        if (on_batch) {
+            on_batch(result);
+        }
+        batch.clear();
+    };
+
+    while (true) {
+        BPO bpo;
+        if (!next(bpo)) {
+            break;
+        }
+        batch.push_back(std::move(bpo));
+        if (batch.size() >= batch_size) {
+            flush();
+        }
+    }
+    flush();
+
+    return stats;
+}
+
+void CAS::store_chunk(const BPO* bpos, size_t begin, size_t end, StoreManyResult& result) {
+    std::unordered_map<HashId, size_t> first_index;
+    first_index.reserve(end - begin);
+
+    bsoncxx::builder::basic::array in_array;
+    size_t candidates = 0;
+    for (size_t i = begin; i < end; ++i) {
+        auto inserted = first_index.emplace(result.hashes[i], i);
+        if (!inserted.second) {
+            result.statuses[i] = StoreStatus::Duplicate;
+            continue;
+        }
+        if (definitely_missing(result.hashes[i])) {
+            continue;
+        }
+        in_array.append(result.hashes[i].to_bson());
+        ++candidates;
+    }
+
+    if (candidates > 0) {
+        try {
+            bsoncxx::builder::basic::document in_doc;
+            in_doc.append(bsoncxx::builder::basic::kvp("$in", in_array));
+            bsoncxx::builder::basic::document filter;
+            filter.append(bsoncxx::builder::basic::kvp("hash", in_doc));
+
+            bsoncxx::builder::stream::document projection;
+            projection << "hash" << 1 << kLastStoredField << 1 << "_id" << 0;
+
+            mongocxx::options::find opts;
+            opts.projection(projection.view());
+
+            auto collection = lease_collection();
+            auto cursor = collection->find(filter.view(), opts);
+            ++result.stats.round_trips;
+
+            std::vector<std::pair<HashId, size_t>> stale;
+            for (auto&& doc : cursor) {
+                if (!doc["hash"]) {
+                    continue;
+                }
+                HashId hash;
+                if (!HashId::from_bson(doc["hash"].get_value(), hash)) {
+                    continue;
+                }
+                auto found = first_index.find(hash);
+                if (found != first_index.end()) {
+                    result.statuses[found->second] = StoreStatus::Duplicate;
+                    if (!is_fresh(doc)) {
+                        stale.emplace_back(hash, found->second);
+                    }
+                    first_index.erase(found);
+                }
+            }
+
+            if (!stale.empty()) {
+                bsoncxx::builder::basic::array stale_array;
+                for (const auto& entry : stale) {
+                    stale_array.append(entry.first.to_bson());
+                }
+                bsoncxx::builder::basic::document stale_in;
+                stale_in.append(bsoncxx::builder::basic::kvp("$in", stale_array));
+                auto stale_filter = make_stale_filter(bsoncxx::types::bson_value::view{bsoncxx::types::b_document{stale_in.view()}});
+
+                bsoncxx::builder::stream::document touch;
+                touch << "$set" << bsoncxx::builder::stream::open_document
+                      << kLastStoredField << bsoncxx::types::b_date{std::chrono::system_clock::now()}
+                      << bsoncxx::builder::stream::close_document;
+                auto touched = collection->update_many(stale_filter.view(), touch.view());
+                ++result.stats.round_trips;
+
+                // Fewer matched: some were refreshed by another store, or
+                // collected since the lookup and go back to be inserted.
+                if (!touched || touched->matched_count() < static_cast<int64_t>(stale.size())) {
+                    bsoncxx::builder::basic::document stale_lookup;
+                    stale_lookup.append(bsoncxx::builder::basic::kvp("hash", stale_in.view()));
+                    std::unordered_set<HashId> present;
+                    for (auto&& doc : collection->find(stale_lookup.view(), opts)) {
+                        HashId hash;
+                        if (doc["hash"] && HashId::from_bson(doc["hash"].get_value(), hash)) {
+                            present.insert(hash);
+                        }
+                    }
+                    ++result.stats.round_trips;
+                    for (const auto& entry : stale) {
+                        if (present.count(entry.first) == 0) {
+                            first_index.emplace(entry.first, entry.second);
+                        }
+                    }
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error checking CAS batch existence: " << e.what() << std::endl;
+            return;
+        }
+    }
+
+    if (first_index.empty()) {
+        return;
+    }
+
+    std::vector<size_t> doc_items;
+    doc_items.reserve(first_index.size());
+    for (const auto& entry : first_index) {
+        doc_items.push_back(entry.second);
+    }
+    std::sort(doc_items.begin(), doc_items.end());
+
+    std::vector<bsoncxx::document::value> docs;
+    std::vector<GeometryExtent> extents;
+    std::vector<GeometryRecord> geometry_records;
+    docs.reserve(doc_items.size());
+    extents.reserve(doc_items.size());
+    for (size_t i : doc_items) {
+        extents.push_back(bpos[i].get_extent());
+        std::optional<GeometryRecord> geometry_record;
+        docs.push_back(make_document(
+            result.hashes[i], bpos[i].get_geometry(), bpos[i].get_attributes(), extents.back(), geometry_record
+        ));
+        if (geometry_record) {
+            geometry_records.push_back(std::move(*geometry_record));
+        }
+    }
+
+    // Geometries go first so that no stored object references a missing one.
+    if (!geometry_records.empty()) {
+        bool stored = geometry_cas_->store_many(geometry_records);
+        ++result.stats.round_trips;
+        if (!stored) {
+            return;
+        }
+    }
+
+    mongocxx::options::insert insert_opts;
+    insert_opts.ordered(false);
+
+    try {
+        lease_collection()->insert_many(docs, insert_opts);
+        ++result.stats.round_trips;
+        for (size_t i : doc_items) {
+            result.statuses[i] = StoreStatus::Inserted;
+        }
+    } catch (const mongocxx::bulk_write_exception& e) {
+        ++result.stats.round_trips;
+        for (size_t i : doc_items) {
+            result.statuses[i] = StoreStatus::Inserted;
+        }
+
+        bool has_details = false;
+        if (e.raw_server_error()) {
+            auto reply = e.raw_server_error()->view();
+            if (reply["writeErrors"] && reply["writeErrors"].type() == bsoncxx::type::k_array) {
+                has_details = true;
+                for (auto&& error : reply["writeErrors"].get_array().value) {
+                    auto error_doc = error.get_document().value;
+                    if (!error_doc["index"] || !error_doc["code"]) {
+                        continue;
+                    }
+                    auto index = static_cast<size_t>(error_doc["index"].get_int32().value);
+                    if (index >= doc_items.size()) {
+                        continue;
+                    }
+                    bool duplicate = error_doc["code"].get_int32().value == kDuplicateKeyError;
+                    result.statuses[doc_items[index]] = duplicate ? StoreStatus::Duplicate : StoreStatus::Failed;
+                }
+            }
+        }
+
+        if (!has_details) {
+            std::cerr << "Error storing CAS batch: " << e.what() << std::endl;
+            for (size_t i : doc_items) {
+                result.statuses[i] = StoreStatus::Failed;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error storing CAS batch: " << e.what() << std::endl;
+    }
+
+    for (size_t k = 0; k < doc_items.size(); ++k) {
+        if (result.statuses[doc_items[k]] == StoreStatus::Inserted) {
+            index_envelope(result.hashes[doc_items[k]], extents[k].envelope);
+        }
+    }
+}
+
+void CAS::index_envelope(const HashId& hash, const Envelope& envelope) {
+    if (spatial_index_ && !envelope.is_empty()) {
+        spatial_index_->insert(hash, envelope);
+    }
+}
+
+// With precision enabled the stored geometry is the snapped one, and extent
+// is recomputed from it so the envelope fields and the spatial index agree
+// with what was hashed. With a geometry CAS, geometry_record receives the
+// geometry document and the returned document references it.
+bsoncxx::document::value CAS::make_document(
+    const HashId& hash,
+    const bsoncxx::document::view& geometry,
+    const bsoncxx::document::view& attributes,
+    GeometryExtent& extent,
+    std::optional<GeometryRecord>& geometry_record
+) const {
+    std::optional<bsoncxx::document::value> snapped;
+    std::vector<uint8_t> blob;
+    if (precision_.enabled) {
+        bsoncxx::document::value value{bsoncxx::document::view()};
+        bool with_blob = precision_.encoding != GeometryEncoding::GeoJSON;
+        if (codec_.quantize(geometry, value, with_blob ? &blob : nullptr)) {
+            snapped.emplace(std::move(value));
+            GeometryExtent::from_geometry(snapped->view(), extent);
+        }
+    }
+
+    // An envelope stands in for the geometry only if there is one to index.
+    bsoncxx::document::view full = snapped ? snapped->view() : geometry;
+    bool blob_only = !blob.empty() && precision_.encoding == GeometryEncoding::Blob && extent.is_valid();
+    bool split = geometry_cas_ && extent.is_valid() && full.length() >= split_min_bytes_;
+    std::optional<bsoncxx::document::value> envelope;
+    if (blob_only || split) {
+        const Envelope& box = extent.envelope;
+        envelope.emplace(envelope_geometry(box.min_x, box.min_y, box.max_x, box.max_y));
+    }
+
+    bsoncxx::types::b_date now{std::chrono::system_clock::now()};
+    const char* type_name = GeoJSONValidator::type_name(GeoJSONValidator::get_type(geometry));
+    auto append_geometry = [&](bsoncxx::builder::stream::document& target) {
+        target << "geometry" << bsoncxx::types::b_document{blob_only ? envelope->view() : full};
+        if (!blob.empty()) {
+            target << CoordinateCodec::kBlobField
+                   << bsoncxx::types::b_binary{bsoncxx::binary_sub_type::k_binary, static_cast<uint32_t>(blob.size()), blob.data()};
+        }
+        if (blob_only) {
+            target << CoordinateCodec::kEncodingField << CoordinateCodec::kBlobEncoding;
+        }
+    };
+
+    bsoncxx::builder::stream::document doc;
+    doc << "hash" << hash.to_bson();
+    if (split) {
+        GeometryRecord record;
+        record.hash = GeometryCAS::compute_hash(full);
+        HashId geometry_hash = record.hash;
+        if (full.length() >= GeometryCAS::kChunkThreshold) {
+            // Too large for one document; the GeometryCAS chunks it. Moving
+            // the snapped value keeps its buffer, and `full` with it.
+            record.geometry = full;
+            record.owned = std::move(snapped);
+        } else {
+            bsoncxx::builder::stream::document geometry_doc;
+            geometry_doc << "hash" << geometry_hash.to_bson();
+            append_geometry(geometry_doc);
+            geometry_doc << "created_at" << now << GeometryCAS::kLastStoredField << now;
+            record.document.emplace(geometry_doc << bsoncxx::builder::stream::finalize);
+        }
+        geometry_record.emplace(std::move(record));
+
+        doc << "geometry" << bsoncxx::types::b_document{envelope->view()}
+            << CoordinateCodec::kEncodingField << kReferenceEncoding
+            << kGeometryHashField << geometry_hash.to_bson()
+            << kAttributesHashField << compute_attributes_hash(attributes).to_bson()
+            << "geometry_type" << type_name;
+    } else {
+        append_geometry(doc);
+        if (blob_only) {
+            doc << "geometry_type" << type_name;
+        }
+    }
+    doc << "attributes" << bsoncxx::types::b_document{attributes}
+        << "created_at" << now
+        << kLastStoredField << now;
+    if (extent.is_valid()) {
+        doc << bsoncxx::builder::concatenate(extent.to_bson().view());
+    }
+    return doc << bsoncxx::builder::stream::finalize;
+}
+
+std::unique_ptr<BPO> CAS::retrieve(const HashId& hash) {
+    if (!cache_) {
+        return fetch(hash);
+    }
+
+    auto shared = retrieve_shared(hash);
+    return shared ? std::make_unique<BPO>(*shared) : nullptr;
+}
+
+std::shared_ptr<const BPO> CAS::retrieve_shared(const HashId& hash) {
+    if (cache_) {
+        if (auto cached = cache_->get(hash)) {
+            return cached;
+        }
+        if (cache_->is_known_missing(hash)) {
+            return nullptr;
+        }
+    }
+
+    std::shared_ptr<const BPO> loaded = fetch(hash);
+    if (cache_) {
+        if (loaded) {
+            cache_->put(hash, loaded);
+        } else {
+            cache_->mark_missing(hash);
+        }
+    }
+    return loaded;
+}
+
+std::unique_ptr<BPO> CAS::fetch(const HashId& hash) {
+    if (definitely_missing(hash)) {
+        return nullptr;
+    }
+
     try {
         bsoncxx::builder::stream::document filter;
-        filter << "hash" << hash;
+        filter << "hash" << hash.to_bson();
         
-        auto result = collection_.find_one(filter.view());
+        auto result = lease_collection()->find_one(filter.view());
         
         if (!result) {
             return nullptr;
         }
         
-        return std::make_unique<BPO>(result->view());
+        std::optional<bsoncxx::document::value> resolved;
+        if (!resolve(result->view(), resolved)) {
+            return nullptr;
+        }
+        return std::make_unique<BPO>(resolved ? resolved->view() : result->view());
     } catch (const std::exception& e) {
         std::cerr << "Error retrieving from CAS: " << e.what() << std::endl;
         return nullptr;
     }
 }
 
-bool CAS::exists(const std::string& hash) {
+bool CAS::exists(const HashId& hash) {
+    if (cache_) {
+        if (cache_->get(hash)) {
+            return true;
+        }
+        if (cache_->is_known_missing(hash)) {
+            return false;
+        }
+    }
+    if (definitely_missing(hash)) {
+        return false;
+    }
+
     try {
         bsoncxx::builder::stream::document filter;
-        filter << "hash" << hash;
-        
-        auto result = collection_.find_one(filter.view());
+        filter << "hash" << hash.to_bson();
+
+        bsoncxx::builder::stream::document projection;
+        projection << "hash" << 1 << "_id" << 0;
+
+        mongocxx::options::find opts;
+        opts.projection(projection.view());
+
+        auto result = lease_collection()->find_one(filter.view(), opts);
+        if (cache_ && !result) {
+            cache_->mark_missing(hash);
+        }
         return result.has_value();
     } catch (const std::exception& e) {
         std::cerr << "Error checking CAS existence: " << e.what() << std::endl;
@@ -88,12 +732,319 @@ bool CAS::exists(const std::string& hash) {
     }
 }
 
-bool CAS::remove(const std::string& hash) {
+std::vector<std::unique_ptr<BPO>> CAS::retrieve_many(const std::vector<HashId>& hashes) {
+    std::vector<std::unique_ptr<BPO>> results(hashes.size());
+
+    if (cache_) {
+        auto shared = retrieve_many_shared(hashes);
+        for (size_t i = 0; i < shared.size(); ++i) {
+            if (shared[i]) {
+                results[i] = std::make_unique<BPO>(*shared[i]);
+            }
+        }
+        return results;
+    }
+
+    PendingReferences references;
+    lookup_chunks(hashes, false, [&](size_t index, const bsoncxx::document::view& doc) {
+        if (is_geometry_reference(doc)) {
+            references.emplace_back(index, bsoncxx::document::value(doc));
+            return;
+        }
+        results[index] = std::make_unique<BPO>(doc);
+    });
+    resolve_references(references, [&](size_t index, const bsoncxx::document::view& doc) {
+        results[index] = std::make_unique<BPO>(doc);
+    });
+
+    return results;
+}
+
+std::vector<std::shared_ptr<const BPO>> CAS::retrieve_many_shared(const std::vector<HashId>& hashes) {
+    std::vector<std::shared_ptr<const BPO>> results(hashes.size());
+    std::vector<HashId> pending;
+    std::vector<size_t> pending_index;
+
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        if (cache_) {
+            if ((results[i] = cache_->get(hashes[i]))) {
+                continue;
+            }
+            if (cache_->is_known_missing(hashes[i])) {
+                continue;
+            }
+        }
+        pending.push_back(hashes[i]);
+        pending_index.push_back(i);
+    }
+
+    std::vector<bool> found(pending.size(), false);
+    PendingReferences references;
+    lookup_chunks(pending, false, [&](size_t index, const bsoncxx::document::view& doc) {
+        if (is_geometry_reference(doc)) {
+            references.emplace_back(index, bsoncxx::document::value(doc));
+            return;
+        }
+        results[pending_index[index]] = std::make_shared<const BPO>(doc);
+        found[index] = true;
+    });
+    resolve_references(references, [&](size_t index, const bsoncxx::document::view& doc) {
+        results[pending_index[index]] = std::make_shared<const BPO>(doc);
+        found[index] = true;
+    });
+
+    if (cache_) {
+        for (size_t i = 0; i < pending.size(); ++i) {
+            if (found[i]) {
+                cache_->put(pending[i], results[pending_index[i]]);
+            } else {
+                cache_->mark_missing(pending[i]);
+            }
+        }
+    }
+
+    return results;
+}
+
+std::vector<bool> CAS::exists_many(const std::vector<HashId>& hashes) {
+    std::vector<bool> results(hashes.size(), false);
+    std::vector<HashId> pending;
+    std::vector<size_t> pending_index;
+
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        if (cache_) {
+            if (cache_->get(hashes[i])) {
+                results[i] = true;
+                continue;
+            }
+            if (cache_->is_known_missing(hashes[i])) {
+                continue;
+            }
+        }
+        pending.push_back(hashes[i]);
+        pending_index.push_back(i);
+    }
+
+    std::vector<bool> found(pending.size(), false);
+    lookup_chunks(pending, true, [&](size_t index, const bsoncxx::document::view&) {
+        results[pending_index[index]] = true;
+        found[index] = true;
+    });
+
+    if (cache_) {
+        for (size_t i = 0; i < pending.size(); ++i) {
+            if (!found[i]) {
+                cache_->mark_missing(pending[i]);
+            }
+        }
+    }
+
+    return results;
+}
+
+bool CAS::resolve(const bsoncxx::document::view& doc, std::optional<bsoncxx::document::value>& resolved) {
+    if (!is_geometry_reference(doc)) {
+        return true;
+    }
+    auto geometry = geometry_of(doc);
+    if (!geometry) {
+        return false;
+    }
+    resolved.emplace(reassemble_document(doc, geometry->view()));
+    return true;
+}
+
+bool CAS::read_geometry(
+    const bsoncxx::document::view& doc,
+    bsoncxx::document::view& geometry,
+    std::optional<bsoncxx::document::value>& decoded
+) {
+    if (!is_geometry_reference(doc)) {
+        return read_stored_geometry(doc, geometry, decoded);
+    }
+    auto shared = geometry_of(doc);
+    if (!shared) {
+        return false;
+    }
+    decoded.emplace(*shared);
+    geometry = decoded->view();
+    return true;
+}
+
+GeometryCAS::Handle CAS::geometry_of(const bsoncxx::document::view& doc) {
+    HashId geometry_hash;
+    if (!geometry_cas_ || !read_geometry_hash(doc, geometry_hash)) {
+        std::cerr << "Error resolving CAS geometry: no geometry CAS for reference" << std::endl;
+        return nullptr;
+    }
+    auto geometry = geometry_cas_->retrieve(geometry_hash);
+    if (!geometry) {
+        std::cerr << "Error resolving CAS geometry: " << geometry_hash.to_hex() << " is missing" << std::endl;
+    }
+    return geometry;
+}
+
+void CAS::resolve_references(
+    PendingReferences& references,
+    const std::function<void(size_t index, const bsoncxx::document::view& doc)>& on_resolved
+) {
+    if (references.empty()) {
+        return;
+    }
+    if (!geometry_cas_) {
+        std::cerr << "Error resolving CAS geometry: no geometry CAS for reference" << std::endl;
+        return;
+    }
+
+    std::vector<HashId> geometry_hashes(references.size());
+    for (size_t i = 0; i < references.size(); ++i) {
+        read_geometry_hash(references[i].second.view(), geometry_hashes[i]);
+    }
+    auto geometries = geometry_cas_->retrieve_many(geometry_hashes);
+    for (size_t i = 0; i < references.size(); ++i) {
+        if (!geometries[i]) {
+            std::cerr << "Error resolving CAS geometry: " << geometry_hashes[i].to_hex() << " is missing" << std::endl;
+            continue;
+        }
+        auto full = reassemble_document(references[i].second.view(), geometries[i]->view());
+        on_resolved(references[i].first, full.view());
+    }
+}
+
+void CAS::append_result(
+    const bsoncxx::document::view& doc,
+    std::vector<std::unique_ptr<BPO>>& results,
+    PendingReferences& references
+) {
+    if (is_geometry_reference(doc)) {
+        references.emplace_back(results.size(), bsoncxx::document::value(doc));
+        results.emplace_back();
+        return;
+    }
+    results.push_back(std::make_unique<BPO>(doc));
+}
+
+// Fills the slots append_result() left for references, dropping dangling ones.
+void CAS::finish_results(std::vector<std::unique_ptr<BPO>>& results, PendingReferences& references) {
+    if (references.empty()) {
+        return;
+    }
+    resolve_references(references, [&](size_t index, const bsoncxx::document::view& doc) {
+        results[index] = std::make_unique<BPO>(doc);
+    });
+    results.erase(std::remove(results.begin(), results.end(), nullptr), results.end());
+}
+
+void CAS::lookup_chunks(
+    const std::vector<HashId>& hashes,
+    bool hash_only,
+    const std::function<void(size_t index, const bsoncxx::document::view& doc)>& on_found
+) {
+    std::unordered_map<HashId, std::vector<size_t>> positions;
+    positions.reserve(hashes.size());
+    std::vector<const HashId*> unique_hashes;
+    unique_hashes.reserve(hashes.size());
+
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        if (definitely_missing(hashes[i])) {
+            continue;
+        }
+        auto& slots = positions[hashes[i]];
+        if (slots.empty()) {
+            unique_hashes.push_back(&hashes[i]);
+        }
+        slots.push_back(i);
+    }
+
+    mongocxx::options::find base_opts;
+    if (hash_only) {
+        bsoncxx::builder::stream::document projection;
+        projection << "hash" << 1 << "_id" << 0;
+        base_opts.projection(projection << bsoncxx::builder::stream::finalize);
+    }
+
+    std::mutex found_mutex;
+    auto lookup_chunk = [&](size_t begin, size_t end) {
+        bsoncxx::builder::basic::array in_array;
+        for (size_t i = begin; i < end; ++i) {
+            in_array.append(unique_hashes[i]->to_bson());
+        }
+
+        bsoncxx::builder::basic::document in_doc;
+        in_doc.append(bsoncxx::builder::basic::kvp("$in", in_array));
+        bsoncxx::builder::basic::document filter;
+        filter.append(bsoncxx::builder::basic::kvp("hash", in_doc));
+
+        mongocxx::options::find opts = base_opts;
+        opts.batch_size(static_cast<int32_t>(end - begin));
+
+        try {
+            auto collection = lease_collection();
+            auto cursor = collection->find(filter.view(), opts);
+            for (auto&& doc : cursor) {
+                if (!doc["hash"]) {
+                    continue;
+                }
+                HashId hash;
+                if (!HashId::from_bson(doc["hash"].get_value(), hash)) {
+                    continue;
+                }
+                auto found = positions.find(hash);
+                if (found == positions.end()) {
+                    continue;
+                }
+                std::lock_guard<std::mutex> lock(found_mutex);
+                for (size_t index : found->second) {
+                    on_found(index, doc);
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error looking up CAS batch: " << e.what() << std::endl;
+        }
+    };
+
+    size_t chunk_count = (unique_hashes.size() + kLookupChunkSize - 1) / kLookupChunkSize;
+    size_t worker_count = std::min(chunk_count, kMaxParallelLookups);
+    if (!connection_ || !connection_->is_pooled() || worker_count < 2) {
+        for (size_t begin = 0; begin < unique_hashes.size(); begin += kLookupChunkSize) {
+            lookup_chunk(begin, std::min(unique_hashes.size(), begin + kLookupChunkSize));
+        }
+        return;
+    }
+
+    // Each worker leases its own client, so chunks overlap their round trips.
+    std::atomic<size_t> next_chunk{0};
+    std::vector<std::thread> workers;
+    workers.reserve(worker_count);
+    for (size_t w = 0; w < worker_count; ++w) {
+        workers.emplace_back([&]() {
+            for (size_t chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++) {
+                size_t begin = chunk * kLookupChunkSize;
+                lookup_chunk(begin, std::min(unique_hashes.size(), begin + kLookupChunkSize));
+            }
+        });
+    }
+    for (auto& worker : workers) {
+        worker.join();
+    }
+}
+
+// A referenced geometry may be shared, so it stays in the geometry CAS.
+bool CAS::remove(const HashId& hash) {
     try {
         bsoncxx::builder::stream::document filter;
-        filter << "hash" << hash;
+        filter << "hash" << hash.to_bson();
         
-        auto result = collection_.delete_one(filter.view());
+        auto result = lease_collection()->delete_one(filter.view());
+        if (cache_) {
+            cache_->erase(hash);
+        }
+        if (existence_filter_) {
+            existence_filter_->remove(hash);
+        }
+        if (spatial_index_) {
+            spatial_index_->remove(hash);
+        }
         return result->deleted_count() > 0;
     } catch (const std::exception& e) {
         std::cerr << "Error removing from CAS: " << e.what() << std::endl;
@@ -101,27 +1052,29 @@ bool CAS::remove(const std::string& hash) {
     }
 }
 
-std::vector<std::string> CAS::get_all_hashes() {
-    std::vector<std::string> hashes;
-    
-    try {
-        bsoncxx::builder::stream::document projection;
-        projection << "hash" << 1 << "_id" << 0;
-        
-        mongocxx::options::find opts;
-        opts.projection(projection.view());
-        
-        bsoncxx::builder::stream::document empty_filter;
-        auto cursor = collection_.find(empty_filter.view(), opts);
-        
-        for (auto&& doc : cursor) {
-            if (doc["hash"]) {
-                hashes.push_back(std::string(doc["hash"].get_string().value));
-            }
+void CAS::forget(const std::vector<HashId>& hashes) {
+    for (const auto& hash : hashes) {
+        if (cache_) {
+            cache_->erase(hash);
+        }
+        if (existence_filter_) {
+            existence_filter_->remove(hash);
+        }
+        if (spatial_index_) {
+            spatial_index_->remove(hash);
         }
-    } catch (const std::exception& e) {
-        std::cerr << "Error getting all hashes: " << e.what() << std::endl;
     }
+}
+
+std::vector<HashId> CAS::get_all_hashes() {
+    std::vector<HashId> hashes;
+    
+    CASQueryOptions options;
+    options.projection = CASProjection::HashOnly;
+    for_each_hash([&](const HashId& hash) {
+        hashes.push_back(hash);
+        return true;
+    }, options);
     
     return hashes;
 }
@@ -129,26 +1082,18 @@ std::vector<std::string> CAS::get_all_hashes() {
 size_t CAS::count() {
     try {
         bsoncxx::builder::stream::document empty_filter;
-        return collection_.count_documents(empty_filter.view());
+        return lease_collection()->count_documents(empty_filter.view());
     } catch (const std::exception& e) {
         std::cerr << "Error counting CAS: " << e.what() << std::endl;
         return 0;
     }
 }
 
-std::string CAS::sha256_hash(const std::string& data) {
-    unsigned char hash[SHA256_DIGEST_LENGTH];
-    SHA256_CTX sha256;
-    SHA256_Init(&sha256);
-    SHA256_Update(&sha256, data.c_str(), data.length());
-    SHA256_Final(hash, &sha256);
-    
-    std::stringstream ss;
-    for (int i = 0; i < SHA256_DIGEST_LENGTH; i++) {
-        ss << std::hex << std::setw(2) << std::setfill('0') << static_cast<int>(hash[i]);
-    }
-    
-    return ss.str();
+HashId CAS::sha256_hash(const std::string& data) {
+    Sha256Stream stream;
+    stream.update(data.data(), data.length());
+
+    return stream.finish();
 }
 
 std::string CAS::serialize_for_hashing(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes) {
@@ -160,96 +1105,418 @@ std::string CAS::serialize_for_hashing(const bsoncxx::document::view& geometry,
 
 std::vector<std::unique_ptr<BPO>> CAS::find_by_geometry_type(GeometryType type) {
     std::vector<std::unique_ptr<BPO>> results;
+    PendingReferences references;
     
-    std::string type_str;
-    switch (type) {
-        case GeometryType::Point:
-            type_str = "Point";
-            break;
-        case GeometryType::LineString:
-            type_str = "LineString";
-            break;
-        case GeometryType::Polygon:
-            type_str = "Polygon";
-            break;
-        default:
-            return results;
-    }
+    for_each_by_geometry_type(type, [&](const bsoncxx::document::view& doc) {
+        append_result(doc, results, references);
+        return true;
+    });
     
-    try {
-        bsoncxx::builder::stream::document filter_builder;
-        filter_builder << "geometry.type" << type_str;
-        
-        auto cursor = collection_.find(filter_builder.view());
-        
-        for (auto&& doc : cursor) {
-            results.push_back(std::make_unique<BPO>(doc));
+    finish_results(results, references);
+    return results;
+}
+
+std::vector<std::unique_ptr<BPO>> CAS::find_in_bbox(double min_lon, double min_lat, double max_lon, double max_lat) {
+    std::vector<std::unique_ptr<BPO>> results;
+    
+    if (spatial_index_ && spatial_index_->is_ready()) {
+        auto hashes = spatial_index_->query_within(Envelope(min_lon, min_lat, max_lon, max_lat));
+        for (auto& bpo : retrieve_many(hashes)) {
+            if (bpo) {
+                results.push_back(std::move(bpo));
+            }
         }
-    } catch (const std::exception& e) {
-        std::cerr << "Error finding BPOs by geometry type: " << e.what() << std::endl;
+        return results;
     }
     
+    PendingReferences references;
+    for_each_in_bbox(min_lon, min_lat, max_lon, max_lat, [&](const bsoncxx::document::view& doc) {
+        append_result(doc, results, references);
+        return true;
+    });
+    
+    finish_results(results, references);
     return results;
 }
 
-std::vector<std::unique_ptr<BPO>> CAS::find_in_bbox(double min_lon, double min_lat, double max_lon, double max_lat) {
+std::vector<std::unique_ptr<BPO>> CAS::find_intersecting_bbox(double min_lon, double min_lat, double max_lon, double max_lat) {
     std::vector<std::unique_ptr<BPO>> results;
+    PendingReferences references;
+    auto filter = make_bbox_filter("$geoIntersects", min_lon, min_lat, max_lon, max_lat);
     
-    try {
-        bsoncxx::builder::basic::document filter_builder;
-        
-        bsoncxx::builder::basic::array ring_array;
-        
-        bsoncxx::builder::basic::array point1;
-        point1.append(min_lon);
-        point1.append(min_lat);
-        ring_array.append(point1);
-        
-        bsoncxx::builder::basic::array point2;
-        point2.append(max_lon);
-        point2.append(min_lat);
-        ring_array.append(point2);
-        
-        bsoncxx::builder::basic::array point3;
-        point3.append(max_lon);
-        point3.append(max_lat);
-        ring_array.append(point3);
-        
-        bsoncxx::builder::basic::array point4;
-        point4.append(min_lon);
-        point4.append(max_lat);
-        ring_array.append(point4);
-        
-        bsoncxx::builder::basic::array point5;
-        point5.append(min_lon);
-        point5.append(min_lat);
-        ring_array.append(point5);
-        
-        bsoncxx::builder::basic::array coords_array;
-        coords_array.append(ring_array);
-        
-        bsoncxx::builder::basic::document geometry_doc;
-        geometry_doc.append(bsoncxx::builder::basic::kvp("type", "Polygon"));
-        geometry_doc.append(bsoncxx::builder::basic::kvp("coordinates", coords_array));
-        
-        bsoncxx::builder::basic::document geo_within_doc;
-        geo_within_doc.append(bsoncxx::builder::basic::kvp("$geometry", geometry_doc));
-        
-        bsoncxx::builder::basic::document geometry_filter;
-        geometry_filter.append(bsoncxx::builder::basic::kvp("$geoWithin", geo_within_doc));
+    if (!spatial_index_ || !spatial_index_->is_ready()) {
+        auto cursor = open_bbox("$geoIntersects", min_lon, min_lat, max_lon, max_lat, CASQueryOptions());
+        visit_all(*cursor, [&](const bsoncxx::document::view& doc) {
+            append_result(doc, results, references);
+            return true;
+        });
+        finish_results(results, references);
+        return results;
+    }
+    
+    // Envelope overlap only narrows the candidates; the server still runs
+    // the exact test, but only on the listed hashes instead of the 2dsphere index.
+    auto candidates = spatial_index_->query_intersects(Envelope(min_lon, min_lat, max_lon, max_lat));
+    for (size_t begin = 0; begin < candidates.size(); begin += kLookupChunkSize) {
+        size_t end = std::min(candidates.size(), begin + kLookupChunkSize);
         
-        filter_builder.append(bsoncxx::builder::basic::kvp("geometry", geometry_filter));
+        bsoncxx::builder::basic::array in_array;
+        for (size_t i = begin; i < end; ++i) {
+            in_array.append(candidates[i].to_bson());
+        }
+        bsoncxx::builder::basic::document in_doc;
+        in_doc.append(bsoncxx::builder::basic::kvp("$in", in_array));
         
-        auto cursor = collection_.find(filter_builder.view());
+        bsoncxx::builder::basic::document chunk_filter;
+        chunk_filter.append(bsoncxx::builder::basic::kvp("hash", in_doc));
+        chunk_filter.append(bsoncxx::builder::basic::kvp("geometry", filter.view()["geometry"].get_value()));
         
-        for (auto&& doc : cursor) {
-            results.push_back(std::make_unique<BPO>(doc));
+        auto cursor = open(chunk_filter.view(), CASQueryOptions());
+        visit_all(*cursor, [&](const bsoncxx::document::view& doc) {
+            append_result(doc, results, references);
+            return true;
+        });
+    }
+    
+    finish_results(results, references);
+    return results;
+}
+
+CASCursor::CASCursor()
+    : cas_(nullptr), count_(0) {
+}
+
+CASCursor::CASCursor(mongocxx::cursor&& cursor, std::optional<ClientLease> lease, CAS* cas)
+    : cas_(cas), lease_(std::move(lease)), cursor_(std::move(cursor)), count_(0) {
+}
+
+bool CASCursor::next() {
+    if (rest_) {
+        if (rest_->next()) {
+            current_ = rest_->current();
+            ++count_;
+            return true;
+        }
+        rest_.reset();
+        current_ = bsoncxx::document::view();
+        return false;
+    }
+    if (!cursor_) {
+        return false;
+    }
+
+    try {
+        if (!it_) {
+            it_.emplace(cursor_->begin());
+        } else {
+            ++*it_;
+        }
+
+        if (*it_ != cursor_->end()) {
+            current_ = **it_;
+            ++count_;
+            return true;
         }
     } catch (const std::exception& e) {
-        std::cerr << "Error finding BPOs in bbox: " << e.what() << std::endl;
+        std::cerr << "Error reading CAS cursor: " << e.what() << std::endl;
+    }
+
+    it_.reset();
+    cursor_.reset();
+    lease_.reset();
+    current_ = bsoncxx::document::view();
+
+    // The lease is returned first, so the next query can take it again.
+    if (then_) {
+        auto next_query = std::move(then_);
+        then_ = nullptr;
+        rest_ = next_query(count_);
+        if (rest_) {
+            return next();
+        }
     }
+    return false;
+}
+
+bsoncxx::document::view CASCursor::current() const {
+    return current_;
+}
+
+bool CASCursor::current_hash(HashId& hash) const {
+    auto element = current_["hash"];
+    return element && HashId::from_bson(element.get_value(), hash);
+}
+
+BPO CASCursor::current_bpo() const {
+    if (cas_ && is_geometry_reference(current_)) {
+        std::optional<bsoncxx::document::value> resolved;
+        if (cas_->resolve(current_, resolved) && resolved) {
+            return BPO(resolved->view());
+        }
+        return BPO();
+    }
+    return BPO::borrow(current_);
+}
+
+bool CASCursor::current_geometry(bsoncxx::document::view& geometry, std::optional<bsoncxx::document::value>& decoded) const {
+    if (cas_) {
+        return cas_->read_geometry(current_, geometry, decoded);
+    }
+    return read_stored_geometry(current_, geometry, decoded);
+}
+
+size_t CASCursor::count() const {
+    return count_;
+}
+
+void CASCursor::then(std::function<std::unique_ptr<CASCursor>(size_t visited)> next_query) {
+    then_ = std::move(next_query);
+}
+
+std::unique_ptr<CASCursor> CAS::scan(const CASQueryOptions& options) {
+    bsoncxx::builder::stream::document empty_filter;
+    return open(empty_filter.view(), options);
+}
+
+std::unique_ptr<CASCursor> CAS::query_by_geometry_type(GeometryType type, const CASQueryOptions& options) {
+    if (type == GeometryType::Unknown) {
+        return std::make_unique<CASCursor>();
+    }
+    std::string type_str = GeoJSONValidator::type_name(type);
     
-    return results;
+    // Blob-encoded documents keep only an envelope in `geometry`, so their
+    // type is matched on the separate geometry_type field.
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_array;
+    using bsoncxx::builder::basic::make_document;
+    auto filter = make_document(kvp("$or", make_array(
+        make_document(
+            kvp("geometry.type", type_str),
+            kvp(CoordinateCodec::kEncodingField, make_document(kvp("$exists", false)))
+        ),
+        make_document(kvp("geometry_type", type_str))
+    )));
+    return open(filter.view(), options);
+}
+
+std::unique_ptr<CASCursor> CAS::query_in_bbox(
+    double min_lon, double min_lat, double max_lon, double max_lat,
+    const CASQueryOptions& options
+) {
+    return open_bbox("$geoWithin", min_lon, min_lat, max_lon, max_lat, options);
+}
+
+// Objects stored before envelopes existed have none until backfill-envelopes
+// runs. They are read by a second query after the envelope-indexed one, so
+// that one stays a pure range predicate on envelope_idx. The limit spans both
+// queries; skip applies to the first only.
+std::unique_ptr<CASCursor> CAS::open_bbox(
+    const std::string& geo_operator,
+    double min_lon, double min_lat, double max_lon, double max_lat,
+    const CASQueryOptions& options
+) {
+    auto filter = make_bbox_filter(geo_operator, min_lon, min_lat, max_lon, max_lat);
+    auto cursor = open(filter.view(), options);
+    auto legacy = std::make_shared<bsoncxx::document::value>(make_legacy_bbox_filter(filter.view()));
+    cursor->then([this, legacy, options](size_t visited) -> std::unique_ptr<CASCursor> {
+        CASQueryOptions rest = options;
+        rest.skip = 0;
+        if (options.limit > 0) {
+            if (visited >= static_cast<size_t>(options.limit)) {
+                return nullptr;
+            }
+            rest.limit = options.limit - static_cast<int64_t>(visited);
+        }
+        return open(legacy->view(), rest);
+    });
+    return cursor;
+}
+
+bsoncxx::document::value CAS::make_bbox_filter(
+    const std::string& geo_operator,
+    double min_lon, double min_lat, double max_lon, double max_lat
+) {
+    bsoncxx::builder::basic::document filter_builder;
+    
+    bsoncxx::builder::basic::array ring_array;
+    
+    bsoncxx::builder::basic::array point1;
+    point1.append(min_lon);
+    point1.append(min_lat);
+    ring_array.append(point1);
+    
+    bsoncxx::builder::basic::array point2;
+    point2.append(max_lon);
+    point2.append(min_lat);
+    ring_array.append(point2);
+    
+    bsoncxx::builder::basic::array point3;
+    point3.append(max_lon);
+    point3.append(max_lat);
+    ring_array.append(point3);
+    
+    bsoncxx::builder::basic::array point4;
+    point4.append(min_lon);
+    point4.append(max_lat);
+    ring_array.append(point4);
+    
+    bsoncxx::builder::basic::array point5;
+    point5.append(min_lon);
+    point5.append(min_lat);
+    ring_array.append(point5);
+    
+    bsoncxx::builder::basic::array coords_array;
+    coords_array.append(ring_array);
+    
+    bsoncxx::builder::basic::document geometry_doc;
+    geometry_doc.append(bsoncxx::builder::basic::kvp("type", "Polygon"));
+    geometry_doc.append(bsoncxx::builder::basic::kvp("coordinates", coords_array));
+    
+    bsoncxx::builder::basic::document geo_operator_doc;
+    geo_operator_doc.append(bsoncxx::builder::basic::kvp("$geometry", geometry_doc));
+    
+    bsoncxx::builder::basic::document geometry_filter;
+    geometry_filter.append(bsoncxx::builder::basic::kvp(geo_operator, geo_operator_doc));
+    
+    // Envelope ranges are answered from envelope_idx before the server
+    // evaluates the exact geometry predicate on the survivors.
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+    if (geo_operator == "$geoWithin") {
+        filter_builder.append(kvp("envelope.min_lon", make_document(kvp("$gte", min_lon), kvp("$lte", max_lon))));
+        filter_builder.append(kvp("envelope.min_lat", make_document(kvp("$gte", min_lat), kvp("$lte", max_lat))));
+        filter_builder.append(kvp("envelope.max_lon", make_document(kvp("$gte", min_lon), kvp("$lte", max_lon))));
+        filter_builder.append(kvp("envelope.max_lat", make_document(kvp("$gte", min_lat), kvp("$lte", max_lat))));
+    } else {
+        filter_builder.append(kvp("envelope.min_lon", make_document(kvp("$lte", max_lon))));
+        filter_builder.append(kvp("envelope.min_lat", make_document(kvp("$lte", max_lat))));
+        filter_builder.append(kvp("envelope.max_lon", make_document(kvp("$gte", min_lon))));
+        filter_builder.append(kvp("envelope.max_lat", make_document(kvp("$gte", min_lat))));
+    }
+    
+    filter_builder.append(bsoncxx::builder::basic::kvp("geometry", geometry_filter));
+    
+    return filter_builder.extract();
+}
+
+bsoncxx::document::value CAS::make_legacy_bbox_filter(const bsoncxx::document::view& bbox_filter) {
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_document;
+    return make_document(
+        kvp("envelope.min_lon", make_document(kvp("$exists", false))),
+        kvp("geometry", bbox_filter["geometry"].get_value())
+    );
+}
+
+size_t CAS::for_each_hash(const std::function<bool(const HashId&)>& visit, const CASQueryOptions& options) {
+    CASQueryOptions hash_options = options;
+    hash_options.projection = CASProjection::HashOnly;
+    
+    auto cursor = scan(hash_options);
+    size_t visited = 0;
+    while (cursor->next()) {
+        HashId hash;
+        if (!cursor->current_hash(hash)) {
+            continue;
+        }
+        ++visited;
+        if (!visit(hash)) {
+            break;
+        }
+    }
+    return visited;
+}
+
+size_t CAS::for_each_by_geometry_type(
+    GeometryType type,
+    const std::function<bool(const bsoncxx::document::view&)>& visit,
+    const CASQueryOptions& options
+) {
+    auto cursor = query_by_geometry_type(type, options);
+    return visit_all(*cursor, visit);
+}
+
+size_t CAS::for_each_in_bbox(
+    double min_lon, double min_lat, double max_lon, double max_lat,
+    const std::function<bool(const bsoncxx::document::view&)>& visit,
+    const CASQueryOptions& options
+) {
+    auto cursor = query_in_bbox(min_lon, min_lat, max_lon, max_lat, options);
+    return visit_all(*cursor, visit);
+}
+
+// Visits each stored object among hashes once, in no particular order.
+// Lookups go straight to the collection in kLookupChunkSize batches.
+size_t CAS::for_each_of(
+    const std::vector<HashId>& hashes,
+    const std::function<bool(const bsoncxx::document::view&)>& visit
+) {
+    std::vector<HashId> unique_hashes(hashes);
+    std::sort(unique_hashes.begin(), unique_hashes.end());
+    unique_hashes.erase(std::unique(unique_hashes.begin(), unique_hashes.end()), unique_hashes.end());
+
+    size_t visited = 0;
+    bool stopped = false;
+    lookup_chunks(unique_hashes, false, [&](size_t, const bsoncxx::document::view& doc) {
+        if (stopped) {
+            return;
+        }
+        ++visited;
+        stopped = !visit(doc);
+    });
+    return visited;
+}
+
+size_t CAS::visit_all(CASCursor& cursor, const std::function<bool(const bsoncxx::document::view&)>& visit) {
+    while (cursor.next()) {
+        if (!visit(cursor.current())) {
+            break;
+        }
+    }
+    return cursor.count();
+}
+
+std::unique_ptr<CASCursor> CAS::open(const bsoncxx::document::view& filter, const CASQueryOptions& options) {
+    try {
+        auto collection = lease_collection();
+        auto cursor = collection->find(filter, make_find_options(options));
+        return std::make_unique<CASCursor>(std::move(cursor), std::move(collection.lease), this);
+    } catch (const std::exception& e) {
+        std::cerr << "Error querying CAS: " << e.what() << std::endl;
+        return std::make_unique<CASCursor>();
+    }
+}
+
+mongocxx::options::find CAS::make_find_options(const CASQueryOptions& options) const {
+    mongocxx::options::find opts;
+    
+    if (options.batch_size > 0) {
+        opts.batch_size(options.batch_size);
+    }
+    if (options.limit > 0) {
+        opts.limit(options.limit);
+    }
+    if (options.skip > 0) {
+        opts.skip(options.skip);
+    }
+    
+    bsoncxx::builder::stream::document projection;
+    switch (options.projection) {
+        case CASProjection::HashOnly:
+            projection << "hash" << 1 << "_id" << 0;
+            opts.projection(projection << bsoncxx::builder::stream::finalize);
+            break;
+        case CASProjection::GeometryOnly:
+            projection << "hash" << 1 << "geometry" << 1
+                       << CoordinateCodec::kBlobField << 1 << CoordinateCodec::kEncodingField << 1
+                       << kGeometryHashField << 1 << "_id" << 0;
+            opts.projection(projection << bsoncxx::builder::stream::finalize);
+            break;
+        case CASProjection::Full:
+            break;
+    }
+    
+    return opts;
 }
 
 }
@@ -1,45 +1,305 @@
 #pragma once
 
+#include "storage/hash_id/hash_id.h"
+#include "storage/coordinate_codec/coordinate_codec.h"
+#include "storage/geometry_cas/geometry_cas.h"
+#include "storage/mongodb_connection/mongodb_connection.h"
 #include <mongocxx/collection.hpp>
+#include <mongocxx/cursor.hpp>
+#include <mongocxx/options/find.hpp>
 #include <bsoncxx/document/view.hpp>
 #include <bsoncxx/document/value.hpp>
+#include <bsoncxx/types/bson_value/view.hpp>
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <optional>
 #include <string>
 #include <memory>
+#include <utility>
 #include <vector>
 
 namespace geoversion {
 namespace storage {
 
 class BPO;
+class CAS;
+class ObjectCache;
+class ExistenceFilter;
+class SpatialIndex;
+struct Envelope;
+struct GeometryExtent;
 
 enum class GeometryType;
 
+enum class HashMode {
+    Canonical,
+    LegacyJson
+};
+
+enum class StoreStatus {
+    Inserted,
+    Duplicate,
+    Failed
+};
+
+struct StoreManyStats {
+    size_t total = 0;
+    size_t inserted = 0;
+    size_t duplicates = 0;
+    size_t failed = 0;
+    size_t round_trips = 0;
+    std::chrono::milliseconds elapsed{0};
+
+    StoreManyStats& operator+=(const StoreManyStats& other);
+};
+
+enum class CASProjection {
+    Full,
+    HashOnly,
+    GeometryOnly
+};
+
+struct CASQueryOptions {
+    int32_t batch_size = 0;
+    CASProjection projection = CASProjection::Full;
+    int64_t limit = 0;
+    int64_t skip = 0;
+};
+
+// Forward-only view over a CAS query. current() borrows the driver's batch
+// buffer and stays valid only until the next call to next(). A cursor opened
+// through a pooled CAS keeps its client leased until it is exhausted.
+class CASCursor {
+public:
+    CASCursor();
+    explicit CASCursor(
+        mongocxx::cursor&& cursor,
+        std::optional<ClientLease> lease = std::nullopt,
+        CAS* cas = nullptr
+    );
+
+    CASCursor(const CASCursor&) = delete;
+    CASCursor& operator=(const CASCursor&) = delete;
+
+    bool next();
+    bsoncxx::document::view current() const;
+    bool current_hash(HashId& hash) const;
+    // Borrows the current document: valid only until the next call to next().
+    // A document referencing the geometry CAS is reassembled into an owned BPO.
+    BPO current_bpo() const;
+    bool current_geometry(bsoncxx::document::view& geometry, std::optional<bsoncxx::document::value>& decoded) const;
+    size_t count() const;
+
+    // Once this cursor is exhausted, continues with the cursor returned by
+    // next_query, which is given the number of documents visited so far.
+    void then(std::function<std::unique_ptr<CASCursor>(size_t visited)> next_query);
+
+private:
+    CAS* cas_;
+    std::optional<ClientLease> lease_;
+    std::optional<mongocxx::cursor> cursor_;
+    std::optional<mongocxx::cursor::iterator> it_;
+    bsoncxx::document::view current_;
+    size_t count_;
+    std::function<std::unique_ptr<CASCursor>(size_t)> then_;
+    std::unique_ptr<CASCursor> rest_;
+};
+
+struct StoreManyResult {
+    std::vector<HashId> hashes;
+    std::vector<StoreStatus> statuses;
+    StoreManyStats stats;
+};
+
 class CAS {
 public:
-    explicit CAS(mongocxx::collection collection);
+    explicit CAS(mongocxx::collection collection, HashMode hash_mode = HashMode::Canonical);
+    explicit CAS(MongoDBConnection& connection, HashMode hash_mode = HashMode::Canonical);
+
+    HashId compute_hash(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
+    HashId compute_hash(const BPO& bpo);
+    HashId compute_canonical_hash(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
+    HashId compute_legacy_hash(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
+    static HashId compute_attributes_hash(const bsoncxx::document::view& attributes);
+
+    HashMode get_hash_mode() const;
+
+    void set_cache(std::shared_ptr<ObjectCache> cache);
+    std::shared_ptr<ObjectCache> get_cache() const;
+
+    void set_existence_filter(std::shared_ptr<ExistenceFilter> filter);
+    std::shared_ptr<ExistenceFilter> get_existence_filter() const;
 
-    std::string compute_hash(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
-    std::string compute_hash(const BPO& bpo);
+    void set_spatial_index(std::shared_ptr<SpatialIndex> index);
+    std::shared_ptr<SpatialIndex> get_spatial_index() const;
+
+    // With precision enabled, geometries are snapped to the grid before
+    // hashing and storing. Set before the CAS is shared between threads.
+    void set_precision(const PrecisionOptions& options);
+    const PrecisionOptions& get_precision() const;
+
+    // With a geometry CAS set, new objects keep their geometry there under
+    // its own hash and reference it, so objects differing only in attributes
+    // share one copy. BPO hashes are unchanged. Only geometries of at least
+    // split_min_bytes move; GeometryCAS::kChunkThreshold limits it to those
+    // that need chunking. Set before sharing the CAS.
+    void set_geometry_cas(std::shared_ptr<GeometryCAS> geometry_cas, size_t split_min_bytes = 0);
+    std::shared_ptr<GeometryCAS> get_geometry_cas() const;
+
+    // A store that finds its object refreshes kLastStoredField only when
+    // it is older than this, so most deduplicated stores stay reads. The
+    // garbage collector's grace period must be well above it. Set before
+    // sharing the CAS.
+    void set_touch_interval(std::chrono::seconds interval);
+    std::chrono::seconds get_touch_interval() const;
+    // Refreshes kLastStoredField of the stored objects among hashes, as a
+    // deduplicated store of each would.
+    bool touch_many(const std::vector<HashId>& hashes);
+
+    // Documents handed to visitors are stored documents; these reassemble
+    // the ones whose geometry is a reference. resolve() leaves `resolved`
+    // empty for documents that need nothing and fails on dangling references.
+    bool resolve(const bsoncxx::document::view& doc, std::optional<bsoncxx::document::value>& resolved);
+    bool read_geometry(
+        const bsoncxx::document::view& doc,
+        bsoncxx::document::view& geometry,
+        std::optional<bsoncxx::document::value>& decoded
+    );
     
     bool store(const BPO& bpo);
-    bool store(const std::string& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
+    bool store(const HashId& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
+
+    StoreManyResult store_many(const std::vector<BPO>& bpos);
+    StoreManyResult store_many(const BPO* bpos, size_t count);
+    StoreManyResult store_many(const BPO* bpos, const HashId* hashes, size_t count);
+    StoreManyStats store_stream(
+        const std::function<bool(BPO&)>& next,
+        size_t batch_size = kDefaultBatchSize,
+        const std::function<void(const StoreManyResult&)>& on_batch = nullptr
+    );
     
-    std::unique_ptr<BPO> retrieve(const std::string& hash);
-    bool exists(const std::string& hash);
+    std::unique_ptr<BPO> retrieve(const HashId& hash);
+    std::shared_ptr<const BPO> retrieve_shared(const HashId& hash);
+    bool exists(const HashId& hash);
+
+    std::vector<std::unique_ptr<BPO>> retrieve_many(const std::vector<HashId>& hashes);
+    std::vector<std::shared_ptr<const BPO>> retrieve_many_shared(const std::vector<HashId>& hashes);
+    std::vector<bool> exists_many(const std::vector<HashId>& hashes);
     
-    bool remove(const std::string& hash);
+    bool remove(const HashId& hash);
+    // Drops hashes deleted from the collection directly, e.g. by the
+    // garbage collector, from the cache, existence filter and spatial index.
+    void forget(const std::vector<HashId>& hashes);
     
-    std::vector<std::string> get_all_hashes();
+    std::vector<HashId> get_all_hashes();
     
     size_t count();
     
     std::vector<std::unique_ptr<BPO>> find_by_geometry_type(GeometryType type);
     std::vector<std::unique_ptr<BPO>> find_in_bbox(double min_lon, double min_lat, double max_lon, double max_lat);
+    std::vector<std::unique_ptr<BPO>> find_intersecting_bbox(double min_lon, double min_lat, double max_lon, double max_lat);
+
+    std::unique_ptr<CASCursor> scan(const CASQueryOptions& options = CASQueryOptions());
+    std::unique_ptr<CASCursor> query_by_geometry_type(GeometryType type, const CASQueryOptions& options = CASQueryOptions());
+    std::unique_ptr<CASCursor> query_in_bbox(
+        double min_lon, double min_lat, double max_lon, double max_lat,
+        const CASQueryOptions& options = CASQueryOptions()
+    );
+
+    size_t for_each_hash(const std::function<bool(const HashId&)>& visit, const CASQueryOptions& options = CASQueryOptions());
+    size_t for_each_by_geometry_type(
+        GeometryType type,
+        const std::function<bool(const bsoncxx::document::view&)>& visit,
+        const CASQueryOptions& options = CASQueryOptions()
+    );
+    size_t for_each_in_bbox(
+        double min_lon, double min_lat, double max_lon, double max_lat,
+        const std::function<bool(const bsoncxx::document::view&)>& visit,
+        const CASQueryOptions& options = CASQueryOptions()
+    );
+    size_t for_each_of(
+        const std::vector<HashId>& hashes,
+        const std::function<bool(const bsoncxx::document::view&)>& visit
+    );
+
+    static constexpr size_t kDefaultBatchSize = 1000;
+    static constexpr size_t kLookupChunkSize = 500;
+    static constexpr size_t kMaxParallelLookups = 4;
+    static constexpr const char* kCollectionName = "bpo_cas";
+    // Refreshed by stores of an object, including deduplicated ones, at
+    // most once per touch interval.
+    static constexpr const char* kLastStoredField = "last_stored_at";
+    static constexpr std::chrono::seconds kDefaultTouchInterval{30 * 60};
 
 private:
+    struct CollectionLease {
+        std::optional<ClientLease> lease;
+        mongocxx::collection collection;
+
+        mongocxx::collection* operator->() { return &collection; }
+    };
+
+    MongoDBConnection* connection_;
     mongocxx::collection collection_;
+    HashMode hash_mode_;
+    std::shared_ptr<ObjectCache> cache_;
+    std::shared_ptr<ExistenceFilter> existence_filter_;
+    std::shared_ptr<SpatialIndex> spatial_index_;
+    PrecisionOptions precision_;
+    CoordinateCodec codec_;
+    std::shared_ptr<GeometryCAS> geometry_cas_;
+    size_t split_min_bytes_;
+    std::chrono::seconds touch_interval_;
+
+    // Reference documents held back, with their result slot, until their
+    // geometries are fetched in one batch.
+    using PendingReferences = std::vector<std::pair<size_t, bsoncxx::document::value>>;
+
+    HashId hash_by_mode(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
+    bsoncxx::document::value make_document(
+        const HashId& hash,
+        const bsoncxx::document::view& geometry,
+        const bsoncxx::document::view& attributes,
+        GeometryExtent& extent,
+        std::optional<GeometryRecord>& geometry_record
+    ) const;
+    GeometryCAS::Handle geometry_of(const bsoncxx::document::view& doc);
+    void resolve_references(
+        PendingReferences& references,
+        const std::function<void(size_t index, const bsoncxx::document::view& doc)>& on_resolved
+    );
+    void append_result(const bsoncxx::document::view& doc, std::vector<std::unique_ptr<BPO>>& results, PendingReferences& references);
+    void finish_results(std::vector<std::unique_ptr<BPO>>& results, PendingReferences& references);
+    std::unique_ptr<BPO> fetch(const HashId& hash);
+    CollectionLease lease_collection();
+    bool definitely_missing(const HashId& hash) const;
+    bool touch(const HashId& hash);
+    bool is_fresh(const bsoncxx::document::view& doc) const;
+    bsoncxx::document::value make_stale_filter(const bsoncxx::types::bson_value::view& hash_match) const;
+    void index_envelope(const HashId& hash, const Envelope& envelope);
+    void store_chunk(const BPO* bpos, size_t begin, size_t end, StoreManyResult& result);
+    void lookup_chunks(
+        const std::vector<HashId>& hashes,
+        bool hash_only,
+        const std::function<void(size_t index, const bsoncxx::document::view& doc)>& on_found
+    );
+    
+    std::unique_ptr<CASCursor> open(const bsoncxx::document::view& filter, const CASQueryOptions& options);
+    std::unique_ptr<CASCursor> open_bbox(
+        const std::string& geo_operator,
+        double min_lon, double min_lat, double max_lon, double max_lat,
+        const CASQueryOptions& options
+    );
+    mongocxx::options::find make_find_options(const CASQueryOptions& options) const;
+    static bsoncxx::document::value make_bbox_filter(
+        const std::string& geo_operator,
+        double min_lon, double min_lat, double max_lon, double max_lat
+    );
+    static bsoncxx::document::value make_legacy_bbox_filter(const bsoncxx::document::view& bbox_filter);
+    static size_t visit_all(CASCursor& cursor, const std::function<bool(const bsoncxx::document::view&)>& visit);
     
-    std::string sha256_hash(const std::string& data);
+    HashId sha256_hash(const std::string& data);
     std::string serialize_for_hashing(const bsoncxx::document::view& geometry, const bsoncxx::document::view& attributes);
 };
 
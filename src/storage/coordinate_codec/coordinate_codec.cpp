@@ -0,0 +1,493 @@
+#include "coordinate_codec.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include <bsoncxx/types.hpp>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <string>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+// Keeps fixed-point values and their deltas well inside int64.
+constexpr double kMaxFixed = 4.0e18;
+
+void put_varint(std::vector<uint8_t>& blob, uint64_t value) {
+    while (value >= 0x80) {
+        blob.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    blob.push_back(static_cast<uint8_t>(value));
+}
+
+void put_zigzag(std::vector<uint8_t>& blob, int64_t value) {
+    put_varint(blob, (static_cast<uint64_t>(value) << 1) ^ static_cast<uint64_t>(value >> 63));
+}
+
+bool read_number(const bsoncxx::types::bson_value::view& element, double& value) {
+    switch (element.type()) {
+        case bsoncxx::type::k_double:
+            value = element.get_double().value;
+            return true;
+        case bsoncxx::type::k_int32:
+            value = element.get_int32().value;
+            return true;
+        case bsoncxx::type::k_int64:
+            value = static_cast<double>(element.get_int64().value);
+            return true;
+        default:
+            return false;
+    }
+}
+
+size_t array_size(const bsoncxx::array::view& array) {
+    return static_cast<size_t>(std::distance(array.begin(), array.end()));
+}
+
+// Type tags in the blob are GeometryType values; the nesting below the
+// tag is implied by the type, as in GeoJSON itself.
+enum class Nesting {
+    Position,
+    Positions,
+    Lines,
+    Polygons
+};
+
+Nesting nesting_of(GeometryType type) {
+    switch (type) {
+        case GeometryType::Point:
+            return Nesting::Position;
+        case GeometryType::MultiPoint:
+        case GeometryType::LineString:
+            return Nesting::Positions;
+        case GeometryType::MultiLineString:
+        case GeometryType::Polygon:
+            return Nesting::Lines;
+        default:
+            return Nesting::Polygons;
+    }
+}
+
+class BlobReader {
+public:
+    BlobReader(const uint8_t* data, size_t size) : pos_(data), end_(data + size) {}
+
+    bool byte(uint8_t& value) {
+        if (pos_ == end_) {
+            return false;
+        }
+        value = *pos_++;
+        return true;
+    }
+
+    bool bytes(void* out, size_t count) {
+        if (static_cast<size_t>(end_ - pos_) < count) {
+            return false;
+        }
+        std::memcpy(out, pos_, count);
+        pos_ += count;
+        return true;
+    }
+
+    bool varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t next = 0;
+            if (!byte(next)) {
+                return false;
+            }
+            value |= static_cast<uint64_t>(next & 0x7F) << shift;
+            if ((next & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool zigzag(int64_t& value) {
+        uint64_t raw = 0;
+        if (!varint(raw)) {
+            return false;
+        }
+        value = static_cast<int64_t>((raw >> 1) ^ (~(raw & 1) + 1));
+        return true;
+    }
+
+    // Every encoded element takes at least one byte, so a count larger
+    // than what is left can only come from a corrupt blob.
+    bool count(uint64_t& value) {
+        return varint(value) && value <= static_cast<uint64_t>(end_ - pos_);
+    }
+
+    bool done() const {
+        return pos_ == end_;
+    }
+
+private:
+    const uint8_t* pos_;
+    const uint8_t* end_;
+};
+
+class BlobDecoder {
+public:
+    BlobDecoder(BlobReader& reader, double scale) : reader_(reader), scale_(scale) {}
+
+    bool geometry(bsoncxx::builder::core& builder, size_t depth) {
+        uint8_t tag = 0;
+        if (!reader_.byte(tag) || tag >= static_cast<uint8_t>(GeometryType::Unknown)) {
+            return false;
+        }
+        GeometryType type = static_cast<GeometryType>(tag);
+        builder.key_view("type");
+        builder.append(GeoJSONValidator::type_name(type));
+
+        if (type == GeometryType::GeometryCollection) {
+            uint64_t count = 0;
+            if (depth == 0 || !reader_.count(count)) {
+                return false;
+            }
+            builder.key_view("geometries");
+            builder.open_array();
+            for (uint64_t i = 0; i < count; ++i) {
+                builder.open_document();
+                if (!geometry(builder, depth - 1)) {
+                    return false;
+                }
+                builder.close_document();
+            }
+            builder.close_array();
+            return true;
+        }
+
+        builder.key_view("coordinates");
+        switch (nesting_of(type)) {
+            case Nesting::Position:
+                return position(builder);
+            case Nesting::Positions:
+                return positions(builder);
+            case Nesting::Lines:
+                return lines(builder);
+            case Nesting::Polygons:
+                return polygons(builder);
+        }
+        return false;
+    }
+
+private:
+    BlobReader& reader_;
+    double scale_;
+    int64_t last_[2] = {0, 0};
+
+    bool position(bsoncxx::builder::core& builder) {
+        int64_t dx = 0;
+        int64_t dy = 0;
+        if (!reader_.zigzag(dx) || !reader_.zigzag(dy)) {
+            return false;
+        }
+        // Wrapping arithmetic: a corrupt blob must not overflow a signed value.
+        last_[0] = static_cast<int64_t>(static_cast<uint64_t>(last_[0]) + static_cast<uint64_t>(dx));
+        last_[1] = static_cast<int64_t>(static_cast<uint64_t>(last_[1]) + static_cast<uint64_t>(dy));
+        builder.open_array();
+        builder.append(static_cast<double>(last_[0]) / scale_);
+        builder.append(static_cast<double>(last_[1]) / scale_);
+        builder.close_array();
+        return true;
+    }
+
+    template <typename Member>
+    bool members(bsoncxx::builder::core& builder, Member member) {
+        uint64_t count = 0;
+        if (!reader_.count(count)) {
+            return false;
+        }
+        builder.open_array();
+        for (uint64_t i = 0; i < count; ++i) {
+            if (!(this->*member)(builder)) {
+                return false;
+            }
+        }
+        builder.close_array();
+        return true;
+    }
+
+    bool positions(bsoncxx::builder::core& builder) {
+        return members(builder, &BlobDecoder::position);
+    }
+
+    bool lines(bsoncxx::builder::core& builder) {
+        return members(builder, &BlobDecoder::positions);
+    }
+
+    bool polygons(bsoncxx::builder::core& builder) {
+        return members(builder, &BlobDecoder::lines);
+    }
+};
+
+}
+
+CoordinateCodec::CoordinateCodec(double grid) {
+    // 1 / 1e-7 is not exactly 1e7 in binary; snapping the scale to the
+    // nearest integer keeps decimal grids exact (q / 1e7 rounds correctly).
+    double scale = 1.0 / grid;
+    double rounded = std::round(scale);
+    scale_ = std::fabs(scale - rounded) < 1e-6 * scale ? rounded : scale;
+}
+
+double CoordinateCodec::grid() const {
+    return 1.0 / scale_;
+}
+
+int64_t CoordinateCodec::to_fixed(double value) const {
+    return std::llround(value * scale_);
+}
+
+double CoordinateCodec::from_fixed(int64_t value) const {
+    return static_cast<double>(value) / scale_;
+}
+
+bool CoordinateCodec::quantize(
+    const bsoncxx::document::view& geometry,
+    bsoncxx::document::value& out,
+    std::vector<uint8_t>* blob
+) const {
+    if (blob) {
+        begin_blob(*blob);
+    }
+    bsoncxx::builder::core builder(false);
+    int64_t last[2] = {0, 0};
+    if (!walk(geometry, &builder, blob, last, kMaxDepth)) {
+        if (blob) {
+            blob->clear();
+        }
+        return false;
+    }
+    out = builder.extract_document();
+    return true;
+}
+
+bool CoordinateCodec::encode(const bsoncxx::document::view& geometry, std::vector<uint8_t>& blob) const {
+    begin_blob(blob);
+    int64_t last[2] = {0, 0};
+    if (!walk(geometry, nullptr, &blob, last, kMaxDepth)) {
+        blob.clear();
+        return false;
+    }
+    return true;
+}
+
+bool CoordinateCodec::decode(const uint8_t* data, size_t size, bsoncxx::document::value& geometry) {
+    BlobReader reader(data, size);
+    uint8_t version = 0;
+    double scale = 0.0;
+    if (!reader.byte(version) || version != kVersion ||
+        !reader.bytes(&scale, sizeof(double)) || !std::isfinite(scale) || scale <= 0.0) {
+        return false;
+    }
+
+    bsoncxx::builder::core builder(false);
+    BlobDecoder decoder(reader, scale);
+    if (!decoder.geometry(builder, kMaxDepth) || !reader.done()) {
+        return false;
+    }
+    geometry = builder.extract_document();
+    return true;
+}
+
+void CoordinateCodec::begin_blob(std::vector<uint8_t>& blob) const {
+    uint8_t scale[sizeof(double)];
+    std::memcpy(scale, &scale_, sizeof(double));
+    blob.clear();
+    blob.push_back(kVersion);
+    blob.insert(blob.end(), scale, scale + sizeof(double));
+}
+
+// One pass serves both outputs: the canonical snapped GeoJSON (builder)
+// and the blob. last carries the previous position for delta coding.
+bool CoordinateCodec::walk(
+    const bsoncxx::document::view& geometry,
+    bsoncxx::builder::core* builder,
+    std::vector<uint8_t>* blob,
+    int64_t* last,
+    size_t depth
+) const {
+    GeometryType type = GeoJSONValidator::get_type(geometry);
+    if (type == GeometryType::Unknown) {
+        return false;
+    }
+    if (blob) {
+        blob->push_back(static_cast<uint8_t>(type));
+    }
+    if (builder) {
+        builder->key_view("type");
+        builder->append(GeoJSONValidator::type_name(type));
+    }
+
+    if (type == GeometryType::GeometryCollection) {
+        auto geometries = geometry["geometries"];
+        if (depth == 0 || !geometries || geometries.type() != bsoncxx::type::k_array) {
+            return false;
+        }
+        auto members = geometries.get_array().value;
+        if (blob) {
+            put_varint(*blob, array_size(members));
+        }
+        if (builder) {
+            builder->key_view("geometries");
+            builder->open_array();
+        }
+        for (auto&& member : members) {
+            if (member.type() != bsoncxx::type::k_document) {
+                return false;
+            }
+            if (builder) {
+                builder->open_document();
+            }
+            if (!walk(member.get_document().value, builder, blob, last, depth - 1)) {
+                return false;
+            }
+            if (builder) {
+                builder->close_document();
+            }
+        }
+        if (builder) {
+            builder->close_array();
+        }
+        return true;
+    }
+
+    auto coordinates = geometry["coordinates"];
+    if (!coordinates || coordinates.type() != bsoncxx::type::k_array) {
+        return false;
+    }
+    if (builder) {
+        builder->key_view("coordinates");
+    }
+
+    // levels: how many array layers sit above the positions.
+    size_t levels = static_cast<size_t>(nesting_of(type));
+    auto emit = [&](auto&& self, const bsoncxx::array::view& array, size_t level) -> bool {
+        if (level == 0) {
+            double value[2];
+            size_t count = 0;
+            for (auto&& element : array) {
+                if (count == 2 || !read_number(element.get_value(), value[count])) {
+                    return false;
+                }
+                ++count;
+            }
+            if (count != 2) {
+                return false;
+            }
+            int64_t fixed[2];
+            for (size_t i = 0; i < 2; ++i) {
+                double scaled = value[i] * scale_;
+                if (!std::isfinite(scaled) || std::fabs(scaled) > kMaxFixed) {
+                    return false;
+                }
+                fixed[i] = std::llround(scaled);
+            }
+            if (blob) {
+                put_zigzag(*blob, fixed[0] - last[0]);
+                put_zigzag(*blob, fixed[1] - last[1]);
+            }
+            last[0] = fixed[0];
+            last[1] = fixed[1];
+            if (builder) {
+                builder->open_array();
+                builder->append(from_fixed(fixed[0]));
+                builder->append(from_fixed(fixed[1]));
+                builder->close_array();
+            }
+            return true;
+        }
+
+        if (blob) {
+            put_varint(*blob, array_size(array));
+        }
+        if (builder) {
+            builder->open_array();
+        }
+        for (auto&& member : array) {
+            if (member.type() != bsoncxx::type::k_array || !self(self, member.get_array().value, level - 1)) {
+                return false;
+            }
+        }
+        if (builder) {
+            builder->close_array();
+        }
+        return true;
+    };
+    return emit(emit, coordinates.get_array().value, levels);
+}
+
+bool read_stored_geometry(
+    const bsoncxx::document::view& doc,
+    bsoncxx::document::view& geometry,
+    std::optional<bsoncxx::document::value>& decoded
+) {
+    auto encoding = doc[CoordinateCodec::kEncodingField];
+    if (encoding && encoding.type() == bsoncxx::type::k_string &&
+        std::string(encoding.get_string().value) == CoordinateCodec::kBlobEncoding) {
+        auto blob = doc[CoordinateCodec::kBlobField];
+        if (!blob || blob.type() != bsoncxx::type::k_binary) {
+            return false;
+        }
+        bsoncxx::document::value value{bsoncxx::document::view()};
+        auto binary = blob.get_binary();
+        if (!CoordinateCodec::decode(binary.bytes, binary.size, value)) {
+            return false;
+        }
+        decoded.emplace(std::move(value));
+        geometry = decoded->view();
+        return true;
+    }
+
+    auto element = doc["geometry"];
+    if (!element || element.type() != bsoncxx::type::k_document) {
+        return false;
+    }
+    geometry = element.get_document().value;
+    return true;
+}
+
+bsoncxx::document::value envelope_geometry(double min_x, double min_y, double max_x, double max_y) {
+    bsoncxx::builder::core builder(false);
+    auto position = [&](double x, double y) {
+        builder.open_array();
+        builder.append(x);
+        builder.append(y);
+        builder.close_array();
+    };
+
+    builder.key_view("type");
+    if (min_x == max_x && min_y == max_y) {
+        builder.append(GeoJSONValidator::type_name(GeometryType::Point));
+        builder.key_view("coordinates");
+        position(min_x, min_y);
+    } else if (min_x == max_x || min_y == max_y) {
+        builder.append(GeoJSONValidator::type_name(GeometryType::LineString));
+        builder.key_view("coordinates");
+        builder.open_array();
+        position(min_x, min_y);
+        position(max_x, max_y);
+        builder.close_array();
+    } else {
+        builder.append(GeoJSONValidator::type_name(GeometryType::Polygon));
+        builder.key_view("coordinates");
+        builder.open_array();
+        builder.open_array();
+        position(min_x, min_y);
+        position(max_x, min_y);
+        position(max_x, max_y);
+        position(min_x, max_y);
+        position(min_x, min_y);
+        builder.close_array();
+        builder.close_array();
+    }
+    return builder.extract_document();
+}
+
+}
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <bsoncxx/builder/core.hpp>
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+enum class GeometryEncoding {
+    // Quantized GeoJSON only.
+    GeoJSON,
+    // Quantized GeoJSON plus the compact blob.
+    GeoJSONAndBlob,
+    // Blob only; `geometry` holds a simplified envelope for the 2dsphere index.
+    Blob
+};
+
+struct PrecisionOptions {
+    bool enabled = false;
+    double grid = 1e-7;
+    GeometryEncoding encoding = GeometryEncoding::GeoJSON;
+};
+
+// Fixed-point coordinate codec. quantize() snaps every position to the grid
+// and rebuilds the geometry in its canonical GeoJSON form, so geometries
+// that differ only by noise below the grid hash the same. encode() writes
+// the same snapped geometry as a blob: type tags and counts as varints,
+// positions as zigzag varint deltas from the previous position.
+// Only 2D positions are handled; anything else is left to the caller.
+class CoordinateCodec {
+public:
+    explicit CoordinateCodec(double grid = 1e-7);
+
+    double grid() const;
+    int64_t to_fixed(double value) const;
+    double from_fixed(int64_t value) const;
+
+    // blob, when given, receives encode() of the same geometry in the same pass.
+    bool quantize(
+        const bsoncxx::document::view& geometry,
+        bsoncxx::document::value& out,
+        std::vector<uint8_t>* blob = nullptr
+    ) const;
+    bool encode(const bsoncxx::document::view& geometry, std::vector<uint8_t>& blob) const;
+    static bool decode(const uint8_t* data, size_t size, bsoncxx::document::value& geometry);
+
+    static constexpr uint8_t kVersion = 1;
+    static constexpr size_t kMaxDepth = 16;
+    static constexpr const char* kBlobField = "geometry_q";
+    static constexpr const char* kEncodingField = "geometry_encoding";
+    static constexpr const char* kBlobEncoding = "q1";
+
+private:
+    double scale_;
+
+    void begin_blob(std::vector<uint8_t>& blob) const;
+
+    bool walk(
+        const bsoncxx::document::view& geometry,
+        bsoncxx::builder::core* builder,
+        std::vector<uint8_t>* blob,
+        int64_t* last,
+        size_t depth
+    ) const;
+};
+
+// Geometry of a stored bpo_cas document. Documents written with
+// GeometryEncoding::Blob carry only an envelope in `geometry`; for those
+// the blob is decoded into `decoded` and `geometry` points at it.
+bool read_stored_geometry(
+    const bsoncxx::document::view& doc,
+    bsoncxx::document::view& geometry,
+    std::optional<bsoncxx::document::value>& decoded
+);
+
+// Point, segment or rectangle covering the envelope, whichever is not
+// degenerate, for the 2dsphere index of blob-encoded documents.
+bsoncxx::document::value envelope_geometry(double min_x, double min_y, double max_x, double max_y);
+
+}
+}
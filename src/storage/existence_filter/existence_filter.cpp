@@ -0,0 +1,422 @@
+#include "existence_filter.h"
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include <bsoncxx/builder/stream/document.hpp>
+#include <bsoncxx/types.hpp>
+#include <mongocxx/options/find.hpp>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr size_t kBlockWords = 8;
+constexpr uint64_t kBlockBitMask = kBlockWords * 64 - 1;
+constexpr uint32_t kMaxHashCount = 16;
+
+constexpr char kFileMagic[8] = {'G', 'V', 'E', 'X', 'F', 'L', 'T', '1'};
+
+// created_at is stamped by the writing client, so allow for clock skew
+// between application hosts when catching up after a load.
+constexpr std::chrono::minutes kCatchUpSkew{5};
+
+uint64_t read_u64(const HashId& hash, size_t offset) {
+    uint64_t value = 0;
+    std::memcpy(&value, hash.data() + offset, sizeof(value));
+    return value;
+}
+
+struct FileHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t hash_count;
+    uint64_t block_count;
+    uint64_t items;
+    int64_t saved_at_ms;
+};
+
+}
+
+ExistenceFilter::Bits::Bits(size_t block_count, uint32_t hash_count)
+    : block_count(block_count),
+      hash_count(hash_count),
+      words(new std::atomic<uint64_t>[block_count * kBlockWords]),
+      items(0) {
+    for (size_t i = 0; i < block_count * kBlockWords; ++i) {
+        words[i].store(0, std::memory_order_relaxed);
+    }
+}
+
+// Block chosen by the first 8 bytes, bits inside it by double hashing over
+// the next 16; SHA-256 output is uniform, so no further mixing is needed.
+bool ExistenceFilter::Bits::add(const HashId& hash) {
+    std::atomic<uint64_t>* block = &words[(hash.prefix() % block_count) * kBlockWords];
+    uint64_t h1 = read_u64(hash, 8);
+    uint64_t h2 = read_u64(hash, 16) | 1;
+
+    bool changed = false;
+    for (uint32_t i = 0; i < hash_count; ++i) {
+        uint64_t bit = (h1 + i * h2) & kBlockBitMask;
+        uint64_t mask = uint64_t(1) << (bit & 63);
+        uint64_t previous = block[bit >> 6].fetch_or(mask, std::memory_order_relaxed);
+        changed |= (previous & mask) == 0;
+    }
+    if (changed) {
+        items.fetch_add(1, std::memory_order_relaxed);
+    }
+    return changed;
+}
+
+bool ExistenceFilter::Bits::test(const HashId& hash) const {
+    const std::atomic<uint64_t>* block = &words[(hash.prefix() % block_count) * kBlockWords];
+    uint64_t h1 = read_u64(hash, 8);
+    uint64_t h2 = read_u64(hash, 16) | 1;
+
+    for (uint32_t i = 0; i < hash_count; ++i) {
+        uint64_t bit = (h1 + i * h2) & kBlockBitMask;
+        if ((block[bit >> 6].load(std::memory_order_relaxed) & (uint64_t(1) << (bit & 63))) == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t ExistenceFilter::Bits::memory_usage() const {
+    return block_count * kBlockWords * sizeof(uint64_t);
+}
+
+ExistenceFilter::ExistenceFilter(const ExistenceFilterOptions& options)
+    : options_(options),
+      ready_(false),
+      stopping_(false),
+      removed_(0),
+      definite_negatives_(0),
+      possible_positives_(0),
+      build_time_ms_(0),
+      running_(false) {
+    double rate = std::min(std::max(options_.target_false_positive_rate, 1e-6), 0.5);
+    double bits_per_item = -std::log(rate) / (std::log(2.0) * std::log(2.0));
+    double total_bits = bits_per_item * static_cast<double>(std::max<size_t>(1, options_.expected_items));
+
+    block_count_ = std::max<size_t>(1, static_cast<size_t>(std::ceil(total_bits / (kBlockWords * 64))));
+    hash_count_ = static_cast<uint32_t>(std::lround(bits_per_item * std::log(2.0)));
+    hash_count_ = std::min(std::max<uint32_t>(1, hash_count_), kMaxHashCount);
+
+    bits_ = std::make_shared<Bits>(block_count_, hash_count_);
+}
+
+ExistenceFilter::~ExistenceFilter() {
+    stopping_ = true;
+    if (worker_.joinable()) {
+        worker_.join();
+    }
+    if (!options_.persist_path.empty() && ready_) {
+        save();
+    }
+}
+
+// The fresh bits are published before building_ is cleared, so reading
+// building_ first means the hash reaches whichever set survives a rebuild.
+void ExistenceFilter::add(const HashId& hash) {
+    if (auto building = std::atomic_load(&building_)) {
+        building->add(hash);
+    }
+    std::atomic_load(&bits_)->add(hash);
+}
+
+void ExistenceFilter::remove(const HashId&) {
+    ++removed_;
+}
+
+bool ExistenceFilter::might_contain(const HashId& hash) {
+    if (!ready_.load(std::memory_order_acquire)) {
+        return true;
+    }
+    if (std::atomic_load(&bits_)->test(hash)) {
+        possible_positives_.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+    definite_negatives_.fetch_add(1, std::memory_order_relaxed);
+    return false;
+}
+
+bool ExistenceFilter::is_ready() const {
+    return ready_.load(std::memory_order_acquire);
+}
+
+bool ExistenceFilter::wait_until_ready() {
+    std::unique_lock<std::mutex> lock(state_mutex_);
+    state_changed_.wait(lock, [this]() { return !running_ || ready_; });
+    return ready_;
+}
+
+bool ExistenceFilter::rebuild(mongocxx::collection collection) {
+    auto start = std::chrono::steady_clock::now();
+
+    auto fresh = std::make_shared<Bits>(block_count_, hash_count_);
+    std::atomic_store(&building_, fresh);
+
+    bsoncxx::builder::stream::document filter;
+    bool completed = scan(collection, *fresh, filter.view());
+
+    if (completed) {
+        std::atomic_store(&bits_, fresh);
+        removed_ = 0;
+    }
+    std::atomic_store(&building_, std::shared_ptr<Bits>());
+
+    if (completed) {
+        build_time_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        ready_ = true;
+        state_changed_.notify_all();
+    }
+    return completed;
+}
+
+bool ExistenceFilter::catch_up(mongocxx::collection collection) {
+    auto start = std::chrono::steady_clock::now();
+
+    bsoncxx::builder::stream::document created_filter;
+    created_filter << "created_at" << bsoncxx::builder::stream::open_document
+                   << "$gte" << bsoncxx::types::b_date{loaded_at_ - kCatchUpSkew}
+                   << bsoncxx::builder::stream::close_document;
+
+    auto current = std::atomic_load(&bits_);
+    bool completed = scan(collection, *current, created_filter.view());
+
+    if (completed) {
+        build_time_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+            std::chrono::steady_clock::now() - start
+        ).count();
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        ready_ = true;
+        state_changed_.notify_all();
+    }
+    return completed;
+}
+
+bool ExistenceFilter::scan(mongocxx::collection& collection, Bits& target, const bsoncxx::document::view& filter) {
+    try {
+        bsoncxx::builder::stream::document projection;
+        projection << "hash" << 1 << "_id" << 0;
+
+        mongocxx::options::find opts;
+        opts.projection(projection.view());
+        opts.batch_size(options_.scan_batch_size);
+
+        auto cursor = collection.find(filter, opts);
+        for (auto&& doc : cursor) {
+            if (stopping_) {
+                return false;
+            }
+            HashId hash;
+            if (doc["hash"] && HashId::from_bson(doc["hash"].get_value(), hash)) {
+                target.add(hash);
+            }
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error building existence filter: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+void ExistenceFilter::start(const std::string& connection_string, const std::string& database_name) {
+    if (worker_.joinable()) {
+        return;
+    }
+
+    bool loaded = !options_.persist_path.empty() && load(options_.persist_path);
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        running_ = true;
+    }
+
+    // The build gets its own client: mongocxx clients must not be shared
+    // between threads.
+    worker_ = std::thread([this, connection_string, database_name, loaded]() {
+        try {
+            MongoDBConnection connection(connection_string, database_name);
+            run_build([&]() { return connection.get_bpo_cas_collection(); }, loaded);
+        } catch (const std::exception& e) {
+            std::cerr << "Error building existence filter: " << e.what() << std::endl;
+        }
+        finish_build();
+    });
+}
+
+void ExistenceFilter::start(MongoDBConnection& connection) {
+    if (worker_.joinable()) {
+        return;
+    }
+
+    bool loaded = !options_.persist_path.empty() && load(options_.persist_path);
+    {
+        std::lock_guard<std::mutex> lock(state_mutex_);
+        running_ = true;
+    }
+
+    worker_ = std::thread([this, &connection, loaded]() {
+        try {
+            ClientLease lease = connection.acquire();
+            run_build([&]() { return lease.collection("bpo_cas"); }, loaded);
+        } catch (const std::exception& e) {
+            std::cerr << "Error building existence filter: " << e.what() << std::endl;
+        }
+        finish_build();
+    });
+}
+
+void ExistenceFilter::run_build(const std::function<mongocxx::collection()>& open_collection, bool loaded) {
+    if (!loaded || !catch_up(open_collection())) {
+        rebuild(open_collection());
+    }
+}
+
+void ExistenceFilter::finish_build() {
+    std::lock_guard<std::mutex> lock(state_mutex_);
+    running_ = false;
+    state_changed_.notify_all();
+}
+
+bool ExistenceFilter::save() const {
+    return save(options_.persist_path);
+}
+
+bool ExistenceFilter::save(const std::string& path) const {
+    if (path.empty() || !is_ready()) {
+        return false;
+    }
+
+    // Stamp before copying the bits: anything stored while we write is caught
+    // up on the next load.
+    auto saved_at = std::chrono::system_clock::now();
+    auto bits = std::atomic_load(&bits_);
+
+    FileHeader header;
+    std::memcpy(header.magic, kFileMagic, sizeof(kFileMagic));
+    header.version = 1;
+    header.hash_count = bits->hash_count;
+    header.block_count = bits->block_count;
+    header.items = bits->items.load();
+    header.saved_at_ms = std::chrono::duration_cast<std::chrono::milliseconds>(
+        saved_at.time_since_epoch()
+    ).count();
+
+    std::string temp_path = path + ".tmp";
+    try {
+        std::ofstream out(temp_path, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            std::cerr << "Error saving existence filter: cannot open " << temp_path << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+        std::vector<uint64_t> buffer(kBlockWords * 1024);
+        size_t total_words = bits->block_count * kBlockWords;
+        for (size_t begin = 0; begin < total_words; begin += buffer.size()) {
+            size_t count = std::min(buffer.size(), total_words - begin);
+            for (size_t i = 0; i < count; ++i) {
+                buffer[i] = bits->words[begin + i].load(std::memory_order_relaxed);
+            }
+            out.write(reinterpret_cast<const char*>(buffer.data()), count * sizeof(uint64_t));
+        }
+        out.close();
+        if (!out) {
+            std::cerr << "Error saving existence filter: write to " << temp_path << " failed" << std::endl;
+            std::remove(temp_path.c_str());
+            return false;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error saving existence filter: " << e.what() << std::endl;
+        std::remove(temp_path.c_str());
+        return false;
+    }
+
+    return std::rename(temp_path.c_str(), path.c_str()) == 0;
+}
+
+bool ExistenceFilter::load(const std::string& path) {
+    try {
+        std::ifstream in(path, std::ios::binary);
+        if (!in) {
+            return false;
+        }
+
+        FileHeader header;
+        in.read(reinterpret_cast<char*>(&header), sizeof(header));
+        if (!in || std::memcmp(header.magic, kFileMagic, sizeof(kFileMagic)) != 0 ||
+            header.version != 1 || header.hash_count == 0 || header.hash_count > kMaxHashCount ||
+            header.block_count == 0) {
+            std::cerr << "Error loading existence filter: " << path << " has an unknown format" << std::endl;
+            return false;
+        }
+
+        auto bits = std::make_shared<Bits>(static_cast<size_t>(header.block_count), header.hash_count);
+        std::vector<uint64_t> buffer(kBlockWords * 1024);
+        size_t total_words = bits->block_count * kBlockWords;
+        for (size_t begin = 0; begin < total_words; begin += buffer.size()) {
+            size_t count = std::min(buffer.size(), total_words - begin);
+            in.read(reinterpret_cast<char*>(buffer.data()), count * sizeof(uint64_t));
+            if (!in) {
+                std::cerr << "Error loading existence filter: " << path << " is truncated" << std::endl;
+                return false;
+            }
+            for (size_t i = 0; i < count; ++i) {
+                bits->words[begin + i].store(buffer[i], std::memory_order_relaxed);
+            }
+        }
+        bits->items = static_cast<size_t>(header.items);
+
+        loaded_at_ = std::chrono::system_clock::time_point(std::chrono::milliseconds(header.saved_at_ms));
+        std::atomic_store(&bits_, bits);
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading existence filter: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+double ExistenceFilter::estimated_false_positive_rate() const {
+    auto bits = std::atomic_load(&bits_);
+    double total_bits = static_cast<double>(bits->block_count * kBlockWords * 64);
+    double k = static_cast<double>(bits->hash_count);
+    double n = static_cast<double>(bits->items.load(std::memory_order_relaxed));
+    return std::pow(1.0 - std::exp(-k * n / total_bits), k);
+}
+
+size_t ExistenceFilter::memory_usage() const {
+    size_t total = std::atomic_load(&bits_)->memory_usage();
+    if (auto building = std::atomic_load(&building_)) {
+        total += building->memory_usage();
+    }
+    return total;
+}
+
+ExistenceFilterStats ExistenceFilter::get_stats() const {
+    auto bits = std::atomic_load(&bits_);
+
+    ExistenceFilterStats stats;
+    stats.ready = is_ready();
+    stats.items = bits->items.load(std::memory_order_relaxed);
+    stats.removed = removed_.load();
+    stats.memory_bytes = memory_usage();
+    stats.hash_count = bits->hash_count;
+    stats.estimated_false_positive_rate = estimated_false_positive_rate();
+    stats.definite_negatives = definite_negatives_.load();
+    stats.possible_positives = possible_positives_.load();
+    stats.build_time = std::chrono::milliseconds(build_time_ms_.load());
+    return stats;
+}
+
+}
+}
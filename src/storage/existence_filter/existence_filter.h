@@ -0,0 +1,113 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include <mongocxx/collection.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+namespace geoversion {
+namespace storage {
+
+class MongoDBConnection;
+
+struct ExistenceFilterOptions {
+    size_t expected_items = 10000000;
+    double target_false_positive_rate = 0.01;
+    std::string persist_path;
+    int32_t scan_batch_size = 10000;
+};
+
+struct ExistenceFilterStats {
+    bool ready = false;
+    size_t items = 0;
+    size_t removed = 0;
+    size_t memory_bytes = 0;
+    uint32_t hash_count = 0;
+    double estimated_false_positive_rate = 0.0;
+    uint64_t definite_negatives = 0;
+    uint64_t possible_positives = 0;
+    std::chrono::milliseconds build_time{0};
+};
+
+// Blocked Bloom filter over bpo_cas hashes: each hash maps to one 512-bit
+// block, so a lookup touches a single cache line. It only knows about objects
+// seen by the initial scan or added through this process. Bloom filters cannot
+// forget, so remove() just counts stale entries until the next rebuild.
+// Until a build or catch-up scan finishes every lookup answers "maybe".
+class ExistenceFilter {
+public:
+    explicit ExistenceFilter(const ExistenceFilterOptions& options = ExistenceFilterOptions());
+    ~ExistenceFilter();
+
+    ExistenceFilter(const ExistenceFilter&) = delete;
+    ExistenceFilter& operator=(const ExistenceFilter&) = delete;
+
+    void add(const HashId& hash);
+    void remove(const HashId& hash);
+    bool might_contain(const HashId& hash);
+
+    bool is_ready() const;
+    bool wait_until_ready();
+
+    bool rebuild(mongocxx::collection collection);
+    void start(const std::string& connection_string, const std::string& database_name = "geoversion");
+    void start(MongoDBConnection& connection);
+
+    bool save() const;
+    bool save(const std::string& path) const;
+    bool load(const std::string& path);
+
+    double estimated_false_positive_rate() const;
+    size_t memory_usage() const;
+    ExistenceFilterStats get_stats() const;
+
+private:
+    struct Bits {
+        Bits(size_t block_count, uint32_t hash_count);
+
+        size_t block_count;
+        uint32_t hash_count;
+        std::unique_ptr<std::atomic<uint64_t>[]> words;
+        std::atomic<size_t> items;
+
+        bool add(const HashId& hash);
+        bool test(const HashId& hash) const;
+        size_t memory_usage() const;
+    };
+
+    ExistenceFilterOptions options_;
+    size_t block_count_;
+    uint32_t hash_count_;
+
+    std::shared_ptr<Bits> bits_;
+    std::shared_ptr<Bits> building_;
+    std::chrono::system_clock::time_point loaded_at_;
+
+    std::atomic<bool> ready_;
+    std::atomic<bool> stopping_;
+    std::atomic<size_t> removed_;
+    std::atomic<uint64_t> definite_negatives_;
+    std::atomic<uint64_t> possible_positives_;
+    std::atomic<int64_t> build_time_ms_;
+    std::mutex state_mutex_;
+    std::condition_variable state_changed_;
+    bool running_;
+    std::thread worker_;
+
+    bool catch_up(mongocxx::collection collection);
+    void run_build(const std::function<mongocxx::collection()>& open_collection, bool loaded);
+    void finish_build();
+    bool scan(mongocxx::collection& collection, Bits& target, const bsoncxx::document::view& filter);
+};
+
+}
+}
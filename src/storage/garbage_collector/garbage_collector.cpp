@@ -0,0 +1,558 @@
+#include "garbage_collector.h"
+#include "storage/coordinate_codec/coordinate_codec.h"
+#include "storage/geometry_cas/geometry_cas.h"
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+#include <mongocxx/hint.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/pipeline.hpp>
+#include <algorithm>
+#include <future>
+#include <iostream>
+#include <thread>
+
+namespace geoversion {
+namespace storage {
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+namespace {
+
+// Below this many entries a mark set is not worth compacting.
+constexpr size_t kMinCompactSize = 1 << 16;
+constexpr int32_t kScanBatchSize = 10000;
+
+int64_t elapsed_ms(std::chrono::steady_clock::time_point since) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - since).count();
+}
+
+uint64_t size_field(const bsoncxx::document::view& doc, const char* key) {
+    auto element = doc[key];
+    if (element && element.type() == bsoncxx::type::k_int32 && element.get_int32().value >= 0) {
+        return static_cast<uint64_t>(element.get_int32().value);
+    }
+    if (element && element.type() == bsoncxx::type::k_int64 && element.get_int64().value >= 0) {
+        return static_cast<uint64_t>(element.get_int64().value);
+    }
+    return 0;
+}
+
+bsoncxx::builder::basic::array hash_array(const std::vector<HashId>& hashes) {
+    bsoncxx::builder::basic::array array;
+    for (const auto& hash : hashes) {
+        array.append(hash.to_bson());
+    }
+    return array;
+}
+
+// Documents among hashes last stored before the cutoff. Documents from
+// before last_stored_at existed fall back to created_at; those with neither
+// stay. Geometries and chunks share the field name with objects.
+bsoncxx::document::value expired_filter(const std::vector<HashId>& hashes, bsoncxx::types::b_date before) {
+    using bsoncxx::builder::basic::make_array;
+    return make_document(
+        kvp("hash", make_document(kvp("$in", hash_array(hashes)))),
+        kvp("$or", make_array(
+            make_document(kvp(CAS::kLastStoredField, make_document(kvp("$lt", before)))),
+            make_document(
+                kvp(CAS::kLastStoredField, make_document(kvp("$exists", false))),
+                kvp("created_at", make_document(kvp("$lt", before)))
+            )
+        ))
+    );
+}
+
+}
+
+void GarbageCollector::MarkSet::add(const HashId& hash) {
+    prefixes_.push_back(hash.prefix());
+    // Versions share most of their refs; compacting once the set doubles
+    // keeps duplicates from piling up at amortized cost.
+    if (prefixes_.size() >= std::max(kMinCompactSize, 2 * compacted_)) {
+        compact();
+    }
+}
+
+void GarbageCollector::MarkSet::add_packed(const uint8_t* bytes, size_t count) {
+    for (size_t i = 0; i < count; ++i) {
+        add(HashId::from_bytes(bytes + i * HashId::kSize));
+    }
+}
+
+void GarbageCollector::MarkSet::merge(MarkSet& other) {
+    prefixes_.insert(prefixes_.end(), other.prefixes_.begin(), other.prefixes_.end());
+    std::vector<uint64_t>().swap(other.prefixes_);
+    other.compacted_ = 0;
+    compact();
+}
+
+void GarbageCollector::MarkSet::compact() {
+    std::sort(prefixes_.begin(), prefixes_.end());
+    prefixes_.erase(std::unique(prefixes_.begin(), prefixes_.end()), prefixes_.end());
+    compacted_ = prefixes_.size();
+}
+
+// Only after compact().
+bool GarbageCollector::MarkSet::contains(const HashId& hash) const {
+    return std::binary_search(prefixes_.begin(), prefixes_.end(), hash.prefix());
+}
+
+size_t GarbageCollector::MarkSet::size() const {
+    return prefixes_.size();
+}
+
+GarbageCollector::GarbageCollector(MongoDBConnection& connection, CAS& cas, const GarbageCollectorOptions& options)
+    : connection_(connection), cas_(cas), options_(options) {
+    if (options_.delete_batch_size == 0) {
+        options_.delete_batch_size = GarbageCollectorOptions().delete_batch_size;
+    }
+}
+
+void GarbageCollector::mark_hash_array(const bsoncxx::document::view& doc, const char* field, MarkSet& marks) {
+    auto element = doc[field];
+    if (!element || element.type() != bsoncxx::type::k_array) {
+        return;
+    }
+    for (auto&& value : element.get_array().value) {
+        HashId hash;
+        if (HashId::from_bson(value.get_value(), hash)) {
+            marks.add(hash);
+        }
+    }
+}
+
+bool GarbageCollector::mark_chunks(const bsoncxx::document::view& filter, MarkSet& marks) {
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("refs", 1), kvp("_id", 0)));
+        opts.batch_size(static_cast<int32_t>(SituationRepository::kChunksPerInsert));
+
+        ClientLease lease = connection_.acquire();
+        auto cursor = lease.collection(SituationRepository::kRefsCollectionName).find(filter, opts);
+        for (auto&& doc : cursor) {
+            if (doc["refs"] && doc["refs"].type() == bsoncxx::type::k_binary) {
+                auto packed = doc["refs"].get_binary();
+                marks.add_packed(packed.bytes, packed.size / HashId::kSize);
+            }
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error marking version refs: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool GarbageCollector::mark_deltas(const bsoncxx::document::view& filter, MarkSet& marks) {
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(
+            kvp("added_bpos", 1),
+            kvp("removed_bpos", 1),
+            kvp("modified_bpos", 1),
+            kvp("_id", 0)
+        ));
+
+        ClientLease lease = connection_.acquire();
+        auto cursor = lease.collection("version_deltas").find(filter, opts);
+        for (auto&& doc : cursor) {
+            mark_hash_array(doc, "added_bpos", marks);
+            mark_hash_array(doc, "removed_bpos", marks);
+            if (!doc["modified_bpos"] || doc["modified_bpos"].type() != bsoncxx::type::k_array) {
+                continue;
+            }
+            for (auto&& pair : doc["modified_bpos"].get_array().value) {
+                if (pair.type() != bsoncxx::type::k_document) {
+                    continue;
+                }
+                auto pair_doc = pair.get_document().value;
+                for (const char* side : {"old_hash", "new_hash"}) {
+                    HashId hash;
+                    if (pair_doc[side] && HashId::from_bson(pair_doc[side].get_value(), hash)) {
+                        marks.add(hash);
+                    }
+                }
+            }
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error marking version deltas: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool GarbageCollector::mark_inline(const bsoncxx::document::view& filter, MarkSet& marks) {
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("bpo_refs", 1), kvp("_id", 0)));
+
+        ClientLease lease = connection_.acquire();
+        auto cursor = lease.collection("situation_versions").find(filter, opts);
+        for (auto&& doc : cursor) {
+            mark_hash_array(doc, "bpo_refs", marks);
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error marking inline version refs: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Versions created since `since` that this run has not marked yet, which
+// covers commits that overlapped the mark phase or the sweep so far.
+bool GarbageCollector::mark_late(
+    std::chrono::system_clock::time_point since,
+    std::unordered_set<std::string>& seen,
+    MarkSet& marks,
+    GarbageCollectionReport& report
+) {
+    bsoncxx::builder::basic::array fresh;
+    size_t fresh_count = 0;
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("version_id", 1), kvp("bpo_refs", 1), kvp("_id", 0)));
+
+        ClientLease lease = connection_.acquire();
+        auto cursor = lease.collection("situation_versions").find(make_document(
+            kvp("created_at", make_document(kvp("$gte", bsoncxx::types::b_date{since})))
+        ), opts);
+        for (auto&& doc : cursor) {
+            if (!doc["version_id"] || doc["version_id"].type() != bsoncxx::type::k_string) {
+                continue;
+            }
+            std::string version_id(doc["version_id"].get_string().value);
+            if (!seen.insert(version_id).second) {
+                continue;
+            }
+            mark_hash_array(doc, "bpo_refs", marks);
+            fresh.append(version_id);
+            ++fresh_count;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error marking new versions: " << e.what() << std::endl;
+        return false;
+    }
+    if (fresh_count == 0) {
+        return true;
+    }
+
+    auto ids = fresh.extract();
+    bool marked = mark_chunks(make_document(kvp("version_id", make_document(kvp("$in", ids.view())))), marks) &&
+        mark_deltas(make_document(kvp("to_version_id", make_document(kvp("$in", ids.view())))), marks);
+    marks.compact();
+    report.late_versions += fresh_count;
+    return marked;
+}
+
+// Hashes held by `field` of the documents matching filter, whether it is
+// one hash or an array of them.
+bool GarbageCollector::mark_field(
+    const char* collection,
+    const bsoncxx::document::view& filter,
+    const char* field,
+    MarkSet& marks
+) {
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp(field, 1), kvp("_id", 0)));
+        opts.batch_size(kScanBatchSize);
+
+        ClientLease lease = connection_.acquire();
+        auto cursor = lease.collection(collection).find(filter, opts);
+        for (auto&& doc : cursor) {
+            auto element = doc[field];
+            if (!element) {
+                continue;
+            }
+            if (element.type() == bsoncxx::type::k_array) {
+                mark_hash_array(doc, field, marks);
+                continue;
+            }
+            HashId hash;
+            if (HashId::from_bson(element.get_value(), hash)) {
+                marks.add(hash);
+            }
+        }
+        marks.compact();
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error marking " << collection << " references: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Geometries are marked from the objects left after their sweep, and
+// chunks from the manifests left after the geometries'. A store that finds
+// a geometry or chunk refreshes its last_stored_at before relying on it, so
+// whatever is referenced after marking is kept by the grace period.
+bool GarbageCollector::sweep_geometries(std::chrono::system_clock::time_point cutoff, GarbageCollectionReport& report) {
+    MarkSet geometries;
+    auto referencing = make_document(kvp(kGeometryHashField, make_document(kvp("$exists", true))));
+    if (!mark_field(CAS::kCollectionName, referencing.view(), kGeometryHashField, geometries) ||
+        !sweep_unmarked(GeometryCAS::kCollectionName, "geometry_hash_idx", geometries, cutoff,
+                        report.geometries_unreachable, report.geometries_deleted, report)) {
+        return false;
+    }
+
+    MarkSet chunks;
+    auto manifests = make_document(kvp(CoordinateCodec::kEncodingField, GeometryCAS::kChunkedEncoding));
+    return mark_field(GeometryCAS::kCollectionName, manifests.view(), "chunks", chunks) &&
+        sweep_unmarked(GeometryCAS::kChunkCollectionName, "chunk_hash_idx", chunks, cutoff,
+                       report.chunks_unreachable, report.chunks_deleted, report);
+}
+
+bool GarbageCollector::sweep_unmarked(
+    const char* collection,
+    const char* index,
+    const MarkSet& marks,
+    std::chrono::system_clock::time_point cutoff,
+    uint64_t& unreachable,
+    uint64_t& deleted,
+    GarbageCollectionReport& report
+) {
+    auto started = std::chrono::steady_clock::now();
+    uint64_t deleted_before = deleted;
+    uint64_t kept_recent = 0;
+    auto geometry_cas = cas_.get_geometry_cas();
+    bool geometries = std::string(collection) == GeometryCAS::kCollectionName;
+
+    std::vector<HashId> batch;
+    batch.reserve(options_.delete_batch_size);
+    auto sweep_pending = [&]() {
+        if (!sweep_batch(collection, batch, cutoff, kept_recent, deleted, report)) {
+            return false;
+        }
+        if (geometries && geometry_cas) {
+            geometry_cas->forget(batch);
+        }
+        batch.clear();
+        throttle(started, deleted - deleted_before);
+        return true;
+    };
+
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("hash", 1), kvp("_id", 0)));
+        opts.hint(mongocxx::hint(index));
+        opts.batch_size(kScanBatchSize);
+
+        ClientLease lease = connection_.acquire();
+        auto cursor = lease.collection(collection).find(make_document(), opts);
+        for (auto&& doc : cursor) {
+            HashId hash;
+            if (!doc["hash"] || !HashId::from_bson(doc["hash"].get_value(), hash) || marks.contains(hash)) {
+                continue;
+            }
+            ++unreachable;
+            batch.push_back(hash);
+            if (batch.size() >= options_.delete_batch_size && !sweep_pending()) {
+                return false;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error scanning " << collection << " hashes: " << e.what() << std::endl;
+        return false;
+    }
+    return batch.empty() || sweep_pending();
+}
+
+// Deletes the expired documents of batch and leaves in it the hashes
+// actually deleted.
+bool GarbageCollector::sweep_batch(
+    const char* collection,
+    std::vector<HashId>& batch,
+    std::chrono::system_clock::time_point cutoff,
+    uint64_t& kept_recent,
+    uint64_t& deleted,
+    GarbageCollectionReport& report
+) {
+    bsoncxx::types::b_date before{cutoff};
+    try {
+        ClientLease lease = connection_.acquire();
+        mongocxx::collection objects = lease.collection(collection);
+
+        // Sizes are taken on the server so the documents never travel.
+        mongocxx::pipeline pipeline;
+        pipeline.match(expired_filter(batch, before).view());
+        pipeline.project(make_document(
+            kvp("_id", 0),
+            kvp("hash", 1),
+            kvp("size", make_document(kvp("$bsonSize", "$$ROOT")))
+        ));
+
+        std::vector<HashId> expired;
+        std::vector<uint64_t> sizes;
+        uint64_t bytes = 0;
+        for (auto&& doc : objects.aggregate(pipeline)) {
+            HashId hash;
+            if (doc["hash"] && HashId::from_bson(doc["hash"].get_value(), hash)) {
+                expired.push_back(hash);
+                sizes.push_back(size_field(doc, "size"));
+                bytes += sizes.back();
+            }
+        }
+        kept_recent += batch.size() - expired.size();
+        batch.clear();
+        if (expired.empty()) {
+            return true;
+        }
+        if (options_.dry_run) {
+            report.reclaimed_bytes += bytes;
+            return true;
+        }
+
+        auto result = objects.delete_many(expired_filter(expired, before).view());
+        uint64_t count = result ? static_cast<uint64_t>(result->deleted_count()) : 0;
+        deleted += count;
+
+        // Objects stored again since the lookup survive, and so do their
+        // cache entries.
+        if (count < expired.size()) {
+            mongocxx::options::find opts;
+            opts.projection(make_document(kvp("hash", 1), kvp("_id", 0)));
+            std::unordered_set<HashId> survivors;
+            auto filter = make_document(kvp("hash", make_document(kvp("$in", hash_array(expired)))));
+            for (auto&& doc : objects.find(filter.view(), opts)) {
+                HashId hash;
+                if (doc["hash"] && HashId::from_bson(doc["hash"].get_value(), hash)) {
+                    survivors.insert(hash);
+                }
+            }
+            size_t kept = 0;
+            bytes = 0;
+            for (size_t i = 0; i < expired.size(); ++i) {
+                if (survivors.count(expired[i]) == 0) {
+                    expired[kept++] = expired[i];
+                    bytes += sizes[i];
+                }
+            }
+            expired.resize(kept);
+        }
+        report.reclaimed_bytes += bytes;
+        batch.swap(expired);
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error sweeping " << collection << ": " << e.what() << std::endl;
+        return false;
+    }
+}
+
+void GarbageCollector::throttle(std::chrono::steady_clock::time_point started, uint64_t deleted) const {
+    if (options_.max_deletes_per_second == 0 || options_.dry_run) {
+        return;
+    }
+    auto due = std::chrono::milliseconds(deleted * 1000 / options_.max_deletes_per_second);
+    auto spent = std::chrono::steady_clock::now() - started;
+    if (spent < due) {
+        std::this_thread::sleep_for(due - spent);
+    }
+}
+
+GarbageCollectionReport GarbageCollector::run() {
+    GarbageCollectionReport report;
+    auto started_at = std::chrono::system_clock::now();
+    auto cutoff = started_at - options_.grace_period;
+    auto mark_started = std::chrono::steady_clock::now();
+
+    MarkSet marks;
+    MarkSet delta_marks;
+    MarkSet inline_marks;
+    auto everything = make_document();
+    auto legacy = make_document(kvp("bpo_refs.0", make_document(kvp("$exists", true))));
+    bool marked = false;
+    if (connection_.is_pooled()) {
+        auto chunks = std::async(std::launch::async, [&]() {
+            return mark_chunks(everything.view(), marks);
+        });
+        auto deltas = std::async(std::launch::async, [&]() {
+            return mark_deltas(everything.view(), delta_marks);
+        });
+        bool inline_marked = mark_inline(legacy.view(), inline_marks);
+        bool chunks_marked = chunks.get();
+        bool deltas_marked = deltas.get();
+        marked = chunks_marked && deltas_marked && inline_marked;
+    } else {
+        marked = mark_chunks(everything.view(), marks) &&
+            mark_deltas(everything.view(), delta_marks) &&
+            mark_inline(legacy.view(), inline_marks);
+    }
+    if (!marked) {
+        return report;
+    }
+    marks.merge(delta_marks);
+    marks.merge(inline_marks);
+    report.marked = marks.size();
+    report.mark_time_ms = elapsed_ms(mark_started);
+
+    // Unmarked hashes are swept a batch at a time while hash_idx streams.
+    // Commits that overlapped the mark phase started at most a grace period
+    // before it, and each batch first marks the versions written since.
+    auto sweep_started = std::chrono::steady_clock::now();
+    std::unordered_set<std::string> seen;
+    MarkSet late;
+    std::vector<HashId> pending;
+    std::vector<HashId> batch;
+    pending.reserve(options_.delete_batch_size);
+    auto sweep_pending = [&]() {
+        if (!mark_late(cutoff, seen, late, report)) {
+            return false;
+        }
+        batch.clear();
+        for (const auto& hash : pending) {
+            if (!late.contains(hash)) {
+                batch.push_back(hash);
+            }
+        }
+        pending.clear();
+        if (!batch.empty() &&
+            !sweep_batch(CAS::kCollectionName, batch, cutoff, report.kept_recent, report.deleted, report)) {
+            return false;
+        }
+        cas_.forget(batch);
+        throttle(sweep_started, report.deleted);
+        return true;
+    };
+
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("hash", 1), kvp("_id", 0)));
+        opts.hint(mongocxx::hint("hash_idx"));
+        opts.batch_size(kScanBatchSize);
+
+        ClientLease lease = connection_.acquire();
+        auto cursor = lease.collection(CAS::kCollectionName).find(make_document(), opts);
+        for (auto&& doc : cursor) {
+            HashId hash;
+            if (!doc["hash"] || !HashId::from_bson(doc["hash"].get_value(), hash)) {
+                continue;
+            }
+            ++report.scanned;
+            if (marks.contains(hash)) {
+                continue;
+            }
+            ++report.unreachable;
+            pending.push_back(hash);
+            if (pending.size() >= options_.delete_batch_size && !sweep_pending()) {
+                return report;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error scanning CAS hashes: " << e.what() << std::endl;
+        return report;
+    }
+    if (!pending.empty() && !sweep_pending()) {
+        return report;
+    }
+    if (!sweep_geometries(cutoff, report)) {
+        return report;
+    }
+
+    report.sweep_time_ms = elapsed_ms(sweep_started);
+    report.ok = true;
+    return report;
+}
+
+}
+}
@@ -0,0 +1,138 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include "storage/cas/cas.h"
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/situation_repository/situation_repository.h"
+#include <bsoncxx/document/view.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+struct GarbageCollectorOptions {
+    // Objects stored more recently are kept, whether referenced or not. A
+    // deduplicated store or a commit referring to the object counts, through
+    // CAS::kLastStoredField, which is refreshed at most once per
+    // CAS::get_touch_interval(); keep this well above that interval and
+    // GeometryCAS::get_touch_interval(), which does the same for geometries.
+    std::chrono::seconds grace_period = std::chrono::hours(1);
+    size_t delete_batch_size = 1000;
+    // Deleted objects per second; 0 does not limit.
+    size_t max_deletes_per_second = 5000;
+    // Finds and sizes the garbage without deleting it.
+    bool dry_run = false;
+};
+
+struct GarbageCollectionReport {
+    bool ok = false;
+    // Distinct hashes held by versions and deltas when the sweep started.
+    uint64_t marked = 0;
+    // Versions committed during the run, marked before each batch.
+    uint64_t late_versions = 0;
+    uint64_t scanned = 0;
+    uint64_t unreachable = 0;
+    uint64_t kept_recent = 0;
+    uint64_t deleted = 0;
+    // Geometries and position chunks no remaining object or manifest holds.
+    uint64_t geometries_unreachable = 0;
+    uint64_t geometries_deleted = 0;
+    uint64_t chunks_unreachable = 0;
+    uint64_t chunks_deleted = 0;
+    // BSON size of the deleted documents, objects, geometries and chunks
+    // alike; what would be freed on a dry run.
+    uint64_t reclaimed_bytes = 0;
+    int64_t mark_time_ms = 0;
+    int64_t sweep_time_ms = 0;
+};
+
+// Mark and sweep of bpo_cas on a live database. The mark phase streams
+// every hash a version can reach: the ref chunks of keyframes, legacy
+// inline bpo_refs and all of version_deltas, which also covers versions
+// stored as deltas. The sweep streams hash_idx alone and deletes unmarked
+// objects last stored before the grace period in rate-limited batches,
+// marking the versions committed meanwhile before each one. A commit may
+// refer to objects no version holds yet, so it must not take longer than
+// the grace period less the CAS touch interval after storing them. Not to
+// be run alongside Migration, which rewrites the refs of old versions.
+// Then bpo_geometries is swept of geometries no remaining object refers
+// to, and bpo_geometry_chunks of chunks no remaining manifest lists, under
+// the same grace period; this also takes geometries left behind by a store
+// that failed after writing them. A dry run marks from every object, so
+// geometries only its collectable objects hold are not counted.
+class GarbageCollector {
+public:
+    GarbageCollector(MongoDBConnection& connection, CAS& cas,
+                     const GarbageCollectorOptions& options = GarbageCollectorOptions());
+
+    GarbageCollector(const GarbageCollector&) = delete;
+    GarbageCollector& operator=(const GarbageCollector&) = delete;
+
+    GarbageCollectionReport run();
+
+private:
+    // Sorted 64-bit hash prefixes. A prefix shared by a live and a dead
+    // object only keeps the dead one.
+    class MarkSet {
+    public:
+        void add(const HashId& hash);
+        void add_packed(const uint8_t* bytes, size_t count);
+        void merge(MarkSet& other);
+        void compact();
+        bool contains(const HashId& hash) const;
+        size_t size() const;
+
+    private:
+        std::vector<uint64_t> prefixes_;
+        size_t compacted_ = 0;
+    };
+
+    MongoDBConnection& connection_;
+    CAS& cas_;
+    GarbageCollectorOptions options_;
+
+    bool mark_chunks(const bsoncxx::document::view& filter, MarkSet& marks);
+    bool mark_deltas(const bsoncxx::document::view& filter, MarkSet& marks);
+    bool mark_inline(const bsoncxx::document::view& filter, MarkSet& marks);
+    bool mark_late(
+        std::chrono::system_clock::time_point since,
+        std::unordered_set<std::string>& seen,
+        MarkSet& marks,
+        GarbageCollectionReport& report
+    );
+    bool mark_field(
+        const char* collection,
+        const bsoncxx::document::view& filter,
+        const char* field,
+        MarkSet& marks
+    );
+    bool sweep_geometries(std::chrono::system_clock::time_point cutoff, GarbageCollectionReport& report);
+    bool sweep_unmarked(
+        const char* collection,
+        const char* index,
+        const MarkSet& marks,
+        std::chrono::system_clock::time_point cutoff,
+        uint64_t& unreachable,
+        uint64_t& deleted,
+        GarbageCollectionReport& report
+    );
+    bool sweep_batch(
+        const char* collection,
+        std::vector<HashId>& batch,
+        std::chrono::system_clock::time_point cutoff,
+        uint64_t& kept_recent,
+        uint64_t& deleted,
+        GarbageCollectionReport& report
+    );
+    void throttle(std::chrono::steady_clock::time_point started, uint64_t deleted) const;
+
+    static void mark_hash_array(const bsoncxx::document::view& doc, const char* field, MarkSet& marks);
+};
+
+}
+}
@@ -0,0 +1,66 @@
+#include "geojson_export.h"
+#include "storage/geojson_export/geojson_writer.h"
+#include <optional>
+
+namespace geoversion {
+namespace storage {
+
+GeoJSONExporter::GeoJSONExporter(CAS& cas, const GeoJSONExportOptions& options)
+    : cas_(cas), options_(options) {
+}
+
+GeoJSONExportReport GeoJSONExporter::export_all(OutputSink& sink) {
+    CASQueryOptions query;
+    query.batch_size = options_.batch_size;
+    return run(sink, [&](const std::function<bool(const bsoncxx::document::view&)>& visit) {
+        auto cursor = cas_.scan(query);
+        while (cursor->next() && visit(cursor->current())) {
+        }
+    });
+}
+
+GeoJSONExportReport GeoJSONExporter::export_bbox(double min_lon, double min_lat, double max_lon, double max_lat, OutputSink& sink) {
+    CASQueryOptions query;
+    query.batch_size = options_.batch_size;
+    return run(sink, [&](const std::function<bool(const bsoncxx::document::view&)>& visit) {
+        cas_.for_each_in_bbox(min_lon, min_lat, max_lon, max_lat, visit, query);
+    });
+}
+
+GeoJSONExportReport GeoJSONExporter::export_hashes(const std::vector<HashId>& hashes, OutputSink& sink) {
+    return run(sink, [&](const std::function<bool(const bsoncxx::document::view&)>& visit) {
+        cas_.for_each_of(hashes, visit);
+    });
+}
+
+GeoJSONExportReport GeoJSONExporter::run(
+    OutputSink& sink,
+    const std::function<void(const std::function<bool(const bsoncxx::document::view&)>&)>& source
+) {
+    auto start = std::chrono::steady_clock::now();
+    GeoJSONExportReport report;
+    GeoJSONWriter writer(sink, options_.buffer_size);
+
+    writer.begin();
+    source([&](const bsoncxx::document::view& doc) {
+        bsoncxx::document::view geometry;
+        std::optional<bsoncxx::document::value> decoded;
+        if (!cas_.read_geometry(doc, geometry, decoded)) {
+            geometry = bsoncxx::document::view();
+        }
+        return writer.write_feature(doc, geometry);
+    });
+    bool ended = !writer.failed() && writer.end();
+
+    report.ok = ended;
+    report.error = ended ? std::string() : sink.error();
+    report.features = writer.features();
+    report.bytes = writer.bytes_written();
+    report.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start
+    );
+    return report;
+}
+
+}
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include "storage/cas/cas.h"
+#include "storage/geojson_export/output_sink.h"
+#include "storage/hash_id/hash_id.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+class GeoJSONWriter;
+
+struct GeoJSONExportOptions {
+    int32_t batch_size = 1000;
+    size_t buffer_size = 1 << 20;
+};
+
+struct GeoJSONExportReport {
+    bool ok = false;
+    std::string error;
+    uint64_t features = 0;
+    uint64_t bytes = 0;
+    std::chrono::milliseconds elapsed{0};
+};
+
+// Streams CAS documents into a GeoJSON FeatureCollection. Documents are
+// rendered straight from the cursor's batch buffer, so memory stays at one
+// driver batch plus the writer buffer regardless of how many are exported.
+class GeoJSONExporter {
+public:
+    explicit GeoJSONExporter(CAS& cas, const GeoJSONExportOptions& options = GeoJSONExportOptions());
+
+    GeoJSONExportReport export_all(OutputSink& sink);
+    GeoJSONExportReport export_bbox(double min_lon, double min_lat, double max_lon, double max_lat, OutputSink& sink);
+    GeoJSONExportReport export_hashes(const std::vector<HashId>& hashes, OutputSink& sink);
+
+private:
+    CAS& cas_;
+    GeoJSONExportOptions options_;
+
+    GeoJSONExportReport run(
+        OutputSink& sink,
+        const std::function<void(const std::function<bool(const bsoncxx::document::view&)>&)>& source
+    );
+};
+
+}
+}
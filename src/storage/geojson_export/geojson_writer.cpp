@@ -0,0 +1,274 @@
+#include "geojson_writer.h"
+#include "storage/coordinate_codec/coordinate_codec.h"
+#include <bsoncxx/types.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cmath>
+#include <cstring>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr size_t kNumberSize = 32;
+
+bool needs_escape(char c) {
+    return c == '"' || c == '\\' || static_cast<unsigned char>(c) < 0x20;
+}
+
+}
+
+GeoJSONWriter::GeoJSONWriter(OutputSink& sink, size_t buffer_size)
+    : sink_(sink),
+      buffer_(std::max<size_t>(buffer_size, 4096)),
+      used_(0),
+      features_(0),
+      bytes_written_(0),
+      failed_(false) {
+}
+
+bool GeoJSONWriter::begin() {
+    put("{\"type\":\"FeatureCollection\",\"features\":[");
+    return !failed_;
+}
+
+bool GeoJSONWriter::write_feature(const bsoncxx::document::view& doc) {
+    bsoncxx::document::view geometry;
+    std::optional<bsoncxx::document::value> decoded;
+    if (!read_stored_geometry(doc, geometry, decoded)) {
+        geometry = bsoncxx::document::view();
+    }
+    return write_feature(doc, geometry);
+}
+
+bool GeoJSONWriter::write_feature(const bsoncxx::document::view& doc, const bsoncxx::document::view& geometry) {
+    HashId hash;
+    auto hash_element = doc["hash"];
+    if (hash_element) {
+        HashId::from_bson(hash_element.get_value(), hash);
+    }
+
+    auto attributes = doc["attributes"];
+    return write_feature(
+        hash,
+        geometry,
+        attributes && attributes.type() == bsoncxx::type::k_document ? attributes.get_document().value : bsoncxx::document::view()
+    );
+}
+
+bool GeoJSONWriter::write_feature(const HashId& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& properties) {
+    if (features_ > 0) {
+        put(',');
+    }
+    put("{\"type\":\"Feature\"");
+    if (!hash.is_null()) {
+        char* out = reserve(HashId::kHexLength + 8);
+        if (out) {
+            static constexpr char kDigits[] = "0123456789abcdef";
+            std::memcpy(out, ",\"id\":\"", 7);
+            out += 7;
+            for (size_t i = 0; i < HashId::kSize; ++i) {
+                *out++ = kDigits[hash.data()[i] >> 4];
+                *out++ = kDigits[hash.data()[i] & 0x0F];
+            }
+            *out = '"';
+            used_ += HashId::kHexLength + 8;
+        }
+    }
+    put(",\"geometry\":");
+    if (geometry.empty()) {
+        put("null");
+    } else {
+        write_document(geometry);
+    }
+    put(",\"properties\":");
+    write_document(properties);
+    put('}');
+
+    ++features_;
+    return !failed_;
+}
+
+bool GeoJSONWriter::end() {
+    put("]}\n");
+    return flush() && sink_.finish();
+}
+
+uint64_t GeoJSONWriter::features() const {
+    return features_;
+}
+
+uint64_t GeoJSONWriter::bytes_written() const {
+    return bytes_written_ + used_;
+}
+
+bool GeoJSONWriter::failed() const {
+    return failed_;
+}
+
+bool GeoJSONWriter::flush() {
+    if (failed_) {
+        return false;
+    }
+    if (used_ > 0) {
+        if (!sink_.write(buffer_.data(), used_)) {
+            failed_ = true;
+            return false;
+        }
+        bytes_written_ += used_;
+        used_ = 0;
+    }
+    return true;
+}
+
+// Returns room for size bytes (size must fit the buffer); the caller
+// advances used_ by what it actually wrote.
+char* GeoJSONWriter::reserve(size_t size) {
+    if (buffer_.size() - used_ < size && !flush()) {
+        return nullptr;
+    }
+    return buffer_.data() + used_;
+}
+
+void GeoJSONWriter::put(char c) {
+    char* out = reserve(1);
+    if (out) {
+        *out = c;
+        ++used_;
+    }
+}
+
+void GeoJSONWriter::put(std::string_view text) {
+    while (!text.empty() && !failed_) {
+        if (used_ == buffer_.size() && !flush()) {
+            return;
+        }
+        size_t chunk = std::min(text.size(), buffer_.size() - used_);
+        std::memcpy(buffer_.data() + used_, text.data(), chunk);
+        used_ += chunk;
+        text.remove_prefix(chunk);
+    }
+}
+
+void GeoJSONWriter::write_string(std::string_view text) {
+    put('"');
+    size_t run = 0;
+    for (size_t i = 0; i < text.size(); ++i) {
+        char c = text[i];
+        if (!needs_escape(c)) {
+            continue;
+        }
+        put(text.substr(run, i - run));
+        run = i + 1;
+        switch (c) {
+            case '"': put("\\\""); break;
+            case '\\': put("\\\\"); break;
+            case '\n': put("\\n"); break;
+            case '\r': put("\\r"); break;
+            case '\t': put("\\t"); break;
+            case '\b': put("\\b"); break;
+            case '\f': put("\\f"); break;
+            default: {
+                static constexpr char kDigits[] = "0123456789abcdef";
+                char escaped[6] = {'\\', 'u', '0', '0', kDigits[(c >> 4) & 0x0F], kDigits[c & 0x0F]};
+                put(std::string_view(escaped, sizeof(escaped)));
+                break;
+            }
+        }
+    }
+    put(text.substr(run));
+    put('"');
+}
+
+void GeoJSONWriter::write_double(double value) {
+    if (!std::isfinite(value)) {
+        put("null");
+        return;
+    }
+    char* out = reserve(kNumberSize);
+    if (!out) {
+        return;
+    }
+    auto result = std::to_chars(out, out + kNumberSize, value);
+    used_ += static_cast<size_t>(result.ptr - out);
+}
+
+void GeoJSONWriter::write_int(int64_t value) {
+    char* out = reserve(kNumberSize);
+    if (!out) {
+        return;
+    }
+    auto result = std::to_chars(out, out + kNumberSize, value);
+    used_ += static_cast<size_t>(result.ptr - out);
+}
+
+void GeoJSONWriter::write_value(const bsoncxx::types::bson_value::view& value) {
+    switch (value.type()) {
+        case bsoncxx::type::k_double:
+            write_double(value.get_double().value);
+            break;
+        case bsoncxx::type::k_int32:
+            write_int(value.get_int32().value);
+            break;
+        case bsoncxx::type::k_int64:
+            write_int(value.get_int64().value);
+            break;
+        case bsoncxx::type::k_string:
+            write_string(std::string_view(value.get_string().value.data(), value.get_string().value.size()));
+            break;
+        case bsoncxx::type::k_bool:
+            put(value.get_bool().value ? "true" : "false");
+            break;
+        case bsoncxx::type::k_document:
+            write_document(value.get_document().value);
+            break;
+        case bsoncxx::type::k_array:
+            write_array(value.get_array().value);
+            break;
+        case bsoncxx::type::k_date:
+            write_int(value.get_date().to_int64());
+            break;
+        case bsoncxx::type::k_oid:
+            write_string(value.get_oid().value.to_string());
+            break;
+        case bsoncxx::type::k_decimal128:
+            write_string(value.get_decimal128().value.to_string());
+            break;
+        default:
+            put("null");
+            break;
+    }
+}
+
+void GeoJSONWriter::write_document(const bsoncxx::document::view& doc) {
+    put('{');
+    bool first = true;
+    for (auto&& element : doc) {
+        if (!first) {
+            put(',');
+        }
+        first = false;
+        auto key = element.key();
+        write_string(std::string_view(key.data(), key.size()));
+        put(':');
+        write_value(element.get_value());
+    }
+    put('}');
+}
+
+void GeoJSONWriter::write_array(const bsoncxx::array::view& array) {
+    put('[');
+    bool first = true;
+    for (auto&& element : array) {
+        if (!first) {
+            put(',');
+        }
+        first = false;
+        write_value(element.get_value());
+    }
+    put(']');
+}
+
+}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "storage/geojson_export/output_sink.h"
+#include "storage/hash_id/hash_id.h"
+#include <bsoncxx/array/view.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <bsoncxx/types/bson_value/view.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+// Writes a GeoJSON FeatureCollection into a fixed-size buffer that is
+// flushed to the sink when full. BSON values are rendered directly, without
+// going through bsoncxx::to_json or per-feature strings; doubles use the
+// shortest round-trip form from std::to_chars.
+class GeoJSONWriter {
+public:
+    explicit GeoJSONWriter(OutputSink& sink, size_t buffer_size = kDefaultBufferSize);
+
+    GeoJSONWriter(const GeoJSONWriter&) = delete;
+    GeoJSONWriter& operator=(const GeoJSONWriter&) = delete;
+
+    bool begin();
+    // Writes one CAS document (hash, geometry, attributes) as a Feature.
+    bool write_feature(const bsoncxx::document::view& doc);
+    // Same, with the geometry already read from the document.
+    bool write_feature(const bsoncxx::document::view& doc, const bsoncxx::document::view& geometry);
+    bool write_feature(const HashId& hash, const bsoncxx::document::view& geometry, const bsoncxx::document::view& properties);
+    bool end();
+
+    uint64_t features() const;
+    uint64_t bytes_written() const;
+    bool failed() const;
+
+    static constexpr size_t kDefaultBufferSize = 1 << 20;
+
+private:
+    OutputSink& sink_;
+    std::vector<char> buffer_;
+    size_t used_;
+    uint64_t features_;
+    uint64_t bytes_written_;
+    bool failed_;
+
+    bool flush();
+    char* reserve(size_t size);
+    void put(char c);
+    void put(std::string_view text);
+
+    void write_string(std::string_view text);
+    void write_double(double value);
+    void write_int(int64_t value);
+    void write_value(const bsoncxx::types::bson_value::view& value);
+    void write_document(const bsoncxx::document::view& doc);
+    void write_array(const bsoncxx::array::view& array);
+};
+
+}
+}
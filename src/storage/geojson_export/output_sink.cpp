@@ -0,0 +1,276 @@
+#include "output_sink.h"
+#include <cerrno>
+#include <cstring>
+#include <vector>
+
+#ifdef GEOVERSION_HAVE_ZLIB
+#include <zlib.h>
+#endif
+
+#ifdef GEOVERSION_HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr size_t kCompressedBufferSize = 256 * 1024;
+
+bool ends_with(const std::string& value, const std::string& suffix) {
+    return value.size() >= suffix.size() &&
+           value.compare(value.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+#ifdef GEOVERSION_HAVE_ZLIB
+class GzipSink : public OutputSink {
+public:
+    explicit GzipSink(std::unique_ptr<FileSink> file)
+        : file_(std::move(file)), out_(kCompressedBufferSize), initialized_(false) {
+        std::memset(&stream_, 0, sizeof(stream_));
+        // windowBits 15 + 16 selects the gzip container instead of raw zlib.
+        initialized_ = deflateInit2(&stream_, Z_DEFAULT_COMPRESSION, Z_DEFLATED, 15 + 16, 8, Z_DEFAULT_STRATEGY) == Z_OK;
+        if (!initialized_) {
+            error_ = "cannot initialize gzip stream";
+        }
+    }
+
+    ~GzipSink() override {
+        if (initialized_) {
+            deflateEnd(&stream_);
+        }
+    }
+
+    bool write(const char* data, size_t size) override {
+        if (!initialized_) {
+            return false;
+        }
+        stream_.next_in = reinterpret_cast<Bytef*>(const_cast<char*>(data));
+        stream_.avail_in = static_cast<uInt>(size);
+        return pump(Z_NO_FLUSH);
+    }
+
+    bool finish() override {
+        if (!initialized_) {
+            return false;
+        }
+        stream_.next_in = nullptr;
+        stream_.avail_in = 0;
+        return pump(Z_FINISH) && file_->finish();
+    }
+
+private:
+    std::unique_ptr<FileSink> file_;
+    std::vector<char> out_;
+    z_stream stream_;
+    bool initialized_;
+
+    bool pump(int flush) {
+        while (true) {
+            stream_.next_out = reinterpret_cast<Bytef*>(out_.data());
+            stream_.avail_out = static_cast<uInt>(out_.size());
+            int status = deflate(&stream_, flush);
+            if (status == Z_STREAM_ERROR) {
+                error_ = "gzip compression failed";
+                return false;
+            }
+            size_t produced = out_.size() - stream_.avail_out;
+            if (produced > 0 && !file_->write(out_.data(), produced)) {
+                error_ = file_->error();
+                return false;
+            }
+            if (flush == Z_FINISH ? status == Z_STREAM_END : stream_.avail_in == 0 && stream_.avail_out != 0) {
+                return true;
+            }
+        }
+    }
+};
+#endif
+
+#ifdef GEOVERSION_HAVE_ZSTD
+class ZstdSink : public OutputSink {
+public:
+    explicit ZstdSink(std::unique_ptr<FileSink> file)
+        : file_(std::move(file)), out_(ZSTD_CStreamOutSize()), stream_(ZSTD_createCCtx()) {
+        if (!stream_) {
+            error_ = "cannot initialize zstd stream";
+            return;
+        }
+        ZSTD_CCtx_setParameter(stream_, ZSTD_c_compressionLevel, 3);
+    }
+
+    ~ZstdSink() override {
+        ZSTD_freeCCtx(stream_);
+    }
+
+    bool write(const char* data, size_t size) override {
+        ZSTD_inBuffer input{data, size, 0};
+        while (input.pos < input.size) {
+            if (!pump(input, ZSTD_e_continue)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool finish() override {
+        ZSTD_inBuffer input{nullptr, 0, 0};
+        while (true) {
+            size_t remaining = 0;
+            if (!pump(input, ZSTD_e_end, &remaining)) {
+                return false;
+            }
+            if (remaining == 0) {
+                return file_->finish();
+            }
+        }
+    }
+
+private:
+    std::unique_ptr<FileSink> file_;
+    std::vector<char> out_;
+    ZSTD_CCtx* stream_;
+
+    bool pump(ZSTD_inBuffer& input, ZSTD_EndDirective mode, size_t* remaining = nullptr) {
+        if (!stream_) {
+            return false;
+        }
+        ZSTD_outBuffer output{out_.data(), out_.size(), 0};
+        size_t status = ZSTD_compressStream2(stream_, &output, &input, mode);
+        if (ZSTD_isError(status)) {
+            error_ = std::string("zstd compression failed: ") + ZSTD_getErrorName(status);
+            return false;
+        }
+        if (output.pos > 0 && !file_->write(out_.data(), output.pos)) {
+            error_ = file_->error();
+            return false;
+        }
+        if (remaining) {
+            *remaining = status;
+        }
+        return true;
+    }
+};
+#endif
+
+}
+
+FileSink::FileSink() : file_(nullptr), owned_(false) {
+}
+
+FileSink::~FileSink() {
+    if (file_ && owned_) {
+        std::fclose(file_);
+    }
+}
+
+bool FileSink::open(const std::string& path) {
+    if (path == "-") {
+        file_ = stdout;
+        owned_ = false;
+        return true;
+    }
+    file_ = std::fopen(path.c_str(), "wb");
+    if (!file_) {
+        error_ = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    owned_ = true;
+    return true;
+}
+
+bool FileSink::write(const char* data, size_t size) {
+    if (!file_) {
+        return false;
+    }
+    if (std::fwrite(data, 1, size, file_) != size) {
+        error_ = std::string("write failed: ") + std::strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool FileSink::finish() {
+    if (!file_) {
+        return false;
+    }
+    bool ok = std::fflush(file_) == 0;
+    if (owned_) {
+        ok = std::fclose(file_) == 0 && ok;
+        file_ = nullptr;
+    }
+    if (!ok) {
+        error_ = std::string("flush failed: ") + std::strerror(errno);
+    }
+    return ok;
+}
+
+ExportCompression compression_from_path(const std::string& path) {
+    if (ends_with(path, ".gz")) {
+        return ExportCompression::Gzip;
+    }
+    if (ends_with(path, ".zst")) {
+        return ExportCompression::Zstd;
+    }
+    return ExportCompression::None;
+}
+
+bool compression_available(ExportCompression compression) {
+    switch (compression) {
+        case ExportCompression::None:
+            return true;
+        case ExportCompression::Gzip:
+#ifdef GEOVERSION_HAVE_ZLIB
+            return true;
+#else
+            return false;
+#endif
+        case ExportCompression::Zstd:
+#ifdef GEOVERSION_HAVE_ZSTD
+            return true;
+#else
+            return false;
+#endif
+    }
+    return false;
+}
+
+std::unique_ptr<OutputSink> open_output_sink(const std::string& path, ExportCompression compression, std::string& error) {
+    if (!compression_available(compression)) {
+        error = compression == ExportCompression::Gzip
+            ? "gzip support was not compiled in"
+            : "zstd support was not compiled in";
+        return nullptr;
+    }
+
+    auto file = std::make_unique<FileSink>();
+    if (!file->open(path)) {
+        error = file->error();
+        return nullptr;
+    }
+
+    std::unique_ptr<OutputSink> sink;
+    switch (compression) {
+        case ExportCompression::None:
+            return file;
+        case ExportCompression::Gzip:
+#ifdef GEOVERSION_HAVE_ZLIB
+            sink = std::make_unique<GzipSink>(std::move(file));
+#endif
+            break;
+        case ExportCompression::Zstd:
+#ifdef GEOVERSION_HAVE_ZSTD
+            sink = std::make_unique<ZstdSink>(std::move(file));
+#endif
+            break;
+    }
+    if (sink && !sink->error().empty()) {
+        error = sink->error();
+        return nullptr;
+    }
+    return sink;
+}
+
+}
+}
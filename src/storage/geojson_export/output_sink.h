@@ -0,0 +1,54 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdio>
+#include <memory>
+#include <string>
+
+namespace geoversion {
+namespace storage {
+
+enum class ExportCompression {
+    None,
+    Gzip,
+    Zstd
+};
+
+// Byte sink for exporters. Compressing sinks stream through a fixed-size
+// buffer, so memory does not depend on how much is written.
+class OutputSink {
+public:
+    virtual ~OutputSink() = default;
+
+    virtual bool write(const char* data, size_t size) = 0;
+    virtual bool finish() = 0;
+
+    const std::string& error() const { return error_; }
+
+protected:
+    std::string error_;
+};
+
+class FileSink : public OutputSink {
+public:
+    FileSink();
+    ~FileSink() override;
+
+    bool open(const std::string& path);
+    bool write(const char* data, size_t size) override;
+    bool finish() override;
+
+private:
+    FILE* file_;
+    bool owned_;
+};
+
+ExportCompression compression_from_path(const std::string& path);
+bool compression_available(ExportCompression compression);
+
+// path "-" writes to stdout. Returns nullptr and sets error if the file
+// cannot be opened or the compression was not compiled in.
+std::unique_ptr<OutputSink> open_output_sink(const std::string& path, ExportCompression compression, std::string& error);
+
+}
+}
@@ -0,0 +1,84 @@
+#include "geojson_import.h"
+#include "storage/geojson_import/geojson_reader.h"
+#include "utils/mapped_file/mapped_file.h"
+
+namespace geoversion {
+namespace storage {
+
+GeoJSONImporter::GeoJSONImporter(CAS& cas, const GeoJSONImportOptions& options)
+    : cas_(cas), options_(options) {
+    // Decoding happens on the calling thread and enters the pipeline after
+    // its parse stage, so that stage needs no more than one idle thread.
+    options_.pipeline.parse_threads = 1;
+}
+
+void GeoJSONImporter::set_progress(std::function<void(const GeoJSONImportProgress&)> on_progress) {
+    on_progress_ = std::move(on_progress);
+}
+
+GeoJSONImportReport GeoJSONImporter::import_file(const std::string& path) {
+    utils::MappedFile file;
+    if (!file.open(path)) {
+        GeoJSONImportReport report;
+        report.error = file.error();
+        return report;
+    }
+    return run(file.data(), file.size(), [&](size_t offset) { file.release_before(offset); });
+}
+
+GeoJSONImportReport GeoJSONImporter::import_buffer(const char* data, size_t size) {
+    return run(data, size, nullptr);
+}
+
+GeoJSONImportReport GeoJSONImporter::run(const char* data, size_t size, const std::function<void(size_t)>& release) {
+    GeoJSONImportReport report;
+    report.bytes = size;
+    if (size == 0) {
+        report.error = "empty input";
+        return report;
+    }
+
+    GeoJSONReader reader(data, size);
+    IngestPipeline pipeline(cas_, options_.pipeline);
+    pipeline.start();
+
+    auto start = std::chrono::steady_clock::now();
+    auto last_progress = start;
+    size_t released = 0;
+
+    BPO bpo;
+    while (reader.next(bpo)) {
+        if (!pipeline.submit(std::move(bpo))) {
+            break;
+        }
+
+        size_t offset = reader.offset();
+        if (release && offset - released >= options_.release_interval_bytes) {
+            release(offset);
+            released = offset;
+        }
+
+        auto now = std::chrono::steady_clock::now();
+        if (on_progress_ && now - last_progress >= options_.progress_interval) {
+            last_progress = now;
+            IngestPipelineStats stats = pipeline.get_stats();
+            GeoJSONImportProgress progress;
+            progress.bytes_read = offset;
+            progress.total_bytes = size;
+            progress.features = reader.features_read();
+            progress.stored = stats.store.inserted + stats.store.duplicates;
+            progress.elapsed = std::chrono::duration_cast<std::chrono::milliseconds>(now - start);
+            on_progress_(progress);
+        }
+    }
+
+    report.pipeline = pipeline.finish();
+    report.features = reader.features_read();
+    report.without_geometry = reader.features_skipped();
+    report.error = reader.error();
+    report.ok = !reader.failed();
+    return report;
+}
+
+}
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include "storage/cas/cas.h"
+#include "storage/ingest_pipeline/ingest_pipeline.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace geoversion {
+namespace storage {
+
+struct GeoJSONImportOptions {
+    IngestPipelineOptions pipeline;
+    size_t release_interval_bytes = 64 * 1024 * 1024;
+    std::chrono::milliseconds progress_interval{5000};
+};
+
+struct GeoJSONImportProgress {
+    size_t bytes_read = 0;
+    size_t total_bytes = 0;
+    uint64_t features = 0;
+    uint64_t stored = 0;
+    std::chrono::milliseconds elapsed{0};
+};
+
+struct GeoJSONImportReport {
+    bool ok = false;
+    std::string error;
+    size_t bytes = 0;
+    uint64_t features = 0;
+    uint64_t without_geometry = 0;
+    IngestPipelineStats pipeline;
+};
+
+// Imports a GeoJSON FeatureCollection file into the CAS. The file is
+// memory-mapped and decoded feature by feature; decoded BPOs go through
+// IngestPipeline, whose bounded queues keep memory flat for any file size.
+class GeoJSONImporter {
+public:
+    explicit GeoJSONImporter(CAS& cas, const GeoJSONImportOptions& options = GeoJSONImportOptions());
+
+    void set_progress(std::function<void(const GeoJSONImportProgress&)> on_progress);
+
+    GeoJSONImportReport import_file(const std::string& path);
+    GeoJSONImportReport import_buffer(const char* data, size_t size);
+
+private:
+    CAS& cas_;
+    GeoJSONImportOptions options_;
+    std::function<void(const GeoJSONImportProgress&)> on_progress_;
+
+    GeoJSONImportReport run(const char* data, size_t size, const std::function<void(size_t)>& release);
+};
+
+}
+}
@@ -0,0 +1,528 @@
+#include "geojson_reader.h"
+#include <bsoncxx/types.hpp>
+#include <charconv>
+#include <cstring>
+#include <limits>
+#include <optional>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+bool is_number_char(char c) {
+    return (c >= '0' && c <= '9') || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E';
+}
+
+int hex_value(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+void append_utf8(std::string& out, uint32_t code_point) {
+    if (code_point < 0x80) {
+        out.push_back(static_cast<char>(code_point));
+    } else if (code_point < 0x800) {
+        out.push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+        out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else if (code_point < 0x10000) {
+        out.push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    } else {
+        out.push_back(static_cast<char>(0xF0 | (code_point >> 18)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 12) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+        out.push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+    }
+}
+
+}
+
+GeoJSONReader::GeoJSONReader(const char* data, size_t size)
+    : begin_(data),
+      pos_(data),
+      end_(data + size),
+      state_(State::Start),
+      first_feature_(true),
+      features_read_(0),
+      features_skipped_(0) {
+}
+
+bool GeoJSONReader::next(BPO& bpo) {
+    if (state_ == State::Start) {
+        if (!open_features()) {
+            return false;
+        }
+        state_ = State::Features;
+    }
+
+    while (state_ == State::Features) {
+        skip_whitespace();
+        if (pos_ < end_ && *pos_ == ']') {
+            ++pos_;
+            state_ = State::Done;
+            close_collection();
+            return false;
+        }
+        if (!first_feature_ && !consume(',')) {
+            return false;
+        }
+        first_feature_ = false;
+
+        bool has_geometry = false;
+        if (!read_feature(bpo, has_geometry)) {
+            return false;
+        }
+        ++features_read_;
+        if (has_geometry) {
+            return true;
+        }
+        ++features_skipped_;
+    }
+    return false;
+}
+
+size_t GeoJSONReader::offset() const {
+    return static_cast<size_t>(pos_ - begin_);
+}
+
+uint64_t GeoJSONReader::features_read() const {
+    return features_read_;
+}
+
+uint64_t GeoJSONReader::features_skipped() const {
+    return features_skipped_;
+}
+
+bool GeoJSONReader::failed() const {
+    return !error_.empty();
+}
+
+const std::string& GeoJSONReader::error() const {
+    return error_;
+}
+
+bool GeoJSONReader::fail(const std::string& message) {
+    if (error_.empty()) {
+        error_ = message + " at byte " + std::to_string(offset());
+    }
+    state_ = State::Done;
+    return false;
+}
+
+void GeoJSONReader::skip_whitespace() {
+    while (pos_ < end_ && (*pos_ == ' ' || *pos_ == '\n' || *pos_ == '\r' || *pos_ == '\t')) {
+        ++pos_;
+    }
+}
+
+bool GeoJSONReader::consume(char expected) {
+    skip_whitespace();
+    if (pos_ >= end_ || *pos_ != expected) {
+        return fail(std::string("expected '") + expected + "'");
+    }
+    ++pos_;
+    return true;
+}
+
+bool GeoJSONReader::consume_literal(const char* literal) {
+    size_t length = std::strlen(literal);
+    if (static_cast<size_t>(end_ - pos_) < length || std::memcmp(pos_, literal, length) != 0) {
+        return fail(std::string("expected ") + literal);
+    }
+    pos_ += length;
+    return true;
+}
+
+// Walks the top-level object up to the opening bracket of "features".
+bool GeoJSONReader::open_features() {
+    if (!consume('{')) {
+        return false;
+    }
+
+    while (true) {
+        skip_whitespace();
+        if (pos_ < end_ && *pos_ == '}') {
+            return fail("FeatureCollection has no features array");
+        }
+        if (!parse_string(key_) || !consume(':')) {
+            return false;
+        }
+        if (key_ == "features") {
+            return consume('[');
+        }
+        if (!skip_value()) {
+            return false;
+        }
+        skip_whitespace();
+        if (pos_ < end_ && *pos_ == ',') {
+            ++pos_;
+            continue;
+        }
+        if (pos_ >= end_ || *pos_ != '}') {
+            return fail("expected ',' or '}'");
+        }
+    }
+}
+
+bool GeoJSONReader::close_collection() {
+    while (true) {
+        skip_whitespace();
+        if (pos_ < end_ && *pos_ == '}') {
+            ++pos_;
+            skip_whitespace();
+            return pos_ == end_ || fail("unexpected data after FeatureCollection");
+        }
+        if (!consume(',') || !parse_string(key_) || !consume(':') || !skip_value()) {
+            return false;
+        }
+    }
+}
+
+bool GeoJSONReader::read_feature(BPO& bpo, bool& has_geometry) {
+    if (!consume('{')) {
+        return false;
+    }
+
+    std::optional<bsoncxx::document::value> geometry;
+    std::optional<bsoncxx::document::value> properties;
+
+    skip_whitespace();
+    if (pos_ < end_ && *pos_ == '}') {
+        ++pos_;
+        has_geometry = false;
+        return true;
+    }
+
+    while (true) {
+        if (!parse_string(key_) || !consume(':')) {
+            return false;
+        }
+        skip_whitespace();
+
+        bool is_geometry = key_ == "geometry";
+        if ((is_geometry || key_ == "properties") && pos_ < end_ && *pos_ == '{') {
+            bsoncxx::builder::core builder(false);
+            if (!parse_members(builder, is_geometry, 1)) {
+                return false;
+            }
+            (is_geometry ? geometry : properties) = builder.extract_document();
+        } else if ((is_geometry || key_ == "properties") && pos_ < end_ && *pos_ == 'n') {
+            if (!consume_literal("null")) {
+                return false;
+            }
+        } else if (is_geometry || key_ == "properties") {
+            return fail("expected object or null for " + key_);
+        } else if (!skip_value()) {
+            return false;
+        }
+
+        skip_whitespace();
+        if (pos_ < end_ && *pos_ == ',') {
+            ++pos_;
+            skip_whitespace();
+            continue;
+        }
+        if (!consume('}')) {
+            return false;
+        }
+        break;
+    }
+
+    has_geometry = geometry.has_value();
+    if (has_geometry) {
+        bpo = BPO(
+            HashId(),
+            geometry->view(),
+            properties ? properties->view() : bsoncxx::document::view()
+        );
+    }
+    return true;
+}
+
+bool GeoJSONReader::parse_string(std::string& out) {
+    skip_whitespace();
+    if (pos_ >= end_ || *pos_ != '"') {
+        return fail("expected string");
+    }
+    ++pos_;
+    out.clear();
+
+    while (pos_ < end_) {
+        const char* run = pos_;
+        while (pos_ < end_ && *pos_ != '"' && *pos_ != '\\' && static_cast<unsigned char>(*pos_) >= 0x20) {
+            ++pos_;
+        }
+        out.append(run, pos_);
+        if (pos_ >= end_) {
+            break;
+        }
+
+        char c = *pos_++;
+        if (c == '"') {
+            return true;
+        }
+        if (c != '\\') {
+            return fail("control character in string");
+        }
+        if (pos_ >= end_) {
+            break;
+        }
+
+        char escape = *pos_++;
+        switch (escape) {
+            case '"': out.push_back('"'); break;
+            case '\\': out.push_back('\\'); break;
+            case '/': out.push_back('/'); break;
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                auto read_hex = [&](uint32_t& value) {
+                    if (end_ - pos_ < 4) {
+                        return false;
+                    }
+                    value = 0;
+                    for (int i = 0; i < 4; ++i) {
+                        int digit = hex_value(pos_[i]);
+                        if (digit < 0) {
+                            return false;
+                        }
+                        value = (value << 4) | static_cast<uint32_t>(digit);
+                    }
+                    pos_ += 4;
+                    return true;
+                };
+
+                uint32_t code_point = 0;
+                if (!read_hex(code_point)) {
+                    return fail("invalid \\u escape");
+                }
+                if (code_point >= 0xD800 && code_point <= 0xDBFF) {
+                    uint32_t low = 0;
+                    if (end_ - pos_ < 2 || pos_[0] != '\\' || pos_[1] != 'u') {
+                        return fail("unpaired surrogate");
+                    }
+                    pos_ += 2;
+                    if (!read_hex(low) || low < 0xDC00 || low > 0xDFFF) {
+                        return fail("unpaired surrogate");
+                    }
+                    code_point = 0x10000 + ((code_point - 0xD800) << 10) + (low - 0xDC00);
+                } else if (code_point >= 0xDC00 && code_point <= 0xDFFF) {
+                    return fail("unpaired surrogate");
+                }
+                append_utf8(out, code_point);
+                break;
+            }
+            default:
+                return fail("invalid escape");
+        }
+    }
+    return fail("unterminated string");
+}
+
+bool GeoJSONReader::parse_value(bsoncxx::builder::core& builder, bool as_double, int depth) {
+    if (depth > kMaxDepth) {
+        return fail("nesting too deep");
+    }
+
+    skip_whitespace();
+    if (pos_ >= end_) {
+        return fail("unexpected end of input");
+    }
+
+    switch (*pos_) {
+        case '"':
+            if (!parse_string(text_)) {
+                return false;
+            }
+            builder.append(bsoncxx::types::b_string{text_});
+            return true;
+        case '{':
+            builder.open_document();
+            if (!parse_members(builder, as_double, depth + 1)) {
+                return false;
+            }
+            builder.close_document();
+            return true;
+        case '[':
+            builder.open_array();
+            if (!parse_elements(builder, as_double, depth + 1)) {
+                return false;
+            }
+            builder.close_array();
+            return true;
+        case 't':
+            if (!consume_literal("true")) {
+                return false;
+            }
+            builder.append(bsoncxx::types::b_bool{true});
+            return true;
+        case 'f':
+            if (!consume_literal("false")) {
+                return false;
+            }
+            builder.append(bsoncxx::types::b_bool{false});
+            return true;
+        case 'n':
+            if (!consume_literal("null")) {
+                return false;
+            }
+            builder.append(bsoncxx::types::b_null{});
+            return true;
+        default:
+            return parse_number(builder, as_double);
+    }
+}
+
+// Expects pos_ at '{'; the caller opens and closes the BSON document.
+bool GeoJSONReader::parse_members(bsoncxx::builder::core& builder, bool as_double, int depth) {
+    ++pos_;
+    skip_whitespace();
+    if (pos_ < end_ && *pos_ == '}') {
+        ++pos_;
+        return true;
+    }
+
+    while (true) {
+        if (!parse_string(key_) || !consume(':')) {
+            return false;
+        }
+        builder.key_owned(key_);
+        if (!parse_value(builder, as_double, depth)) {
+            return false;
+        }
+        skip_whitespace();
+        if (pos_ < end_ && *pos_ == ',') {
+            ++pos_;
+            continue;
+        }
+        return consume('}');
+    }
+}
+
+bool GeoJSONReader::parse_elements(bsoncxx::builder::core& builder, bool as_double, int depth) {
+    ++pos_;
+    skip_whitespace();
+    if (pos_ < end_ && *pos_ == ']') {
+        ++pos_;
+        return true;
+    }
+
+    while (true) {
+        if (!parse_value(builder, as_double, depth)) {
+            return false;
+        }
+        skip_whitespace();
+        if (pos_ < end_ && *pos_ == ',') {
+            ++pos_;
+            continue;
+        }
+        return consume(']');
+    }
+}
+
+bool GeoJSONReader::parse_number(bsoncxx::builder::core& builder, bool as_double) {
+    const char* start = pos_;
+    bool integral = true;
+    while (pos_ < end_ && is_number_char(*pos_)) {
+        if (*pos_ == '.' || *pos_ == 'e' || *pos_ == 'E') {
+            integral = false;
+        }
+        ++pos_;
+    }
+    if (pos_ == start) {
+        return fail("unexpected character");
+    }
+
+    if (integral && !as_double) {
+        int64_t value = 0;
+        auto result = std::from_chars(start, pos_, value);
+        if (result.ec == std::errc() && result.ptr == pos_) {
+            if (value >= std::numeric_limits<int32_t>::min() && value <= std::numeric_limits<int32_t>::max()) {
+                builder.append(bsoncxx::types::b_int32{static_cast<int32_t>(value)});
+            } else {
+                builder.append(bsoncxx::types::b_int64{value});
+            }
+            return true;
+        }
+    }
+
+    double value = 0.0;
+    auto result = std::from_chars(start, pos_, value);
+    if (result.ec != std::errc() || result.ptr != pos_) {
+        return fail("invalid number");
+    }
+    builder.append(bsoncxx::types::b_double{value});
+    return true;
+}
+
+// Skips one value without decoding it. Containers are matched by bracket
+// depth only; their contents are not validated.
+bool GeoJSONReader::skip_value() {
+    skip_whitespace();
+    if (pos_ >= end_) {
+        return fail("unexpected end of input");
+    }
+
+    if (*pos_ == '"') {
+        return skip_string();
+    }
+
+    if (*pos_ != '{' && *pos_ != '[') {
+        const char* start = pos_;
+        while (pos_ < end_ && *pos_ != ',' && *pos_ != '}' && *pos_ != ']' &&
+               *pos_ != ' ' && *pos_ != '\n' && *pos_ != '\r' && *pos_ != '\t') {
+            ++pos_;
+        }
+        return pos_ != start || fail("expected value");
+    }
+
+    size_t depth = 0;
+    while (pos_ < end_) {
+        char c = *pos_;
+        if (c == '"') {
+            if (!skip_string()) {
+                return false;
+            }
+            continue;
+        }
+        ++pos_;
+        if (c == '{' || c == '[') {
+            ++depth;
+        } else if (c == '}' || c == ']') {
+            if (--depth == 0) {
+                return true;
+            }
+        }
+    }
+    return fail("unterminated value");
+}
+
+bool GeoJSONReader::skip_string() {
+    ++pos_;
+    while (pos_ < end_) {
+        const void* found = std::memchr(pos_, '"', static_cast<size_t>(end_ - pos_));
+        if (!found) {
+            break;
+        }
+        const char* quote = static_cast<const char*>(found);
+        size_t backslashes = 0;
+        for (const char* p = quote; p > pos_ && p[-1] == '\\'; --p) {
+            ++backslashes;
+        }
+        pos_ = quote + 1;
+        if (backslashes % 2 == 0) {
+            return true;
+        }
+    }
+    return fail("unterminated string");
+}
+
+}
+}
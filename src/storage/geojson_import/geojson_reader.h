@@ -0,0 +1,70 @@
+#pragma once
+
+#include "storage/bpo_storage/bpo_storage.h"
+#include <bsoncxx/builder/core.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace geoversion {
+namespace storage {
+
+// Pull parser for a GeoJSON FeatureCollection held in memory (typically a
+// MappedFile). Features are decoded one at a time straight into BSON
+// builders; everything outside "features" and outside a feature's
+// "geometry"/"properties" is skipped without being materialized.
+// Geometry numbers are always stored as doubles, matching GeoJSONValidator.
+class GeoJSONReader {
+public:
+    GeoJSONReader(const char* data, size_t size);
+
+    // Returns false at the end of the collection or on malformed input;
+    // error() tells the two apart. Features with a null geometry are skipped.
+    bool next(BPO& bpo);
+
+    size_t offset() const;
+    uint64_t features_read() const;
+    uint64_t features_skipped() const;
+    bool failed() const;
+    const std::string& error() const;
+
+    static constexpr int kMaxDepth = 256;
+
+private:
+    enum class State {
+        Start,
+        Features,
+        Done
+    };
+
+    const char* begin_;
+    const char* pos_;
+    const char* end_;
+    State state_;
+    bool first_feature_;
+    uint64_t features_read_;
+    uint64_t features_skipped_;
+    std::string error_;
+    std::string key_;
+    std::string text_;
+
+    bool fail(const std::string& message);
+    void skip_whitespace();
+    bool consume(char expected);
+    bool consume_literal(const char* literal);
+
+    bool open_features();
+    bool close_collection();
+    bool read_feature(BPO& bpo, bool& has_geometry);
+
+    bool parse_string(std::string& out);
+    bool parse_value(bsoncxx::builder::core& builder, bool as_double, int depth);
+    bool parse_members(bsoncxx::builder::core& builder, bool as_double, int depth);
+    bool parse_elements(bsoncxx::builder::core& builder, bool as_double, int depth);
+    bool parse_number(bsoncxx::builder::core& builder, bool as_double);
+    bool skip_value();
+    bool skip_string();
+};
+
+}
+}
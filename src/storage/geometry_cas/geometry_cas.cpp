@@ -0,0 +1,799 @@
+#include "geometry_cas.h"
+#include "storage/cas/canonical_hash.h"
+#include "storage/coordinate_codec/coordinate_codec.h"
+#include <bsoncxx/builder/core.hpp>
+#include <bsoncxx/builder/stream/document.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+#include <mongocxx/exception/bulk_write_exception.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/options/insert.hpp>
+#include <algorithm>
+#include <atomic>
+#include <future>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <unordered_set>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr int kDuplicateKeyError = 11000;
+
+bsoncxx::document::value make_in_filter(const std::vector<HashId>& hashes, size_t begin, size_t end) {
+    bsoncxx::builder::basic::array in_array;
+    for (size_t i = begin; i < end; ++i) {
+        in_array.append(hashes[i].to_bson());
+    }
+    bsoncxx::builder::basic::document in_doc;
+    in_doc.append(bsoncxx::builder::basic::kvp("$in", in_array));
+    bsoncxx::builder::basic::document filter;
+    filter.append(bsoncxx::builder::basic::kvp("hash", in_doc));
+    return filter.extract();
+}
+
+}
+
+GeometryCAS::GeometryCAS(mongocxx::collection geometries, mongocxx::collection chunks, size_t cache_bytes)
+    : connection_(nullptr), collection_(geometries), chunks_(chunks), touch_interval_(kDefaultTouchInterval),
+      cache_capacity_(cache_bytes), cache_bytes_(0), hits_(0), misses_(0) {
+}
+
+GeometryCAS::GeometryCAS(MongoDBConnection& connection, size_t cache_bytes)
+    : connection_(&connection), touch_interval_(kDefaultTouchInterval),
+      cache_capacity_(cache_bytes), cache_bytes_(0), hits_(0), misses_(0) {
+}
+
+GeometryCAS::CollectionLease GeometryCAS::lease_collection() {
+    if (!connection_) {
+        return CollectionLease{std::nullopt, collection_};
+    }
+    ClientLease lease = connection_->acquire();
+    mongocxx::collection collection = lease.collection(kCollectionName);
+    return CollectionLease{std::move(lease), collection};
+}
+
+GeometryCAS::CollectionLease GeometryCAS::lease_chunks() {
+    if (!connection_) {
+        return CollectionLease{std::nullopt, chunks_};
+    }
+    ClientLease lease = connection_->acquire();
+    mongocxx::collection collection = lease.collection(kChunkCollectionName);
+    return CollectionLease{std::move(lease), collection};
+}
+
+HashId GeometryCAS::compute_hash(const bsoncxx::document::view& geometry) {
+    static constexpr char kDomain[] = "geoversion.geometry.v1";
+
+    Sha256Stream stream;
+    stream.update(kDomain, sizeof(kDomain));
+    CanonicalHasher::append_document(stream, geometry);
+
+    return stream.finish();
+}
+
+void GeometryCAS::set_touch_interval(std::chrono::seconds interval) {
+    touch_interval_ = interval;
+}
+
+std::chrono::seconds GeometryCAS::get_touch_interval() const {
+    return touch_interval_;
+}
+
+// As CAS::touch: true if the geometry is stored and was stored within the
+// touch interval, refreshing last_stored_at only when it is stale. The
+// cache is not consulted, since a cached geometry may have been collected.
+bool GeometryCAS::touch(const HashId& hash) {
+    bsoncxx::builder::stream::document filter;
+    filter << "hash" << hash.to_bson();
+    bsoncxx::builder::stream::document projection;
+    projection << kLastStoredField << 1 << "_id" << 0;
+    mongocxx::options::find opts;
+    opts.projection(projection.view());
+
+    auto collection = lease_collection();
+    auto found = collection->find_one(filter.view(), opts);
+    if (!found) {
+        return false;
+    }
+    if (is_fresh(found->view())) {
+        return true;
+    }
+
+    bsoncxx::builder::stream::document update;
+    update << "$set" << bsoncxx::builder::stream::open_document
+           << kLastStoredField << bsoncxx::types::b_date{std::chrono::system_clock::now()}
+           << bsoncxx::builder::stream::close_document;
+    auto stale_filter = make_stale_filter(bsoncxx::types::bson_value::view{hash.to_bson()});
+    auto result = collection->update_one(stale_filter.view(), update.view());
+    if (result && result->matched_count() > 0) {
+        return true;
+    }
+    // Refreshed meanwhile by another store, or collected.
+    return collection->find_one(filter.view(), opts).has_value();
+}
+
+bool GeometryCAS::is_fresh(const bsoncxx::document::view& doc) const {
+    auto stored_at = doc[kLastStoredField];
+    return stored_at && stored_at.type() == bsoncxx::type::k_date &&
+           stored_at.get_date().value > std::chrono::system_clock::now().time_since_epoch() - touch_interval_;
+}
+
+bsoncxx::document::value GeometryCAS::make_stale_filter(const bsoncxx::types::bson_value::view& hash_match) const {
+    using bsoncxx::builder::basic::kvp;
+    using bsoncxx::builder::basic::make_array;
+    using bsoncxx::builder::basic::make_document;
+    bsoncxx::types::b_date threshold{std::chrono::system_clock::now() - touch_interval_};
+    return make_document(
+        kvp("hash", hash_match),
+        kvp("$or", make_array(
+            make_document(kvp(kLastStoredField, make_document(kvp("$lt", threshold)))),
+            make_document(kvp(kLastStoredField, make_document(kvp("$exists", false))))
+        ))
+    );
+}
+
+bool GeometryCAS::store(const GeometryRecord& record) {
+    if (!record.document) {
+        return store_chunked(record);
+    }
+    try {
+        if (touch(record.hash)) {
+            return true;
+        }
+        lease_collection()->insert_one(record.document->view());
+        return true;
+    } catch (const std::exception& e) {
+        // A concurrent writer may have stored the same geometry first.
+        if (exists(record.hash)) {
+            return true;
+        }
+        std::cerr << "Error storing geometry: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool GeometryCAS::store_many(const std::vector<GeometryRecord>& records) {
+    std::vector<HashId> hashes;
+    std::vector<bsoncxx::document::view> docs;
+    bool stored = true;
+    for (const auto& record : records) {
+        if (record.document) {
+            hashes.push_back(record.hash);
+            docs.push_back(record.document->view());
+        }
+    }
+    if (!docs.empty()) {
+        stored = insert_missing(false, hashes, docs);
+    }
+    for (const auto& record : records) {
+        if (!record.document) {
+            stored = store_chunked(record) && stored;
+        }
+    }
+    return stored;
+}
+
+// Inserts the documents whose hash is not stored yet and refreshes the
+// stale last_stored_at of those that are; hashes[i] is the hash of docs[i].
+// Losing a race to another writer counts as stored.
+bool GeometryCAS::insert_missing(
+    bool chunks,
+    const std::vector<HashId>& hashes,
+    const std::vector<bsoncxx::document::view>& docs
+) {
+    std::unordered_map<HashId, size_t> first_index;
+    first_index.reserve(hashes.size());
+    std::vector<HashId> candidates;
+    candidates.reserve(hashes.size());
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        if (first_index.emplace(hashes[i], i).second) {
+            candidates.push_back(hashes[i]);
+        }
+    }
+
+    try {
+        bsoncxx::builder::stream::document projection;
+        projection << "hash" << 1 << kLastStoredField << 1 << "_id" << 0;
+        mongocxx::options::find opts;
+        opts.projection(projection.view());
+
+        auto collection = chunks ? lease_chunks() : lease_collection();
+        for (size_t begin = 0; begin < candidates.size(); begin += kLookupChunkSize) {
+            size_t end = std::min(candidates.size(), begin + kLookupChunkSize);
+            auto filter = make_in_filter(candidates, begin, end);
+            std::vector<std::pair<HashId, size_t>> stale;
+            for (auto&& doc : collection->find(filter.view(), opts)) {
+                HashId hash;
+                if (!doc["hash"] || !HashId::from_bson(doc["hash"].get_value(), hash)) {
+                    continue;
+                }
+                auto found = first_index.find(hash);
+                if (found == first_index.end()) {
+                    continue;
+                }
+                if (!is_fresh(doc)) {
+                    stale.emplace_back(hash, found->second);
+                }
+                first_index.erase(found);
+            }
+            if (stale.empty()) {
+                continue;
+            }
+
+            bsoncxx::builder::basic::array stale_array;
+            for (const auto& entry : stale) {
+                stale_array.append(entry.first.to_bson());
+            }
+            bsoncxx::builder::basic::document stale_in;
+            stale_in.append(bsoncxx::builder::basic::kvp("$in", stale_array));
+            auto stale_filter = make_stale_filter(bsoncxx::types::bson_value::view{bsoncxx::types::b_document{stale_in.view()}});
+
+            bsoncxx::builder::stream::document touch;
+            touch << "$set" << bsoncxx::builder::stream::open_document
+                  << kLastStoredField << bsoncxx::types::b_date{std::chrono::system_clock::now()}
+                  << bsoncxx::builder::stream::close_document;
+            auto touched = collection->update_many(stale_filter.view(), touch.view());
+
+            // Fewer matched: some were refreshed by another store, or
+            // collected since the lookup and go back to be inserted.
+            if (!touched || touched->matched_count() < static_cast<int64_t>(stale.size())) {
+                bsoncxx::builder::basic::document stale_lookup;
+                stale_lookup.append(bsoncxx::builder::basic::kvp("hash", stale_in.view()));
+                std::unordered_set<HashId> present;
+                for (auto&& doc : collection->find(stale_lookup.view(), opts)) {
+                    HashId hash;
+                    if (doc["hash"] && HashId::from_bson(doc["hash"].get_value(), hash)) {
+                        present.insert(hash);
+                    }
+                }
+                for (const auto& entry : stale) {
+                    if (present.count(entry.first) == 0) {
+                        first_index.emplace(entry.first, entry.second);
+                    }
+                }
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error checking geometry existence: " << e.what() << std::endl;
+        return false;
+    }
+
+    if (first_index.empty()) {
+        return true;
+    }
+
+    std::vector<size_t> items;
+    items.reserve(first_index.size());
+    for (const auto& entry : first_index) {
+        items.push_back(entry.second);
+    }
+    std::sort(items.begin(), items.end());
+
+    std::vector<bsoncxx::document::view> missing;
+    missing.reserve(items.size());
+    for (size_t i : items) {
+        missing.push_back(docs[i]);
+    }
+
+    mongocxx::options::insert insert_opts;
+    insert_opts.ordered(false);
+
+    try {
+        auto collection = chunks ? lease_chunks() : lease_collection();
+        collection->insert_many(missing, insert_opts);
+        return true;
+    } catch (const mongocxx::bulk_write_exception& e) {
+        bool only_duplicates = false;
+        if (e.raw_server_error()) {
+            auto reply = e.raw_server_error()->view();
+            if (reply["writeErrors"] && reply["writeErrors"].type() == bsoncxx::type::k_array) {
+                only_duplicates = true;
+                for (auto&& error : reply["writeErrors"].get_array().value) {
+                    auto error_doc = error.get_document().value;
+                    if (!error_doc["code"] || error_doc["code"].get_int32().value != kDuplicateKeyError) {
+                        only_duplicates = false;
+                    }
+                }
+            }
+        }
+        if (!only_duplicates) {
+            std::cerr << "Error storing geometry batch: " << e.what() << std::endl;
+        }
+        return only_duplicates;
+    } catch (const std::exception& e) {
+        std::cerr << "Error storing geometry batch: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Chunks are written in batches of about kChunkBatchBytes while the
+// geometry is cut, then the manifest; a geometry that cannot be chunked
+// is stored whole.
+bool GeometryCAS::store_chunked(const GeometryRecord& record) {
+    try {
+        if (touch(record.hash)) {
+            return true;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error checking geometry existence: " << e.what() << std::endl;
+        return false;
+    }
+
+    std::vector<uint8_t> structure;
+    uint64_t positions = 0;
+    bsoncxx::builder::basic::array chunk_hashes;
+    std::vector<GeometryChunk> pending;
+    size_t pending_bytes = 0;
+    bool sink_failed = false;
+
+    bool split = GeometryChunker::split(record.geometry, structure, positions, [&](GeometryChunk&& chunk) {
+        chunk_hashes.append(chunk.hash.to_bson());
+        pending_bytes += chunk.data.size();
+        pending.push_back(std::move(chunk));
+        if (pending_bytes >= kChunkBatchBytes) {
+            sink_failed = !store_chunks(pending);
+            pending.clear();
+            pending_bytes = 0;
+        }
+        return !sink_failed;
+    });
+
+    bsoncxx::types::b_date now{std::chrono::system_clock::now()};
+    bsoncxx::builder::stream::document doc;
+    doc << "hash" << record.hash.to_bson();
+    if (split) {
+        if (!store_chunks(pending)) {
+            return false;
+        }
+        doc << CoordinateCodec::kEncodingField << kChunkedEncoding
+            << "structure" << bsoncxx::types::b_binary{bsoncxx::binary_sub_type::k_binary, static_cast<uint32_t>(structure.size()), structure.data()}
+            << "positions" << static_cast<int64_t>(positions)
+            << "chunks" << bsoncxx::types::b_array{chunk_hashes.view()};
+    } else if (sink_failed) {
+        return false;
+    } else {
+        doc << "geometry" << bsoncxx::types::b_document{record.geometry};
+    }
+    doc << "created_at" << now << kLastStoredField << now;
+
+    try {
+        lease_collection()->insert_one(doc.view());
+        return true;
+    } catch (const std::exception& e) {
+        if (exists(record.hash)) {
+            return true;
+        }
+        std::cerr << "Error storing geometry: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool GeometryCAS::store_chunks(const std::vector<GeometryChunk>& chunks) {
+    if (chunks.empty()) {
+        return true;
+    }
+    std::vector<bsoncxx::document::value> values;
+    std::vector<bsoncxx::document::view> docs;
+    std::vector<HashId> hashes;
+    values.reserve(chunks.size());
+    docs.reserve(chunks.size());
+    hashes.reserve(chunks.size());
+    bsoncxx::types::b_date now{std::chrono::system_clock::now()};
+    for (const auto& chunk : chunks) {
+        bsoncxx::builder::stream::document doc;
+        doc << "hash" << chunk.hash.to_bson()
+            << "positions" << static_cast<int32_t>(chunk.positions)
+            << "data" << bsoncxx::types::b_binary{bsoncxx::binary_sub_type::k_binary, static_cast<uint32_t>(chunk.data.size()), chunk.data.data()}
+            << "created_at" << now << kLastStoredField << now;
+        values.push_back(doc << bsoncxx::builder::stream::finalize);
+        docs.push_back(values.back().view());
+        hashes.push_back(chunk.hash);
+    }
+    return insert_missing(true, hashes, docs);
+}
+
+GeometryCAS::Handle GeometryCAS::retrieve(const HashId& hash) {
+    if (auto cached = cache_get(hash)) {
+        return cached;
+    }
+
+    try {
+        bsoncxx::builder::stream::document filter;
+        filter << "hash" << hash.to_bson();
+
+        auto result = lease_collection()->find_one(filter.view());
+        if (!result) {
+            return nullptr;
+        }
+
+        Handle geometry = decode(result->view());
+        if (geometry) {
+            cache_put(hash, geometry);
+        }
+        return geometry;
+    } catch (const std::exception& e) {
+        std::cerr << "Error retrieving geometry: " << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
+std::vector<GeometryCAS::Handle> GeometryCAS::retrieve_many(const std::vector<HashId>& hashes) {
+    std::vector<Handle> results(hashes.size());
+    std::unordered_map<HashId, std::vector<size_t>> positions;
+    std::vector<HashId> pending;
+
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        if ((results[i] = cache_get(hashes[i]))) {
+            continue;
+        }
+        auto& slots = positions[hashes[i]];
+        if (slots.empty()) {
+            pending.push_back(hashes[i]);
+        }
+        slots.push_back(i);
+    }
+
+    auto place = [&](const HashId& hash, const Handle& geometry) {
+        if (!geometry) {
+            return;
+        }
+        cache_put(hash, geometry);
+        for (size_t index : positions[hash]) {
+            results[index] = geometry;
+        }
+    };
+
+    // Chunked geometries are assembled once the lookup has released its
+    // client, since assembly leases clients of its own.
+    std::vector<std::pair<HashId, bsoncxx::document::value>> manifests;
+    try {
+        auto collection = lease_collection();
+        for (size_t begin = 0; begin < pending.size(); begin += kLookupChunkSize) {
+            size_t end = std::min(pending.size(), begin + kLookupChunkSize);
+            auto filter = make_in_filter(pending, begin, end);
+
+            mongocxx::options::find opts;
+            opts.batch_size(static_cast<int32_t>(end - begin));
+
+            for (auto&& doc : collection->find(filter.view(), opts)) {
+                HashId hash;
+                if (!doc["hash"] || !HashId::from_bson(doc["hash"].get_value(), hash) || !positions.count(hash)) {
+                    continue;
+                }
+                if (doc["chunks"]) {
+                    manifests.emplace_back(hash, bsoncxx::document::value(doc));
+                    continue;
+                }
+                place(hash, decode(doc));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error retrieving geometry batch: " << e.what() << std::endl;
+    }
+
+    for (const auto& manifest : manifests) {
+        place(manifest.first, assemble(manifest.second.view()));
+    }
+
+    return results;
+}
+
+bool GeometryCAS::exists(const HashId& hash) {
+    if (cache_get(hash)) {
+        return true;
+    }
+
+    try {
+        bsoncxx::builder::stream::document filter;
+        filter << "hash" << hash.to_bson();
+
+        bsoncxx::builder::stream::document projection;
+        projection << "hash" << 1 << "_id" << 0;
+
+        mongocxx::options::find opts;
+        opts.projection(projection.view());
+
+        return lease_collection()->find_one(filter.view(), opts).has_value();
+    } catch (const std::exception& e) {
+        std::cerr << "Error checking geometry existence: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool GeometryCAS::remove(const HashId& hash) {
+    try {
+        bsoncxx::builder::stream::document filter;
+        filter << "hash" << hash.to_bson();
+
+        auto result = lease_collection()->delete_one(filter.view());
+        cache_erase(hash);
+        return result->deleted_count() > 0;
+    } catch (const std::exception& e) {
+        std::cerr << "Error removing geometry: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+size_t GeometryCAS::count() {
+    try {
+        bsoncxx::builder::stream::document empty_filter;
+        return lease_collection()->count_documents(empty_filter.view());
+    } catch (const std::exception& e) {
+        std::cerr << "Error counting geometries: " << e.what() << std::endl;
+        return 0;
+    }
+}
+
+void GeometryCAS::forget(const std::vector<HashId>& hashes) {
+    for (const auto& hash : hashes) {
+        cache_erase(hash);
+    }
+}
+
+GeometryCacheStats GeometryCAS::get_cache_stats() const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    GeometryCacheStats stats;
+    stats.hits = hits_;
+    stats.misses = misses_;
+    stats.entries = entries_.size();
+    stats.bytes = cache_bytes_;
+    return stats;
+}
+
+void GeometryCAS::clear_cache() {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    lru_.clear();
+    entries_.clear();
+    cache_bytes_ = 0;
+}
+
+GeometryCAS::Handle GeometryCAS::cache_get(const HashId& hash) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto found = entries_.find(hash);
+    if (found == entries_.end()) {
+        ++misses_;
+        return nullptr;
+    }
+    ++hits_;
+    lru_.splice(lru_.begin(), lru_, found->second);
+    return found->second->geometry;
+}
+
+void GeometryCAS::cache_put(const HashId& hash, const Handle& geometry) {
+    size_t bytes = sizeof(CacheEntry) + sizeof(bsoncxx::document::value) + geometry->view().length();
+    if (bytes > cache_capacity_) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (entries_.count(hash)) {
+        return;
+    }
+    lru_.push_front(CacheEntry{hash, geometry, bytes});
+    entries_.emplace(hash, lru_.begin());
+    cache_bytes_ += bytes;
+
+    while (cache_bytes_ > cache_capacity_) {
+        cache_bytes_ -= lru_.back().bytes;
+        entries_.erase(lru_.back().hash);
+        lru_.pop_back();
+    }
+}
+
+void GeometryCAS::cache_erase(const HashId& hash) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto found = entries_.find(hash);
+    if (found == entries_.end()) {
+        return;
+    }
+    cache_bytes_ -= found->second->bytes;
+    lru_.erase(found->second);
+    entries_.erase(found);
+}
+
+GeometryCAS::Handle GeometryCAS::decode(const bsoncxx::document::view& doc) {
+    auto encoding = doc[CoordinateCodec::kEncodingField];
+    if (encoding && encoding.type() == bsoncxx::type::k_string &&
+        std::string(encoding.get_string().value) == kChunkedEncoding) {
+        return assemble(doc);
+    }
+
+    bsoncxx::document::view geometry;
+    std::optional<bsoncxx::document::value> decoded;
+    if (!read_stored_geometry(doc, geometry, decoded)) {
+        return nullptr;
+    }
+    if (decoded) {
+        return std::make_shared<const bsoncxx::document::value>(std::move(*decoded));
+    }
+    return std::make_shared<const bsoncxx::document::value>(geometry);
+}
+
+// Chunks arrive in windows of kChunkWindow; the next window is fetched
+// while the current one is appended, so at most two windows are in memory
+// besides the geometry being built.
+GeometryCAS::Handle GeometryCAS::assemble(const bsoncxx::document::view& manifest) {
+    auto structure = manifest["structure"];
+    auto positions = manifest["positions"];
+    auto chunk_list = manifest["chunks"];
+    if (!structure || structure.type() != bsoncxx::type::k_binary ||
+        !positions || positions.type() != bsoncxx::type::k_int64 ||
+        !chunk_list || chunk_list.type() != bsoncxx::type::k_array) {
+        std::cerr << "Error assembling geometry: malformed manifest" << std::endl;
+        return nullptr;
+    }
+
+    std::vector<HashId> hashes;
+    for (auto&& element : chunk_list.get_array().value) {
+        HashId hash;
+        if (!HashId::from_bson(element.get_value(), hash)) {
+            std::cerr << "Error assembling geometry: malformed chunk hash" << std::endl;
+            return nullptr;
+        }
+        hashes.push_back(hash);
+    }
+
+    bool parallel = connection_ && connection_->is_pooled();
+    auto fetch_window = [this, &hashes](size_t begin) {
+        std::vector<GeometryChunk> window;
+        if (!fetch_chunks(hashes, begin, std::min(hashes.size(), begin + kChunkWindow), window)) {
+            window.clear();
+        }
+        return window;
+    };
+    auto start_window = [&](size_t begin) {
+        return std::async(parallel ? std::launch::async : std::launch::deferred, fetch_window, begin);
+    };
+
+    size_t next_begin = 0;
+    std::future<std::vector<GeometryChunk>> next = start_window(next_begin);
+    std::vector<GeometryChunk> window;
+    size_t taken = 0;
+    size_t consumed = 0;
+
+    auto next_chunk = [&](GeometryChunk& chunk) {
+        if (taken == window.size()) {
+            if (next_begin >= hashes.size()) {
+                return false;
+            }
+            window = next.get();
+            next_begin += kChunkWindow;
+            taken = 0;
+            if (window.empty()) {
+                return false;
+            }
+            if (next_begin < hashes.size()) {
+                next = start_window(next_begin);
+            }
+        }
+        chunk = std::move(window[taken++]);
+        ++consumed;
+        return true;
+    };
+
+    auto binary = structure.get_binary();
+    bsoncxx::document::value geometry{bsoncxx::document::view()};
+    bool assembled = GeometryChunker::assemble(
+        binary.bytes, binary.size, static_cast<uint64_t>(positions.get_int64().value), next_chunk, geometry
+    );
+    if (!assembled || consumed != hashes.size()) {
+        std::cerr << "Error assembling geometry: chunks missing or inconsistent" << std::endl;
+        return nullptr;
+    }
+    return std::make_shared<const bsoncxx::document::value>(std::move(geometry));
+}
+
+// Fills chunks with hashes[begin, end) in order. With a pooled connection
+// the range is split across up to kMaxParallelFetches leased clients.
+bool GeometryCAS::fetch_chunks(
+    const std::vector<HashId>& hashes,
+    size_t begin,
+    size_t end,
+    std::vector<GeometryChunk>& chunks
+) {
+    chunks.assign(end - begin, GeometryChunk());
+    std::unordered_map<HashId, std::vector<size_t>> slots;
+    for (size_t i = begin; i < end; ++i) {
+        slots[hashes[i]].push_back(i - begin);
+    }
+    std::vector<HashId> unique;
+    unique.reserve(slots.size());
+    for (const auto& entry : slots) {
+        unique.push_back(entry.first);
+    }
+
+    std::atomic<bool> failed{false};
+    std::mutex chunks_mutex;
+    auto fetch_range = [&](size_t from, size_t to) {
+        try {
+            auto filter = make_in_filter(unique, from, to);
+            auto collection = lease_chunks();
+            for (auto&& doc : collection->find(filter.view())) {
+                HashId hash;
+                auto data = doc["data"];
+                auto count = doc["positions"];
+                if (!doc["hash"] || !HashId::from_bson(doc["hash"].get_value(), hash) ||
+                    !data || data.type() != bsoncxx::type::k_binary ||
+                    !count || count.type() != bsoncxx::type::k_int32) {
+                    continue;
+                }
+                auto found = slots.find(hash);
+                if (found == slots.end()) {
+                    continue;
+                }
+                auto binary = data.get_binary();
+                std::lock_guard<std::mutex> lock(chunks_mutex);
+                for (size_t slot : found->second) {
+                    chunks[slot].hash = hash;
+                    chunks[slot].positions = static_cast<uint32_t>(count.get_int32().value);
+                    chunks[slot].data.assign(binary.bytes, binary.bytes + binary.size);
+                }
+            }
+        } catch (const std::exception& e) {
+            std::cerr << "Error fetching geometry chunks: " << e.what() << std::endl;
+            failed = true;
+        }
+    };
+
+    size_t workers = connection_ && connection_->is_pooled()
+        ? std::min(unique.size(), kMaxParallelFetches)
+        : 1;
+    if (workers < 2) {
+        fetch_range(0, unique.size());
+    } else {
+        size_t per_worker = (unique.size() + workers - 1) / workers;
+        std::vector<std::thread> threads;
+        for (size_t from = 0; from < unique.size(); from += per_worker) {
+            threads.emplace_back(fetch_range, from, std::min(unique.size(), from + per_worker));
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+
+    if (failed) {
+        return false;
+    }
+    for (const auto& chunk : chunks) {
+        if (chunk.positions == 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool is_geometry_reference(const bsoncxx::document::view& doc) {
+    auto encoding = doc[CoordinateCodec::kEncodingField];
+    return encoding && encoding.type() == bsoncxx::type::k_string &&
+           std::string(encoding.get_string().value) == kReferenceEncoding;
+}
+
+bool read_geometry_hash(const bsoncxx::document::view& doc, HashId& hash) {
+    auto element = doc[kGeometryHashField];
+    return element && HashId::from_bson(element.get_value(), hash);
+}
+
+bsoncxx::document::value reassemble_document(const bsoncxx::document::view& doc, const bsoncxx::document::view& geometry) {
+    bsoncxx::builder::core builder(false);
+    for (auto&& element : doc) {
+        auto key = element.key();
+        if (key == "geometry" || key == "geometry_type" ||
+            key == CoordinateCodec::kEncodingField || key == CoordinateCodec::kBlobField) {
+            continue;
+        }
+        builder.key_view(key);
+        builder.append(element.get_value());
+    }
+    builder.key_view("geometry");
+    builder.append(bsoncxx::types::b_document{geometry});
+    return builder.extract_document();
+}
+
+}
+}
@@ -0,0 +1,154 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include "storage/geometry_cas/geometry_chunks.h"
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include <mongocxx/collection.hpp>
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <bsoncxx/types/bson_value/view.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+// A geometry to store, keyed by its hash: either a ready bpo_geometries
+// document or, for an oversized geometry, the geometry itself, which the
+// GeometryCAS splits into chunks.
+struct GeometryRecord {
+    HashId hash;
+    std::optional<bsoncxx::document::value> document;
+    bsoncxx::document::view geometry;
+    // Holds `geometry` when the caller's document does not outlive the record.
+    std::optional<bsoncxx::document::value> owned;
+};
+
+struct GeometryCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// Content-addressed store of geometries alone, so BPOs that differ only in
+// their attributes share one copy of the geometry. Documents use the same
+// geometry fields as bpo_cas, including the quantized blob encodings.
+// Decoded geometries are kept in an LRU cache of their own, bounded by size.
+// Geometries of kChunkThreshold bytes and more are stored as a manifest
+// over content-addressed chunks in bpo_geometry_chunks, which versions of
+// a geometry share, and are reassembled from chunks fetched in parallel.
+class GeometryCAS {
+public:
+    using Handle = std::shared_ptr<const bsoncxx::document::value>;
+
+    GeometryCAS(mongocxx::collection geometries, mongocxx::collection chunks, size_t cache_bytes = kDefaultCacheBytes);
+    explicit GeometryCAS(MongoDBConnection& connection, size_t cache_bytes = kDefaultCacheBytes);
+
+    GeometryCAS(const GeometryCAS&) = delete;
+    GeometryCAS& operator=(const GeometryCAS&) = delete;
+
+    static HashId compute_hash(const bsoncxx::document::view& geometry);
+
+    // Geometries already stored count as stored.
+    bool store(const GeometryRecord& record);
+    bool store_many(const std::vector<GeometryRecord>& records);
+
+    Handle retrieve(const HashId& hash);
+    std::vector<Handle> retrieve_many(const std::vector<HashId>& hashes);
+    bool exists(const HashId& hash);
+    bool remove(const HashId& hash);
+    size_t count();
+    // Drops cached copies of geometries deleted behind the GeometryCAS.
+    void forget(const std::vector<HashId>& hashes);
+
+    // As CAS::set_touch_interval, for geometries and chunks found by a store.
+    void set_touch_interval(std::chrono::seconds interval);
+    std::chrono::seconds get_touch_interval() const;
+
+    GeometryCacheStats get_cache_stats() const;
+    void clear_cache();
+
+    static constexpr size_t kDefaultCacheBytes = 64 * 1024 * 1024;
+    static constexpr size_t kLookupChunkSize = 500;
+    static constexpr size_t kChunkThreshold = 4 * 1024 * 1024;
+    static constexpr size_t kChunkBatchBytes = 8 * 1024 * 1024;
+    static constexpr size_t kChunkWindow = 16;
+    static constexpr size_t kMaxParallelFetches = 4;
+    static constexpr const char* kCollectionName = "bpo_geometries";
+    static constexpr const char* kChunkCollectionName = "bpo_geometry_chunks";
+    static constexpr const char* kChunkedEncoding = "chunked";
+    // Refreshed by stores that find the geometry or chunk, at most once per
+    // touch interval; the garbage collector keeps what was stored since.
+    static constexpr const char* kLastStoredField = "last_stored_at";
+    static constexpr std::chrono::seconds kDefaultTouchInterval{30 * 60};
+
+private:
+    struct CollectionLease {
+        std::optional<ClientLease> lease;
+        mongocxx::collection collection;
+
+        mongocxx::collection* operator->() { return &collection; }
+    };
+
+    struct CacheEntry {
+        HashId hash;
+        Handle geometry;
+        size_t bytes;
+    };
+
+    MongoDBConnection* connection_;
+    mongocxx::collection collection_;
+    mongocxx::collection chunks_;
+
+    mutable std::mutex cache_mutex_;
+    std::list<CacheEntry> lru_;
+    std::unordered_map<HashId, std::list<CacheEntry>::iterator> entries_;
+    std::chrono::seconds touch_interval_;
+    size_t cache_capacity_;
+    size_t cache_bytes_;
+    uint64_t hits_;
+    uint64_t misses_;
+
+    CollectionLease lease_collection();
+    CollectionLease lease_chunks();
+    Handle cache_get(const HashId& hash);
+    void cache_put(const HashId& hash, const Handle& geometry);
+    void cache_erase(const HashId& hash);
+
+    bool touch(const HashId& hash);
+    bool is_fresh(const bsoncxx::document::view& doc) const;
+    bsoncxx::document::value make_stale_filter(const bsoncxx::types::bson_value::view& hash_match) const;
+    bool insert_missing(
+        bool chunks,
+        const std::vector<HashId>& hashes,
+        const std::vector<bsoncxx::document::view>& docs
+    );
+    bool store_chunked(const GeometryRecord& record);
+    bool store_chunks(const std::vector<GeometryChunk>& chunks);
+    Handle decode(const bsoncxx::document::view& doc);
+    Handle assemble(const bsoncxx::document::view& manifest);
+    bool fetch_chunks(const std::vector<HashId>& hashes, size_t begin, size_t end, std::vector<GeometryChunk>& chunks);
+};
+
+// Fields of a bpo_cas document whose geometry lives in the geometry CAS.
+// `geometry` then holds only the envelope, for the 2dsphere index.
+constexpr const char* kReferenceEncoding = "ref";
+constexpr const char* kGeometryHashField = "geometry_hash";
+constexpr const char* kAttributesHashField = "attributes_hash";
+
+bool is_geometry_reference(const bsoncxx::document::view& doc);
+bool read_geometry_hash(const bsoncxx::document::view& doc, HashId& hash);
+
+// Copy of a reference document with the full geometry in place of the envelope.
+bsoncxx::document::value reassemble_document(const bsoncxx::document::view& doc, const bsoncxx::document::view& geometry);
+
+}
+}
@@ -0,0 +1,372 @@
+#include "geometry_chunks.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/cas/canonical_hash.h"
+#include <bsoncxx/builder/core.hpp>
+#include <bsoncxx/types.hpp>
+#include <cmath>
+#include <cstring>
+#include <iterator>
+#include <string>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr double kExactIntegerLimit = 9007199254740992.0;
+
+void put_varint(std::vector<uint8_t>& out, uint64_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+// Array nesting below `coordinates`, by GeometryType.
+int coordinate_levels(GeometryType type) {
+    switch (type) {
+        case GeometryType::Point:
+            return 0;
+        case GeometryType::MultiPoint:
+        case GeometryType::LineString:
+            return 1;
+        case GeometryType::MultiLineString:
+        case GeometryType::Polygon:
+            return 2;
+        default:
+            return 3;
+    }
+}
+
+bool is_boundary(const uint8_t* position) {
+    uint64_t x = 0;
+    uint64_t y = 0;
+    std::memcpy(&x, position, sizeof(double));
+    std::memcpy(&y, position + sizeof(double), sizeof(double));
+    uint64_t h = x * 0x9E3779B97F4A7C15ull ^ y * 0xC2B2AE3D27D4EB4Full;
+    h ^= h >> 29;
+    h *= 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 32;
+    return (h & GeometryChunker::kBoundaryMask) == 0;
+}
+
+class ChunkWriter {
+public:
+    explicit ChunkWriter(const GeometryChunker::ChunkSink& sink) : sink_(sink), count_(0), total_(0) {}
+
+    bool add(double x, double y) {
+        size_t offset = data_.size();
+        data_.resize(offset + GeometryChunker::kPositionBytes);
+        std::memcpy(data_.data() + offset, &x, sizeof(double));
+        std::memcpy(data_.data() + offset + sizeof(double), &y, sizeof(double));
+        ++count_;
+        ++total_;
+        if (count_ >= GeometryChunker::kMaxPositions ||
+            (count_ >= GeometryChunker::kMinPositions && is_boundary(data_.data() + offset))) {
+            return flush();
+        }
+        return true;
+    }
+
+    bool flush() {
+        if (count_ == 0) {
+            return true;
+        }
+        GeometryChunk chunk;
+        chunk.hash = GeometryChunker::hash_chunk(data_.data(), data_.size());
+        chunk.positions = count_;
+        chunk.data = std::move(data_);
+        data_ = std::vector<uint8_t>();
+        data_.reserve(chunk.data.size());
+        count_ = 0;
+        return sink_(std::move(chunk));
+    }
+
+    uint64_t total() const {
+        return total_;
+    }
+
+private:
+    const GeometryChunker::ChunkSink& sink_;
+    std::vector<uint8_t> data_;
+    uint32_t count_;
+    uint64_t total_;
+};
+
+// With structure set, checks the geometry and records its shape; with
+// writer set, streams its positions. split() runs one pass of each.
+class Walker {
+public:
+    Walker(std::vector<uint8_t>* structure, ChunkWriter* writer) : structure_(structure), writer_(writer) {}
+
+    bool geometry(const bsoncxx::document::view& geometry, size_t depth) {
+        GeometryType type = GeoJSONValidator::get_type(geometry);
+        if (type == GeometryType::Unknown) {
+            return false;
+        }
+        // Members are found by name, in any order, but nothing else may be
+        // present: assemble() rebuilds exactly these two.
+        bool collection = type == GeometryType::GeometryCollection;
+        auto member_array = geometry[collection ? "geometries" : "coordinates"];
+        if (!member_array || member_array.type() != bsoncxx::type::k_array ||
+            std::distance(geometry.begin(), geometry.end()) != 2) {
+            return false;
+        }
+        auto members = member_array.get_array().value;
+        if (structure_) {
+            structure_->push_back(static_cast<uint8_t>(type));
+        }
+
+        if (!collection) {
+            return coordinates(members, coordinate_levels(type));
+        }
+        if (depth == 0) {
+            return false;
+        }
+        count(members);
+        for (auto&& member : members) {
+            if (member.type() != bsoncxx::type::k_document ||
+                !this->geometry(member.get_document().value, depth - 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    bool coordinates(const bsoncxx::array::view& array, int levels) {
+        if (levels == 0) {
+            auto it = array.begin();
+            double x = 0.0;
+            if (it == array.end() || !number(*it, x)) {
+                return false;
+            }
+            double y = 0.0;
+            if (++it == array.end() || !number(*it, y)) {
+                return false;
+            }
+            if (++it != array.end()) {
+                return false;
+            }
+            return !writer_ || writer_->add(x, y);
+        }
+        count(array);
+        for (auto&& member : array) {
+            if (member.type() != bsoncxx::type::k_array || !coordinates(member.get_array().value, levels - 1)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    std::vector<uint8_t>* structure_;
+    ChunkWriter* writer_;
+
+    // Integers come back as doubles, which hash the same as long as the
+    // conversion is exact.
+    static bool number(const bsoncxx::array::element& element, double& value) {
+        switch (element.type()) {
+            case bsoncxx::type::k_double:
+                value = element.get_double().value;
+                return true;
+            case bsoncxx::type::k_int32:
+                value = element.get_int32().value;
+                return true;
+            case bsoncxx::type::k_int64: {
+                int64_t integer = element.get_int64().value;
+                value = static_cast<double>(integer);
+                return std::fabs(value) < kExactIntegerLimit && static_cast<int64_t>(value) == integer;
+            }
+            default:
+                return false;
+        }
+    }
+
+    void count(const bsoncxx::array::view& array) {
+        if (structure_) {
+            put_varint(*structure_, static_cast<uint64_t>(std::distance(array.begin(), array.end())));
+        }
+    }
+};
+
+class StructureReader {
+public:
+    StructureReader(const uint8_t* data, size_t size) : pos_(data), end_(data + size) {}
+
+    bool byte(uint8_t& value) {
+        if (pos_ == end_) {
+            return false;
+        }
+        value = *pos_++;
+        return true;
+    }
+
+    bool varint(uint64_t& value) {
+        value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            uint8_t next = 0;
+            if (!byte(next)) {
+                return false;
+            }
+            value |= static_cast<uint64_t>(next & 0x7F) << shift;
+            if ((next & 0x80) == 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    bool done() const {
+        return pos_ == end_;
+    }
+
+private:
+    const uint8_t* pos_;
+    const uint8_t* end_;
+};
+
+class Assembler {
+public:
+    Assembler(StructureReader& reader, uint64_t positions, const GeometryChunker::ChunkSource& next_chunk)
+        : reader_(reader), remaining_(positions), next_chunk_(next_chunk), offset_(0) {}
+
+    bool geometry(bsoncxx::builder::core& builder, size_t depth) {
+        uint8_t tag = 0;
+        if (!reader_.byte(tag) || tag >= static_cast<uint8_t>(GeometryType::Unknown)) {
+            return false;
+        }
+        GeometryType type = static_cast<GeometryType>(tag);
+        builder.key_view("type");
+        builder.append(GeoJSONValidator::type_name(type));
+
+        if (type != GeometryType::GeometryCollection) {
+            builder.key_view("coordinates");
+            return coordinates(builder, coordinate_levels(type));
+        }
+
+        uint64_t count = 0;
+        if (depth == 0 || !reader_.varint(count)) {
+            return false;
+        }
+        builder.key_view("geometries");
+        builder.open_array();
+        for (uint64_t i = 0; i < count; ++i) {
+            builder.open_document();
+            if (!geometry(builder, depth - 1)) {
+                return false;
+            }
+            builder.close_document();
+        }
+        builder.close_array();
+        return true;
+    }
+
+    // Every position was consumed and the last chunk has nothing left over.
+    bool finished() const {
+        return remaining_ == 0 && offset_ == chunk_.data.size();
+    }
+
+private:
+    StructureReader& reader_;
+    uint64_t remaining_;
+    const GeometryChunker::ChunkSource& next_chunk_;
+    GeometryChunk chunk_;
+    size_t offset_;
+
+    bool coordinates(bsoncxx::builder::core& builder, int levels) {
+        builder.open_array();
+        if (levels == 0) {
+            double xy[2];
+            if (!position(xy)) {
+                return false;
+            }
+            builder.append(xy[0]);
+            builder.append(xy[1]);
+        } else {
+            uint64_t count = 0;
+            if (!reader_.varint(count)) {
+                return false;
+            }
+            for (uint64_t i = 0; i < count; ++i) {
+                if (!coordinates(builder, levels - 1)) {
+                    return false;
+                }
+            }
+        }
+        builder.close_array();
+        return true;
+    }
+
+    bool position(double* xy) {
+        if (remaining_ == 0) {
+            return false;
+        }
+        if (offset_ == chunk_.data.size()) {
+            chunk_ = GeometryChunk();
+            if (!next_chunk_(chunk_) || chunk_.positions == 0 ||
+                chunk_.data.size() != chunk_.positions * GeometryChunker::kPositionBytes) {
+                return false;
+            }
+            offset_ = 0;
+        }
+        std::memcpy(xy, chunk_.data.data() + offset_, GeometryChunker::kPositionBytes);
+        offset_ += GeometryChunker::kPositionBytes;
+        --remaining_;
+        return true;
+    }
+};
+
+}
+
+bool GeometryChunker::split(
+    const bsoncxx::document::view& geometry,
+    std::vector<uint8_t>& structure,
+    uint64_t& positions,
+    const ChunkSink& on_chunk
+) {
+    structure.clear();
+    Walker checker(&structure, nullptr);
+    if (!checker.geometry(geometry, kMaxDepth)) {
+        structure.clear();
+        return false;
+    }
+
+    ChunkWriter writer(on_chunk);
+    Walker streamer(nullptr, &writer);
+    if (!streamer.geometry(geometry, kMaxDepth) || !writer.flush()) {
+        return false;
+    }
+    positions = writer.total();
+    return true;
+}
+
+bool GeometryChunker::assemble(
+    const uint8_t* structure,
+    size_t size,
+    uint64_t positions,
+    const ChunkSource& next_chunk,
+    bsoncxx::document::value& geometry
+) {
+    StructureReader reader(structure, size);
+    Assembler assembler(reader, positions, next_chunk);
+    bsoncxx::builder::core builder(false);
+    if (!assembler.geometry(builder, kMaxDepth) || !reader.done() || !assembler.finished()) {
+        return false;
+    }
+    geometry = builder.extract_document();
+    return true;
+}
+
+HashId GeometryChunker::hash_chunk(const uint8_t* data, size_t size) {
+    static constexpr char kDomain[] = "geoversion.chunk.v1";
+
+    Sha256Stream stream;
+    stream.update(kDomain, sizeof(kDomain));
+    stream.update(data, size);
+
+    return stream.finish();
+}
+
+}
+}
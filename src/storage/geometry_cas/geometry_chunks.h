@@ -0,0 +1,61 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+// A run of consecutive positions, x and y as doubles in host byte order.
+struct GeometryChunk {
+    HashId hash;
+    uint32_t positions = 0;
+    std::vector<uint8_t> data;
+};
+
+// Splits a geometry into its structure (type tags and counts as varints,
+// walked as in the coordinate blob) and a stream of positions cut into
+// content-defined chunks: a chunk ends after a position whose hash has its
+// low bits clear, so an edit moves boundaries only next to itself and the
+// remaining chunks keep their hashes from one version to the next.
+// Only geometries that assemble() rebuilds byte for byte are accepted:
+// `type` followed by `coordinates` or `geometries`, 2D double positions.
+class GeometryChunker {
+public:
+    using ChunkSink = std::function<bool(GeometryChunk&& chunk)>;
+    using ChunkSource = std::function<bool(GeometryChunk& chunk)>;
+
+    // Checks the whole geometry before the first chunk reaches on_chunk;
+    // chunks are handed over as soon as they are cut.
+    static bool split(
+        const bsoncxx::document::view& geometry,
+        std::vector<uint8_t>& structure,
+        uint64_t& positions,
+        const ChunkSink& on_chunk
+    );
+    // next_chunk yields the chunks in order; only one is held at a time.
+    static bool assemble(
+        const uint8_t* structure,
+        size_t size,
+        uint64_t positions,
+        const ChunkSource& next_chunk,
+        bsoncxx::document::value& geometry
+    );
+
+    static HashId hash_chunk(const uint8_t* data, size_t size);
+
+    static constexpr size_t kPositionBytes = 2 * sizeof(double);
+    static constexpr uint32_t kMinPositions = 4096;
+    static constexpr uint32_t kMaxPositions = 65536;
+    // About 16k positions (256 KB) per chunk on average.
+    static constexpr uint64_t kBoundaryMask = (1u << 14) - 1;
+    static constexpr size_t kMaxDepth = 16;
+};
+
+}
+}
@@ -0,0 +1,466 @@
+#include "geometry_store.h"
+#include "storage/bpo_storage/coordinate_kernels.h"
+#include "storage/cas/cas.h"
+#include <bsoncxx/types.hpp>
+#include <limits>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr size_t kMaxOffset = std::numeric_limits<uint32_t>::max();
+
+bool is_polygon(GeometryType type) {
+    return type == GeometryType::Polygon || type == GeometryType::MultiPolygon;
+}
+
+}
+
+GeometryStore::GeometryStore() {
+    clear();
+}
+
+bool GeometryStore::append(const HashId& hash, const bsoncxx::document::view& geometry) {
+    Mark start = mark();
+    GeometryType type = GeoJSONValidator::get_type(geometry);
+    bool ok = true;
+
+    if (type == GeometryType::Unknown) {
+        ok = false;
+    } else if (type == GeometryType::GeometryCollection) {
+        auto geometries = geometry["geometries"];
+        ok = geometries && geometries.type() == bsoncxx::type::k_array;
+        if (ok) {
+            for (auto&& member : geometries.get_array().value) {
+                if (member.type() != bsoncxx::type::k_document ||
+                    !append_member(member.get_document().value)) {
+                    ok = false;
+                    break;
+                }
+            }
+        }
+    } else {
+        ok = append_member(geometry);
+    }
+
+    if (!ok || member_offsets_.size() - 1 > kMaxOffset) {
+        rollback(start);
+        return false;
+    }
+
+    object_offsets_.push_back(static_cast<uint32_t>(member_offsets_.size() - 1));
+    object_types_.push_back(static_cast<uint8_t>(type));
+    hashes_.push_back(hash);
+
+    size_t begin = start.positions;
+    size_t count = xs_.size() - begin;
+    if (count > 0) {
+        CoordinateSummary summary = summarize_coordinates(xs_.data() + begin, ys_.data() + begin, count);
+        min_xs_.push_back(summary.min_x);
+        min_ys_.push_back(summary.min_y);
+        max_xs_.push_back(summary.max_x);
+        max_ys_.push_back(summary.max_y);
+    } else {
+        Envelope empty;
+        min_xs_.push_back(empty.min_x);
+        min_ys_.push_back(empty.min_y);
+        max_xs_.push_back(empty.max_x);
+        max_ys_.push_back(empty.max_y);
+    }
+    return true;
+}
+
+bool GeometryStore::append(const BPO& bpo) {
+    return append(bpo.get_hash(), bpo.get_geometry());
+}
+
+size_t GeometryStore::append(CASCursor& cursor) {
+    size_t appended = 0;
+    while (cursor.next()) {
+        HashId hash;
+        bsoncxx::document::view geometry;
+        std::optional<bsoncxx::document::value> decoded;
+        if (cursor.current_hash(hash) && cursor.current_geometry(geometry, decoded) &&
+            append(hash, geometry)) {
+            ++appended;
+        }
+    }
+    return appended;
+}
+
+void GeometryStore::reserve(size_t objects, size_t positions) {
+    xs_.reserve(positions);
+    ys_.reserve(positions);
+    ring_offsets_.reserve(objects + 1);
+    part_offsets_.reserve(objects + 1);
+    member_offsets_.reserve(objects + 1);
+    member_types_.reserve(objects);
+    object_offsets_.reserve(objects + 1);
+    object_types_.reserve(objects);
+    hashes_.reserve(objects);
+    min_xs_.reserve(objects);
+    min_ys_.reserve(objects);
+    max_xs_.reserve(objects);
+    max_ys_.reserve(objects);
+}
+
+void GeometryStore::clear() {
+    xs_.clear();
+    ys_.clear();
+    ring_offsets_.assign(1, 0);
+    part_offsets_.assign(1, 0);
+    member_offsets_.assign(1, 0);
+    member_types_.clear();
+    object_offsets_.assign(1, 0);
+    object_types_.clear();
+    hashes_.clear();
+    min_xs_.clear();
+    min_ys_.clear();
+    max_xs_.clear();
+    max_ys_.clear();
+}
+
+void GeometryStore::shrink_to_fit() {
+    xs_.shrink_to_fit();
+    ys_.shrink_to_fit();
+    ring_offsets_.shrink_to_fit();
+    part_offsets_.shrink_to_fit();
+    member_offsets_.shrink_to_fit();
+    member_types_.shrink_to_fit();
+    object_offsets_.shrink_to_fit();
+    object_types_.shrink_to_fit();
+    hashes_.shrink_to_fit();
+    min_xs_.shrink_to_fit();
+    min_ys_.shrink_to_fit();
+    max_xs_.shrink_to_fit();
+    max_ys_.shrink_to_fit();
+}
+
+size_t GeometryStore::size() const {
+    return hashes_.size();
+}
+
+size_t GeometryStore::position_count() const {
+    return xs_.size();
+}
+
+size_t GeometryStore::memory_usage() const {
+    return sizeof(GeometryStore) +
+           (xs_.capacity() + ys_.capacity()) * sizeof(double) +
+           (ring_offsets_.capacity() + part_offsets_.capacity() +
+            member_offsets_.capacity() + object_offsets_.capacity()) * sizeof(uint32_t) +
+           member_types_.capacity() + object_types_.capacity() +
+           hashes_.capacity() * sizeof(HashId) +
+           (min_xs_.capacity() + min_ys_.capacity() + max_xs_.capacity() + max_ys_.capacity()) * sizeof(double);
+}
+
+const HashId& GeometryStore::hash(size_t index) const {
+    return hashes_[index];
+}
+
+GeometryType GeometryStore::type(size_t index) const {
+    return static_cast<GeometryType>(object_types_[index]);
+}
+
+Envelope GeometryStore::envelope(size_t index) const {
+    return Envelope(min_xs_[index], min_ys_[index], max_xs_[index], max_ys_[index]);
+}
+
+std::pair<size_t, size_t> GeometryStore::position_range(size_t index) const {
+    size_t first_ring = part_offsets_[member_offsets_[object_offsets_[index]]];
+    size_t last_ring = part_offsets_[member_offsets_[object_offsets_[index + 1]]];
+    return {ring_offsets_[first_ring], ring_offsets_[last_ring]};
+}
+
+const double* GeometryStore::xs() const {
+    return xs_.data();
+}
+
+const double* GeometryStore::ys() const {
+    return ys_.data();
+}
+
+bsoncxx::document::value GeometryStore::to_bson(size_t index) const {
+    bsoncxx::builder::core builder(false);
+    size_t first = object_offsets_[index];
+    size_t last = object_offsets_[index + 1];
+
+    if (type(index) == GeometryType::GeometryCollection) {
+        builder.key_view("type");
+        builder.append(GeoJSONValidator::type_name(GeometryType::GeometryCollection));
+        builder.key_view("geometries");
+        builder.open_array();
+        for (size_t member = first; member < last; ++member) {
+            builder.open_document();
+            build_member(member, builder);
+            builder.close_document();
+        }
+        builder.close_array();
+    } else {
+        build_member(first, builder);
+    }
+    return builder.extract_document();
+}
+
+bool GeometryStore::validate(size_t index, const GeoJSONValidationOptions& options) const {
+    auto range = position_range(index);
+    if (!coordinates_in_range(xs_.data() + range.first, ys_.data() + range.first, range.second - range.first)) {
+        return false;
+    }
+    for (size_t member = object_offsets_[index]; member < object_offsets_[index + 1]; ++member) {
+        if (!validate_member(member, options)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+std::vector<size_t> GeometryStore::query_intersects(const Envelope& box) const {
+    return query(box, false);
+}
+
+std::vector<size_t> GeometryStore::query_within(const Envelope& box) const {
+    return query(box, true);
+}
+
+std::vector<SpatialEntry> GeometryStore::spatial_entries() const {
+    std::vector<SpatialEntry> entries;
+    entries.reserve(size());
+    for (size_t i = 0; i < size(); ++i) {
+        Envelope box = envelope(i);
+        if (!box.is_empty()) {
+            entries.push_back(SpatialEntry{box, hashes_[i]});
+        }
+    }
+    return entries;
+}
+
+GeometryStore::Mark GeometryStore::mark() const {
+    return Mark{xs_.size(), ring_offsets_.size(), part_offsets_.size(), member_offsets_.size()};
+}
+
+void GeometryStore::rollback(const Mark& mark) {
+    xs_.resize(mark.positions);
+    ys_.resize(mark.positions);
+    ring_offsets_.resize(mark.rings);
+    part_offsets_.resize(mark.parts);
+    member_offsets_.resize(mark.members);
+    member_types_.resize(mark.members - 1);
+}
+
+bool GeometryStore::append_member(const bsoncxx::document::view& geometry) {
+    GeometryType type = GeoJSONValidator::get_type(geometry);
+    auto coordinates = geometry["coordinates"];
+    if (type == GeometryType::Unknown || type == GeometryType::GeometryCollection ||
+        !coordinates || coordinates.type() != bsoncxx::type::k_array) {
+        // Nested collections would come back flattened, so they are refused.
+        return false;
+    }
+    auto array = coordinates.get_array().value;
+
+    bool ok = true;
+    switch (type) {
+        case GeometryType::Point:
+            ok = append_position(array);
+            if (ok) {
+                ring_offsets_.push_back(static_cast<uint32_t>(xs_.size()));
+                close_part();
+            }
+            break;
+        case GeometryType::MultiPoint:
+        case GeometryType::LineString:
+            ok = append_ring(array);
+            if (ok) {
+                close_part();
+            }
+            break;
+        case GeometryType::MultiLineString:
+        case GeometryType::Polygon:
+            ok = append_rings(array);
+            if (ok) {
+                close_part();
+            }
+            break;
+        case GeometryType::MultiPolygon:
+            for (auto&& polygon : array) {
+                if (polygon.type() != bsoncxx::type::k_array || !append_rings(polygon.get_array().value)) {
+                    ok = false;
+                    break;
+                }
+                close_part();
+            }
+            break;
+        default:
+            ok = false;
+            break;
+    }
+    if (!ok || ring_offsets_.size() > kMaxOffset || part_offsets_.size() > kMaxOffset) {
+        return false;
+    }
+
+    member_offsets_.push_back(static_cast<uint32_t>(part_offsets_.size() - 1));
+    member_types_.push_back(static_cast<uint8_t>(type));
+    return true;
+}
+
+bool GeometryStore::append_position(const bsoncxx::array::view& position) {
+    auto it = position.begin();
+    if (it == position.end() || it->type() != bsoncxx::type::k_double) {
+        return false;
+    }
+    double x = it->get_double().value;
+    ++it;
+    if (it == position.end() || it->type() != bsoncxx::type::k_double) {
+        return false;
+    }
+    double y = it->get_double().value;
+    ++it;
+    if (it != position.end() || xs_.size() >= kMaxOffset) {
+        return false;
+    }
+    xs_.push_back(x);
+    ys_.push_back(y);
+    return true;
+}
+
+bool GeometryStore::append_ring(const bsoncxx::array::view& positions) {
+    for (auto&& position : positions) {
+        if (position.type() != bsoncxx::type::k_array || !append_position(position.get_array().value)) {
+            return false;
+        }
+    }
+    ring_offsets_.push_back(static_cast<uint32_t>(xs_.size()));
+    return true;
+}
+
+bool GeometryStore::append_rings(const bsoncxx::array::view& rings) {
+    for (auto&& ring : rings) {
+        if (ring.type() != bsoncxx::type::k_array || !append_ring(ring.get_array().value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+void GeometryStore::close_part() {
+    part_offsets_.push_back(static_cast<uint32_t>(ring_offsets_.size() - 1));
+}
+
+bool GeometryStore::validate_member(size_t member, const GeoJSONValidationOptions& options) const {
+    GeometryType type = static_cast<GeometryType>(member_types_[member]);
+    size_t first_part = member_offsets_[member];
+    size_t last_part = member_offsets_[member + 1];
+    if (first_part == last_part) {
+        return false;
+    }
+
+    for (size_t part = first_part; part < last_part; ++part) {
+        size_t first_ring = part_offsets_[part];
+        size_t last_ring = part_offsets_[part + 1];
+        if (first_ring == last_ring) {
+            return false;
+        }
+        for (size_t ring = first_ring; ring < last_ring; ++ring) {
+            size_t begin = ring_offsets_[ring];
+            size_t count = ring_offsets_[ring + 1] - begin;
+            if (is_polygon(type)) {
+                if (!ring_is_closed(xs_.data() + begin, ys_.data() + begin, count) ||
+                    (options.check_topology && ring_self_intersects(xs_.data() + begin, ys_.data() + begin, count))) {
+                    return false;
+                }
+            } else if (count < (type == GeometryType::MultiPoint || type == GeometryType::Point ? 1u : 2u)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void GeometryStore::build_member(size_t member, bsoncxx::builder::core& builder) const {
+    GeometryType type = static_cast<GeometryType>(member_types_[member]);
+    size_t first_part = member_offsets_[member];
+    size_t last_part = member_offsets_[member + 1];
+
+    builder.key_view("type");
+    builder.append(GeoJSONValidator::type_name(type));
+    builder.key_view("coordinates");
+
+    if (type == GeometryType::Point) {
+        size_t position = ring_offsets_[part_offsets_[first_part]];
+        builder.open_array();
+        builder.append(xs_[position]);
+        builder.append(ys_[position]);
+        builder.close_array();
+    } else if (type == GeometryType::MultiPolygon) {
+        builder.open_array();
+        for (size_t part = first_part; part < last_part; ++part) {
+            build_part(part, type, builder);
+        }
+        builder.close_array();
+    } else {
+        build_part(first_part, type, builder);
+    }
+}
+
+// MultiPoint and LineString parts are a single run of positions; the other
+// part types are arrays of rings.
+void GeometryStore::build_part(size_t part, GeometryType type, bsoncxx::builder::core& builder) const {
+    size_t first_ring = part_offsets_[part];
+    size_t last_ring = part_offsets_[part + 1];
+    if (type == GeometryType::MultiPoint || type == GeometryType::LineString) {
+        build_ring(first_ring, builder);
+        return;
+    }
+    builder.open_array();
+    for (size_t ring = first_ring; ring < last_ring; ++ring) {
+        build_ring(ring, builder);
+    }
+    builder.close_array();
+}
+
+void GeometryStore::build_ring(size_t ring, bsoncxx::builder::core& builder) const {
+    builder.open_array();
+    for (size_t i = ring_offsets_[ring]; i < ring_offsets_[ring + 1]; ++i) {
+        builder.open_array();
+        builder.append(xs_[i]);
+        builder.append(ys_[i]);
+        builder.close_array();
+    }
+    builder.close_array();
+}
+
+// Written without early exits so the comparisons vectorize; matches are
+// collected in a second pass.
+std::vector<size_t> GeometryStore::query(const Envelope& box, bool within) const {
+    size_t count = size();
+    std::vector<uint8_t> hits(count);
+    const double* min_xs = min_xs_.data();
+    const double* min_ys = min_ys_.data();
+    const double* max_xs = max_xs_.data();
+    const double* max_ys = max_ys_.data();
+
+    if (within) {
+        for (size_t i = 0; i < count; ++i) {
+            hits[i] = (min_xs[i] >= box.min_x) & (max_xs[i] <= box.max_x) &
+                      (min_ys[i] >= box.min_y) & (max_ys[i] <= box.max_y) &
+                      (min_xs[i] <= max_xs[i]);
+        }
+    } else {
+        for (size_t i = 0; i < count; ++i) {
+            hits[i] = (min_xs[i] <= box.max_x) & (max_xs[i] >= box.min_x) &
+                      (min_ys[i] <= box.max_y) & (max_ys[i] >= box.min_y);
+        }
+    }
+
+    std::vector<size_t> result;
+    for (size_t i = 0; i < count; ++i) {
+        if (hits[i]) {
+            result.push_back(i);
+        }
+    }
+    return result;
+}
+
+}
+}
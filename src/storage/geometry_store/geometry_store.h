@@ -0,0 +1,106 @@
+#pragma once
+
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/hash_id/hash_id.h"
+#include "storage/spatial_index/envelope.h"
+#include "storage/spatial_index/spatial_index.h"
+#include <bsoncxx/builder/core.hpp>
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+class CASCursor;
+
+// Struct-of-arrays geometry columns for large in-memory result sets.
+// Positions live in flat xs/ys arrays; nesting is kept as offset arrays:
+//
+//   object -> members (one per geometry, several for a GeometryCollection)
+//   member -> parts   (one, or one per polygon of a MultiPolygon)
+//   part   -> rings   (one per LineString / ring / point run)
+//   ring   -> positions
+//
+// Envelopes are kept per object in four parallel arrays so bbox scans are
+// plain loops over doubles. Only 2D double positions and non-nested
+// collections are accepted: to_bson() must give back the same geometry.
+class GeometryStore {
+public:
+    GeometryStore();
+
+    bool append(const HashId& hash, const bsoncxx::document::view& geometry);
+    bool append(const BPO& bpo);
+    // Appends every remaining document of a CAS cursor (a GeometryOnly
+    // projection is enough); returns how many were accepted.
+    size_t append(CASCursor& cursor);
+
+    void reserve(size_t objects, size_t positions);
+    void clear();
+    void shrink_to_fit();
+
+    size_t size() const;
+    size_t position_count() const;
+    size_t memory_usage() const;
+
+    const HashId& hash(size_t index) const;
+    GeometryType type(size_t index) const;
+    Envelope envelope(size_t index) const;
+    std::pair<size_t, size_t> position_range(size_t index) const;
+
+    const double* xs() const;
+    const double* ys() const;
+
+    bsoncxx::document::value to_bson(size_t index) const;
+
+    // Same rules as GeoJSONValidator, applied to the flat columns.
+    bool validate(size_t index, const GeoJSONValidationOptions& options = GeoJSONValidationOptions()) const;
+
+    std::vector<size_t> query_intersects(const Envelope& box) const;
+    std::vector<size_t> query_within(const Envelope& box) const;
+    std::vector<SpatialEntry> spatial_entries() const;
+
+private:
+    struct Mark {
+        size_t positions;
+        size_t rings;
+        size_t parts;
+        size_t members;
+    };
+
+    std::vector<double> xs_;
+    std::vector<double> ys_;
+    std::vector<uint32_t> ring_offsets_;
+    std::vector<uint32_t> part_offsets_;
+    std::vector<uint32_t> member_offsets_;
+    std::vector<uint8_t> member_types_;
+    std::vector<uint32_t> object_offsets_;
+    std::vector<uint8_t> object_types_;
+    std::vector<HashId> hashes_;
+    std::vector<double> min_xs_;
+    std::vector<double> min_ys_;
+    std::vector<double> max_xs_;
+    std::vector<double> max_ys_;
+
+    Mark mark() const;
+    void rollback(const Mark& mark);
+
+    bool append_member(const bsoncxx::document::view& geometry);
+    bool append_position(const bsoncxx::array::view& position);
+    bool append_ring(const bsoncxx::array::view& positions);
+    bool append_rings(const bsoncxx::array::view& rings);
+    void close_part();
+
+    bool validate_member(size_t member, const GeoJSONValidationOptions& options) const;
+    void build_member(size_t member, bsoncxx::builder::core& builder) const;
+    void build_part(size_t part, GeometryType type, bsoncxx::builder::core& builder) const;
+    void build_ring(size_t ring, bsoncxx::builder::core& builder) const;
+
+    std::vector<size_t> query(const Envelope& box, bool within) const;
+};
+
+}
+}
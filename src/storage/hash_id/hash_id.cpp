@@ -0,0 +1,110 @@
+#include "hash_id.h"
+#include <stdexcept>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr int8_t kInvalidNibble = -1;
+
+struct NibbleTable {
+    int8_t values[256];
+
+    constexpr NibbleTable() : values() {
+        for (int i = 0; i < 256; ++i) {
+            values[i] = kInvalidNibble;
+        }
+        for (int i = 0; i < 10; ++i) {
+            values['0' + i] = static_cast<int8_t>(i);
+        }
+        for (int i = 0; i < 6; ++i) {
+            values['a' + i] = static_cast<int8_t>(10 + i);
+            values['A' + i] = static_cast<int8_t>(10 + i);
+        }
+    }
+};
+
+constexpr NibbleTable kNibbles{};
+
+}
+
+HashId HashId::from_bytes(const uint8_t* data) {
+    HashId hash;
+    std::memcpy(hash.bytes_.data(), data, kSize);
+    return hash;
+}
+
+bool HashId::from_hex(std::string_view hex, HashId& out) {
+    if (hex.size() != kHexLength) {
+        return false;
+    }
+    for (size_t i = 0; i < kSize; ++i) {
+        int8_t high = kNibbles.values[static_cast<unsigned char>(hex[2 * i])];
+        int8_t low = kNibbles.values[static_cast<unsigned char>(hex[2 * i + 1])];
+        if (high == kInvalidNibble || low == kInvalidNibble) {
+            return false;
+        }
+        out.bytes_[i] = static_cast<uint8_t>((high << 4) | low);
+    }
+    return true;
+}
+
+HashId HashId::from_hex(std::string_view hex) {
+    HashId hash;
+    if (!from_hex(hex, hash)) {
+        throw std::invalid_argument("Invalid hash hex string: " + std::string(hex));
+    }
+    return hash;
+}
+
+bool HashId::from_bson(const bsoncxx::types::bson_value::view& value, HashId& out) {
+    if (value.type() == bsoncxx::type::k_binary) {
+        const auto& binary = value.get_binary();
+        if (binary.size != kSize) {
+            return false;
+        }
+        std::memcpy(out.bytes_.data(), binary.bytes, kSize);
+        return true;
+    }
+    if (value.type() == bsoncxx::type::k_string) {
+        auto hex = value.get_string().value;
+        return from_hex(std::string_view(hex.data(), hex.size()), out);
+    }
+    return false;
+}
+
+std::string HashId::to_hex() const {
+    static constexpr char kHexDigits[] = "0123456789abcdef";
+
+    std::string result(kHexLength, '\0');
+    for (size_t i = 0; i < kSize; ++i) {
+        result[2 * i] = kHexDigits[bytes_[i] >> 4];
+        result[2 * i + 1] = kHexDigits[bytes_[i] & 0x0f];
+    }
+    return result;
+}
+
+bsoncxx::types::b_binary HashId::to_bson() const {
+    return bsoncxx::types::b_binary{bsoncxx::binary_sub_type::k_binary, static_cast<uint32_t>(kSize), bytes_.data()};
+}
+
+bool HashId::is_null() const {
+    for (uint8_t byte : bytes_) {
+        if (byte != 0) {
+            return false;
+        }
+    }
+    return true;
+}
+
+uint64_t HashId::prefix() const {
+    uint64_t value = 0;
+    for (size_t i = 0; i < sizeof(value); ++i) {
+        value = (value << 8) | bytes_[i];
+    }
+    return value;
+}
+
+}
+}
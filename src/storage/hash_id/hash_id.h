@@ -0,0 +1,77 @@
+#pragma once
+
+#include <bsoncxx/types.hpp>
+#include <bsoncxx/types/bson_value/view.hpp>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <type_traits>
+
+namespace geoversion {
+namespace storage {
+
+class HashId {
+public:
+    static constexpr size_t kSize = 32;
+    static constexpr size_t kHexLength = kSize * 2;
+
+    HashId() = default;
+
+    static HashId from_bytes(const uint8_t* data);
+    static bool from_hex(std::string_view hex, HashId& out);
+    static HashId from_hex(std::string_view hex);
+    static bool from_bson(const bsoncxx::types::bson_value::view& value, HashId& out);
+
+    std::string to_hex() const;
+    bsoncxx::types::b_binary to_bson() const;
+
+    const uint8_t* data() const { return bytes_.data(); }
+    uint8_t* data() { return bytes_.data(); }
+    static constexpr size_t size() { return kSize; }
+
+    bool is_null() const;
+    uint64_t prefix() const;
+
+    friend bool operator==(const HashId& a, const HashId& b) {
+        return std::memcmp(a.bytes_.data(), b.bytes_.data(), kSize) == 0;
+    }
+    friend bool operator!=(const HashId& a, const HashId& b) { return !(a == b); }
+    friend bool operator<(const HashId& a, const HashId& b) {
+        return std::memcmp(a.bytes_.data(), b.bytes_.data(), kSize) < 0;
+    }
+    friend bool operator>(const HashId& a, const HashId& b) { return b < a; }
+    friend bool operator<=(const HashId& a, const HashId& b) { return !(b < a); }
+    friend bool operator>=(const HashId& a, const HashId& b) { return !(a < b); }
+
+private:
+    std::array<uint8_t, kSize> bytes_{};
+};
+
+static_assert(std::is_trivially_copyable<HashId>::value, "HashId must be trivially copyable");
+static_assert(sizeof(HashId) == HashId::kSize, "HashId must not carry padding");
+
+struct HashIdHasher {
+    size_t operator()(const HashId& hash) const noexcept {
+        size_t value;
+        std::memcpy(&value, hash.data(), sizeof(value));
+        return value;
+    }
+};
+
+}
+}
+
+namespace std {
+
+template <>
+struct hash<geoversion::storage::HashId> {
+    size_t operator()(const geoversion::storage::HashId& hash) const noexcept {
+        return geoversion::storage::HashIdHasher{}(hash);
+    }
+};
+
+}
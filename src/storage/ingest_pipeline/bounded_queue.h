@@ -0,0 +1,183 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <thread>
+
+namespace geoversion {
+namespace storage {
+
+// Spin, then yield, then sleep: waiting on a full or empty queue should not
+// burn a core that a neighbouring stage could use.
+class Backoff {
+public:
+    void pause() {
+        if (step_ < kSpinSteps) {
+            ++step_;
+        } else if (step_ < kYieldSteps) {
+            ++step_;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(kSleepMicros));
+        }
+    }
+
+    void reset() {
+        step_ = 0;
+    }
+
+private:
+    static constexpr uint32_t kSpinSteps = 64;
+    static constexpr uint32_t kYieldSteps = 128;
+    static constexpr uint32_t kSleepMicros = 200;
+
+    uint32_t step_ = 0;
+};
+
+// Bounded multi-producer/multi-consumer ring (Vyukov): every slot carries a
+// sequence number, so producers and consumers only contend on their own
+// cursor. Capacity is rounded up to a power of two. close() is called once
+// all producers are done; pop() then drains what is left and returns false.
+template <typename T>
+class BoundedQueue {
+public:
+    explicit BoundedQueue(size_t capacity)
+        : capacity_(round_up(capacity)),
+          mask_(capacity_ - 1),
+          slots_(new Slot[capacity_]),
+          head_(0),
+          tail_(0),
+          closed_(false),
+          full_waits_(0) {
+        for (size_t i = 0; i < capacity_; ++i) {
+            slots_[i].sequence.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+
+    bool try_push(T& value) {
+        size_t position = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots_[position & mask_];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    slot.value = std::move(value);
+                    slot.sequence.store(position + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                position = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    bool try_pop(T& value) {
+        size_t position = head_.load(std::memory_order_relaxed);
+        while (true) {
+            Slot& slot = slots_[position & mask_];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            intptr_t diff = static_cast<intptr_t>(sequence) - static_cast<intptr_t>(position + 1);
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(position, position + 1, std::memory_order_relaxed)) {
+                    value = std::move(slot.value);
+                    slot.sequence.store(position + capacity_, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                position = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // Blocks while the queue is full; this is the pipeline's backpressure.
+    // Returns false only if the queue was closed.
+    bool push(T& value) {
+        if (closed_.load(std::memory_order_acquire)) {
+            return false;
+        }
+        if (try_push(value)) {
+            return true;
+        }
+        full_waits_.fetch_add(1, std::memory_order_relaxed);
+        Backoff backoff;
+        while (!closed_.load(std::memory_order_acquire)) {
+            if (try_push(value)) {
+                return true;
+            }
+            backoff.pause();
+        }
+        return false;
+    }
+
+    bool pop(T& value) {
+        Backoff backoff;
+        while (true) {
+            if (try_pop(value)) {
+                return true;
+            }
+            if (closed_.load(std::memory_order_acquire)) {
+                return try_pop(value);
+            }
+            backoff.pause();
+        }
+    }
+
+    void close() {
+        closed_.store(true, std::memory_order_release);
+    }
+
+    bool is_closed() const {
+        return closed_.load(std::memory_order_acquire);
+    }
+
+    size_t size() const {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t head = head_.load(std::memory_order_relaxed);
+        return tail > head ? tail - head : 0;
+    }
+
+    size_t capacity() const {
+        return capacity_;
+    }
+
+    uint64_t full_waits() const {
+        return full_waits_.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T value;
+    };
+
+    static size_t round_up(size_t capacity) {
+        size_t rounded = 2;
+        while (rounded < capacity) {
+            rounded <<= 1;
+        }
+        return rounded;
+    }
+
+    const size_t capacity_;
+    const size_t mask_;
+    std::unique_ptr<Slot[]> slots_;
+
+    alignas(64) std::atomic<size_t> head_;
+    alignas(64) std::atomic<size_t> tail_;
+    alignas(64) std::atomic<bool> closed_;
+    std::atomic<uint64_t> full_waits_;
+};
+
+}
+}
@@ -0,0 +1,366 @@
+#include "ingest_pipeline.h"
+#include <bsoncxx/json.hpp>
+#include <bsoncxx/types.hpp>
+#include <algorithm>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+size_t default_threads(size_t requested, size_t share) {
+    if (requested > 0) {
+        return requested;
+    }
+    size_t cores = std::max<unsigned>(1, std::thread::hardware_concurrency());
+    return std::max<size_t>(1, cores / share);
+}
+
+uint64_t elapsed_ns(std::chrono::steady_clock::time_point since) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - since
+    ).count());
+}
+
+}
+
+IngestPipeline::IngestPipeline(CAS& cas, const IngestPipelineOptions& options)
+    : cas_(cas),
+      options_(options),
+      input_(options.queue_capacity),
+      parsed_(options.queue_capacity),
+      validated_(options.queue_capacity),
+      hashed_(std::max(options.queue_capacity, options.batch_size)),
+      submitted_(0),
+      started_(false),
+      finished_(false),
+      drained_(false),
+      elapsed_ms_(0) {
+    if (options_.batch_size == 0) {
+        options_.batch_size = CAS::kDefaultBatchSize;
+    }
+    // Hashing walks every coordinate twice (canonical encoding + SHA-256),
+    // so it gets the largest share of the cores.
+    options_.parse_threads = default_threads(options_.parse_threads, 4);
+    options_.validate_threads = default_threads(options_.validate_threads, 4);
+    options_.hash_threads = default_threads(options_.hash_threads, 2);
+    options_.writer_threads = std::max<size_t>(1, options_.writer_threads);
+}
+
+IngestPipeline::~IngestPipeline() {
+    if (started_ && !finished_) {
+        finish();
+    }
+}
+
+void IngestPipeline::set_on_batch(std::function<void(const StoreManyResult&)> on_batch) {
+    on_batch_ = std::move(on_batch);
+}
+
+void IngestPipeline::start() {
+    if (started_.exchange(true)) {
+        return;
+    }
+    start_time_ = std::chrono::steady_clock::now();
+
+    launch(kParse, options_.parse_threads, &IngestPipeline::run_parse);
+    launch(kValidate, options_.validate_threads, &IngestPipeline::run_validate);
+    launch(kHash, options_.hash_threads, &IngestPipeline::run_hash);
+    launch(kWrite, options_.writer_threads, &IngestPipeline::run_write);
+}
+
+bool IngestPipeline::submit_json(std::string json) {
+    IngestInput input;
+    input.json = std::move(json);
+    if (!input_.push(input)) {
+        return false;
+    }
+    ++submitted_;
+    return true;
+}
+
+bool IngestPipeline::submit(bsoncxx::document::value feature) {
+    IngestInput input;
+    input.document = std::move(feature);
+    if (!input_.push(input)) {
+        return false;
+    }
+    ++submitted_;
+    return true;
+}
+
+bool IngestPipeline::submit(BPO bpo) {
+    IngestItem item;
+    item.bpo = std::move(bpo);
+    if (!parsed_.push(item)) {
+        return false;
+    }
+    ++submitted_;
+    ++counters_[kParse].processed;
+    return true;
+}
+
+IngestPipelineStats IngestPipeline::finish() {
+    if (!started_) {
+        start();
+    }
+    if (!finished_.exchange(true)) {
+        input_.close();
+        for (auto& thread : threads_) {
+            thread.join();
+        }
+        threads_.clear();
+        elapsed_ms_ = static_cast<int64_t>(elapsed_ns(start_time_) / 1000000);
+        drained_ = true;
+    }
+    return get_stats();
+}
+
+IngestPipelineStats IngestPipeline::get_stats() const {
+    IngestPipelineStats stats;
+    stats.submitted = submitted_.load();
+    if (started_) {
+        stats.elapsed = drained_
+            ? std::chrono::milliseconds(elapsed_ms_.load())
+            : std::chrono::milliseconds(elapsed_ns(start_time_) / 1000000);
+    }
+
+    stats.stages.push_back(stage_stats(kParse, "parse", input_.size(), input_.capacity(), input_.full_waits()));
+    stats.stages.push_back(stage_stats(kValidate, "validate", parsed_.size(), parsed_.capacity(), parsed_.full_waits()));
+    stats.stages.push_back(stage_stats(kHash, "hash", validated_.size(), validated_.capacity(), validated_.full_waits()));
+    stats.stages.push_back(stage_stats(kWrite, "write", hashed_.size(), hashed_.capacity(), hashed_.full_waits()));
+
+    {
+        std::lock_guard<std::mutex> lock(store_mutex_);
+        stats.store = store_stats_;
+    }
+    return stats;
+}
+
+// Accepts a GeoJSON Feature (geometry + properties) or a bare geometry.
+bool IngestPipeline::parse_feature(const bsoncxx::document::view& feature, BPO& bpo) {
+    auto type = feature["type"];
+    if (!type || type.type() != bsoncxx::type::k_string) {
+        return false;
+    }
+
+    if (type.get_string().value != "Feature") {
+        if (!feature["coordinates"] && !feature["geometries"]) {
+            return false;
+        }
+        bpo = BPO(HashId(), feature, bsoncxx::document::view());
+        return true;
+    }
+
+    auto geometry = feature["geometry"];
+    if (!geometry || geometry.type() != bsoncxx::type::k_document) {
+        return false;
+    }
+    auto properties = feature["properties"];
+    bsoncxx::document::view attributes;
+    if (properties && properties.type() == bsoncxx::type::k_document) {
+        attributes = properties.get_document().value;
+    }
+    bpo = BPO(HashId(), geometry.get_document().value, attributes);
+    return true;
+}
+
+void IngestPipeline::launch(StageId stage, size_t count, void (IngestPipeline::*body)()) {
+    counters_[stage].threads = count;
+    counters_[stage].running = count;
+    for (size_t i = 0; i < count; ++i) {
+        threads_.emplace_back([this, stage, body]() {
+            (this->*body)();
+            if (--counters_[stage].running == 0) {
+                close_output(stage);
+            }
+        });
+    }
+}
+
+void IngestPipeline::close_output(StageId stage) {
+    switch (stage) {
+        case kParse:
+            parsed_.close();
+            break;
+        case kValidate:
+            validated_.close();
+            break;
+        case kHash:
+            hashed_.close();
+            break;
+        default:
+            break;
+    }
+}
+
+void IngestPipeline::run_parse() {
+    StageCounters& counters = counters_[kParse];
+    IngestInput input;
+    while (input_.pop(input)) {
+        auto begin = std::chrono::steady_clock::now();
+        IngestItem item;
+        bool parsed = false;
+        try {
+            if (input.document) {
+                parsed = parse_feature(input.document->view(), item.bpo);
+            } else {
+                auto document = bsoncxx::from_json(input.json);
+                parsed = parse_feature(document.view(), item.bpo);
+            }
+        } catch (const std::exception&) {
+            parsed = false;
+        }
+        input = IngestInput();
+        counters.busy_ns += elapsed_ns(begin);
+
+        if (!parsed) {
+            ++counters.rejected;
+            continue;
+        }
+        ++counters.processed;
+        if (!parsed_.push(item)) {
+            return;
+        }
+    }
+}
+
+void IngestPipeline::run_validate() {
+    StageCounters& counters = counters_[kValidate];
+    IngestItem item;
+    while (parsed_.pop(item)) {
+        auto begin = std::chrono::steady_clock::now();
+        bool valid = false;
+        try {
+            valid = GeoJSONValidator::validate(item.bpo.get_geometry(), options_.validation);
+        } catch (const std::exception&) {
+            valid = false;
+        }
+        counters.busy_ns += elapsed_ns(begin);
+
+        if (!valid) {
+            ++counters.rejected;
+            continue;
+        }
+        ++counters.processed;
+        if (!validated_.push(item)) {
+            return;
+        }
+    }
+}
+
+void IngestPipeline::run_hash() {
+    StageCounters& counters = counters_[kHash];
+    IngestItem item;
+    while (validated_.pop(item)) {
+        auto begin = std::chrono::steady_clock::now();
+        item.hash = cas_.compute_hash(item.bpo);
+        item.bpo.set_hash(item.hash);
+        counters.busy_ns += elapsed_ns(begin);
+
+        ++counters.processed;
+        if (!hashed_.push(item)) {
+            return;
+        }
+    }
+}
+
+// Fills batches up to batch_size, but flushes a partial batch once its
+// oldest item has waited flush_interval so a slow producer still makes
+// steady progress.
+void IngestPipeline::run_write() {
+    std::vector<BPO> bpos;
+    std::vector<HashId> hashes;
+    bpos.reserve(options_.batch_size);
+    hashes.reserve(options_.batch_size);
+
+    auto oldest = std::chrono::steady_clock::now();
+    Backoff backoff;
+    IngestItem item;
+
+    auto take = [&]() {
+        if (bpos.empty()) {
+            oldest = std::chrono::steady_clock::now();
+        }
+        bpos.push_back(std::move(item.bpo));
+        hashes.push_back(item.hash);
+        if (bpos.size() >= options_.batch_size) {
+            flush(bpos, hashes);
+        }
+        backoff.reset();
+    };
+
+    while (true) {
+        if (hashed_.try_pop(item)) {
+            take();
+            continue;
+        }
+        if (!bpos.empty() && std::chrono::steady_clock::now() - oldest >= options_.flush_interval) {
+            flush(bpos, hashes);
+            continue;
+        }
+        if (hashed_.is_closed()) {
+            if (hashed_.try_pop(item)) {
+                take();
+                continue;
+            }
+            break;
+        }
+        backoff.pause();
+    }
+    flush(bpos, hashes);
+}
+
+void IngestPipeline::flush(std::vector<BPO>& bpos, std::vector<HashId>& hashes) {
+    if (bpos.empty()) {
+        return;
+    }
+
+    StageCounters& counters = counters_[kWrite];
+    auto begin = std::chrono::steady_clock::now();
+    StoreManyResult result = cas_.store_many(bpos.data(), hashes.data(), bpos.size());
+    counters.busy_ns += elapsed_ns(begin);
+    counters.processed += result.stats.total - result.stats.failed;
+    counters.rejected += result.stats.failed;
+
+    {
+        std::lock_guard<std::mutex> lock(store_mutex_);
+        store_stats_ += result.stats;
+        if (on_batch_) {
+            on_batch_(result);
+        }
+    }
+
+    bpos.clear();
+    hashes.clear();
+}
+
+IngestStageStats IngestPipeline::stage_stats(StageId stage, const char* name, size_t depth, size_t capacity, uint64_t waits) const {
+    const StageCounters& counters = counters_[stage];
+
+    IngestStageStats stats;
+    stats.name = name;
+    stats.threads = counters.threads;
+    stats.processed = counters.processed.load();
+    stats.rejected = counters.rejected.load();
+    stats.queue_depth = depth;
+    stats.queue_capacity = capacity;
+    stats.full_waits = waits;
+
+    if (started_) {
+        uint64_t wall_ns = drained_
+            ? static_cast<uint64_t>(elapsed_ms_.load()) * 1000000
+            : elapsed_ns(start_time_);
+        if (wall_ns > 0) {
+            stats.items_per_second = static_cast<double>(stats.processed) * 1e9 / static_cast<double>(wall_ns);
+            if (stats.threads > 0) {
+                stats.busy_ratio = static_cast<double>(counters.busy_ns.load()) /
+                                   (static_cast<double>(wall_ns) * static_cast<double>(stats.threads));
+            }
+        }
+    }
+    return stats;
+}
+
+}
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/cas/cas.h"
+#include "storage/hash_id/hash_id.h"
+#include "storage/ingest_pipeline/bounded_queue.h"
+#include <bsoncxx/document/value.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+struct IngestPipelineOptions {
+    size_t parse_threads = 0;
+    size_t validate_threads = 0;
+    size_t hash_threads = 0;
+    size_t writer_threads = 1;
+    size_t queue_capacity = 4096;
+    size_t batch_size = CAS::kDefaultBatchSize;
+    std::chrono::milliseconds flush_interval{100};
+    GeoJSONValidationOptions validation;
+};
+
+struct IngestStageStats {
+    std::string name;
+    size_t threads = 0;
+    uint64_t processed = 0;
+    uint64_t rejected = 0;
+    size_t queue_depth = 0;
+    size_t queue_capacity = 0;
+    uint64_t full_waits = 0;
+    double items_per_second = 0.0;
+    double busy_ratio = 0.0;
+};
+
+struct IngestPipelineStats {
+    std::vector<IngestStageStats> stages;
+    StoreManyStats store;
+    uint64_t submitted = 0;
+    std::chrono::milliseconds elapsed{0};
+};
+
+// A raw GeoJSON Feature (or bare geometry) waiting to be parsed. Either the
+// JSON text or an already decoded document is set.
+struct IngestInput {
+    std::string json;
+    std::optional<bsoncxx::document::value> document;
+};
+
+struct IngestItem {
+    BPO bpo;
+    HashId hash;
+};
+
+// Staged ingest: parse -> validate -> hash -> batched write, connected by
+// bounded lock-free queues. A full queue blocks the stage feeding it, so a
+// slow database throttles parsing instead of buffering the whole input.
+// Writer threads share the CAS; more than one writer needs a CAS built on a
+// pooled MongoDBConnection.
+class IngestPipeline {
+public:
+    explicit IngestPipeline(CAS& cas, const IngestPipelineOptions& options = IngestPipelineOptions());
+    ~IngestPipeline();
+
+    IngestPipeline(const IngestPipeline&) = delete;
+    IngestPipeline& operator=(const IngestPipeline&) = delete;
+
+    void set_on_batch(std::function<void(const StoreManyResult&)> on_batch);
+
+    void start();
+
+    bool submit_json(std::string json);
+    bool submit(bsoncxx::document::value feature);
+    bool submit(BPO bpo);
+
+    IngestPipelineStats finish();
+    IngestPipelineStats get_stats() const;
+
+    static bool parse_feature(const bsoncxx::document::view& feature, BPO& bpo);
+
+private:
+    enum StageId {
+        kParse = 0,
+        kValidate,
+        kHash,
+        kWrite,
+        kStageCount
+    };
+
+    struct StageCounters {
+        size_t threads = 0;
+        std::atomic<uint64_t> processed{0};
+        std::atomic<uint64_t> rejected{0};
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<size_t> running{0};
+    };
+
+    CAS& cas_;
+    IngestPipelineOptions options_;
+    std::function<void(const StoreManyResult&)> on_batch_;
+
+    BoundedQueue<IngestInput> input_;
+    BoundedQueue<IngestItem> parsed_;
+    BoundedQueue<IngestItem> validated_;
+    BoundedQueue<IngestItem> hashed_;
+
+    StageCounters counters_[kStageCount];
+    std::vector<std::thread> threads_;
+    std::atomic<uint64_t> submitted_;
+    std::atomic<bool> started_;
+    std::atomic<bool> finished_;
+    std::atomic<bool> drained_;
+    std::chrono::steady_clock::time_point start_time_;
+    std::atomic<int64_t> elapsed_ms_;
+
+    mutable std::mutex store_mutex_;
+    StoreManyStats store_stats_;
+
+    void launch(StageId stage, size_t count, void (IngestPipeline::*body)());
+    void close_output(StageId stage);
+    void run_parse();
+    void run_validate();
+    void run_hash();
+    void run_write();
+    void flush(std::vector<BPO>& bpos, std::vector<HashId>& hashes);
+    IngestStageStats stage_stats(StageId stage, const char* name, size_t depth, size_t capacity, uint64_t waits) const;
+};
+
+}
+}
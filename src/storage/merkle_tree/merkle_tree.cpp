@@ -0,0 +1,519 @@
+#include "merkle_tree.h"
+#include "storage/cas/canonical_hash.h"
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+#include <mongocxx/exception/bulk_write_exception.hpp>
+#include <mongocxx/options/find.hpp>
+#include <mongocxx/options/insert.hpp>
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+
+namespace geoversion {
+namespace storage {
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+namespace {
+
+constexpr int kDuplicateKeyError = 11000;
+constexpr size_t kBranchEntrySize = 1 + HashId::kSize;
+
+bsoncxx::document::value make_in_filter(const std::vector<HashId>& hashes, size_t begin, size_t end) {
+    bsoncxx::builder::basic::array in_array;
+    for (size_t i = begin; i < end; ++i) {
+        in_array.append(hashes[i].to_bson());
+    }
+    return make_document(kvp("hash", make_document(kvp("$in", in_array))));
+}
+
+// Node built in memory over a range of the sorted refs.
+struct BuildNode {
+    HashId hash;
+    size_t begin = 0;
+    size_t end = 0;
+    uint8_t level = 0;
+    bool leaf = true;
+    std::vector<uint8_t> entries;
+    std::vector<size_t> children;
+};
+
+}
+
+size_t MerkleTree::Node::size() const {
+    return entries.size() / (leaf ? HashId::kSize : kBranchEntrySize);
+}
+
+uint8_t MerkleTree::Node::digit(size_t i) const {
+    return entries[i * kBranchEntrySize];
+}
+
+HashId MerkleTree::Node::child(size_t i) const {
+    return HashId::from_bytes(entries.data() + i * kBranchEntrySize + 1);
+}
+
+HashId MerkleTree::Node::ref(size_t i) const {
+    return HashId::from_bytes(entries.data() + i * HashId::kSize);
+}
+
+MerkleTree::MerkleTree(mongocxx::collection nodes)
+    : connection_(nullptr), collection_(nodes) {
+}
+
+MerkleTree::MerkleTree(MongoDBConnection& connection)
+    : connection_(&connection) {
+}
+
+MerkleTree::CollectionLease MerkleTree::lease_collection() {
+    if (!connection_) {
+        return CollectionLease{std::nullopt, collection_};
+    }
+    ClientLease lease = connection_->acquire();
+    mongocxx::collection collection = lease.collection(kCollectionName);
+    return CollectionLease{std::move(lease), collection};
+}
+
+HashId MerkleTree::hash_node(bool leaf, uint8_t level, const uint8_t* entries, size_t size) {
+    static constexpr char kDomain[] = "geoversion.merkle.v1";
+
+    Sha256Stream stream;
+    stream.update(kDomain, sizeof(kDomain));
+    stream.update_byte(leaf ? 1 : 0);
+    stream.update_byte(level);
+    if (size > 0) {
+        stream.update(entries, size);
+    }
+    return stream.finish();
+}
+
+HashId MerkleTree::empty_root() {
+    return hash_node(true, 0, nullptr, 0);
+}
+
+bsoncxx::document::value MerkleTree::make_node_document(
+    const HashId& hash, bool leaf, uint8_t level, uint64_t count, const uint8_t* entries, size_t size
+) {
+    static const uint8_t kNoEntries = 0;
+    bsoncxx::types::b_binary packed{
+        bsoncxx::binary_sub_type::k_binary,
+        static_cast<uint32_t>(size),
+        size > 0 ? entries : &kNoEntries
+    };
+    return make_document(
+        kvp("hash", hash.to_bson()),
+        kvp("leaf", leaf),
+        kvp("level", static_cast<int32_t>(level)),
+        kvp("count", static_cast<int64_t>(count)),
+        kvp("entries", packed)
+    );
+}
+
+bool MerkleTree::build(const std::vector<HashId>& refs, HashId& root, MerkleBuildStats* stats) {
+    std::vector<BuildNode> nodes;
+    // Ranges of refs sharing a prefix are contiguous, so each level splits
+    // its range into runs of equal next byte.
+    std::function<size_t(size_t, size_t, uint8_t)> build_node = [&](size_t begin, size_t end, uint8_t level) {
+        size_t index = nodes.size();
+        nodes.emplace_back();
+        nodes[index].begin = begin;
+        nodes[index].end = end;
+        nodes[index].level = level;
+
+        if (end - begin <= kLeafCapacity || level + 1u >= HashId::kSize) {
+            nodes[index].hash = hash_node(true, level, begin < end ? refs[begin].data() : nullptr, (end - begin) * HashId::kSize);
+            return index;
+        }
+
+        std::vector<uint8_t> entries;
+        std::vector<size_t> children;
+        for (size_t i = begin; i < end;) {
+            uint8_t digit = refs[i].data()[level];
+            size_t j = i + 1;
+            while (j < end && refs[j].data()[level] == digit) {
+                ++j;
+            }
+            size_t child = build_node(i, j, static_cast<uint8_t>(level + 1));
+            entries.push_back(digit);
+            entries.insert(entries.end(), nodes[child].hash.data(), nodes[child].hash.data() + HashId::kSize);
+            children.push_back(child);
+            i = j;
+        }
+        nodes[index].leaf = false;
+        nodes[index].hash = hash_node(false, level, entries.data(), entries.size());
+        nodes[index].entries = std::move(entries);
+        nodes[index].children = std::move(children);
+        return index;
+    };
+    build_node(0, refs.size(), 0);
+    root = nodes[0].hash;
+    if (stats) {
+        stats->nodes = nodes.size();
+    }
+
+    // Top down, a stored node ends the descent: its subtree is stored too.
+    std::vector<std::vector<size_t>> missing_levels;
+    std::vector<size_t> frontier{0};
+    while (!frontier.empty()) {
+        std::vector<HashId> hashes;
+        hashes.reserve(frontier.size());
+        for (size_t index : frontier) {
+            hashes.push_back(nodes[index].hash);
+        }
+        std::vector<bool> found;
+        if (!existing(hashes, found)) {
+            return false;
+        }
+        std::vector<size_t> missing;
+        std::vector<size_t> next;
+        for (size_t k = 0; k < frontier.size(); ++k) {
+            if (found[k]) {
+                continue;
+            }
+            const BuildNode& node = nodes[frontier[k]];
+            missing.push_back(frontier[k]);
+            next.insert(next.end(), node.children.begin(), node.children.end());
+        }
+        missing_levels.push_back(std::move(missing));
+        frontier.swap(next);
+    }
+
+    for (auto level = missing_levels.rbegin(); level != missing_levels.rend(); ++level) {
+        std::vector<bsoncxx::document::value> docs;
+        size_t batch_bytes = 0;
+        for (size_t index : *level) {
+            const BuildNode& node = nodes[index];
+            const uint8_t* entries = node.leaf
+                ? (node.begin < node.end ? refs[node.begin].data() : nullptr)
+                : node.entries.data();
+            size_t size = node.leaf ? (node.end - node.begin) * HashId::kSize : node.entries.size();
+            docs.push_back(make_node_document(node.hash, node.leaf, node.level, node.end - node.begin, entries, size));
+            batch_bytes += docs.back().view().length();
+            if (stats) {
+                ++stats->written;
+                stats->bytes_written += docs.back().view().length();
+            }
+            if (batch_bytes >= kInsertBatchBytes) {
+                if (!insert_nodes(docs)) {
+                    return false;
+                }
+                docs.clear();
+                batch_bytes = 0;
+            }
+        }
+        if (!docs.empty() && !insert_nodes(docs)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool MerkleTree::existing(const std::vector<HashId>& hashes, std::vector<bool>& found) {
+    found.assign(hashes.size(), false);
+    std::unordered_map<HashId, std::vector<size_t>> positions;
+    for (size_t i = 0; i < hashes.size(); ++i) {
+        positions[hashes[i]].push_back(i);
+    }
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("hash", 1), kvp("_id", 0)));
+
+        auto collection = lease_collection();
+        for (size_t begin = 0; begin < hashes.size(); begin += kLookupChunkSize) {
+            size_t end = std::min(hashes.size(), begin + kLookupChunkSize);
+            auto filter = make_in_filter(hashes, begin, end);
+            for (auto&& doc : collection->find(filter.view(), opts)) {
+                HashId hash;
+                if (!doc["hash"] || !HashId::from_bson(doc["hash"].get_value(), hash)) {
+                    continue;
+                }
+                auto it = positions.find(hash);
+                if (it != positions.end()) {
+                    for (size_t i : it->second) {
+                        found[i] = true;
+                    }
+                }
+            }
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error checking Merkle nodes: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+// Nodes another writer stored first count as stored.
+bool MerkleTree::insert_nodes(const std::vector<bsoncxx::document::value>& docs) {
+    mongocxx::options::insert insert_opts;
+    insert_opts.ordered(false);
+
+    try {
+        lease_collection()->insert_many(docs, insert_opts);
+        return true;
+    } catch (const mongocxx::bulk_write_exception& e) {
+        bool only_duplicates = false;
+        if (e.raw_server_error()) {
+            auto reply = e.raw_server_error()->view();
+            if (reply["writeErrors"] && reply["writeErrors"].type() == bsoncxx::type::k_array) {
+                only_duplicates = true;
+                for (auto&& error : reply["writeErrors"].get_array().value) {
+                    auto error_doc = error.get_document().value;
+                    if (!error_doc["code"] || error_doc["code"].get_int32().value != kDuplicateKeyError) {
+                        only_duplicates = false;
+                    }
+                }
+            }
+        }
+        if (!only_duplicates) {
+            std::cerr << "Error storing Merkle nodes: " << e.what() << std::endl;
+        }
+        return only_duplicates;
+    } catch (const std::exception& e) {
+        std::cerr << "Error storing Merkle nodes: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool MerkleTree::fetch_nodes(const std::vector<HashId>& hashes, NodeMap& nodes, MerkleDiffStats* stats) {
+    std::vector<HashId> wanted;
+    for (const auto& hash : hashes) {
+        if (nodes.find(hash) == nodes.end()) {
+            wanted.push_back(hash);
+        }
+    }
+    std::sort(wanted.begin(), wanted.end());
+    wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+    if (wanted.empty()) {
+        return true;
+    }
+
+    try {
+        auto collection = lease_collection();
+        for (size_t begin = 0; begin < wanted.size(); begin += kLookupChunkSize) {
+            size_t end = std::min(wanted.size(), begin + kLookupChunkSize);
+            auto filter = make_in_filter(wanted, begin, end);
+            if (stats) {
+                ++stats->round_trips;
+            }
+            for (auto&& doc : collection->find(filter.view())) {
+                Node node;
+                if (!doc["hash"] || !HashId::from_bson(doc["hash"].get_value(), node.hash) ||
+                    !doc["entries"] || doc["entries"].type() != bsoncxx::type::k_binary ||
+                    !doc["leaf"] || doc["leaf"].type() != bsoncxx::type::k_bool) {
+                    continue;
+                }
+                node.leaf = doc["leaf"].get_bool().value;
+                node.level = doc["level"] && doc["level"].type() == bsoncxx::type::k_int32
+                    ? static_cast<uint8_t>(doc["level"].get_int32().value)
+                    : 0;
+                node.count = doc["count"] && doc["count"].type() == bsoncxx::type::k_int64
+                    ? static_cast<uint64_t>(doc["count"].get_int64().value)
+                    : 0;
+                auto entries = doc["entries"].get_binary();
+                node.entries.assign(entries.bytes, entries.bytes + entries.size);
+                if (node.entries.size() % (node.leaf ? HashId::kSize : kBranchEntrySize) != 0) {
+                    continue;
+                }
+                if (stats) {
+                    ++stats->nodes_loaded;
+                }
+                HashId hash = node.hash;
+                nodes.emplace(hash, std::move(node));
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error reading Merkle nodes: " << e.what() << std::endl;
+        return false;
+    }
+
+    for (const auto& hash : wanted) {
+        if (nodes.find(hash) == nodes.end()) {
+            std::cerr << "Error reading Merkle nodes: node " << hash.to_hex() << " missing" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+// Appends the refs under roots, subtree by subtree; callers sort.
+bool MerkleTree::collect(const std::vector<HashId>& roots, NodeMap& nodes, std::vector<HashId>& refs, MerkleDiffStats* stats) {
+    std::vector<HashId> frontier(roots);
+    while (!frontier.empty()) {
+        if (!fetch_nodes(frontier, nodes, stats)) {
+            return false;
+        }
+        std::vector<HashId> next;
+        for (const auto& hash : frontier) {
+            const Node& node = nodes.at(hash);
+            for (size_t i = 0; i < node.size(); ++i) {
+                if (node.leaf) {
+                    refs.push_back(node.ref(i));
+                } else {
+                    next.push_back(node.child(i));
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+    return true;
+}
+
+bool MerkleTree::read_refs(const HashId& root, std::vector<HashId>& refs) {
+    refs.clear();
+    NodeMap nodes;
+    if (!collect({root}, nodes, refs, nullptr)) {
+        return false;
+    }
+    std::sort(refs.begin(), refs.end());
+    return true;
+}
+
+bool MerkleTree::contains(const HashId& root) {
+    std::vector<bool> found;
+    return existing({root}, found) && found[0];
+}
+
+bool MerkleTree::diff(
+    const HashId& from_root,
+    const HashId& to_root,
+    std::vector<HashId>& added,
+    std::vector<HashId>& removed,
+    MerkleDiffStats* stats
+) {
+    if (from_root == to_root) {
+        return true;
+    }
+
+    // A side without a node stands for an empty subtree.
+    struct Pair {
+        std::optional<HashId> from;
+        std::optional<HashId> to;
+    };
+
+    NodeMap nodes;
+    std::vector<HashId> removed_roots;
+    std::vector<HashId> added_roots;
+    std::vector<Pair> mixed;
+    std::vector<Pair> frontier{Pair{from_root, to_root}};
+
+    while (!frontier.empty()) {
+        std::vector<HashId> wanted;
+        for (const auto& pair : frontier) {
+            wanted.push_back(*pair.from);
+            wanted.push_back(*pair.to);
+        }
+        if (!fetch_nodes(wanted, nodes, stats)) {
+            return false;
+        }
+
+        std::vector<Pair> next;
+        for (const auto& pair : frontier) {
+            const Node& a = nodes.at(*pair.from);
+            const Node& b = nodes.at(*pair.to);
+            if (a.leaf || b.leaf) {
+                mixed.push_back(pair);
+                continue;
+            }
+            // Branch entries are in digit order.
+            size_t i = 0;
+            size_t j = 0;
+            while (i < a.size() || j < b.size()) {
+                if (j == b.size() || (i < a.size() && a.digit(i) < b.digit(j))) {
+                    removed_roots.push_back(a.child(i++));
+                } else if (i == a.size() || b.digit(j) < a.digit(i)) {
+                    added_roots.push_back(b.child(j++));
+                } else {
+                    HashId from_child = a.child(i++);
+                    HashId to_child = b.child(j++);
+                    if (from_child != to_child) {
+                        next.push_back(Pair{from_child, to_child});
+                    }
+                }
+            }
+        }
+        frontier.swap(next);
+    }
+
+    if (!collect(removed_roots, nodes, removed, stats) || !collect(added_roots, nodes, added, stats)) {
+        return false;
+    }
+
+    // A leaf facing a branch or another leaf: compare their full contents,
+    // which hold at most a few leaves' worth on the leaf side.
+    for (const auto& pair : mixed) {
+        std::vector<HashId> from_refs;
+        std::vector<HashId> to_refs;
+        if (!collect({*pair.from}, nodes, from_refs, stats) || !collect({*pair.to}, nodes, to_refs, stats)) {
+            return false;
+        }
+        std::sort(from_refs.begin(), from_refs.end());
+        std::sort(to_refs.begin(), to_refs.end());
+        std::set_difference(to_refs.begin(), to_refs.end(), from_refs.begin(), from_refs.end(), std::back_inserter(added));
+        std::set_difference(from_refs.begin(), from_refs.end(), to_refs.begin(), to_refs.end(), std::back_inserter(removed));
+    }
+
+    std::sort(added.begin(), added.end());
+    std::sort(removed.begin(), removed.end());
+    return true;
+}
+
+MerkleSyncReport MerkleTree::sync(
+    const HashId& root,
+    MerkleTree& target,
+    const std::function<void(const HashId&)>& on_new_ref
+) {
+    MerkleSyncReport report;
+    NodeMap nodes;
+    std::vector<std::vector<bsoncxx::document::value>> levels;
+    std::vector<HashId> frontier{root};
+
+    while (!frontier.empty()) {
+        std::vector<bool> found;
+        if (!target.existing(frontier, found)) {
+            return report;
+        }
+        std::vector<HashId> missing;
+        for (size_t k = 0; k < frontier.size(); ++k) {
+            if (!found[k]) {
+                missing.push_back(frontier[k]);
+            }
+        }
+        if (!fetch_nodes(missing, nodes, nullptr)) {
+            return report;
+        }
+
+        std::vector<HashId> next;
+        std::vector<bsoncxx::document::value> docs;
+        for (const auto& hash : missing) {
+            const Node& node = nodes.at(hash);
+            docs.push_back(make_node_document(node.hash, node.leaf, node.level, node.count, node.entries.data(), node.entries.size()));
+            ++report.nodes_copied;
+            for (size_t i = 0; i < node.size(); ++i) {
+                if (!node.leaf) {
+                    next.push_back(node.child(i));
+                    continue;
+                }
+                ++report.refs_copied;
+                if (on_new_ref) {
+                    on_new_ref(node.ref(i));
+                }
+            }
+        }
+        levels.push_back(std::move(docs));
+        frontier.swap(next);
+    }
+
+    // Children before parents, as build() writes them.
+    for (auto level = levels.rbegin(); level != levels.rend(); ++level) {
+        if (!level->empty() && !target.insert_nodes(*level)) {
+            return report;
+        }
+    }
+    report.ok = true;
+    return report;
+}
+
+}
+}
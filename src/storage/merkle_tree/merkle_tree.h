@@ -0,0 +1,119 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include <mongocxx/collection.hpp>
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <optional>
+#include <unordered_map>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+struct MerkleBuildStats {
+    size_t nodes = 0;
+    size_t written = 0;
+    size_t bytes_written = 0;
+};
+
+struct MerkleDiffStats {
+    size_t nodes_loaded = 0;
+    size_t round_trips = 0;
+};
+
+struct MerkleSyncReport {
+    bool ok = false;
+    size_t nodes_copied = 0;
+    size_t refs_copied = 0;
+};
+
+// Content-addressed Merkle tree over a sorted set of BPO hashes. A node
+// covers the hashes sharing its prefix: a leaf lists up to kLeafCapacity
+// of them, otherwise it branches on the next hash byte (fanout 256). The
+// shape depends only on the set, so versions share every subtree whose
+// hashes did not change, and two trees are compared by descending only
+// where node hashes differ. Nodes live in merkle_nodes and are written
+// children first, so a stored node implies its whole subtree.
+class MerkleTree {
+public:
+    explicit MerkleTree(mongocxx::collection nodes);
+    explicit MerkleTree(MongoDBConnection& connection);
+
+    MerkleTree(const MerkleTree&) = delete;
+    MerkleTree& operator=(const MerkleTree&) = delete;
+
+    // refs sorted and free of duplicates. Stores only the missing nodes.
+    bool build(const std::vector<HashId>& refs, HashId& root, MerkleBuildStats* stats = nullptr);
+
+    // Sorted hashes in to_root and not in from_root, and the reverse.
+    bool diff(
+        const HashId& from_root,
+        const HashId& to_root,
+        std::vector<HashId>& added,
+        std::vector<HashId>& removed,
+        MerkleDiffStats* stats = nullptr
+    );
+    bool read_refs(const HashId& root, std::vector<HashId>& refs);
+    bool contains(const HashId& root);
+
+    // Copies the nodes of root that target lacks; on_new_ref sees the refs
+    // of every copied leaf, the objects target may be missing too.
+    MerkleSyncReport sync(
+        const HashId& root,
+        MerkleTree& target,
+        const std::function<void(const HashId&)>& on_new_ref = nullptr
+    );
+
+    static HashId empty_root();
+
+    static constexpr size_t kLeafCapacity = 256;
+    static constexpr size_t kLookupChunkSize = 500;
+    static constexpr size_t kInsertBatchBytes = 8 * 1024 * 1024;
+    static constexpr const char* kCollectionName = "merkle_nodes";
+
+private:
+    struct CollectionLease {
+        std::optional<ClientLease> lease;
+        mongocxx::collection collection;
+
+        mongocxx::collection* operator->() { return &collection; }
+    };
+
+    // Leaf entries are packed hashes; branch entries a digit byte followed
+    // by the child hash.
+    struct Node {
+        HashId hash;
+        bool leaf = true;
+        uint8_t level = 0;
+        uint64_t count = 0;
+        std::vector<uint8_t> entries;
+
+        size_t size() const;
+        uint8_t digit(size_t i) const;
+        HashId child(size_t i) const;
+        HashId ref(size_t i) const;
+    };
+
+    using NodeMap = std::unordered_map<HashId, Node>;
+
+    MongoDBConnection* connection_;
+    mongocxx::collection collection_;
+
+    CollectionLease lease_collection();
+    static HashId hash_node(bool leaf, uint8_t level, const uint8_t* entries, size_t size);
+    static bsoncxx::document::value make_node_document(
+        const HashId& hash, bool leaf, uint8_t level, uint64_t count, const uint8_t* entries, size_t size
+    );
+    bool fetch_nodes(const std::vector<HashId>& hashes, NodeMap& nodes, MerkleDiffStats* stats);
+    bool existing(const std::vector<HashId>& hashes, std::vector<bool>& found);
+    bool insert_nodes(const std::vector<bsoncxx::document::value>& docs);
+    bool collect(const std::vector<HashId>& roots, NodeMap& nodes, std::vector<HashId>& refs, MerkleDiffStats* stats);
+};
+
+}
+}
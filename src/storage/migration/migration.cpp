@@ -0,0 +1,621 @@
+#include "migration.h"
+#include "storage/cas/cas.h"
+#include "storage/coordinate_codec/coordinate_codec.h"
+#include "storage/geometry_cas/geometry_cas.h"
+#include "storage/situation_repository/situation_repository.h"
+#include "storage/spatial_index/envelope.h"
+#include "storage/version_diff/version_delta.h"
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/builder/stream/document.hpp>
+#include <bsoncxx/types.hpp>
+#include <mongocxx/bulk_write.hpp>
+#include <mongocxx/exception/bulk_write_exception.hpp>
+#include <mongocxx/model/delete_one.hpp>
+#include <mongocxx/model/update_one.hpp>
+#include <mongocxx/options/bulk_write.hpp>
+#include <mongocxx/options/index.hpp>
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+namespace {
+
+constexpr int kDuplicateKeyError = 11000;
+
+struct PendingRename {
+    bsoncxx::oid id;
+    HashId old_hash;
+    HashId new_hash;
+};
+
+bool remap_hash(
+    const bsoncxx::types::bson_value::view& value,
+    const std::unordered_map<HashId, HashId>& renamed,
+    HashId& out
+) {
+    if (!HashId::from_bson(value, out)) {
+        return false;
+    }
+    auto found = renamed.find(out);
+    if (found != renamed.end()) {
+        out = found->second;
+    }
+    return true;
+}
+
+bool remap_hash_array(
+    const bsoncxx::array::view& source,
+    const std::unordered_map<HashId, HashId>& renamed,
+    bsoncxx::builder::basic::array& target
+) {
+    bool changed = false;
+    std::unordered_set<HashId> seen;
+    for (auto&& element : source) {
+        HashId hash;
+        if (!remap_hash(element.get_value(), renamed, hash)) {
+            continue;
+        }
+        HashId original;
+        HashId::from_bson(element.get_value(), original);
+        if (element.type() != bsoncxx::type::k_binary || original != hash) {
+            changed = true;
+        }
+        if (!seen.insert(hash).second) {
+            changed = true;
+            continue;
+        }
+        target.append(hash.to_bson());
+    }
+    return changed;
+}
+
+void apply_renames(
+    mongocxx::collection& collection,
+    CAS& cas,
+    const std::vector<PendingRename>& pending,
+    HashMigrationReport& report,
+    std::unordered_map<HashId, HashId>& renamed,
+    std::unordered_set<HashId>& merged
+) {
+    if (pending.empty()) {
+        return;
+    }
+
+    std::vector<HashId> targets;
+    targets.reserve(pending.size());
+    for (const auto& item : pending) {
+        targets.push_back(item.new_hash);
+    }
+    std::vector<bool> present = cas.exists_many(targets);
+
+    mongocxx::options::bulk_write opts;
+    opts.ordered(false);
+    auto bulk = collection.create_bulk_write(opts);
+
+    for (size_t i = 0; i < pending.size(); ++i) {
+        if (present[i]) {
+            bulk.append(mongocxx::model::delete_one{make_document(kvp("_id", pending[i].id))});
+        } else {
+            bulk.append(mongocxx::model::update_one{
+                make_document(kvp("_id", pending[i].id)),
+                make_document(kvp("$set", make_document(kvp("hash", pending[i].new_hash.to_bson()))))
+            });
+        }
+    }
+
+    std::vector<bool> failed(pending.size(), false);
+    std::vector<bool> collided(pending.size(), false);
+    try {
+        bulk.execute();
+    } catch (const mongocxx::bulk_write_exception& e) {
+        if (!e.raw_server_error() || !e.raw_server_error()->view()["writeErrors"]) {
+            std::cerr << "Error migrating CAS hashes: " << e.what() << std::endl;
+            report.failed += pending.size();
+            return;
+        }
+        for (auto&& error : e.raw_server_error()->view()["writeErrors"].get_array().value) {
+            auto error_doc = error.get_document().value;
+            auto index = static_cast<size_t>(error_doc["index"].get_int32().value);
+            if (index >= pending.size()) {
+                continue;
+            }
+            if (error_doc["code"].get_int32().value == kDuplicateKeyError) {
+                collided[index] = true;
+            } else {
+                failed[index] = true;
+            }
+        }
+    }
+
+    for (size_t i = 0; i < pending.size(); ++i) {
+        if (failed[i]) {
+            ++report.failed;
+            continue;
+        }
+        if (collided[i]) {
+            try {
+                collection.delete_one(make_document(kvp("_id", pending[i].id)).view());
+            } catch (const std::exception& e) {
+                std::cerr << "Error merging CAS duplicate: " << e.what() << std::endl;
+                ++report.failed;
+                continue;
+            }
+            ++report.merged;
+            merged.insert(pending[i].new_hash);
+        } else if (present[i]) {
+            ++report.merged;
+            merged.insert(pending[i].new_hash);
+        } else if (pending[i].old_hash == pending[i].new_hash) {
+            ++report.reencoded;
+        } else {
+            ++report.migrated;
+        }
+        renamed[pending[i].old_hash] = pending[i].new_hash;
+    }
+}
+
+struct PendingExtent {
+    bsoncxx::oid id;
+    GeometryExtent extent;
+};
+
+void apply_extents(
+    mongocxx::collection& collection,
+    const std::vector<PendingExtent>& pending,
+    EnvelopeBackfillReport& report
+) {
+    if (pending.empty()) {
+        return;
+    }
+
+    mongocxx::options::bulk_write opts;
+    opts.ordered(false);
+    auto bulk = collection.create_bulk_write(opts);
+    for (const auto& item : pending) {
+        bulk.append(mongocxx::model::update_one{
+            make_document(kvp("_id", item.id)),
+            make_document(kvp("$set", item.extent.to_bson()))
+        });
+    }
+
+    size_t failed = 0;
+    try {
+        bulk.execute();
+    } catch (const mongocxx::bulk_write_exception& e) {
+        if (!e.raw_server_error() || !e.raw_server_error()->view()["writeErrors"]) {
+            std::cerr << "Error backfilling envelopes: " << e.what() << std::endl;
+            report.failed += pending.size();
+            return;
+        }
+        auto errors = e.raw_server_error()->view()["writeErrors"].get_array().value;
+        failed = static_cast<size_t>(std::distance(errors.begin(), errors.end()));
+    }
+
+    report.failed += failed;
+    report.updated += pending.size() - failed;
+}
+
+}
+
+Migration::Migration(MongoDBConnection& connection) : connection_(connection) {
+}
+
+void Migration::set_merkle_tree(std::shared_ptr<MerkleTree> tree) {
+    merkle_ = std::move(tree);
+}
+
+std::shared_ptr<MerkleTree> Migration::get_merkle_tree() const {
+    return merkle_;
+}
+
+HashMigrationReport Migration::verify_hashes() {
+    return scan_hashes(false);
+}
+
+HashMigrationReport Migration::migrate_hashes() {
+    return scan_hashes(true);
+}
+
+HashMigrationReport Migration::scan_hashes(bool apply) {
+    HashMigrationReport report;
+    auto collection = connection_.get_bpo_cas_collection();
+    CAS cas(collection);
+    cas.set_geometry_cas(std::make_shared<GeometryCAS>(connection_));
+
+    std::unordered_map<HashId, HashId> renamed;
+    std::unordered_set<HashId> merged;
+    std::vector<PendingRename> pending;
+    pending.reserve(kBatchSize);
+
+    try {
+        bsoncxx::builder::stream::document projection;
+        projection << "_id" << 1 << "hash" << 1 << "geometry" << 1 << "attributes" << 1
+                   << CoordinateCodec::kBlobField << 1 << CoordinateCodec::kEncodingField << 1
+                   << kGeometryHashField << 1;
+
+        mongocxx::options::find opts;
+        opts.projection(projection.view());
+        opts.batch_size(static_cast<int32_t>(kBatchSize));
+
+        bsoncxx::builder::stream::document empty_filter;
+        auto cursor = collection.find(empty_filter.view(), opts);
+
+        for (auto&& doc : cursor) {
+            ++report.scanned;
+            if (!doc["hash"] || !doc["geometry"] || !doc["attributes"]) {
+                ++report.unknown;
+                continue;
+            }
+
+            HashId stored;
+            if (!HashId::from_bson(doc["hash"].get_value(), stored)) {
+                ++report.unknown;
+                continue;
+            }
+            bool string_encoded = doc["hash"].type() == bsoncxx::type::k_string;
+            bsoncxx::document::view geometry;
+            std::optional<bsoncxx::document::value> decoded;
+            if (!cas.read_geometry(doc, geometry, decoded)) {
+                ++report.unknown;
+                continue;
+            }
+            auto attributes = doc["attributes"].get_document().value;
+
+            HashId target = stored;
+            if (stored == cas.compute_canonical_hash(geometry, attributes)) {
+                ++report.canonical;
+            } else if (stored == cas.compute_legacy_hash(geometry, attributes)) {
+                ++report.legacy;
+                target = cas.compute_canonical_hash(geometry, attributes);
+            } else {
+                ++report.unknown;
+            }
+
+            if (!apply || (target == stored && !string_encoded)) {
+                continue;
+            }
+
+            pending.push_back(PendingRename{doc["_id"].get_oid().value, stored, target});
+            if (pending.size() >= kBatchSize) {
+                apply_renames(collection, cas, pending, report, renamed, merged);
+                pending.clear();
+            }
+        }
+
+        apply_renames(collection, cas, pending, report, renamed, merged);
+    } catch (const std::exception& e) {
+        std::cerr << "Error scanning CAS hashes: " << e.what() << std::endl;
+    }
+
+    if (apply) {
+        report.references_updated += flatten_merged_deltas(renamed, merged);
+        report.references_updated += rewrite_version_refs(renamed);
+        report.references_updated += rewrite_delta_refs(renamed, report.references_failed);
+        refresh_delta_roots(renamed, report.references_failed);
+    }
+
+    return report;
+}
+
+EnvelopeBackfillReport Migration::backfill_envelopes() {
+    EnvelopeBackfillReport report;
+    auto collection = connection_.get_bpo_cas_collection();
+
+    std::vector<PendingExtent> pending;
+    pending.reserve(kBatchSize);
+
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("_id", 1), kvp("geometry", 1)));
+        opts.batch_size(static_cast<int32_t>(kBatchSize));
+
+        auto cursor = collection.find(make_document(kvp("envelope", make_document(kvp("$exists", false)))), opts);
+        for (auto&& doc : cursor) {
+            ++report.scanned;
+            PendingExtent item{doc["_id"].get_oid().value, GeometryExtent()};
+            if (!doc["geometry"] || doc["geometry"].type() != bsoncxx::type::k_document ||
+                !GeometryExtent::from_geometry(doc["geometry"].get_document().value, item.extent)) {
+                ++report.skipped;
+                continue;
+            }
+
+            pending.push_back(item);
+            if (pending.size() >= kBatchSize) {
+                apply_extents(collection, pending, report);
+                pending.clear();
+            }
+        }
+
+        apply_extents(collection, pending, report);
+
+        mongocxx::options::index index_options;
+        index_options.name("envelope_idx");
+        collection.create_index(
+            make_document(
+                kvp("envelope.min_lon", 1),
+                kvp("envelope.min_lat", 1),
+                kvp("envelope.max_lon", 1),
+                kvp("envelope.max_lat", 1)
+            ),
+            index_options
+        );
+    } catch (const std::exception& e) {
+        std::cerr << "Error backfilling envelopes: " << e.what() << std::endl;
+    }
+
+    return report;
+}
+
+// Once two objects of a delta version merge into one, replaying its chain
+// with renamed deltas no longer yields its ref_count. Such versions are
+// checked out while the chain is still intact and stored as keyframes.
+size_t Migration::flatten_merged_deltas(
+    const std::unordered_map<HashId, HashId>& renamed,
+    const std::unordered_set<HashId>& merged
+) {
+    if (merged.empty()) {
+        return 0;
+    }
+    std::unordered_set<HashId> affected(merged);
+    for (const auto& entry : renamed) {
+        if (merged.count(entry.second) > 0) {
+            affected.insert(entry.first);
+        }
+    }
+
+    size_t updated = 0;
+    auto versions = connection_.get_situation_versions_collection();
+    try {
+        std::vector<std::string> delta_versions;
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("version_id", 1), kvp("_id", 0)));
+        for (auto&& doc : versions.find(make_document(kvp("delta_chain", make_document(kvp("$exists", true)))), opts)) {
+            delta_versions.emplace_back(doc["version_id"].get_string().value);
+        }
+
+        CAS cas(connection_);
+        SituationRepository repository(connection_, cas);
+        repository.set_merkle_tree(merkle_);
+        std::vector<std::pair<std::string, std::vector<HashId>>> flattened;
+        for (const auto& version_id : delta_versions) {
+            auto refs = repository.checkout(version_id);
+            if (!refs || std::none_of(refs->begin(), refs->end(), [&affected](const HashId& hash) {
+                    return affected.count(hash) > 0;
+                })) {
+                continue;
+            }
+            std::vector<HashId> remapped(*refs);
+            for (auto& hash : remapped) {
+                auto found = renamed.find(hash);
+                if (found != renamed.end()) {
+                    hash = found->second;
+                }
+            }
+            std::sort(remapped.begin(), remapped.end());
+            remapped.erase(std::unique(remapped.begin(), remapped.end()), remapped.end());
+            flattened.emplace_back(version_id, std::move(remapped));
+        }
+
+        // Written only after every checkout, so each chain is replayed as stored.
+        for (auto& entry : flattened) {
+            if (repository.replace_refs(entry.first, std::move(entry.second))) {
+                ++updated;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error flattening merged delta versions: " << e.what() << std::endl;
+    }
+
+    return updated;
+}
+
+size_t Migration::rewrite_version_refs(const std::unordered_map<HashId, HashId>& renamed) {
+    size_t updated = 0;
+    auto versions = connection_.get_situation_versions_collection();
+
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("_id", 1), kvp("bpo_refs", 1)));
+        opts.batch_size(static_cast<int32_t>(kBatchSize));
+
+        auto cursor = versions.find(make_document(kvp("bpo_refs.0", make_document(kvp("$exists", true)))), opts);
+        for (auto&& doc : cursor) {
+            bsoncxx::builder::basic::array refs;
+            if (!remap_hash_array(doc["bpo_refs"].get_array().value, renamed, refs)) {
+                continue;
+            }
+            // Inline refs predate Merkle roots; drop any rather than trust it.
+            versions.update_one(
+                make_document(kvp("_id", doc["_id"].get_value())),
+                make_document(
+                    kvp("$set", make_document(kvp("bpo_refs", refs))),
+                    kvp("$unset", make_document(kvp("merkle_root", "")))
+                )
+            );
+            ++updated;
+        }
+
+        // Chunked refs are sorted by hash, so renamed ones are re-sorted.
+        std::vector<std::string> chunked;
+        mongocxx::options::find chunked_opts;
+        chunked_opts.projection(make_document(kvp("version_id", 1), kvp("_id", 0)));
+        for (auto&& doc : versions.find(make_document(kvp("ref_chunks", make_document(kvp("$exists", true)))), chunked_opts)) {
+            chunked.emplace_back(doc["version_id"].get_string().value);
+        }
+
+        CAS cas(connection_);
+        SituationRepository repository(connection_, cas);
+        repository.set_merkle_tree(merkle_);
+        for (const auto& version_id : chunked) {
+            std::vector<HashId> refs;
+            if (!repository.read_refs(version_id, refs)) {
+                continue;
+            }
+            bool changed = false;
+            for (auto& hash : refs) {
+                auto found = renamed.find(hash);
+                if (found != renamed.end()) {
+                    hash = found->second;
+                    changed = true;
+                }
+            }
+            if (changed && repository.replace_refs(version_id, std::move(refs))) {
+                ++updated;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error rewriting version references: " << e.what() << std::endl;
+    }
+
+    return updated;
+}
+
+// Deltas are rewritten whole through VersionDeltaDocuments, so the hash
+// lists stay sorted across parts after renames.
+size_t Migration::rewrite_delta_refs(const std::unordered_map<HashId, HashId>& renamed, size_t& failed) {
+    size_t updated = 0;
+    auto deltas = connection_.get_version_deltas_collection();
+
+    auto remap = [&renamed](HashId& hash) {
+        auto found = renamed.find(hash);
+        if (found == renamed.end() || found->second == hash) {
+            return false;
+        }
+        hash = found->second;
+        return true;
+    };
+
+    try {
+        std::set<std::pair<std::string, std::string>> pairs;
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("from_version_id", 1), kvp("to_version_id", 1), kvp("_id", 0)));
+        opts.batch_size(static_cast<int32_t>(kBatchSize));
+        bsoncxx::builder::stream::document empty_filter;
+        for (auto&& doc : deltas.find(empty_filter.view(), opts)) {
+            if (doc["from_version_id"] && doc["from_version_id"].type() == bsoncxx::type::k_string &&
+                doc["to_version_id"] && doc["to_version_id"].type() == bsoncxx::type::k_string) {
+                pairs.emplace(
+                    std::string(doc["from_version_id"].get_string().value),
+                    std::string(doc["to_version_id"].get_string().value)
+                );
+            }
+        }
+
+        for (const auto& pair : pairs) {
+            VersionDelta delta;
+            std::string identity_field;
+            if (!VersionDeltaDocuments::load(deltas, pair.first, pair.second, delta, identity_field)) {
+                std::cerr << "Error rewriting delta " << pair.first << " -> " << pair.second
+                          << ": unreadable hash entries, left unchanged" << std::endl;
+                ++failed;
+                continue;
+            }
+            delta.from_version_id = pair.first;
+            delta.to_version_id = pair.second;
+
+            bool changed = false;
+            for (auto* hashes : {&delta.added, &delta.removed}) {
+                for (auto& hash : *hashes) {
+                    changed |= remap(hash);
+                }
+                if (!std::is_sorted(hashes->begin(), hashes->end()) ||
+                    std::adjacent_find(hashes->begin(), hashes->end()) != hashes->end()) {
+                    std::sort(hashes->begin(), hashes->end());
+                    hashes->erase(std::unique(hashes->begin(), hashes->end()), hashes->end());
+                    changed = true;
+                }
+            }
+            for (auto& modified : delta.modified) {
+                changed |= remap(modified.old_hash);
+                changed |= remap(modified.new_hash);
+            }
+            auto by_old_hash = [](const ModifiedBPO& a, const ModifiedBPO& b) {
+                return a.old_hash < b.old_hash || (a.old_hash == b.old_hash && a.new_hash < b.new_hash);
+            };
+            if (!std::is_sorted(delta.modified.begin(), delta.modified.end(), by_old_hash)) {
+                std::sort(delta.modified.begin(), delta.modified.end(), by_old_hash);
+                changed = true;
+            }
+
+            if (!changed) {
+                continue;
+            }
+            VersionDeltaDocuments::write(deltas, nullptr, delta, identity_field);
+            ++updated;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error rewriting delta references: " << e.what() << std::endl;
+    }
+
+    return updated;
+}
+
+// Versions stored as deltas keep their Merkle root when the deltas under
+// them are rewritten; those now holding a renamed hash get a fresh root.
+void Migration::refresh_delta_roots(const std::unordered_map<HashId, HashId>& renamed, size_t& failed) {
+    std::unordered_set<HashId> targets;
+    for (const auto& entry : renamed) {
+        if (entry.first != entry.second) {
+            targets.insert(entry.second);
+        }
+    }
+    if (targets.empty()) {
+        return;
+    }
+
+    auto versions = connection_.get_situation_versions_collection();
+    try {
+        std::vector<std::pair<std::string, bool>> delta_versions;
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("version_id", 1), kvp("merkle_root", 1), kvp("_id", 0)));
+        auto filter = make_document(kvp("delta_chain", make_document(kvp("$exists", true))));
+        for (auto&& doc : versions.find(filter.view(), opts)) {
+            delta_versions.emplace_back(std::string(doc["version_id"].get_string().value), static_cast<bool>(doc["merkle_root"]));
+        }
+
+        CAS cas(connection_);
+        SituationRepository repository(connection_, cas);
+        for (const auto& entry : delta_versions) {
+            const std::string& version_id = entry.first;
+            bool has_root = entry.second;
+            // Left unreadable by the rewrite: counted, and its root dropped.
+            auto refs = repository.checkout(version_id);
+            if (!refs) {
+                std::cerr << "Error migrating version " << version_id << ": unreadable after the rewrite" << std::endl;
+                ++failed;
+            }
+            bool touched = !refs || std::any_of(refs->begin(), refs->end(), [&targets](const HashId& hash) {
+                return targets.count(hash) > 0;
+            });
+            if (!touched || !has_root) {
+                continue;
+            }
+
+            HashId root;
+            auto update = refs && merkle_ && merkle_->build(*refs, root)
+                ? make_document(kvp("$set", make_document(kvp("merkle_root", root.to_bson()))))
+                : make_document(kvp("$unset", make_document(kvp("merkle_root", ""))));
+            versions.update_one(make_document(kvp("version_id", version_id)), update.view());
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error refreshing Merkle roots: " << e.what() << std::endl;
+    }
+}
+
+}
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include "storage/merkle_tree/merkle_tree.h"
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include <cstddef>
+#include <memory>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace geoversion {
+namespace storage {
+
+struct HashMigrationReport {
+    size_t scanned = 0;
+    size_t canonical = 0;
+    size_t legacy = 0;
+    size_t unknown = 0;
+    size_t migrated = 0;
+    size_t merged = 0;
+    size_t reencoded = 0;
+    size_t failed = 0;
+    size_t references_updated = 0;
+    // Referencing documents left unchanged because they could not be read,
+    // and versions that cannot be checked out after the rewrite.
+    size_t references_failed = 0;
+};
+
+struct EnvelopeBackfillReport {
+    size_t scanned = 0;
+    size_t updated = 0;
+    size_t skipped = 0;
+    size_t failed = 0;
+};
+
+class Migration {
+public:
+    explicit Migration(MongoDBConnection& connection);
+
+    // Rebuilds the Merkle roots of rewritten versions; without one their
+    // roots are dropped.
+    void set_merkle_tree(std::shared_ptr<MerkleTree> tree);
+    std::shared_ptr<MerkleTree> get_merkle_tree() const;
+
+    HashMigrationReport verify_hashes();
+    HashMigrationReport migrate_hashes();
+
+    EnvelopeBackfillReport backfill_envelopes();
+
+    static constexpr size_t kBatchSize = 500;
+
+private:
+    MongoDBConnection& connection_;
+    std::shared_ptr<MerkleTree> merkle_;
+
+    HashMigrationReport scan_hashes(bool apply);
+    size_t flatten_merged_deltas(
+        const std::unordered_map<HashId, HashId>& renamed,
+        const std::unordered_set<HashId>& merged
+    );
+    size_t rewrite_version_refs(const std::unordered_map<HashId, HashId>& renamed);
+    size_t rewrite_delta_refs(const std::unordered_map<HashId, HashId>& renamed, size_t& failed);
+    void refresh_delta_roots(const std::unordered_map<HashId, HashId>& renamed, size_t& failed);
+};
+
+}
+}
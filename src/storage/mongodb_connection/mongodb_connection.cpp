@@ -3,7 +3,11 @@
 #include <bsoncxx/builder/stream/document.hpp>
 #include <bsoncxx/builder/stream/array.hpp>
 #include <bsoncxx/json.hpp>
+#include <bsoncxx/types.hpp>
+#include <algorithm>
+#include <cctype>
 #include <iostream>
+#include <vector>
 
 namespace {
     mongocxx::instance global_mongo_instance{};
@@ -12,11 +16,86 @@ namespace {
 namespace geoversion {
 namespace storage {
 
+namespace {
+
+// URI option names are case-insensitive.
+bool has_uri_option(const std::string& query, const std::string& name) {
+    size_t begin = 0;
+    while (begin <= query.size()) {
+        size_t end = query.find('&', begin);
+        end = end == std::string::npos ? query.size() : end;
+        size_t equals = query.find('=', begin);
+        size_t key_end = equals == std::string::npos || equals > end ? end : equals;
+        if (key_end - begin == name.size() &&
+            std::equal(name.begin(), name.end(), query.begin() + begin, [](char a, char b) {
+                return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+            })) {
+            return true;
+        }
+        begin = end + 1;
+    }
+    return false;
+}
+
+// Options the URI already sets win over the pool options.
+std::string with_pool_options(const std::string& connection_string, const ConnectionPoolOptions& options) {
+    std::string result = connection_string;
+    size_t path_start = result.find("://");
+    path_start = path_start == std::string::npos ? 0 : path_start + 3;
+    bool has_path = result.find('/', path_start) != std::string::npos;
+    size_t query_start = result.find('?', path_start);
+    std::string query = query_start == std::string::npos ? std::string() : result.substr(query_start + 1);
+
+    std::vector<std::string> added;
+    if (!has_uri_option(query, "maxPoolSize")) {
+        added.push_back("maxPoolSize=" + std::to_string(options.max_pool_size));
+    }
+    if (!has_uri_option(query, "minPoolSize")) {
+        added.push_back("minPoolSize=" + std::to_string(options.min_pool_size));
+    }
+    if (added.empty()) {
+        return result;
+    }
+
+    if (query_start == std::string::npos) {
+        result += has_path ? "?" : "/?";
+    } else if (result.back() != '?' && result.back() != '&') {
+        result += "&";
+    }
+    for (size_t i = 0; i < added.size(); ++i) {
+        result += (i > 0 ? "&" : "") + added[i];
+    }
+    return result;
+}
+
+}
+
+ClientLease::ClientLease(mongocxx::pool::entry entry, const std::string& database_name)
+    : entry_(std::move(entry)), client_(entry_.get()), database_name_(database_name) {
+}
+
+ClientLease::ClientLease(mongocxx::client& client, std::unique_lock<std::recursive_mutex> lock, const std::string& database_name)
+    : lock_(std::move(lock)), client_(&client), database_name_(database_name) {
+}
+
+mongocxx::client& ClientLease::client() {
+    return *client_;
+}
+
+mongocxx::database ClientLease::database() {
+    return client_->database(database_name_);
+}
+
+mongocxx::collection ClientLease::collection(const std::string& name) {
+    return client_->database(database_name_).collection(name);
+}
+
 MongoDBConnection::MongoDBConnection(
     const std::string& connection_string,
     const std::string& database_name
 ) : connection_string_(connection_string),
-    database_name_(database_name)
+    database_name_(database_name),
+    client_mutex_(std::make_unique<std::recursive_mutex>())
 {
     try {
         mongocxx::uri uri(connection_string_);
@@ -31,8 +110,62 @@ MongoDBConnection::MongoDBConnection(
     }
 }
 
+MongoDBConnection::MongoDBConnection(
+    const std::string& connection_string,
+    const std::string& database_name,
+    const ConnectionPoolOptions& pool_options
+) : connection_string_(connection_string),
+    database_name_(database_name),
+    client_mutex_(std::make_unique<std::recursive_mutex>())
+{
+    try {
+        mongocxx::uri uri(with_pool_options(connection_string_, pool_options));
+        pool_ = std::make_unique<mongocxx::pool>(uri);
+        pooled_client_ = pool_->acquire();
+        database_ = pooled_client_->database(database_name_);
+        
+        std::cout << "Connected to MongoDB: " << connection_string_
+                  << " (pool " << pool_options.min_pool_size << ".." << pool_options.max_pool_size << ")" << std::endl;
+        std::cout << "Using database: " << database_name_ << std::endl;
+    } catch (const std::exception& e) {
+        std::cerr << "Failed to connect to MongoDB: " << e.what() << std::endl;
+        throw;
+    }
+}
+
 MongoDBConnection::~MongoDBConnection() = default;
 
+bool MongoDBConnection::is_pooled() const {
+    return pool_ != nullptr;
+}
+
+ClientLease MongoDBConnection::acquire() {
+    if (pool_) {
+        return ClientLease(pool_->acquire(), database_name_);
+    }
+    return ClientLease(*client_, std::unique_lock<std::recursive_mutex>(*client_mutex_), database_name_);
+}
+
+std::optional<ClientLease> MongoDBConnection::try_acquire() {
+    if (pool_) {
+        auto entry = pool_->try_acquire();
+        if (!entry) {
+            return std::nullopt;
+        }
+        return ClientLease(std::move(*entry), database_name_);
+    }
+
+    std::unique_lock<std::recursive_mutex> lock(*client_mutex_, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        return std::nullopt;
+    }
+    return ClientLease(*client_, std::move(lock), database_name_);
+}
+
+const std::string& MongoDBConnection::get_database_name() const {
+    return database_name_;
+}
+
 mongocxx::database MongoDBConnection::get_database() {
     return database_;
 }
@@ -41,6 +174,14 @@ mongocxx::collection MongoDBConnection::get_bpo_cas_collection() {
     return database_.collection("bpo_cas");
 }
 
+mongocxx::collection MongoDBConnection::get_bpo_geometries_collection() {
+    return database_.collection("bpo_geometries");
+}
+
+mongocxx::collection MongoDBConnection::get_bpo_geometry_chunks_collection() {
+    return database_.collection("bpo_geometry_chunks");
+}
+
 mongocxx::collection MongoDBConnection::get_situations_collection() {
     return database_.collection("situations");
 }
@@ -49,44 +190,64 @@ mongocxx::collection MongoDBConnection::get_situation_versions_collection() {
     return database_.collection("situation_versions");
 }
 
+mongocxx::collection MongoDBConnection::get_situation_version_refs_collection() {
+    return database_.collection("situation_version_refs");
+}
+
+mongocxx::collection MongoDBConnection::get_merkle_nodes_collection() {
+    return database_.collection("merkle_nodes");
+}
+
 mongocxx::collection MongoDBConnection::get_version_deltas_collection() {
     return database_.collection("version_deltas");
 }
 
+// Every index the storage code hints or relies on for uniqueness. Databases
+// created before an index was added report uninitialized, so
+// initialize_database() creates the missing ones.
 bool MongoDBConnection::is_initialized() {
+    struct RequiredIndex {
+        const char* collection;
+        const char* name;
+    };
+    static const RequiredIndex required_indexes[] = {
+        {"bpo_cas", "geometry_2dsphere_idx"},
+        {"bpo_cas", "hash_idx"},
+        {"bpo_cas", "envelope_idx"},
+        {"bpo_geometries", "geometry_hash_idx"},
+        {"bpo_geometry_chunks", "chunk_hash_idx"},
+        {"situations", "situation_id_idx"},
+        {"situation_versions", "version_id_idx"},
+        {"situation_versions", "situation_versions_lookup_idx"},
+        {"situation_versions", "situation_versions_created_idx"},
+        {"situation_version_refs", "version_refs_idx"},
+        {"merkle_nodes", "merkle_hash_idx"},
+        {"version_deltas", "delta_id_idx"},
+        {"version_deltas", "delta_lookup_idx"}
+    };
+
     try {
         auto collections = database_.list_collection_names();
-        std::vector<std::string> required_collections = {
-            "bpo_cas",
-            "situations",
-            "situation_versions",
-            "version_deltas"
-        };
-
-        for (const auto& required : required_collections) {
-            bool found = false;
-            for (const auto& collection : collections) {
-                if (collection == required) {
-                    found = true;
-                    break;
+        std::string checked;
+        std::vector<std::string> names;
+        for (const auto& required : required_indexes) {
+            if (checked != required.collection) {
+                checked = required.collection;
+                if (std::find(collections.begin(), collections.end(), checked) == collections.end()) {
+                    return false;
+                }
+                names.clear();
+                for (auto&& index : database_.collection(checked).list_indexes()) {
+                    if (index["name"] && index["name"].type() == bsoncxx::type::k_string) {
+                        names.emplace_back(index["name"].get_string().value);
+                    }
                 }
             }
-            if (!found) {
+            if (std::find(names.begin(), names.end(), required.name) == names.end()) {
                 return false;
             }
         }
-
-        auto bpo_cas = get_bpo_cas_collection();
-        auto indexes = bpo_cas.list_indexes();
-        bool has_geospatial_index = false;
-        for (auto&& index : indexes) {
-            if (index["name"] && index["name"].get_string().value == std::string("geometry_2dsphere_idx")) {
-                has_geospatial_index = true;
-                break;
-            }
-        }
-
-        return has_geospatial_index;
+        return true;
     } catch (const std::exception& e) {
         std::cerr << "Error checking initialization: " << e.what() << std::endl;
         return false;
@@ -113,7 +274,8 @@ bool MongoDBConnection::initialize_database() {
 
 bool MongoDBConnection::test_connection() {
     try {
-        auto admin_db = client_->database("admin");
+        auto lease = acquire();
+        auto admin_db = lease.client().database("admin");
         auto result = admin_db.run_command(
             bsoncxx::builder::stream::document{} << "ping" << 1 
             << bsoncxx::builder::stream::finalize
@@ -152,6 +314,44 @@ void MongoDBConnection::create_geospatial_indexes() {
             hash_index_options
         );
 
+        bsoncxx::builder::stream::document envelope_index_spec;
+        envelope_index_spec << "envelope.min_lon" << 1
+                            << "envelope.min_lat" << 1
+                            << "envelope.max_lon" << 1
+                            << "envelope.max_lat" << 1;
+        
+        mongocxx::options::index envelope_index_options;
+        envelope_index_options.name("envelope_idx");
+        
+        bpo_cas.create_index(
+            envelope_index_spec.view(),
+            envelope_index_options
+        );
+
+        auto bpo_geometries = get_bpo_geometries_collection();
+        bsoncxx::builder::stream::document geometry_hash_index;
+        geometry_hash_index << "hash" << 1;
+
+        mongocxx::options::index geometry_hash_options;
+        geometry_hash_options.name("geometry_hash_idx").unique(true);
+
+        bpo_geometries.create_index(
+            geometry_hash_index.view(),
+            geometry_hash_options
+        );
+
+        auto bpo_geometry_chunks = get_bpo_geometry_chunks_collection();
+        bsoncxx::builder::stream::document chunk_hash_index;
+        chunk_hash_index << "hash" << 1;
+
+        mongocxx::options::index chunk_hash_options;
+        chunk_hash_options.name("chunk_hash_idx").unique(true);
+
+        bpo_geometry_chunks.create_index(
+            chunk_hash_index.view(),
+            chunk_hash_options
+        );
+
         auto situations = get_situations_collection();
         bsoncxx::builder::stream::document situation_id_index;
         situation_id_index << "situation_id" << 1;
@@ -189,6 +389,42 @@ void MongoDBConnection::create_geospatial_indexes() {
             lookup_index_options
         );
 
+        bsoncxx::builder::stream::document situation_versions_created_index;
+        situation_versions_created_index << "created_at" << 1;
+
+        mongocxx::options::index created_index_options;
+        created_index_options.name("situation_versions_created_idx");
+
+        situation_versions.create_index(
+            situation_versions_created_index.view(),
+            created_index_options
+        );
+
+        auto situation_version_refs = get_situation_version_refs_collection();
+        bsoncxx::builder::stream::document version_refs_index;
+        version_refs_index << "version_id" << 1
+                           << "seq" << 1;
+
+        mongocxx::options::index version_refs_options;
+        version_refs_options.name("version_refs_idx").unique(true);
+
+        situation_version_refs.create_index(
+            version_refs_index.view(),
+            version_refs_options
+        );
+
+        auto merkle_nodes = get_merkle_nodes_collection();
+        bsoncxx::builder::stream::document merkle_hash_index;
+        merkle_hash_index << "hash" << 1;
+
+        mongocxx::options::index merkle_hash_options;
+        merkle_hash_options.name("merkle_hash_idx").unique(true);
+
+        merkle_nodes.create_index(
+            merkle_hash_index.view(),
+            merkle_hash_options
+        );
+
         auto version_deltas = get_version_deltas_collection();
         
         bsoncxx::builder::stream::document delta_id_index;
@@ -6,12 +6,44 @@
 #include <mongocxx/uri.hpp>
 #include <bsoncxx/builder/stream/document.hpp>
 #include <bsoncxx/document/view.hpp>
+#include <cstddef>
 #include <memory>
+#include <mutex>
+#include <optional>
 #include <string>
 
 namespace geoversion {
 namespace storage {
 
+struct ConnectionPoolOptions {
+    size_t min_pool_size = 0;
+    size_t max_pool_size = 100;
+};
+
+// Exclusive use of one client for the lifetime of the lease. Pooled
+// connections hand out a pool entry; single-client connections lock the
+// shared client instead (re-entrant within one thread).
+class ClientLease {
+public:
+    ClientLease(ClientLease&&) = default;
+    ClientLease& operator=(ClientLease&&) = default;
+
+    mongocxx::client& client();
+    mongocxx::database database();
+    mongocxx::collection collection(const std::string& name);
+
+private:
+    friend class MongoDBConnection;
+
+    ClientLease(mongocxx::pool::entry entry, const std::string& database_name);
+    ClientLease(mongocxx::client& client, std::unique_lock<std::recursive_mutex> lock, const std::string& database_name);
+
+    std::unique_lock<std::recursive_mutex> lock_;
+    mongocxx::pool::entry entry_;
+    mongocxx::client* client_;
+    std::string database_name_;
+};
+
 class MongoDBConnection {
 public:
     explicit MongoDBConnection(
@@ -19,6 +51,12 @@ public:
         const std::string& database_name = "geoversion"
     );
 
+    MongoDBConnection(
+        const std::string& connection_string,
+        const std::string& database_name,
+        const ConnectionPoolOptions& pool_options
+    );
+
     ~MongoDBConnection();
 
     MongoDBConnection(const MongoDBConnection&) = delete;
@@ -27,14 +65,28 @@ public:
     MongoDBConnection(MongoDBConnection&&) = default;
     MongoDBConnection& operator=(MongoDBConnection&&) = default;
 
+    bool is_pooled() const;
+    ClientLease acquire();
+    std::optional<ClientLease> try_acquire();
+
+    const std::string& get_database_name() const;
+
     mongocxx::database get_database();
 
     mongocxx::collection get_bpo_cas_collection();
 
+    mongocxx::collection get_bpo_geometries_collection();
+
+    mongocxx::collection get_bpo_geometry_chunks_collection();
+
     mongocxx::collection get_situations_collection();
 
     mongocxx::collection get_situation_versions_collection();
 
+    mongocxx::collection get_situation_version_refs_collection();
+
+    mongocxx::collection get_merkle_nodes_collection();
+
     mongocxx::collection get_version_deltas_collection();
 
     bool is_initialized();
@@ -46,7 +98,10 @@ public:
 private:
     std::string connection_string_;
     std::string database_name_;
+    std::unique_ptr<mongocxx::pool> pool_;
+    mongocxx::pool::entry pooled_client_;
     std::unique_ptr<mongocxx::client> client_;
+    std::unique_ptr<std::recursive_mutex> client_mutex_;
     mongocxx::database database_;
 
     void create_geospatial_indexes();
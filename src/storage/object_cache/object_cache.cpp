@@ -0,0 +1,339 @@
+#include "object_cache.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr size_t kWindowPercent = 1;
+constexpr size_t kProtectedPercent = 80;
+constexpr size_t kMinSketchEntries = 1024;
+constexpr size_t kMaxSketchEntries = 1 << 22;
+
+size_t next_power_of_two(size_t value) {
+    size_t result = 1;
+    while (result < value) {
+        result <<= 1;
+    }
+    return result;
+}
+
+uint32_t read_word(const HashId& hash, size_t offset) {
+    uint32_t value = 0;
+    std::memcpy(&value, hash.data() + offset, sizeof(value));
+    return value;
+}
+
+}
+
+FrequencySketch::FrequencySketch(size_t expected_entries)
+    : additions_(0) {
+    size_t width = next_power_of_two(std::min(std::max(expected_entries, kMinSketchEntries), kMaxSketchEntries));
+    counters_.assign(width * kDepth, 0);
+    mask_ = width - 1;
+    sample_size_ = width * 10;
+}
+
+size_t FrequencySketch::index_of(const HashId& hash, size_t row) const {
+    return row * (mask_ + 1) + (read_word(hash, 8 + row * sizeof(uint32_t)) & mask_);
+}
+
+void FrequencySketch::increment(const HashId& hash) {
+    bool added = false;
+    for (size_t row = 0; row < kDepth; ++row) {
+        uint8_t& counter = counters_[index_of(hash, row)];
+        if (counter < kMaxCount) {
+            ++counter;
+            added = true;
+        }
+    }
+    if (added && ++additions_ >= sample_size_) {
+        reset();
+    }
+}
+
+uint8_t FrequencySketch::frequency(const HashId& hash) const {
+    uint8_t result = kMaxCount;
+    for (size_t row = 0; row < kDepth; ++row) {
+        result = std::min(result, counters_[index_of(hash, row)]);
+    }
+    return result;
+}
+
+void FrequencySketch::reset() {
+    for (uint8_t& counter : counters_) {
+        counter >>= 1;
+    }
+    additions_ /= 2;
+}
+
+ObjectCache::ObjectCache(const ObjectCacheOptions& options) {
+    size_t shard_count = std::max<size_t>(1, options.shard_count);
+    size_t shard_capacity = options.capacity_bytes / shard_count;
+
+    window_capacity_ = std::max<size_t>(1, shard_capacity * kWindowPercent / 100);
+    main_capacity_ = shard_capacity - std::min(shard_capacity, window_capacity_);
+    protected_capacity_ = main_capacity_ * kProtectedPercent / 100;
+    negative_capacity_ = std::max<size_t>(1, options.negative_capacity / shard_count);
+
+    size_t expected_entries = shard_capacity / std::max<size_t>(1, options.expected_object_bytes);
+    shards_.reserve(shard_count);
+    for (size_t i = 0; i < shard_count; ++i) {
+        shards_.push_back(std::make_unique<Shard>(expected_entries));
+    }
+}
+
+ObjectCache::Handle ObjectCache::get(const HashId& hash) {
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    shard.sketch.increment(hash);
+    auto found = shard.index.find(hash);
+    if (found == shard.index.end()) {
+        ++shard.stats.misses;
+        return nullptr;
+    }
+
+    ++shard.stats.hits;
+    on_hit(shard, found->second);
+    return found->second->object;
+}
+
+void ObjectCache::put(const HashId& hash, Handle object) {
+    if (!object) {
+        return;
+    }
+    size_t size = estimate_size(*object);
+
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto missing = shard.missing_index.find(hash);
+    if (missing != shard.missing_index.end()) {
+        shard.missing.erase(missing->second);
+        shard.missing_index.erase(missing);
+    }
+
+    auto found = shard.index.find(hash);
+    if (found != shard.index.end()) {
+        on_hit(shard, found->second);
+        return;
+    }
+
+    if (size > window_capacity_ + main_capacity_) {
+        ++shard.stats.rejections;
+        return;
+    }
+
+    shard.window.push_front(Entry{hash, std::move(object), size, Segment::Window});
+    shard.index[hash] = shard.window.begin();
+    shard.window_bytes += size;
+    ++shard.stats.insertions;
+
+    drain_window(shard);
+}
+
+void ObjectCache::erase(const HashId& hash) {
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto found = shard.index.find(hash);
+    if (found != shard.index.end()) {
+        remove_entry(shard, found->second);
+    }
+}
+
+void ObjectCache::clear() {
+    for (auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        shard->window.clear();
+        shard->probation.clear();
+        shard->protected_.clear();
+        shard->index.clear();
+        shard->window_bytes = 0;
+        shard->probation_bytes = 0;
+        shard->protected_bytes = 0;
+        shard->missing.clear();
+        shard->missing_index.clear();
+    }
+}
+
+bool ObjectCache::is_known_missing(const HashId& hash) {
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto found = shard.missing_index.find(hash);
+    if (found == shard.missing_index.end()) {
+        return false;
+    }
+    shard.missing.splice(shard.missing.begin(), shard.missing, found->second);
+    ++shard.stats.negative_hits;
+    return true;
+}
+
+void ObjectCache::mark_missing(const HashId& hash) {
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    if (shard.index.count(hash) > 0 || shard.missing_index.count(hash) > 0) {
+        return;
+    }
+
+    shard.missing.push_front(hash);
+    shard.missing_index[hash] = shard.missing.begin();
+
+    while (shard.missing.size() > negative_capacity_) {
+        shard.missing_index.erase(shard.missing.back());
+        shard.missing.pop_back();
+    }
+}
+
+void ObjectCache::clear_missing(const HashId& hash) {
+    Shard& shard = shard_for(hash);
+    std::lock_guard<std::mutex> lock(shard.mutex);
+
+    auto found = shard.missing_index.find(hash);
+    if (found != shard.missing_index.end()) {
+        shard.missing.erase(found->second);
+        shard.missing_index.erase(found);
+    }
+}
+
+ObjectCacheStats ObjectCache::get_stats() const {
+    ObjectCacheStats total;
+    for (const auto& shard : shards_) {
+        std::lock_guard<std::mutex> lock(shard->mutex);
+        total.hits += shard->stats.hits;
+        total.misses += shard->stats.misses;
+        total.negative_hits += shard->stats.negative_hits;
+        total.insertions += shard->stats.insertions;
+        total.evictions += shard->stats.evictions;
+        total.rejections += shard->stats.rejections;
+        total.entries += shard->index.size();
+        total.bytes += shard->window_bytes + shard->probation_bytes + shard->protected_bytes;
+    }
+    return total;
+}
+
+size_t ObjectCache::estimate_size(const BPO& bpo) {
+    return sizeof(BPO) + sizeof(Entry) + bpo.owned_bytes();
+}
+
+ObjectCache::Shard& ObjectCache::shard_for(const HashId& hash) {
+    return *shards_[hash.data()[0] % shards_.size()];
+}
+
+const ObjectCache::Shard& ObjectCache::shard_for(const HashId& hash) const {
+    return *shards_[hash.data()[0] % shards_.size()];
+}
+
+ObjectCache::EntryList& ObjectCache::list_for(Shard& shard, Segment segment) {
+    switch (segment) {
+        case Segment::Window:
+            return shard.window;
+        case Segment::Probation:
+            return shard.probation;
+        case Segment::Protected:
+        default:
+            return shard.protected_;
+    }
+}
+
+size_t& ObjectCache::bytes_for(Shard& shard, Segment segment) {
+    switch (segment) {
+        case Segment::Window:
+            return shard.window_bytes;
+        case Segment::Probation:
+            return shard.probation_bytes;
+        case Segment::Protected:
+        default:
+            return shard.protected_bytes;
+    }
+}
+
+void ObjectCache::move_to(Shard& shard, EntryList::iterator it, Segment segment) {
+    EntryList& target = list_for(shard, segment);
+    bytes_for(shard, it->segment) -= it->size;
+    bytes_for(shard, segment) += it->size;
+    target.splice(target.begin(), list_for(shard, it->segment), it);
+    it->segment = segment;
+}
+
+void ObjectCache::remove_entry(Shard& shard, EntryList::iterator it) {
+    bytes_for(shard, it->segment) -= it->size;
+    shard.index.erase(it->hash);
+    list_for(shard, it->segment).erase(it);
+}
+
+void ObjectCache::on_hit(Shard& shard, EntryList::iterator it) {
+    switch (it->segment) {
+        case Segment::Window:
+            shard.window.splice(shard.window.begin(), shard.window, it);
+            break;
+        case Segment::Probation:
+            move_to(shard, it, Segment::Protected);
+            rebalance_protected(shard);
+            break;
+        case Segment::Protected:
+            shard.protected_.splice(shard.protected_.begin(), shard.protected_, it);
+            break;
+    }
+}
+
+// Victims are chosen before anything is evicted, so a candidate that is too
+// large for the main area or loses to a later victim costs no entries.
+void ObjectCache::drain_window(Shard& shard) {
+    std::vector<EntryList::iterator> victims;
+    while (shard.window_bytes > window_capacity_ && !shard.window.empty()) {
+        auto candidate = std::prev(shard.window.end());
+        bool admitted = candidate->size <= main_capacity_;
+
+        victims.clear();
+        size_t used = shard.probation_bytes + shard.protected_bytes;
+        auto probation = shard.probation.end();
+        auto protected_entry = shard.protected_.end();
+        uint8_t frequency = admitted ? shard.sketch.frequency(candidate->hash) : 0;
+        while (admitted && used + candidate->size > main_capacity_) {
+            EntryList::iterator victim;
+            if (probation != shard.probation.begin()) {
+                victim = --probation;
+            } else if (protected_entry != shard.protected_.begin()) {
+                victim = --protected_entry;
+            } else {
+                admitted = false;
+                break;
+            }
+            if (frequency <= shard.sketch.frequency(victim->hash)) {
+                admitted = false;
+                break;
+            }
+            victims.push_back(victim);
+            used -= victim->size;
+        }
+
+        if (!admitted) {
+            remove_entry(shard, candidate);
+            ++shard.stats.rejections;
+            continue;
+        }
+        for (auto victim : victims) {
+            remove_entry(shard, victim);
+            ++shard.stats.evictions;
+        }
+        move_to(shard, candidate, Segment::Probation);
+    }
+}
+
+void ObjectCache::rebalance_protected(Shard& shard) {
+    while (shard.protected_bytes > protected_capacity_ && !shard.protected_.empty()) {
+        move_to(shard, std::prev(shard.protected_.end()), Segment::Probation);
+    }
+}
+
+}
+}
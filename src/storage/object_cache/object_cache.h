@@ -0,0 +1,136 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+class BPO;
+
+struct ObjectCacheOptions {
+    size_t capacity_bytes = 256 * 1024 * 1024;
+    size_t shard_count = 16;
+    size_t negative_capacity = 1 << 16;
+    size_t expected_object_bytes = 2048;
+};
+
+struct ObjectCacheStats {
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    uint64_t negative_hits = 0;
+    uint64_t insertions = 0;
+    uint64_t evictions = 0;
+    uint64_t rejections = 0;
+    size_t entries = 0;
+    size_t bytes = 0;
+};
+
+// Approximate counts of recent accesses (4-row count-min sketch, halved periodically).
+class FrequencySketch {
+public:
+    explicit FrequencySketch(size_t expected_entries);
+
+    void increment(const HashId& hash);
+    uint8_t frequency(const HashId& hash) const;
+
+private:
+    static constexpr size_t kDepth = 4;
+    static constexpr uint8_t kMaxCount = 15;
+
+    std::vector<uint8_t> counters_;
+    size_t mask_;
+    size_t additions_;
+    size_t sample_size_;
+
+    size_t index_of(const HashId& hash, size_t row) const;
+    void reset();
+};
+
+// W-TinyLFU cache of immutable BPOs bounded by their approximate byte size.
+// New objects enter a small LRU window; on overflow they compete with the
+// segmented-LRU main area and are admitted only if they are accessed more
+// often than the victim, which keeps one-off scans from flushing hot objects.
+class ObjectCache {
+public:
+    using Handle = std::shared_ptr<const BPO>;
+
+    explicit ObjectCache(const ObjectCacheOptions& options = ObjectCacheOptions());
+
+    ObjectCache(const ObjectCache&) = delete;
+    ObjectCache& operator=(const ObjectCache&) = delete;
+
+    Handle get(const HashId& hash);
+    void put(const HashId& hash, Handle object);
+    void erase(const HashId& hash);
+    void clear();
+
+    bool is_known_missing(const HashId& hash);
+    void mark_missing(const HashId& hash);
+    void clear_missing(const HashId& hash);
+
+    ObjectCacheStats get_stats() const;
+
+    static size_t estimate_size(const BPO& bpo);
+
+private:
+    enum class Segment {
+        Window,
+        Probation,
+        Protected
+    };
+
+    struct Entry {
+        HashId hash;
+        Handle object;
+        size_t size;
+        Segment segment;
+    };
+
+    using EntryList = std::list<Entry>;
+
+    struct Shard {
+        explicit Shard(size_t expected_entries) : sketch(expected_entries) {}
+
+        mutable std::mutex mutex;
+        EntryList window;
+        EntryList probation;
+        EntryList protected_;
+        std::unordered_map<HashId, EntryList::iterator> index;
+        size_t window_bytes = 0;
+        size_t probation_bytes = 0;
+        size_t protected_bytes = 0;
+        FrequencySketch sketch;
+
+        std::list<HashId> missing;
+        std::unordered_map<HashId, std::list<HashId>::iterator> missing_index;
+
+        ObjectCacheStats stats;
+    };
+
+    size_t window_capacity_;
+    size_t main_capacity_;
+    size_t protected_capacity_;
+    size_t negative_capacity_;
+    std::vector<std::unique_ptr<Shard>> shards_;
+
+    Shard& shard_for(const HashId& hash);
+    const Shard& shard_for(const HashId& hash) const;
+
+    EntryList& list_for(Shard& shard, Segment segment);
+    size_t& bytes_for(Shard& shard, Segment segment);
+    void move_to(Shard& shard, EntryList::iterator it, Segment segment);
+    void remove_entry(Shard& shard, EntryList::iterator it);
+    void on_hit(Shard& shard, EntryList::iterator it);
+    void drain_window(Shard& shard);
+    void rebalance_protected(Shard& shard);
+};
+
+}
+}
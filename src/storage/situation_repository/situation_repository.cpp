@@ -0,0 +1,825 @@
+#include "situation_repository.h"
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/oid.hpp>
+#include <bsoncxx/types.hpp>
+#include <mongocxx/client.hpp>
+#include <mongocxx/hint.hpp>
+#include <mongocxx/options/find.hpp>
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <stdexcept>
+
+namespace geoversion {
+namespace storage {
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+namespace {
+
+std::string string_field(const bsoncxx::document::view& doc, const char* key) {
+    auto element = doc[key];
+    if (!element || element.type() != bsoncxx::type::k_string) {
+        return std::string();
+    }
+    return std::string(element.get_string().value);
+}
+
+std::chrono::system_clock::time_point date_field(const bsoncxx::document::view& doc, const char* key) {
+    auto element = doc[key];
+    if (!element || element.type() != bsoncxx::type::k_date) {
+        return std::chrono::system_clock::time_point();
+    }
+    return std::chrono::system_clock::time_point(element.get_date().value);
+}
+
+uint64_t count_field(const bsoncxx::document::view& doc, const char* key) {
+    auto element = doc[key];
+    if (element && element.type() == bsoncxx::type::k_int64 && element.get_int64().value >= 0) {
+        return static_cast<uint64_t>(element.get_int64().value);
+    }
+    if (element && element.type() == bsoncxx::type::k_int32 && element.get_int32().value >= 0) {
+        return static_cast<uint64_t>(element.get_int32().value);
+    }
+    return 0;
+}
+
+void sort_refs(std::vector<HashId>& refs) {
+    std::sort(refs.begin(), refs.end());
+    refs.erase(std::unique(refs.begin(), refs.end()), refs.end());
+}
+
+// Applies a delta to sorted refs, using scratch as the second buffer. A
+// hash migration may have left the delta's lists out of order.
+void apply_delta(std::vector<HashId>& refs, std::vector<HashId>& scratch, VersionDelta& delta) {
+    for (const auto& pair : delta.modified) {
+        delta.removed.push_back(pair.old_hash);
+        delta.added.push_back(pair.new_hash);
+    }
+    sort_refs(delta.removed);
+    sort_refs(delta.added);
+    scratch.clear();
+    std::set_difference(refs.begin(), refs.end(), delta.removed.begin(), delta.removed.end(), std::back_inserter(scratch));
+    refs.clear();
+    std::set_union(scratch.begin(), scratch.end(), delta.added.begin(), delta.added.end(), std::back_inserter(refs));
+}
+
+Situation read_situation(const bsoncxx::document::view& doc) {
+    Situation situation;
+    situation.situation_id = string_field(doc, "situation_id");
+    situation.name = string_field(doc, "name");
+    situation.description = string_field(doc, "description");
+    situation.head_version_id = string_field(doc, "head_version_id");
+    situation.created_at = date_field(doc, "created_at");
+    situation.updated_at = date_field(doc, "updated_at");
+    return situation;
+}
+
+}
+
+SituationRepository::SituationRepository(MongoDBConnection& connection, CAS& cas)
+    : connection_(connection), cas_(cas), transactions_(false), cache_bytes_(0) {
+}
+
+void SituationRepository::set_merkle_tree(std::shared_ptr<MerkleTree> tree) {
+    merkle_ = std::move(tree);
+}
+
+std::shared_ptr<MerkleTree> SituationRepository::get_merkle_tree() const {
+    return merkle_;
+}
+
+void SituationRepository::set_keyframe_policy(const KeyframePolicy& policy) {
+    policy_ = policy;
+    if (policy_.interval == 0) {
+        policy_.interval = 1;
+    }
+    clear_cache();
+}
+
+const KeyframePolicy& SituationRepository::get_keyframe_policy() const {
+    return policy_;
+}
+
+VersionStorageStats SituationRepository::get_storage_stats() const {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    VersionStorageStats stats = stats_;
+    stats.cached_versions = cache_.size();
+    stats.cached_bytes = cache_bytes_;
+    return stats;
+}
+
+// Transactions need a replica set member or mongos.
+bool SituationRepository::supports_transactions() {
+    std::call_once(transactions_checked_, [this]() {
+        try {
+            ClientLease lease = connection_.acquire();
+            auto reply = lease.client().database("admin").run_command(make_document(kvp("hello", 1)));
+            auto view = reply.view();
+            transactions_ = static_cast<bool>(view["setName"]) ||
+                (view["msg"] && view["msg"].type() == bsoncxx::type::k_string &&
+                 view["msg"].get_string().value == "isdbgrid");
+        } catch (const std::exception& e) {
+            std::cerr << "Error checking transaction support: " << e.what() << std::endl;
+        }
+    });
+    return transactions_;
+}
+
+std::optional<Situation> SituationRepository::create_situation(const std::string& name, const std::string& description) {
+    Situation situation;
+    situation.situation_id = bsoncxx::oid().to_string();
+    situation.name = name;
+    situation.description = description;
+    situation.created_at = std::chrono::system_clock::now();
+    situation.updated_at = situation.created_at;
+
+    try {
+        bsoncxx::types::b_date now{situation.created_at};
+        ClientLease lease = connection_.acquire();
+        lease.collection("situations").insert_one(make_document(
+            kvp("situation_id", situation.situation_id),
+            kvp("name", name),
+            kvp("description", description),
+            kvp("created_at", now),
+            kvp("updated_at", now)
+        ));
+        return situation;
+    } catch (const std::exception& e) {
+        std::cerr << "Error creating situation: " << e.what() << std::endl;
+        return std::nullopt;
+    }
+}
+
+std::optional<Situation> SituationRepository::get_situation(const std::string& situation_id) {
+    try {
+        ClientLease lease = connection_.acquire();
+        auto doc = lease.collection("situations").find_one(make_document(kvp("situation_id", situation_id)));
+        if (!doc) {
+            return std::nullopt;
+        }
+        return read_situation(doc->view());
+    } catch (const std::exception& e) {
+        std::cerr << "Error reading situation: " << e.what() << std::endl;
+        return std::nullopt;
+    }
+}
+
+CommitResult SituationRepository::commit_version(VersionCommit commit) {
+    CommitResult result;
+
+    auto situation = get_situation(commit.situation_id);
+    if (!situation) {
+        result.error = "unknown situation " + commit.situation_id;
+        return result;
+    }
+    std::vector<std::string> parents;
+    for (const auto& parent : commit.parent_version_ids) {
+        if (std::find(parents.begin(), parents.end(), parent) == parents.end()) {
+            parents.push_back(parent);
+        }
+    }
+    if (parents.empty() && !situation->head_version_id.empty()) {
+        parents.push_back(situation->head_version_id);
+    }
+
+    // Stored by earlier calls, perhaps long enough ago for the garbage
+    // collector to take them before this version holds them.
+    std::vector<HashId> referenced = commit.refs;
+    sort_refs(referenced);
+
+    if (!commit.bpos.empty()) {
+        StoreManyResult stored = cas_.store_many(commit.bpos);
+        result.store = stored.stats;
+        if (stored.stats.failed > 0) {
+            result.error = std::to_string(stored.stats.failed) + " objects could not be stored";
+            return result;
+        }
+        commit.refs.insert(commit.refs.end(), stored.hashes.begin(), stored.hashes.end());
+        std::vector<BPO>().swap(commit.bpos);
+    }
+    sort_refs(commit.refs);
+    const std::vector<HashId>& refs = commit.refs;
+    result.ref_count = refs.size();
+    result.version_id = bsoncxx::oid().to_string();
+
+    VersionDelta delta;
+    std::vector<std::string> delta_chain;
+    uint64_t chain_changes = 0;
+    if (policy_.interval > 1 && !parents.empty()) {
+        result.keyframe = !plan_delta(parents.front(), refs, delta, delta_chain, chain_changes);
+        delta.to_version_id = result.version_id;
+    }
+
+    // A delta only adds objects its parent already keeps alive or new ones.
+    if (!result.keyframe) {
+        std::vector<HashId> added;
+        std::set_intersection(referenced.begin(), referenced.end(), delta.added.begin(), delta.added.end(),
+                              std::back_inserter(added));
+        referenced.swap(added);
+    }
+    if (!referenced.empty() && !cas_.touch_many(referenced)) {
+        result.error = "failed to refresh referenced objects";
+        return result;
+    }
+    std::vector<HashId>().swap(referenced);
+
+    // Nodes are content-addressed, so storing them ahead of the commit
+    // leaves nothing behind that another version could not share.
+    if (merkle_ && !merkle_->build(refs, result.merkle_root, &result.merkle)) {
+        result.error = "failed to store the Merkle tree";
+        return result;
+    }
+
+    bsoncxx::builder::basic::array parent_array;
+    for (const auto& parent : parents) {
+        parent_array.append(parent);
+    }
+    bsoncxx::types::b_date now{std::chrono::system_clock::now()};
+    bsoncxx::builder::basic::document version_builder;
+    version_builder.append(
+        kvp("version_id", result.version_id),
+        kvp("situation_id", commit.situation_id),
+        kvp("parent_version_ids", parent_array),
+        kvp("commit_message", commit.commit_message),
+        kvp("author", commit.author),
+        kvp("created_at", now),
+        kvp("ref_count", static_cast<int64_t>(refs.size()))
+    );
+    if (result.keyframe) {
+        size_t chunk_count = (refs.size() + kRefsPerChunk - 1) / kRefsPerChunk;
+        version_builder.append(kvp("ref_chunks", static_cast<int32_t>(chunk_count)));
+    } else {
+        bsoncxx::builder::basic::array chain_array;
+        for (const auto& id : delta_chain) {
+            chain_array.append(id);
+        }
+        version_builder.append(
+            kvp("delta_chain", chain_array),
+            kvp("chain_changes", static_cast<int64_t>(chain_changes))
+        );
+    }
+    if (merkle_) {
+        version_builder.append(kvp("merkle_root", result.merkle_root.to_bson()));
+    }
+    auto version_doc = version_builder.extract();
+
+    // Moves the head only from where this commit found it.
+    bsoncxx::builder::basic::document head_filter;
+    head_filter.append(kvp("situation_id", commit.situation_id));
+    if (situation->head_version_id.empty()) {
+        head_filter.append(kvp("head_version_id", bsoncxx::types::b_null{}));
+    } else {
+        head_filter.append(kvp("head_version_id", situation->head_version_id));
+    }
+    auto head_update = make_document(kvp("$set", make_document(
+        kvp("head_version_id", result.version_id),
+        kvp("updated_at", now)
+    )));
+
+    bool head_moved = false;
+    bool version_written = false;
+    try {
+        ClientLease lease = connection_.acquire();
+        if (!check_parents(lease, commit.situation_id, parents)) {
+            result.error = "parent versions do not belong to situation " + commit.situation_id;
+            return result;
+        }
+        mongocxx::collection chunks = lease.collection(kRefsCollectionName);
+        mongocxx::collection deltas = lease.collection("version_deltas");
+        mongocxx::collection versions = lease.collection("situation_versions");
+        mongocxx::collection situations = lease.collection("situations");
+
+        if (supports_transactions()) {
+            auto session = lease.client().start_session();
+            session.with_transaction([&](mongocxx::client_session* transaction) {
+                head_moved = false;
+                if (result.keyframe) {
+                    result.ref_chunks = write_refs(chunks, transaction, result.version_id, refs);
+                } else {
+                    VersionDeltaDocuments::write(deltas, transaction, delta, "");
+                }
+                versions.insert_one(*transaction, version_doc.view());
+                auto updated = situations.update_one(*transaction, head_filter.view(), head_update.view());
+                if (!updated || updated->matched_count() == 0) {
+                    head_moved = true;
+                    throw std::runtime_error("situation head moved");
+                }
+            });
+        } else {
+            if (result.keyframe) {
+                result.ref_chunks = write_refs(chunks, nullptr, result.version_id, refs);
+            } else {
+                VersionDeltaDocuments::write(deltas, nullptr, delta, "");
+            }
+            versions.insert_one(version_doc.view());
+            version_written = true;
+            auto updated = situations.update_one(head_filter.view(), head_update.view());
+            head_moved = !updated || updated->matched_count() == 0;
+        }
+    } catch (const std::exception& e) {
+        if (!head_moved) {
+            std::cerr << "Error committing version: " << e.what() << std::endl;
+            result.error = e.what();
+        }
+        if (!version_written && !supports_transactions()) {
+            try {
+                ClientLease lease = connection_.acquire();
+                if (result.keyframe) {
+                    lease.collection(kRefsCollectionName).delete_many(make_document(kvp("version_id", result.version_id)));
+                } else {
+                    lease.collection("version_deltas").delete_many(make_document(
+                        kvp("from_version_id", delta.from_version_id),
+                        kvp("to_version_id", result.version_id)
+                    ));
+                }
+            } catch (const std::exception& cleanup) {
+                std::cerr << "Error removing refs of failed commit: " << cleanup.what() << std::endl;
+            }
+        }
+    }
+
+    if (head_moved) {
+        // Without a transaction the version stays stored, off the head.
+        result.error = "situation head moved during commit";
+        return result;
+    }
+    result.ok = result.error.empty();
+    if (!result.ok) {
+        return result;
+    }
+
+    uint64_t delta_size = delta.added.size() + delta.removed.size();
+    {
+        std::lock_guard<std::mutex> lock(cache_mutex_);
+        if (result.keyframe) {
+            ++stats_.keyframes;
+            stats_.refs_written += refs.size();
+        } else {
+            ++stats_.deltas;
+            stats_.refs_written += delta_size;
+            stats_.refs_saved += refs.size() - delta_size;
+        }
+    }
+    // The next commit on this line diffs against it.
+    if (policy_.interval > 1) {
+        cache_refs(result.version_id, std::make_shared<const std::vector<HashId>>(std::move(commit.refs)));
+    }
+    return result;
+}
+
+// The delta from base_version_id, if the policy lets the new version go
+// without a keyframe.
+bool SituationRepository::plan_delta(
+    const std::string& base_version_id,
+    const std::vector<HashId>& refs,
+    VersionDelta& delta,
+    std::vector<std::string>& chain,
+    uint64_t& chain_changes
+) {
+    auto base = get_version(base_version_id);
+    if (!base || base->delta_chain.size() + 1 >= policy_.interval) {
+        return false;
+    }
+    RefsHandle base_refs = checkout(base_version_id);
+    if (!base_refs) {
+        return false;
+    }
+    std::set_difference(refs.begin(), refs.end(), base_refs->begin(), base_refs->end(), std::back_inserter(delta.added));
+    std::set_difference(base_refs->begin(), base_refs->end(), refs.begin(), refs.end(), std::back_inserter(delta.removed));
+
+    // A delta as large as the version saves nothing over a keyframe.
+    uint64_t changes = delta.added.size() + delta.removed.size();
+    if (base->chain_changes + changes > policy_.max_changes || changes >= refs.size()) {
+        delta = VersionDelta();
+        return false;
+    }
+    delta.from_version_id = base_version_id;
+    chain = base->delta_chain;
+    chain.push_back(base_version_id);
+    chain_changes = base->chain_changes + changes;
+    return true;
+}
+
+size_t SituationRepository::write_refs(
+    mongocxx::collection& collection,
+    const mongocxx::client_session* session,
+    const std::string& version_id,
+    const std::vector<HashId>& refs
+) {
+    size_t seq = 0;
+    std::vector<bsoncxx::document::value> batch;
+    batch.reserve(kChunksPerInsert);
+    for (size_t begin = 0; begin < refs.size(); begin += kRefsPerChunk) {
+        size_t end = std::min(refs.size(), begin + kRefsPerChunk);
+        bsoncxx::types::b_binary packed{
+            bsoncxx::binary_sub_type::k_binary,
+            static_cast<uint32_t>((end - begin) * HashId::kSize),
+            refs[begin].data()
+        };
+        batch.push_back(make_document(
+            kvp("version_id", version_id),
+            kvp("seq", static_cast<int32_t>(seq)),
+            kvp("count", static_cast<int32_t>(end - begin)),
+            kvp("refs", packed)
+        ));
+        ++seq;
+
+        if (batch.size() == kChunksPerInsert || end == refs.size()) {
+            if (session) {
+                collection.insert_many(*session, batch);
+            } else {
+                collection.insert_many(batch);
+            }
+            batch.clear();
+        }
+    }
+    return seq;
+}
+
+bool SituationRepository::check_parents(
+    ClientLease& lease,
+    const std::string& situation_id,
+    const std::vector<std::string>& parents
+) {
+    if (parents.empty()) {
+        return true;
+    }
+    bsoncxx::builder::basic::array ids;
+    for (const auto& parent : parents) {
+        ids.append(parent);
+    }
+    int64_t found = lease.collection("situation_versions").count_documents(make_document(
+        kvp("version_id", make_document(kvp("$in", ids))),
+        kvp("situation_id", situation_id)
+    ));
+    return found == static_cast<int64_t>(parents.size());
+}
+
+SituationVersion SituationRepository::read_version(const bsoncxx::document::view& doc) {
+    SituationVersion version;
+    version.version_id = string_field(doc, "version_id");
+    version.situation_id = string_field(doc, "situation_id");
+    version.commit_message = string_field(doc, "commit_message");
+    version.author = string_field(doc, "author");
+    version.created_at = date_field(doc, "created_at");
+    if (doc["parent_version_ids"] && doc["parent_version_ids"].type() == bsoncxx::type::k_array) {
+        for (auto&& parent : doc["parent_version_ids"].get_array().value) {
+            if (parent.type() == bsoncxx::type::k_string) {
+                version.parent_version_ids.emplace_back(parent.get_string().value);
+            }
+        }
+    }
+    version.ref_count = count_field(doc, "ref_count");
+    if (doc["merkle_root"]) {
+        HashId::from_bson(doc["merkle_root"].get_value(), version.merkle_root);
+    }
+    if (doc["delta_chain"] && doc["delta_chain"].type() == bsoncxx::type::k_array) {
+        for (auto&& id : doc["delta_chain"].get_array().value) {
+            if (id.type() == bsoncxx::type::k_string) {
+                version.delta_chain.emplace_back(id.get_string().value);
+            }
+        }
+        version.chain_changes = count_field(doc, "chain_changes");
+    }
+    return version;
+}
+
+std::optional<SituationVersion> SituationRepository::get_version(const std::string& version_id) {
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("bpo_refs", 0)));
+
+        ClientLease lease = connection_.acquire();
+        auto doc = lease.collection("situation_versions").find_one(make_document(kvp("version_id", version_id)), opts);
+        if (!doc) {
+            return std::nullopt;
+        }
+        return read_version(doc->view());
+    } catch (const std::exception& e) {
+        std::cerr << "Error reading version: " << e.what() << std::endl;
+        return std::nullopt;
+    }
+}
+
+std::vector<SituationVersion> SituationRepository::list_history(const std::string& situation_id, int64_t limit) {
+    std::vector<SituationVersion> history;
+    try {
+        mongocxx::options::find opts;
+        opts.projection(make_document(kvp("bpo_refs", 0)));
+        opts.sort(make_document(kvp("created_at", -1)));
+        opts.hint(mongocxx::hint("situation_versions_lookup_idx"));
+        if (limit > 0) {
+            opts.limit(limit);
+        }
+
+        ClientLease lease = connection_.acquire();
+        auto cursor = lease.collection("situation_versions").find(make_document(kvp("situation_id", situation_id)), opts);
+        for (auto&& doc : cursor) {
+            history.push_back(read_version(doc));
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error listing version history: " << e.what() << std::endl;
+    }
+    return history;
+}
+
+bool SituationRepository::for_each_ref(const std::string& version_id, const std::function<bool(const HashId&)>& visit) {
+    try {
+        ClientLease lease = connection_.acquire();
+        mongocxx::options::find version_opts;
+        version_opts.projection(make_document(kvp("ref_count", 1), kvp("ref_chunks", 1), kvp("bpo_refs", 1), kvp("delta_chain", 1)));
+        auto version = lease.collection("situation_versions").find_one(make_document(kvp("version_id", version_id)), version_opts);
+        if (!version) {
+            return false;
+        }
+        auto view = version->view();
+
+        if (view["delta_chain"]) {
+            RefsHandle refs = checkout(version_id);
+            if (!refs) {
+                return false;
+            }
+            for (const auto& hash : *refs) {
+                if (!visit(hash)) {
+                    break;
+                }
+            }
+            return true;
+        }
+
+        // Versions written before ref chunks keep an inline bpo_refs array.
+        if (!view["ref_chunks"]) {
+            std::vector<HashId> refs;
+            if (view["bpo_refs"] && view["bpo_refs"].type() == bsoncxx::type::k_array) {
+                for (auto&& ref : view["bpo_refs"].get_array().value) {
+                    HashId hash;
+                    if (HashId::from_bson(ref.get_value(), hash)) {
+                        refs.push_back(hash);
+                    }
+                }
+            }
+            sort_refs(refs);
+            for (const auto& hash : refs) {
+                if (!visit(hash)) {
+                    break;
+                }
+            }
+            return true;
+        }
+
+        uint64_t expected_refs = count_field(view, "ref_count");
+        uint64_t expected_chunks = count_field(view, "ref_chunks");
+
+        mongocxx::options::find opts;
+        opts.sort(make_document(kvp("seq", 1)));
+        opts.hint(mongocxx::hint("version_refs_idx"));
+        opts.projection(make_document(kvp("seq", 1), kvp("count", 1), kvp("refs", 1), kvp("_id", 0)));
+
+        uint64_t seen = 0;
+        uint64_t next_seq = 0;
+        HashId previous;
+        auto cursor = lease.collection(kRefsCollectionName).find(make_document(kvp("version_id", version_id)), opts);
+        for (auto&& doc : cursor) {
+            uint64_t count = count_field(doc, "count");
+            if (count_field(doc, "seq") != next_seq || !doc["refs"] || doc["refs"].type() != bsoncxx::type::k_binary) {
+                std::cerr << "Error reading refs of version " << version_id << ": chunk " << next_seq << " missing" << std::endl;
+                return false;
+            }
+            auto packed = doc["refs"].get_binary();
+            if (packed.size != count * HashId::kSize) {
+                std::cerr << "Error reading refs of version " << version_id << ": chunk " << next_seq << " truncated" << std::endl;
+                return false;
+            }
+            for (uint64_t i = 0; i < count; ++i) {
+                HashId hash = HashId::from_bytes(packed.bytes + i * HashId::kSize);
+                if (seen > 0 && !(previous < hash)) {
+                    std::cerr << "Error reading refs of version " << version_id << ": refs out of order" << std::endl;
+                    return false;
+                }
+                previous = hash;
+                ++seen;
+                if (!visit(hash)) {
+                    return true;
+                }
+            }
+            ++next_seq;
+        }
+        if (next_seq != expected_chunks || seen != expected_refs) {
+            std::cerr << "Error reading refs of version " << version_id << ": expected " << expected_refs
+                      << " refs, found " << seen << std::endl;
+            return false;
+        }
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error reading version refs: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+bool SituationRepository::read_refs(const std::string& version_id, std::vector<HashId>& refs) {
+    refs.clear();
+    return for_each_ref(version_id, [&refs](const HashId& hash) {
+        refs.push_back(hash);
+        return true;
+    });
+}
+
+SituationRepository::RefsHandle SituationRepository::checkout(const std::string& version_id) {
+    auto started = std::chrono::steady_clock::now();
+    RefsHandle refs = cached(version_id);
+    bool hit = static_cast<bool>(refs);
+    size_t applied = 0;
+    if (!refs) {
+        auto version = get_version(version_id);
+        if (!version) {
+            return nullptr;
+        }
+        refs = materialize(*version, applied);
+        if (!refs) {
+            return nullptr;
+        }
+        cache_refs(version_id, refs);
+    }
+
+    auto elapsed = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - started
+    ).count());
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    ++stats_.checkouts;
+    stats_.cache_hits += hit;
+    stats_.deltas_applied += applied;
+    stats_.checkout_time_us += elapsed;
+    stats_.max_checkout_time_us = std::max(stats_.max_checkout_time_us, elapsed);
+    return refs;
+}
+
+SituationRepository::RefsHandle SituationRepository::materialize(const SituationVersion& version, size_t& applied) {
+    auto refs = std::make_shared<std::vector<HashId>>();
+    if (version.delta_chain.empty()) {
+        refs->reserve(version.ref_count);
+        if (!read_refs(version.version_id, *refs)) {
+            return nullptr;
+        }
+        return refs;
+    }
+
+    std::vector<std::string> chain = version.delta_chain;
+    chain.push_back(version.version_id);
+    size_t start = 0;
+    bool from_cache = false;
+    for (size_t i = chain.size() - 1; i-- > 0 && !from_cache;) {
+        RefsHandle base = cached(chain[i]);
+        if (base) {
+            *refs = *base;
+            start = i;
+            from_cache = true;
+        }
+    }
+    if (!from_cache && !read_refs(chain[0], *refs)) {
+        return nullptr;
+    }
+
+    try {
+        // Every delta still to apply, in one query.
+        bsoncxx::builder::basic::array pairs;
+        for (size_t i = start; i + 1 < chain.size(); ++i) {
+            pairs.append(make_document(
+                kvp("from_version_id", chain[i]),
+                kvp("to_version_id", chain[i + 1])
+            ));
+        }
+        mongocxx::options::find opts;
+        opts.sort(make_document(kvp("part", 1)));
+
+        std::unordered_map<std::string, std::vector<bsoncxx::document::value>> parts;
+        ClientLease lease = connection_.acquire();
+        auto cursor = lease.collection("version_deltas").find(make_document(kvp("$or", pairs)), opts);
+        for (auto&& doc : cursor) {
+            parts[string_field(doc, "to_version_id")].emplace_back(doc);
+        }
+
+        std::vector<HashId> scratch;
+        for (size_t i = start + 1; i < chain.size(); ++i) {
+            VersionDelta delta;
+            std::string identity_field;
+            if (!VersionDeltaDocuments::read(parts[chain[i]], delta, identity_field)) {
+                std::cerr << "Error checking out version " << version.version_id << ": delta to "
+                          << chain[i] << " missing" << std::endl;
+                return nullptr;
+            }
+            apply_delta(*refs, scratch, delta);
+            ++applied;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error reading version deltas: " << e.what() << std::endl;
+        return nullptr;
+    }
+
+    if (refs->size() != version.ref_count) {
+        std::cerr << "Error checking out version " << version.version_id << ": expected " << version.ref_count
+                  << " refs, found " << refs->size() << std::endl;
+        return nullptr;
+    }
+    return refs;
+}
+
+SituationRepository::RefsHandle SituationRepository::cached(const std::string& version_id) {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    auto found = cache_index_.find(version_id);
+    if (found == cache_index_.end()) {
+        return nullptr;
+    }
+    cache_.splice(cache_.begin(), cache_, found->second);
+    return found->second->refs;
+}
+
+void SituationRepository::cache_refs(const std::string& version_id, RefsHandle refs) {
+    size_t bytes = refs->size() * HashId::kSize;
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    if (bytes > policy_.cache_bytes || cache_index_.count(version_id) > 0) {
+        return;
+    }
+    cache_.push_front(CachedRefs{version_id, std::move(refs)});
+    cache_index_[version_id] = cache_.begin();
+    cache_bytes_ += bytes;
+    while (cache_bytes_ > policy_.cache_bytes) {
+        cache_bytes_ -= cache_.back().refs->size() * HashId::kSize;
+        cache_index_.erase(cache_.back().version_id);
+        cache_.pop_back();
+    }
+}
+
+void SituationRepository::clear_cache() {
+    std::lock_guard<std::mutex> lock(cache_mutex_);
+    cache_.clear();
+    cache_index_.clear();
+    cache_bytes_ = 0;
+}
+
+bool SituationRepository::replace_refs(const std::string& version_id, std::vector<HashId> refs) {
+    sort_refs(refs);
+    size_t chunk_count = (refs.size() + kRefsPerChunk - 1) / kRefsPerChunk;
+    auto filter = make_document(kvp("version_id", version_id));
+
+    bsoncxx::builder::basic::document set;
+    set.append(
+        kvp("ref_count", static_cast<int64_t>(refs.size())),
+        kvp("ref_chunks", static_cast<int32_t>(chunk_count))
+    );
+    bsoncxx::builder::basic::document unset;
+    unset.append(kvp("bpo_refs", ""), kvp("delta_chain", ""), kvp("chain_changes", ""));
+    if (merkle_) {
+        HashId root;
+        if (!merkle_->build(refs, root)) {
+            return false;
+        }
+        set.append(kvp("merkle_root", root.to_bson()));
+    } else {
+        // A root left from before would no longer describe the refs.
+        unset.append(kvp("merkle_root", ""));
+    }
+    auto update = make_document(
+        kvp("$set", set.extract()),
+        kvp("$unset", unset.extract())
+    );
+    clear_cache();
+
+    try {
+        ClientLease lease = connection_.acquire();
+        mongocxx::collection chunks = lease.collection(kRefsCollectionName);
+        mongocxx::collection versions = lease.collection("situation_versions");
+
+        if (supports_transactions()) {
+            auto session = lease.client().start_session();
+            session.with_transaction([&](mongocxx::client_session* transaction) {
+                auto updated = versions.update_one(*transaction, filter.view(), update.view());
+                if (!updated || updated->matched_count() == 0) {
+                    throw std::runtime_error("unknown version " + version_id);
+                }
+                chunks.delete_many(*transaction, filter.view());
+                write_refs(chunks, transaction, version_id, refs);
+            });
+            return true;
+        }
+
+        // Not atomic here: an interrupted rewrite leaves the version
+        // failing the count check in for_each_ref rather than wrong.
+        auto updated = versions.update_one(filter.view(), update.view());
+        if (!updated || updated->matched_count() == 0) {
+            return false;
+        }
+        chunks.delete_many(filter.view());
+        write_refs(chunks, nullptr, version_id, refs);
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error replacing version refs: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+}
+}
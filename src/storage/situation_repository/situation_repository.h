@@ -0,0 +1,202 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/cas/cas.h"
+#include "storage/merkle_tree/merkle_tree.h"
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/version_diff/version_delta.h"
+#include <mongocxx/client_session.hpp>
+#include <mongocxx/collection.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+struct Situation {
+    std::string situation_id;
+    std::string name;
+    std::string description;
+    // Empty until the first commit.
+    std::string head_version_id;
+    std::chrono::system_clock::time_point created_at;
+    std::chrono::system_clock::time_point updated_at;
+};
+
+struct SituationVersion {
+    std::string version_id;
+    std::string situation_id;
+    std::vector<std::string> parent_version_ids;
+    std::string commit_message;
+    std::string author;
+    std::chrono::system_clock::time_point created_at;
+    uint64_t ref_count = 0;
+    // Null for versions committed without a Merkle tree.
+    HashId merkle_root;
+    // For a version stored as a delta: its keyframe, then every version
+    // whose delta leads to it. Empty for keyframes.
+    std::vector<std::string> delta_chain;
+    // Changes in the deltas from the keyframe to this version.
+    uint64_t chain_changes = 0;
+};
+
+// When a commit stores full refs (a keyframe) rather than its delta to
+// the first parent.
+struct KeyframePolicy {
+    // At most this many versions from one keyframe to the next along a
+    // chain; 1 makes every version a keyframe.
+    size_t interval = 1;
+    // Nor more changes than this in the deltas since the last keyframe.
+    uint64_t max_changes = 1000000;
+    // Recently checked out versions kept in memory, 32 bytes per ref.
+    size_t cache_bytes = 256 * 1024 * 1024;
+};
+
+struct VersionStorageStats {
+    uint64_t keyframes = 0;
+    uint64_t deltas = 0;
+    // Hashes written for committed versions, and those a keyframe would
+    // have written on top for the versions stored as deltas.
+    uint64_t refs_written = 0;
+    uint64_t refs_saved = 0;
+    uint64_t checkouts = 0;
+    uint64_t cache_hits = 0;
+    uint64_t deltas_applied = 0;
+    uint64_t checkout_time_us = 0;
+    uint64_t max_checkout_time_us = 0;
+    size_t cached_versions = 0;
+    size_t cached_bytes = 0;
+};
+
+// The full content of a new version: objects new to the CAS plus the
+// hashes of everything else the version holds, in any order.
+struct VersionCommit {
+    std::string situation_id;
+    // Empty: the situation's head, if it has one. Several for a merge.
+    std::vector<std::string> parent_version_ids;
+    std::string commit_message;
+    std::string author;
+    std::vector<BPO> bpos;
+    std::vector<HashId> refs;
+};
+
+struct CommitResult {
+    bool ok = false;
+    std::string version_id;
+    uint64_t ref_count = 0;
+    size_t ref_chunks = 0;
+    bool keyframe = true;
+    HashId merkle_root;
+    MerkleBuildStats merkle;
+    StoreManyStats store;
+    std::string error;
+};
+
+// Situations and their versions. A version's refs are kept sorted and
+// deduplicated, packed as concatenated hashes into chunk documents of
+// situation_version_refs, so versions of millions of objects stay clear of
+// the document size limit. A commit writes its chunks, the version and the
+// situation's new head in one transaction; on a standalone server, which
+// has none, the version document is written after its chunks and is the
+// commit point. The head only moves if no other commit moved it first.
+//
+// Under a KeyframePolicy, versions between keyframes store only their
+// delta to the first parent, as a version_deltas entry; checkout() applies
+// the chain of deltas to the keyframe, starting from the latest version on
+// the chain still in its cache.
+class SituationRepository {
+public:
+    using RefsHandle = std::shared_ptr<const std::vector<HashId>>;
+
+    SituationRepository(MongoDBConnection& connection, CAS& cas);
+
+    SituationRepository(const SituationRepository&) = delete;
+    SituationRepository& operator=(const SituationRepository&) = delete;
+
+    // With a Merkle tree set, every commit also stores the tree over its
+    // refs and records the root in the version. Set before sharing.
+    void set_merkle_tree(std::shared_ptr<MerkleTree> tree);
+    std::shared_ptr<MerkleTree> get_merkle_tree() const;
+    // Set before sharing.
+    void set_keyframe_policy(const KeyframePolicy& policy);
+    const KeyframePolicy& get_keyframe_policy() const;
+
+    std::optional<Situation> create_situation(const std::string& name, const std::string& description = "");
+    std::optional<Situation> get_situation(const std::string& situation_id);
+
+    CommitResult commit_version(VersionCommit commit);
+
+    std::optional<SituationVersion> get_version(const std::string& version_id);
+    // Newest first; limit 0 returns the whole history.
+    std::vector<SituationVersion> list_history(const std::string& situation_id, int64_t limit = 0);
+
+    // Refs in ascending hash order, one chunk in memory at a time.
+    bool for_each_ref(const std::string& version_id, const std::function<bool(const HashId&)>& visit);
+    bool read_refs(const std::string& version_id, std::vector<HashId>& refs);
+    // Sorted refs of a keyframe or delta version; null on failure.
+    RefsHandle checkout(const std::string& version_id);
+    // Rewrites the refs of an existing version, e.g. after a hash migration,
+    // and makes it a keyframe. Later versions still apply their deltas to
+    // it, so a rewrite should rename hashes rather than change the set.
+    bool replace_refs(const std::string& version_id, std::vector<HashId> refs);
+
+    VersionStorageStats get_storage_stats() const;
+
+    static constexpr size_t kRefsPerChunk = 32768;
+    static constexpr size_t kChunksPerInsert = 16;
+    static constexpr const char* kRefsCollectionName = "situation_version_refs";
+
+private:
+    struct CachedRefs {
+        std::string version_id;
+        RefsHandle refs;
+    };
+
+    MongoDBConnection& connection_;
+    CAS& cas_;
+    std::shared_ptr<MerkleTree> merkle_;
+    KeyframePolicy policy_;
+    std::once_flag transactions_checked_;
+    bool transactions_;
+
+    mutable std::mutex cache_mutex_;
+    std::list<CachedRefs> cache_;
+    std::unordered_map<std::string, std::list<CachedRefs>::iterator> cache_index_;
+    size_t cache_bytes_;
+    VersionStorageStats stats_;
+
+    bool supports_transactions();
+    size_t write_refs(
+        mongocxx::collection& collection,
+        const mongocxx::client_session* session,
+        const std::string& version_id,
+        const std::vector<HashId>& refs
+    );
+    bool plan_delta(
+        const std::string& base_version_id,
+        const std::vector<HashId>& refs,
+        VersionDelta& delta,
+        std::vector<std::string>& chain,
+        uint64_t& chain_changes
+    );
+    RefsHandle materialize(const SituationVersion& version, size_t& applied);
+    RefsHandle cached(const std::string& version_id);
+    void cache_refs(const std::string& version_id, RefsHandle refs);
+    void clear_cache();
+    bool check_parents(ClientLease& lease, const std::string& situation_id, const std::vector<std::string>& parents);
+    static SituationVersion read_version(const bsoncxx::document::view& doc);
+};
+
+}
+}
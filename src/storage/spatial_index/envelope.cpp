@@ -0,0 +1,216 @@
+#include "envelope.h"
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iterator>
+
+namespace geoversion {
+namespace storage {
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+namespace {
+
+bool read_number(const bsoncxx::types::bson_value::view& value, double& number) {
+    switch (value.type()) {
+        case bsoncxx::type::k_double:
+            number = value.get_double().value;
+            return true;
+        case bsoncxx::type::k_int32:
+            number = value.get_int32().value;
+            return true;
+        case bsoncxx::type::k_int64:
+            number = static_cast<double>(value.get_int64().value);
+            return true;
+        default:
+            return false;
+    }
+}
+
+}
+
+Envelope::Envelope(double min_x, double min_y, double max_x, double max_y)
+    : min_x(min_x), min_y(min_y), max_x(max_x), max_y(max_y) {
+}
+
+bool Envelope::is_empty() const {
+    return min_x > max_x || min_y > max_y;
+}
+
+void Envelope::expand(double x, double y) {
+    min_x = std::min(min_x, x);
+    min_y = std::min(min_y, y);
+    max_x = std::max(max_x, x);
+    max_y = std::max(max_y, y);
+}
+
+void Envelope::expand(const Envelope& other) {
+    if (other.is_empty()) {
+        return;
+    }
+    min_x = std::min(min_x, other.min_x);
+    min_y = std::min(min_y, other.min_y);
+    max_x = std::max(max_x, other.max_x);
+    max_y = std::max(max_y, other.max_y);
+}
+
+bool Envelope::intersects(const Envelope& other) const {
+    return min_x <= other.max_x && other.min_x <= max_x &&
+           min_y <= other.max_y && other.min_y <= max_y;
+}
+
+bool Envelope::contains(const Envelope& other) const {
+    return min_x <= other.min_x && other.max_x <= max_x &&
+           min_y <= other.min_y && other.max_y <= max_y;
+}
+
+double Envelope::center_x() const {
+    return (min_x + max_x) * 0.5;
+}
+
+double Envelope::center_y() const {
+    return (min_y + max_y) * 0.5;
+}
+
+bool Envelope::operator==(const Envelope& other) const {
+    return min_x == other.min_x && min_y == other.min_y &&
+           max_x == other.max_x && max_y == other.max_y;
+}
+
+bool Envelope::operator!=(const Envelope& other) const {
+    return !(*this == other);
+}
+
+bool Envelope::from_geometry(const bsoncxx::document::view& geometry, Envelope& envelope) {
+    GeometryExtent extent;
+    if (!GeometryExtent::from_geometry(geometry, extent)) {
+        envelope = Envelope();
+        return false;
+    }
+    envelope = extent.envelope;
+    return true;
+}
+
+bool GeometryExtent::is_valid() const {
+    return !envelope.is_empty();
+}
+
+bsoncxx::document::value GeometryExtent::to_bson() const {
+    return make_document(
+        kvp("envelope", make_document(
+            kvp("min_lon", envelope.min_x),
+            kvp("min_lat", envelope.min_y),
+            kvp("max_lon", envelope.max_x),
+            kvp("max_lat", envelope.max_y)
+        )),
+        kvp("centroid", make_document(
+            kvp("lon", centroid_x),
+            kvp("lat", centroid_y)
+        ))
+    );
+}
+
+bool GeometryExtent::from_geometry(const bsoncxx::document::view& geometry, GeometryExtent& extent) {
+    extent = GeometryExtent();
+    if (!extent.accumulate_geometry(geometry) || extent.vertex_count == 0) {
+        extent = GeometryExtent();
+        return false;
+    }
+    extent.centroid_x = extent.sum_x_ / static_cast<double>(extent.vertex_count);
+    extent.centroid_y = extent.sum_y_ / static_cast<double>(extent.vertex_count);
+    return true;
+}
+
+bool GeometryExtent::from_document(const bsoncxx::document::view& doc, GeometryExtent& extent) {
+    auto envelope = doc["envelope"];
+    auto centroid = doc["centroid"];
+    if (!envelope || envelope.type() != bsoncxx::type::k_document ||
+        !centroid || centroid.type() != bsoncxx::type::k_document) {
+        return false;
+    }
+
+    auto envelope_doc = envelope.get_document().value;
+    auto centroid_doc = centroid.get_document().value;
+    GeometryExtent parsed;
+    for (auto field : {"min_lon", "min_lat", "max_lon", "max_lat"}) {
+        if (!envelope_doc[field]) {
+            return false;
+        }
+    }
+    if (!centroid_doc["lon"] || !centroid_doc["lat"] ||
+        !read_number(envelope_doc["min_lon"].get_value(), parsed.envelope.min_x) ||
+        !read_number(envelope_doc["min_lat"].get_value(), parsed.envelope.min_y) ||
+        !read_number(envelope_doc["max_lon"].get_value(), parsed.envelope.max_x) ||
+        !read_number(envelope_doc["max_lat"].get_value(), parsed.envelope.max_y) ||
+        !read_number(centroid_doc["lon"].get_value(), parsed.centroid_x) ||
+        !read_number(centroid_doc["lat"].get_value(), parsed.centroid_y) ||
+        parsed.envelope.is_empty()) {
+        return false;
+    }
+
+    extent = parsed;
+    return true;
+}
+
+bool GeometryExtent::accumulate_geometry(const bsoncxx::document::view& geometry) {
+    auto geometries = geometry["geometries"];
+    if (geometries && geometries.type() == bsoncxx::type::k_array) {
+        for (auto&& member : geometries.get_array().value) {
+            if (member.type() != bsoncxx::type::k_document) {
+                return false;
+            }
+            if (!accumulate_geometry(member.get_document().value)) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    auto coordinates = geometry["coordinates"];
+    if (!coordinates || coordinates.type() != bsoncxx::type::k_array) {
+        return false;
+    }
+    return accumulate_coordinates(coordinates.get_array().value);
+}
+
+// A position is an array starting with a number; anything else nests deeper.
+bool GeometryExtent::accumulate_coordinates(const bsoncxx::array::view& coordinates) {
+    auto first = coordinates.begin();
+    if (first == coordinates.end()) {
+        return true;
+    }
+
+    if (first->type() != bsoncxx::type::k_array) {
+        auto second = std::next(first);
+        double x = 0.0;
+        double y = 0.0;
+        if (second == coordinates.end() ||
+            !read_number(first->get_value(), x) || !read_number(second->get_value(), y)) {
+            return false;
+        }
+        if (!std::isfinite(x) || !std::isfinite(y)) {
+            return false;
+        }
+        envelope.expand(x, y);
+        sum_x_ += x;
+        sum_y_ += y;
+        ++vertex_count;
+        return true;
+    }
+
+    for (auto&& child : coordinates) {
+        if (child.type() != bsoncxx::type::k_array) {
+            return false;
+        }
+        if (!accumulate_coordinates(child.get_array().value)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+}
+}
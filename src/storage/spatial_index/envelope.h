@@ -0,0 +1,61 @@
+#pragma once
+
+#include <bsoncxx/array/view.hpp>
+#include <bsoncxx/document/value.hpp>
+#include <bsoncxx/document/view.hpp>
+#include <cstddef>
+#include <limits>
+
+namespace geoversion {
+namespace storage {
+
+struct Envelope {
+    double min_x = std::numeric_limits<double>::infinity();
+    double min_y = std::numeric_limits<double>::infinity();
+    double max_x = -std::numeric_limits<double>::infinity();
+    double max_y = -std::numeric_limits<double>::infinity();
+
+    Envelope() = default;
+    Envelope(double min_x, double min_y, double max_x, double max_y);
+
+    bool is_empty() const;
+    void expand(double x, double y);
+    void expand(const Envelope& other);
+
+    bool intersects(const Envelope& other) const;
+    bool contains(const Envelope& other) const;
+
+    double center_x() const;
+    double center_y() const;
+
+    bool operator==(const Envelope& other) const;
+    bool operator!=(const Envelope& other) const;
+
+    static bool from_geometry(const bsoncxx::document::view& geometry, Envelope& envelope);
+};
+
+// Envelope plus vertex centroid of a geometry, persisted on bpo_cas documents
+// as `envelope: {min_lon, min_lat, max_lon, max_lat}` and `centroid: {lon, lat}`.
+// vertex_count is only known when computed from the geometry itself.
+struct GeometryExtent {
+    Envelope envelope;
+    double centroid_x = 0.0;
+    double centroid_y = 0.0;
+    size_t vertex_count = 0;
+
+    bool is_valid() const;
+    bsoncxx::document::value to_bson() const;
+
+    static bool from_geometry(const bsoncxx::document::view& geometry, GeometryExtent& extent);
+    static bool from_document(const bsoncxx::document::view& doc, GeometryExtent& extent);
+
+private:
+    double sum_x_ = 0.0;
+    double sum_y_ = 0.0;
+
+    bool accumulate_geometry(const bsoncxx::document::view& geometry);
+    bool accumulate_coordinates(const bsoncxx::array::view& coordinates);
+};
+
+}
+}
@@ -0,0 +1,289 @@
+#include "spatial_index.h"
+#include <bsoncxx/builder/stream/document.hpp>
+#include <mongocxx/options/find.hpp>
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <mutex>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+constexpr size_t kMinOverlaySize = 1024;
+
+template <typename T, typename EnvelopeOf>
+void sort_tile_recursive(std::vector<T>& items, size_t capacity, EnvelopeOf envelope_of) {
+    size_t leaf_count = (items.size() + capacity - 1) / capacity;
+    size_t slice_count = static_cast<size_t>(std::ceil(std::sqrt(static_cast<double>(leaf_count))));
+    size_t slice_size = std::max<size_t>(1, slice_count) * capacity;
+
+    std::sort(items.begin(), items.end(), [&](const T& a, const T& b) {
+        return envelope_of(a).center_x() < envelope_of(b).center_x();
+    });
+    for (size_t begin = 0; begin < items.size(); begin += slice_size) {
+        auto end = items.begin() + std::min(items.size(), begin + slice_size);
+        std::sort(items.begin() + begin, end, [&](const T& a, const T& b) {
+            return envelope_of(a).center_y() < envelope_of(b).center_y();
+        });
+    }
+}
+
+}
+
+SpatialIndex::SpatialIndex(size_t node_capacity)
+    : node_capacity_(std::max<size_t>(2, node_capacity)),
+      height_(0),
+      ready_(false),
+      build_time_ms_(0),
+      queries_(0),
+      query_time_ns_(0),
+      last_query_ns_(0) {
+}
+
+bool SpatialIndex::build(mongocxx::collection collection, int32_t batch_size) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<SpatialEntry> entries;
+
+    try {
+        bsoncxx::builder::stream::document projection;
+        projection << "hash" << 1 << "geometry" << 1 << "_id" << 0;
+
+        mongocxx::options::find opts;
+        opts.projection(projection.view());
+        opts.batch_size(batch_size);
+
+        bsoncxx::builder::stream::document empty_filter;
+        auto cursor = collection.find(empty_filter.view(), opts);
+
+        for (auto&& doc : cursor) {
+            SpatialEntry entry;
+            if (!doc["hash"] || !HashId::from_bson(doc["hash"].get_value(), entry.hash)) {
+                continue;
+            }
+            if (!doc["geometry"] || doc["geometry"].type() != bsoncxx::type::k_document) {
+                continue;
+            }
+            if (!Envelope::from_geometry(doc["geometry"].get_document().value, entry.envelope)) {
+                continue;
+            }
+            entries.push_back(entry);
+        }
+    } catch (const std::exception& e) {
+        std::cerr << "Error building spatial index: " << e.what() << std::endl;
+        return false;
+    }
+
+    bulk_load(std::move(entries));
+
+    build_time_ms_ = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start
+    ).count();
+    ready_ = true;
+    return true;
+}
+
+void SpatialIndex::bulk_load(std::vector<SpatialEntry> entries) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    entries.insert(entries.end(), pending_.begin(), pending_.end());
+    pack(std::move(entries));
+}
+
+void SpatialIndex::insert(const HashId& hash, const Envelope& envelope) {
+    if (envelope.is_empty()) {
+        return;
+    }
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    removed_.erase(hash);
+    pending_.push_back(SpatialEntry{envelope, hash});
+    compact_if_needed();
+}
+
+void SpatialIndex::remove(const HashId& hash) {
+    std::unique_lock<std::shared_mutex> lock(mutex_);
+    removed_.insert(hash);
+    pending_.erase(
+        std::remove_if(pending_.begin(), pending_.end(), [&](const SpatialEntry& entry) {
+            return entry.hash == hash;
+        }),
+        pending_.end()
+    );
+    compact_if_needed();
+}
+
+std::vector<HashId> SpatialIndex::query_intersects(const Envelope& box) {
+    return query(box, false);
+}
+
+std::vector<HashId> SpatialIndex::query_within(const Envelope& box) {
+    return query(box, true);
+}
+
+bool SpatialIndex::is_ready() const {
+    return ready_;
+}
+
+size_t SpatialIndex::size() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+    return entries_.size() + pending_.size() - std::min(entries_.size() + pending_.size(), removed_.size());
+}
+
+SpatialIndexStats SpatialIndex::get_stats() const {
+    std::shared_lock<std::shared_mutex> lock(mutex_);
+
+    SpatialIndexStats stats;
+    stats.ready = ready_;
+    stats.entries = entries_.size();
+    stats.pending = pending_.size();
+    stats.removed = removed_.size();
+    stats.nodes = nodes_.size();
+    stats.height = height_;
+    stats.memory_bytes = entries_.capacity() * sizeof(SpatialEntry) +
+                         nodes_.capacity() * sizeof(Node) +
+                         pending_.capacity() * sizeof(SpatialEntry) +
+                         removed_.size() * (sizeof(HashId) + 2 * sizeof(void*));
+    stats.build_time = std::chrono::milliseconds(build_time_ms_.load());
+    stats.queries = queries_.load();
+    if (stats.queries > 0) {
+        stats.average_query_us = static_cast<double>(query_time_ns_.load()) / stats.queries / 1000.0;
+    }
+    stats.last_query_us = static_cast<double>(last_query_ns_.load()) / 1000.0;
+    return stats;
+}
+
+// Caller holds the unique lock. Folds pending inserts and tombstones into
+// a freshly packed tree; for duplicate hashes the latest entry wins.
+void SpatialIndex::pack(std::vector<SpatialEntry> entries) {
+    std::unordered_set<HashId> seen;
+    seen.reserve(entries.size());
+    std::vector<SpatialEntry> live;
+    live.reserve(entries.size());
+    for (auto it = entries.rbegin(); it != entries.rend(); ++it) {
+        if (removed_.count(it->hash) > 0 || !seen.insert(it->hash).second) {
+            continue;
+        }
+        live.push_back(*it);
+    }
+    entries.clear();
+    entries.shrink_to_fit();
+
+    pending_.clear();
+    removed_.clear();
+    nodes_.clear();
+    height_ = 0;
+
+    auto entry_envelope = [](const SpatialEntry& entry) -> const Envelope& { return entry.envelope; };
+    auto node_envelope = [](const Node& node) -> const Envelope& { return node.envelope; };
+
+    sort_tile_recursive(live, node_capacity_, entry_envelope);
+    entries_ = std::move(live);
+    if (entries_.empty()) {
+        return;
+    }
+
+    std::vector<Node> level;
+    level.reserve((entries_.size() + node_capacity_ - 1) / node_capacity_);
+    for (size_t begin = 0; begin < entries_.size(); begin += node_capacity_) {
+        size_t end = std::min(entries_.size(), begin + node_capacity_);
+        Node leaf{Envelope(), static_cast<uint32_t>(begin), static_cast<uint32_t>(end - begin), true};
+        for (size_t i = begin; i < end; ++i) {
+            leaf.envelope.expand(entries_[i].envelope);
+        }
+        level.push_back(leaf);
+    }
+    height_ = 1;
+
+    while (level.size() > 1) {
+        sort_tile_recursive(level, node_capacity_, node_envelope);
+
+        size_t base = nodes_.size();
+        nodes_.insert(nodes_.end(), level.begin(), level.end());
+
+        std::vector<Node> parents;
+        parents.reserve((level.size() + node_capacity_ - 1) / node_capacity_);
+        for (size_t begin = 0; begin < level.size(); begin += node_capacity_) {
+            size_t end = std::min(level.size(), begin + node_capacity_);
+            Node parent{Envelope(), static_cast<uint32_t>(base + begin), static_cast<uint32_t>(end - begin), false};
+            for (size_t i = begin; i < end; ++i) {
+                parent.envelope.expand(level[i].envelope);
+            }
+            parents.push_back(parent);
+        }
+        level = std::move(parents);
+        ++height_;
+    }
+    nodes_.push_back(level.front());
+}
+
+void SpatialIndex::compact_if_needed() {
+    size_t pending_limit = std::max(kMinOverlaySize, entries_.size() / 8);
+    size_t removed_limit = std::max(kMinOverlaySize, entries_.size() / 4);
+    if (pending_.size() <= pending_limit && removed_.size() <= removed_limit) {
+        return;
+    }
+
+    std::vector<SpatialEntry> merged;
+    merged.reserve(entries_.size() + pending_.size());
+    merged.insert(merged.end(), entries_.begin(), entries_.end());
+    merged.insert(merged.end(), pending_.begin(), pending_.end());
+    pack(std::move(merged));
+}
+
+std::vector<HashId> SpatialIndex::query(const Envelope& box, bool within) {
+    auto start = std::chrono::steady_clock::now();
+    std::vector<HashId> results;
+
+    {
+        std::shared_lock<std::shared_mutex> lock(mutex_);
+
+        auto matches = [&](const SpatialEntry& entry) {
+            if (within ? !box.contains(entry.envelope) : !box.intersects(entry.envelope)) {
+                return false;
+            }
+            return removed_.empty() || removed_.count(entry.hash) == 0;
+        };
+
+        if (!nodes_.empty()) {
+            std::vector<uint32_t> stack;
+            stack.push_back(static_cast<uint32_t>(nodes_.size() - 1));
+            while (!stack.empty()) {
+                const Node& node = nodes_[stack.back()];
+                stack.pop_back();
+                if (!box.intersects(node.envelope)) {
+                    continue;
+                }
+                for (uint32_t i = node.first; i < node.first + node.count; ++i) {
+                    if (!node.leaf) {
+                        stack.push_back(i);
+                    } else if (matches(entries_[i])) {
+                        results.push_back(entries_[i].hash);
+                    }
+                }
+            }
+        }
+
+        for (const SpatialEntry& entry : pending_) {
+            if (matches(entry)) {
+                results.push_back(entry.hash);
+            }
+        }
+
+        if (!pending_.empty()) {
+            std::sort(results.begin(), results.end());
+            results.erase(std::unique(results.begin(), results.end()), results.end());
+        }
+    }
+
+    auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start
+    ).count();
+    ++queries_;
+    query_time_ns_ += static_cast<uint64_t>(elapsed);
+    last_query_ns_ = static_cast<uint64_t>(elapsed);
+
+    return results;
+}
+
+}
+}
@@ -0,0 +1,90 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include "storage/spatial_index/envelope.h"
+#include <mongocxx/collection.hpp>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <shared_mutex>
+#include <unordered_set>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+struct SpatialEntry {
+    Envelope envelope;
+    HashId hash;
+};
+
+struct SpatialIndexStats {
+    bool ready = false;
+    size_t entries = 0;
+    size_t pending = 0;
+    size_t removed = 0;
+    size_t nodes = 0;
+    size_t height = 0;
+    size_t memory_bytes = 0;
+    std::chrono::milliseconds build_time{0};
+    uint64_t queries = 0;
+    double average_query_us = 0.0;
+    double last_query_us = 0.0;
+};
+
+// Packed R-tree over BPO envelopes, bulk-loaded with Sort-Tile-Recursive.
+// Inserts and removals go to a small overlay (linear-scanned buffer and
+// tombstone set) that is folded back into the packed tree once it grows.
+class SpatialIndex {
+public:
+    explicit SpatialIndex(size_t node_capacity = kDefaultNodeCapacity);
+
+    SpatialIndex(const SpatialIndex&) = delete;
+    SpatialIndex& operator=(const SpatialIndex&) = delete;
+
+    bool build(mongocxx::collection collection, int32_t batch_size = 10000);
+    void bulk_load(std::vector<SpatialEntry> entries);
+
+    void insert(const HashId& hash, const Envelope& envelope);
+    void remove(const HashId& hash);
+
+    std::vector<HashId> query_intersects(const Envelope& box);
+    std::vector<HashId> query_within(const Envelope& box);
+
+    bool is_ready() const;
+    size_t size() const;
+    SpatialIndexStats get_stats() const;
+
+    static constexpr size_t kDefaultNodeCapacity = 16;
+
+private:
+    struct Node {
+        Envelope envelope;
+        uint32_t first;
+        uint32_t count;
+        bool leaf;
+    };
+
+    size_t node_capacity_;
+    std::vector<SpatialEntry> entries_;
+    std::vector<Node> nodes_;
+    size_t height_;
+
+    std::vector<SpatialEntry> pending_;
+    std::unordered_set<HashId> removed_;
+    mutable std::shared_mutex mutex_;
+
+    std::atomic<bool> ready_;
+    std::atomic<int64_t> build_time_ms_;
+    std::atomic<uint64_t> queries_;
+    std::atomic<uint64_t> query_time_ns_;
+    std::atomic<uint64_t> last_query_ns_;
+
+    void pack(std::vector<SpatialEntry> entries);
+    void compact_if_needed();
+    std::vector<HashId> query(const Envelope& box, bool within);
+};
+
+}
+}
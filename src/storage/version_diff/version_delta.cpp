@@ -0,0 +1,189 @@
+#include "version_delta.h"
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+#include <mongocxx/hint.hpp>
+#include <mongocxx/options/find.hpp>
+#include <algorithm>
+#include <chrono>
+
+namespace geoversion {
+namespace storage {
+
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+namespace {
+
+std::string delta_id(const std::string& from_version_id, const std::string& to_version_id, size_t part) {
+    std::string id = from_version_id + ".." + to_version_id;
+    if (part > 0) {
+        id += "#" + std::to_string(part);
+    }
+    return id;
+}
+
+bool read_hash_array(const bsoncxx::document::view& doc, const char* field, std::vector<HashId>& out) {
+    auto element = doc[field];
+    if (!element) {
+        return true;
+    }
+    if (element.type() != bsoncxx::type::k_array) {
+        return false;
+    }
+    for (auto&& value : element.get_array().value) {
+        HashId hash;
+        if (!HashId::from_bson(value.get_value(), hash)) {
+            return false;
+        }
+        out.push_back(hash);
+    }
+    return true;
+}
+
+uint64_t int_field(const bsoncxx::document::view& doc, const char* key) {
+    auto element = doc[key];
+    if (element && element.type() == bsoncxx::type::k_int32 && element.get_int32().value >= 0) {
+        return static_cast<uint64_t>(element.get_int32().value);
+    }
+    if (element && element.type() == bsoncxx::type::k_int64 && element.get_int64().value >= 0) {
+        return static_cast<uint64_t>(element.get_int64().value);
+    }
+    return 0;
+}
+
+}
+
+std::vector<bsoncxx::document::value> VersionDeltaDocuments::build(
+    const VersionDelta& delta,
+    const std::string& identity_field
+) {
+    size_t total = delta.added.size() + delta.removed.size() + delta.modified.size();
+    size_t parts = std::max<size_t>(1, (total + kEntriesPerPart - 1) / kEntriesPerPart);
+    bsoncxx::types::b_date now{std::chrono::system_clock::now()};
+
+    std::vector<bsoncxx::document::value> docs;
+    docs.reserve(parts);
+    size_t a = 0;
+    size_t r = 0;
+    size_t m = 0;
+    for (size_t part = 0; part < parts; ++part) {
+        size_t budget = kEntriesPerPart;
+        bsoncxx::builder::basic::array added;
+        bsoncxx::builder::basic::array removed;
+        bsoncxx::builder::basic::array modified;
+        for (; a < delta.added.size() && budget > 0; ++a, --budget) {
+            added.append(delta.added[a].to_bson());
+        }
+        for (; r < delta.removed.size() && budget > 0; ++r, --budget) {
+            removed.append(delta.removed[r].to_bson());
+        }
+        for (; m < delta.modified.size() && budget > 0; ++m, --budget) {
+            modified.append(make_document(
+                kvp("old_hash", delta.modified[m].old_hash.to_bson()),
+                kvp("new_hash", delta.modified[m].new_hash.to_bson())
+            ));
+        }
+        docs.push_back(make_document(
+            kvp("delta_id", delta_id(delta.from_version_id, delta.to_version_id, part)),
+            kvp("from_version_id", delta.from_version_id),
+            kvp("to_version_id", delta.to_version_id),
+            kvp("added_bpos", added),
+            kvp("removed_bpos", removed),
+            kvp("modified_bpos", modified),
+            kvp("part", static_cast<int32_t>(part)),
+            kvp("parts", static_cast<int32_t>(parts)),
+            kvp("identity_field", identity_field),
+            kvp("created_at", now)
+        ));
+    }
+    return docs;
+}
+
+bool VersionDeltaDocuments::read(
+    const std::vector<bsoncxx::document::value>& parts,
+    VersionDelta& delta,
+    std::string& identity_field
+) {
+    uint64_t expected = 0;
+    uint64_t next_part = 0;
+    for (const auto& part_doc : parts) {
+        auto doc = part_doc.view();
+        // Documents without parts were written whole.
+        uint64_t part = int_field(doc, "part");
+        expected = doc["parts"] ? int_field(doc, "parts") : 1;
+        if (part != next_part) {
+            return false;
+        }
+        if (!read_hash_array(doc, "added_bpos", delta.added) || !read_hash_array(doc, "removed_bpos", delta.removed)) {
+            return false;
+        }
+        if (doc["modified_bpos"] && doc["modified_bpos"].type() == bsoncxx::type::k_array) {
+            for (auto&& pair : doc["modified_bpos"].get_array().value) {
+                if (pair.type() != bsoncxx::type::k_document) {
+                    return false;
+                }
+                auto pair_doc = pair.get_document().value;
+                ModifiedBPO modified;
+                if (!pair_doc["old_hash"] || !pair_doc["new_hash"] ||
+                    !HashId::from_bson(pair_doc["old_hash"].get_value(), modified.old_hash) ||
+                    !HashId::from_bson(pair_doc["new_hash"].get_value(), modified.new_hash)) {
+                    return false;
+                }
+                delta.modified.push_back(modified);
+            }
+        }
+        if (doc["identity_field"] && doc["identity_field"].type() == bsoncxx::type::k_string) {
+            identity_field = std::string(doc["identity_field"].get_string().value);
+        }
+        ++next_part;
+    }
+    return next_part > 0 && next_part == expected;
+}
+
+bool VersionDeltaDocuments::load(
+    mongocxx::collection& deltas,
+    const std::string& from_version_id,
+    const std::string& to_version_id,
+    VersionDelta& delta,
+    std::string& identity_field
+) {
+    mongocxx::options::find opts;
+    opts.sort(make_document(kvp("part", 1)));
+    opts.hint(mongocxx::hint("delta_lookup_idx"));
+
+    std::vector<bsoncxx::document::value> parts;
+    auto cursor = deltas.find(make_document(
+        kvp("from_version_id", from_version_id),
+        kvp("to_version_id", to_version_id)
+    ), opts);
+    for (auto&& doc : cursor) {
+        parts.emplace_back(doc);
+    }
+    return read(parts, delta, identity_field);
+}
+
+void VersionDeltaDocuments::write(
+    mongocxx::collection& deltas,
+    const mongocxx::client_session* session,
+    const VersionDelta& delta,
+    const std::string& identity_field
+) {
+    auto docs = build(delta, identity_field);
+    // Parts left behind by an interrupted write would collide on delta_id.
+    auto filter = make_document(
+        kvp("from_version_id", delta.from_version_id),
+        kvp("to_version_id", delta.to_version_id)
+    );
+    if (session) {
+        deltas.delete_many(*session, filter.view());
+        deltas.insert_many(*session, docs);
+    } else {
+        deltas.delete_many(filter.view());
+        deltas.insert_many(docs);
+    }
+}
+
+}
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include <mongocxx/client_session.hpp>
+#include <mongocxx/collection.hpp>
+#include <bsoncxx/document/value.hpp>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+struct ModifiedBPO {
+    HashId old_hash;
+    HashId new_hash;
+};
+
+// Hash lists are sorted; modified pairs by old_hash.
+struct VersionDelta {
+    std::string from_version_id;
+    std::string to_version_id;
+    std::vector<HashId> added;
+    std::vector<HashId> removed;
+    std::vector<ModifiedBPO> modified;
+    bool from_cache = false;
+};
+
+// Layout of a delta in version_deltas: one document per part of up to
+// kEntriesPerPart hashes, sharing from_version_id and to_version_id.
+// identity_field records how modified pairs were formed; empty when they
+// were not.
+class VersionDeltaDocuments {
+public:
+    static std::vector<bsoncxx::document::value> build(const VersionDelta& delta, const std::string& identity_field);
+    // parts in part order, as found for one pair of versions.
+    static bool read(
+        const std::vector<bsoncxx::document::value>& parts,
+        VersionDelta& delta,
+        std::string& identity_field
+    );
+
+    // Both throw on database errors.
+    static bool load(
+        mongocxx::collection& deltas,
+        const std::string& from_version_id,
+        const std::string& to_version_id,
+        VersionDelta& delta,
+        std::string& identity_field
+    );
+    // Replaces any parts stored for the same pair of versions.
+    static void write(
+        mongocxx::collection& deltas,
+        const mongocxx::client_session* session,
+        const VersionDelta& delta,
+        const std::string& identity_field
+    );
+
+    static constexpr size_t kEntriesPerPart = 100000;
+};
+
+}
+}
@@ -0,0 +1,366 @@
+#include "version_diff.h"
+#include "storage/cas/canonical_hash.h"
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/types.hpp>
+#include <algorithm>
+#include <cstring>
+#include <future>
+#include <iostream>
+#include <iterator>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace geoversion {
+namespace storage {
+
+using bsoncxx::builder::basic::kvp;
+
+namespace {
+
+constexpr size_t kStageSize = 256;
+
+// Number of leading positions where a and b hold the same hash. Successive
+// versions mostly share long runs, so this carries most of a diff.
+size_t common_run(const HashId* a, const HashId* b, size_t count) {
+    const uint8_t* pa = a->data();
+    const uint8_t* pb = b->data();
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i < count; ++i) {
+        __m256i x = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pa + i * HashId::kSize));
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(pb + i * HashId::kSize));
+        if (_mm256_movemask_epi8(_mm256_cmpeq_epi8(x, y)) != -1) {
+            break;
+        }
+    }
+#elif defined(__SSE2__)
+    for (; i < count; ++i) {
+        const uint8_t* x = pa + i * HashId::kSize;
+        const uint8_t* y = pb + i * HashId::kSize;
+        __m128i lo = _mm_cmpeq_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(x)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(y))
+        );
+        __m128i hi = _mm_cmpeq_epi8(
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(x + 16)),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(y + 16))
+        );
+        if (_mm_movemask_epi8(_mm_and_si128(lo, hi)) != 0xFFFF) {
+            break;
+        }
+    }
+#else
+    for (; i < count; ++i) {
+        if (std::memcmp(pa + i * HashId::kSize, pb + i * HashId::kSize, HashId::kSize) != 0) {
+            break;
+        }
+    }
+#endif
+    return i;
+}
+
+// Drops from `hashes` every hash in `paired`; both sorted.
+void remove_paired(std::vector<HashId>& hashes, std::vector<HashId>& paired) {
+    std::sort(paired.begin(), paired.end());
+    std::vector<HashId> remaining;
+    remaining.reserve(hashes.size() - paired.size());
+    std::set_difference(hashes.begin(), hashes.end(), paired.begin(), paired.end(), std::back_inserter(remaining));
+    hashes.swap(remaining);
+}
+
+}
+
+VersionDiff::VersionDiff(
+    MongoDBConnection& connection,
+    SituationRepository& repository,
+    CAS& cas,
+    const VersionDiffOptions& options
+) : connection_(connection), repository_(repository), cas_(cas), options_(options) {
+}
+
+void VersionDiff::diff_sorted(
+    const HashId* from, size_t from_count,
+    const HashId* to, size_t to_count,
+    std::vector<HashId>& added,
+    std::vector<HashId>& removed
+) {
+    // Disjoint stretches alternate unpredictably, so each step copies both
+    // candidates into small staging buffers and advances without branching.
+    HashId stage_added[kStageSize];
+    HashId stage_removed[kStageSize];
+    size_t staged_added = 0;
+    size_t staged_removed = 0;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < from_count && j < to_count) {
+        uint64_t x = from[i].prefix();
+        uint64_t y = to[j].prefix();
+        if (x == y) {
+            size_t run = common_run(from + i, to + j, std::min(from_count - i, to_count - j));
+            if (run > 0) {
+                i += run;
+                j += run;
+                continue;
+            }
+            bool less = std::memcmp(from[i].data(), to[j].data(), HashId::kSize) < 0;
+            x = less ? 0 : 1;
+            y = less ? 1 : 0;
+        }
+        bool take_from = x < y;
+        stage_removed[staged_removed] = from[i];
+        stage_added[staged_added] = to[j];
+        staged_removed += take_from;
+        i += take_from;
+        staged_added += !take_from;
+        j += !take_from;
+        if (staged_removed == kStageSize || staged_added == kStageSize) {
+            removed.insert(removed.end(), stage_removed, stage_removed + staged_removed);
+            added.insert(added.end(), stage_added, stage_added + staged_added);
+            staged_removed = 0;
+            staged_added = 0;
+        }
+    }
+    removed.insert(removed.end(), stage_removed, stage_removed + staged_removed);
+    added.insert(added.end(), stage_added, stage_added + staged_added);
+    removed.insert(removed.end(), from + i, from + from_count);
+    added.insert(added.end(), to + j, to + to_count);
+}
+
+bool VersionDiff::diff(const std::string& from_version_id, const std::string& to_version_id, VersionDelta& delta) {
+    auto cached = load_delta(from_version_id, to_version_id);
+    if (cached) {
+        delta = std::move(*cached);
+        return true;
+    }
+
+    delta = VersionDelta();
+    delta.from_version_id = from_version_id;
+    delta.to_version_id = to_version_id;
+
+    HashId from_root;
+    HashId to_root;
+    std::shared_ptr<MerkleTree> tree = repository_.get_merkle_tree();
+    if (tree && merkle_roots(from_version_id, to_version_id, from_root, to_root)) {
+        if (!tree->diff(from_root, to_root, delta.added, delta.removed)) {
+            return false;
+        }
+    } else {
+        std::vector<HashId> from_refs;
+        std::vector<HashId> to_refs;
+        bool read = false;
+        if (connection_.is_pooled()) {
+            auto from_read = std::async(std::launch::async, [&]() {
+                return repository_.read_refs(from_version_id, from_refs);
+            });
+            bool to_read = repository_.read_refs(to_version_id, to_refs);
+            read = from_read.get() && to_read;
+        } else {
+            read = repository_.read_refs(from_version_id, from_refs) && repository_.read_refs(to_version_id, to_refs);
+        }
+        if (!read) {
+            return false;
+        }
+        diff_sorted(from_refs.data(), from_refs.size(), to_refs.data(), to_refs.size(), delta.added, delta.removed);
+    }
+    pair_modified(delta);
+
+    if (options_.store) {
+        store_delta(delta);
+    }
+    return true;
+}
+
+bool VersionDiff::merkle_roots(
+    const std::string& from_version_id,
+    const std::string& to_version_id,
+    HashId& from_root,
+    HashId& to_root
+) {
+    auto from = repository_.get_version(from_version_id);
+    auto to = repository_.get_version(to_version_id);
+    if (!from || !to || from->merkle_root.is_null() || to->merkle_root.is_null()) {
+        return false;
+    }
+    from_root = from->merkle_root;
+    to_root = to->merkle_root;
+    return true;
+}
+
+bool VersionDiff::identical(const std::string& from_version_id, const std::string& to_version_id, bool& same) {
+    HashId from_root;
+    HashId to_root;
+    if (merkle_roots(from_version_id, to_version_id, from_root, to_root)) {
+        same = from_root == to_root;
+        return true;
+    }
+    VersionDelta delta;
+    if (!diff(from_version_id, to_version_id, delta)) {
+        return false;
+    }
+    same = delta.added.empty() && delta.removed.empty() && delta.modified.empty();
+    return true;
+}
+
+bool VersionDiff::identity_key(const bsoncxx::document::view& doc, const std::string& field, HashId& key) {
+    static constexpr char kDomain[] = "geoversion.identity.v1";
+
+    auto attributes = doc["attributes"];
+    if (field.empty() || !attributes || attributes.type() != bsoncxx::type::k_document) {
+        return false;
+    }
+    auto value = attributes.get_document().value[field];
+    if (!value) {
+        return false;
+    }
+    bsoncxx::builder::basic::document identity;
+    identity.append(kvp(field, value.get_value()));
+
+    Sha256Stream stream;
+    stream.update(kDomain, sizeof(kDomain));
+    CanonicalHasher::append_document(stream, identity.view());
+    key = stream.finish();
+    return true;
+}
+
+const VersionDiffOptions& VersionDiff::get_options() const {
+    return options_;
+}
+
+// Pairs each hash with the canonical hash of its identity attribute;
+// objects without one are left out.
+bool VersionDiff::identities(const std::vector<HashId>& hashes, std::vector<std::pair<HashId, HashId>>& keyed) {
+    keyed.reserve(hashes.size());
+    const std::string& field = options_.identity_field;
+    size_t found = cas_.for_each_of(hashes, [&](const bsoncxx::document::view& doc) {
+        HashId hash;
+        HashId key;
+        if (doc["hash"] && HashId::from_bson(doc["hash"].get_value(), hash) && identity_key(doc, field, key)) {
+            keyed.emplace_back(key, hash);
+        }
+        return true;
+    });
+    return found == hashes.size();
+}
+
+void VersionDiff::pair_modified(VersionDelta& delta) {
+    if (options_.identity_field.empty() || delta.added.empty() || delta.removed.empty()) {
+        return;
+    }
+
+    std::vector<std::pair<HashId, HashId>> before;
+    std::vector<std::pair<HashId, HashId>> after;
+    if (!identities(delta.removed, before) || !identities(delta.added, after)) {
+        std::cerr << "Error pairing modified objects: some objects are missing from the CAS" << std::endl;
+    }
+    auto by_identity = [](const std::pair<HashId, HashId>& a, const std::pair<HashId, HashId>& b) {
+        return a.first < b.first;
+    };
+    std::sort(before.begin(), before.end(), by_identity);
+    std::sort(after.begin(), after.end(), by_identity);
+
+    // An identity pairs only when it names one object on each side.
+    std::vector<HashId> paired_old;
+    std::vector<HashId> paired_new;
+    size_t i = 0;
+    size_t j = 0;
+    while (i < before.size() && j < after.size()) {
+        const HashId& identity = before[i].first;
+        if (identity < after[j].first) {
+            ++i;
+            continue;
+        }
+        if (after[j].first < identity) {
+            ++j;
+            continue;
+        }
+        size_t i_end = i;
+        while (i_end < before.size() && before[i_end].first == identity) {
+            ++i_end;
+        }
+        size_t j_end = j;
+        while (j_end < after.size() && after[j_end].first == identity) {
+            ++j_end;
+        }
+        if (i_end - i == 1 && j_end - j == 1) {
+            delta.modified.push_back(ModifiedBPO{before[i].second, after[j].second});
+            paired_old.push_back(before[i].second);
+            paired_new.push_back(after[j].second);
+        }
+        i = i_end;
+        j = j_end;
+    }
+    if (delta.modified.empty()) {
+        return;
+    }
+
+    std::sort(delta.modified.begin(), delta.modified.end(), [](const ModifiedBPO& a, const ModifiedBPO& b) {
+        return a.old_hash < b.old_hash;
+    });
+    remove_paired(delta.removed, paired_old);
+    remove_paired(delta.added, paired_new);
+}
+
+std::optional<VersionDelta> VersionDiff::load_delta(const std::string& from_version_id, const std::string& to_version_id) {
+    try {
+        ClientLease lease = connection_.acquire();
+        mongocxx::collection deltas = lease.collection("version_deltas");
+
+        VersionDelta delta;
+        delta.from_version_id = from_version_id;
+        delta.to_version_id = to_version_id;
+        delta.from_cache = true;
+        std::string identity_field;
+        if (!VersionDeltaDocuments::load(deltas, from_version_id, to_version_id, delta, identity_field)) {
+            VersionDelta reverse;
+            identity_field.clear();
+            if (!VersionDeltaDocuments::load(deltas, to_version_id, from_version_id, reverse, identity_field)) {
+                return std::nullopt;
+            }
+            delta.added = std::move(reverse.removed);
+            delta.removed = std::move(reverse.added);
+            delta.modified.reserve(reverse.modified.size());
+            for (const auto& pair : reverse.modified) {
+                delta.modified.push_back(ModifiedBPO{pair.new_hash, pair.old_hash});
+            }
+            std::sort(delta.modified.begin(), delta.modified.end(), [](const ModifiedBPO& a, const ModifiedBPO& b) {
+                return a.old_hash < b.old_hash;
+            });
+        }
+
+        // Deltas stored with the versions themselves are not paired.
+        if (identity_field != options_.identity_field) {
+            for (const auto& pair : delta.modified) {
+                delta.removed.push_back(pair.old_hash);
+                delta.added.push_back(pair.new_hash);
+            }
+            delta.modified.clear();
+            std::sort(delta.added.begin(), delta.added.end());
+            std::sort(delta.removed.begin(), delta.removed.end());
+            pair_modified(delta);
+        }
+        return delta;
+    } catch (const std::exception& e) {
+        std::cerr << "Error loading version delta: " << e.what() << std::endl;
+        return std::nullopt;
+    }
+}
+
+bool VersionDiff::store_delta(const VersionDelta& delta) {
+    try {
+        ClientLease lease = connection_.acquire();
+        mongocxx::collection deltas = lease.collection("version_deltas");
+        VersionDeltaDocuments::write(deltas, nullptr, delta, options_.identity_field);
+        return true;
+    } catch (const std::exception& e) {
+        std::cerr << "Error storing version delta: " << e.what() << std::endl;
+        return false;
+    }
+}
+
+}
+}
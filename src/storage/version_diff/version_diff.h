@@ -0,0 +1,76 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include "storage/cas/cas.h"
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/situation_repository/situation_repository.h"
+#include "storage/version_diff/version_delta.h"
+#include <bsoncxx/document/view.hpp>
+#include <cstddef>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+struct VersionDiffOptions {
+    // Attribute naming a feature across versions; a removed and an added
+    // object sharing a value that is unique on both sides are reported as
+    // modified. Empty disables pairing.
+    std::string identity_field = "id";
+    // Write computed deltas to version_deltas for later diffs.
+    bool store = true;
+};
+
+// Diffs versions by a merge over their sorted refs, or through their Merkle
+// trees when both have one, and caches the result in version_deltas,
+// looked up through delta_lookup_idx. A cached delta in the opposite
+// direction is served inverted. Deltas larger than one document are split
+// into parts sharing from_version_id and to_version_id.
+class VersionDiff {
+public:
+    VersionDiff(MongoDBConnection& connection, SituationRepository& repository, CAS& cas,
+                const VersionDiffOptions& options = VersionDiffOptions());
+
+    bool diff(const std::string& from_version_id, const std::string& to_version_id, VersionDelta& delta);
+    // Same refs in both versions; compares Merkle roots where both have one.
+    bool identical(const std::string& from_version_id, const std::string& to_version_id, bool& same);
+
+    std::optional<VersionDelta> load_delta(const std::string& from_version_id, const std::string& to_version_id);
+    bool store_delta(const VersionDelta& delta);
+
+    // Both inputs sorted and free of duplicates; appends to added/removed.
+    static void diff_sorted(
+        const HashId* from, size_t from_count,
+        const HashId* to, size_t to_count,
+        std::vector<HashId>& added,
+        std::vector<HashId>& removed
+    );
+    // Moves pairs sharing an identity from added/removed to modified.
+    void pair_modified(VersionDelta& delta);
+    // Canonical hash of the identity attribute of a bpo_cas document.
+    static bool identity_key(const bsoncxx::document::view& doc, const std::string& field, HashId& key);
+
+    const VersionDiffOptions& get_options() const;
+
+    static constexpr size_t kEntriesPerPart = VersionDeltaDocuments::kEntriesPerPart;
+
+private:
+    MongoDBConnection& connection_;
+    SituationRepository& repository_;
+    CAS& cas_;
+    VersionDiffOptions options_;
+
+    bool merkle_roots(
+        const std::string& from_version_id,
+        const std::string& to_version_id,
+        HashId& from_root,
+        HashId& to_root
+    );
+    bool identities(const std::vector<HashId>& hashes, std::vector<std::pair<HashId, HashId>>& keyed);
+};
+
+}
+}
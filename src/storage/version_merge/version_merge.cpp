@@ -0,0 +1,608 @@
+#include "version_merge.h"
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <future>
+#include <iostream>
+#include <iterator>
+#include <queue>
+#include <thread>
+#include <tuple>
+#include <unordered_set>
+
+namespace geoversion {
+namespace storage {
+
+namespace {
+
+// A base object one side removed, or replaced with another.
+struct Touch {
+    HashId base_hash;
+    HashId replacement;
+};
+
+std::vector<Touch> touches(const VersionDelta& delta) {
+    std::vector<Touch> result;
+    result.reserve(delta.removed.size() + delta.modified.size());
+    for (const auto& hash : delta.removed) {
+        result.push_back(Touch{hash, HashId()});
+    }
+    for (const auto& pair : delta.modified) {
+        result.push_back(Touch{pair.old_hash, pair.new_hash});
+    }
+    std::sort(result.begin(), result.end(), [](const Touch& a, const Touch& b) {
+        return a.base_hash < b.base_hash;
+    });
+    return result;
+}
+
+int64_t cell_of(double value, double cell_size) {
+    return static_cast<int64_t>(std::floor(value / cell_size));
+}
+
+}
+
+VersionMerge::VersionMerge(
+    MongoDBConnection& connection,
+    SituationRepository& repository,
+    VersionDiff& differ,
+    CAS& cas,
+    const VersionMergeOptions& options
+) : connection_(connection), repository_(repository), differ_(differ), cas_(cas), options_(options) {
+    if (!(options_.cell_size > 0.0)) {
+        options_.cell_size = VersionMergeOptions().cell_size;
+    }
+}
+
+bool VersionMerge::load_ancestry(const std::string& version_id) {
+    auto version = repository_.get_version(version_id);
+    if (!version) {
+        return false;
+    }
+    for (auto& entry : repository_.list_history(version->situation_id)) {
+        auto inserted = ancestry_.emplace(entry.version_id, Ancestry());
+        if (inserted.second) {
+            inserted.first->second.parents = std::move(entry.parent_version_ids);
+            inserted.first->second.created_at = entry.created_at;
+        }
+    }
+    return ancestry_.count(version_id) > 0;
+}
+
+// One more than the highest generation among the parents; roots are 1.
+bool VersionMerge::generation(const std::string& version_id, uint64_t& result) {
+    std::vector<std::string> stack{version_id};
+    while (!stack.empty()) {
+        std::string id = stack.back();
+        auto found = ancestry_.find(id);
+        if (found == ancestry_.end()) {
+            if (!load_ancestry(id)) {
+                std::cerr << "Error reading ancestry: unknown version " << id << std::endl;
+                return false;
+            }
+            found = ancestry_.find(id);
+        }
+        if (found->second.generation > 0) {
+            stack.pop_back();
+            continue;
+        }
+        uint64_t highest = 0;
+        bool ready = true;
+        for (const auto& parent : found->second.parents) {
+            auto parent_entry = ancestry_.find(parent);
+            if (parent_entry == ancestry_.end() || parent_entry->second.generation == 0) {
+                stack.push_back(parent);
+                ready = false;
+                continue;
+            }
+            highest = std::max(highest, parent_entry->second.generation);
+        }
+        if (ready) {
+            found->second.generation = highest + 1;
+            stack.pop_back();
+        }
+    }
+    result = ancestry_.at(version_id).generation;
+    return true;
+}
+
+std::optional<std::string> VersionMerge::merge_base(
+    const std::string& ours_version_id,
+    const std::string& theirs_version_id
+) {
+    std::lock_guard<std::mutex> lock(ancestry_mutex_);
+    if (ours_version_id == theirs_version_id) {
+        return ours_version_id;
+    }
+
+    // Versions leave the queue in descending generation, so each is
+    // reached from all its descendants in the walk before it is popped, and
+    // the first one reached from both sides is a best common ancestor.
+    using Item = std::tuple<uint64_t, std::chrono::system_clock::time_point, std::string>;
+    std::priority_queue<Item> queue;
+    std::unordered_map<std::string, uint8_t> reached;
+    auto reach = [&](const std::string& id, uint8_t sides) {
+        uint8_t& flags = reached[id];
+        if ((flags | sides) == flags) {
+            return true;
+        }
+        bool queued = flags != 0;
+        flags |= sides;
+        if (queued) {
+            return true;
+        }
+        uint64_t level = 0;
+        if (!generation(id, level)) {
+            return false;
+        }
+        queue.emplace(level, ancestry_.at(id).created_at, id);
+        return true;
+    };
+    if (!reach(ours_version_id, 1) || !reach(theirs_version_id, 2)) {
+        return std::nullopt;
+    }
+
+    std::unordered_set<std::string> done;
+    while (!queue.empty()) {
+        std::string id = std::get<2>(queue.top());
+        queue.pop();
+        if (!done.insert(id).second) {
+            continue;
+        }
+        uint8_t sides = reached[id];
+        if (sides == 3) {
+            return id;
+        }
+        std::vector<std::string> parents = ancestry_.at(id).parents;
+        for (const auto& parent : parents) {
+            if (!reach(parent, sides)) {
+                return std::nullopt;
+            }
+        }
+    }
+    return std::nullopt;
+}
+
+bool VersionMerge::lookup_objects(
+    const std::vector<HashId>& hashes,
+    std::unordered_map<HashId, ObjectInfo>& objects
+) {
+    const std::string& field = differ_.get_options().identity_field;
+    objects.reserve(objects.size() + hashes.size());
+    size_t found = cas_.for_each_of(hashes, [&](const bsoncxx::document::view& doc) {
+        HashId hash;
+        if (!doc["hash"] || !HashId::from_bson(doc["hash"].get_value(), hash)) {
+            return true;
+        }
+        ObjectInfo& info = objects[hash];
+        GeometryExtent extent;
+        if (GeometryExtent::from_document(doc, extent)) {
+            info.envelope = extent.envelope;
+        } else if (doc["geometry"] && doc["geometry"].type() == bsoncxx::type::k_document) {
+            Envelope::from_geometry(doc["geometry"].get_document().value, info.envelope);
+        }
+        info.has_identity = VersionDiff::identity_key(doc, field, info.identity);
+        return true;
+    });
+    return found == hashes.size();
+}
+
+MergeResult VersionMerge::merge(const std::string& ours_version_id, const std::string& theirs_version_id) {
+    MergeResult result;
+    result.ours_version_id = ours_version_id;
+    result.theirs_version_id = theirs_version_id;
+
+    auto ours_version = repository_.get_version(ours_version_id);
+    if (!ours_version || !repository_.get_version(theirs_version_id)) {
+        result.error = "unknown version";
+        return result;
+    }
+    result.situation_id = ours_version->situation_id;
+    auto base = merge_base(ours_version_id, theirs_version_id);
+    if (!base) {
+        result.error = "versions have no common ancestor";
+        return result;
+    }
+    result.base_version_id = *base;
+
+    VersionDelta ours;
+    VersionDelta theirs;
+    auto side_delta = [&](const std::string& version_id, VersionDelta& delta) {
+        return version_id == *base || differ_.diff(*base, version_id, delta);
+    };
+    bool read = false;
+    if (connection_.is_pooled()) {
+        auto ours_read = std::async(std::launch::async, [&]() {
+            return side_delta(ours_version_id, ours);
+        });
+        bool theirs_read = side_delta(theirs_version_id, theirs);
+        read = ours_read.get() && theirs_read;
+    } else {
+        read = side_delta(ours_version_id, ours) && side_delta(theirs_version_id, theirs);
+    }
+    SituationRepository::RefsHandle base_refs = read ? repository_.checkout(*base) : nullptr;
+    if (!base_refs) {
+        result.error = "failed to read the versions";
+        return result;
+    }
+
+    std::vector<HashId> drop;
+    std::vector<HashId> add;
+    auto take = [&](const Touch& touch) {
+        drop.push_back(touch.base_hash);
+        if (touch.replacement.is_null()) {
+            ++result.removed;
+        } else {
+            add.push_back(touch.replacement);
+            ++result.modified;
+        }
+    };
+
+    // Base objects changed on either side.
+    std::vector<Touch> ours_touches = touches(ours);
+    std::vector<Touch> theirs_touches = touches(theirs);
+    size_t i = 0;
+    size_t j = 0;
+    while (i < ours_touches.size() || j < theirs_touches.size()) {
+        if (j == theirs_touches.size() ||
+            (i < ours_touches.size() && ours_touches[i].base_hash < theirs_touches[j].base_hash)) {
+            take(ours_touches[i++]);
+            continue;
+        }
+        if (i == ours_touches.size() || theirs_touches[j].base_hash < ours_touches[i].base_hash) {
+            take(theirs_touches[j++]);
+            continue;
+        }
+        const Touch& a = ours_touches[i++];
+        const Touch& b = theirs_touches[j++];
+        if (a.replacement == b.replacement) {
+            take(a);
+            continue;
+        }
+        MergeConflict conflict;
+        conflict.kind = a.replacement.is_null() ? MergeConflictKind::DeleteModify :
+            b.replacement.is_null() ? MergeConflictKind::ModifyDelete : MergeConflictKind::ModifyModify;
+        conflict.base_hash = a.base_hash;
+        conflict.ours_hash = a.replacement;
+        conflict.theirs_hash = b.replacement;
+        result.conflicts.push_back(conflict);
+        if (options_.resolution == ConflictResolution::Ours) {
+            take(a);
+        } else if (options_.resolution == ConflictResolution::Theirs) {
+            take(b);
+        }
+    }
+
+    // Objects added on one side only; the same object added on both is
+    // one clean add.
+    std::vector<HashId> ours_only;
+    std::vector<HashId> theirs_only;
+    std::vector<HashId> both;
+    std::set_difference(ours.added.begin(), ours.added.end(), theirs.added.begin(), theirs.added.end(),
+                        std::back_inserter(ours_only));
+    std::set_difference(theirs.added.begin(), theirs.added.end(), ours.added.begin(), ours.added.end(),
+                        std::back_inserter(theirs_only));
+    std::set_intersection(ours.added.begin(), ours.added.end(), theirs.added.begin(), theirs.added.end(),
+                          std::back_inserter(both));
+
+    std::vector<HashId> wanted;
+    bool pair_adds = !differ_.get_options().identity_field.empty() && !ours_only.empty() && !theirs_only.empty();
+    if (pair_adds || options_.spatial) {
+        wanted.insert(wanted.end(), ours_only.begin(), ours_only.end());
+        wanted.insert(wanted.end(), theirs_only.begin(), theirs_only.end());
+    }
+    if (options_.spatial) {
+        for (const auto* side : {&ours_touches, &theirs_touches}) {
+            for (const auto& touch : *side) {
+                wanted.push_back(touch.base_hash);
+                if (!touch.replacement.is_null()) {
+                    wanted.push_back(touch.replacement);
+                }
+            }
+        }
+    }
+    std::sort(wanted.begin(), wanted.end());
+    wanted.erase(std::unique(wanted.begin(), wanted.end()), wanted.end());
+    std::unordered_map<HashId, ObjectInfo> objects;
+    if (!wanted.empty() && !lookup_objects(wanted, objects)) {
+        std::cerr << "Error merging versions: some changed objects are missing from the CAS" << std::endl;
+    }
+
+    std::unordered_set<HashId> rejected;
+    if (pair_adds) {
+        auto keyed = [&objects](const std::vector<HashId>& hashes) {
+            std::vector<std::pair<HashId, HashId>> result;
+            for (const auto& hash : hashes) {
+                auto found = objects.find(hash);
+                if (found != objects.end() && found->second.has_identity) {
+                    result.emplace_back(found->second.identity, hash);
+                }
+            }
+            std::sort(result.begin(), result.end());
+            return result;
+        };
+        auto ours_keys = keyed(ours_only);
+        auto theirs_keys = keyed(theirs_only);
+        size_t a = 0;
+        size_t b = 0;
+        while (a < ours_keys.size() && b < theirs_keys.size()) {
+            if (ours_keys[a].first < theirs_keys[b].first) {
+                ++a;
+                continue;
+            }
+            if (theirs_keys[b].first < ours_keys[a].first) {
+                ++b;
+                continue;
+            }
+            const HashId& identity = ours_keys[a].first;
+            size_t a_end = a;
+            while (a_end < ours_keys.size() && ours_keys[a_end].first == identity) {
+                ++a_end;
+            }
+            size_t b_end = b;
+            while (b_end < theirs_keys.size() && theirs_keys[b_end].first == identity) {
+                ++b_end;
+            }
+            for (size_t x = a; x < a_end; ++x) {
+                for (size_t y = b; y < b_end; ++y) {
+                    MergeConflict conflict;
+                    conflict.kind = MergeConflictKind::AddAdd;
+                    conflict.ours_hash = ours_keys[x].second;
+                    conflict.theirs_hash = theirs_keys[y].second;
+                    result.conflicts.push_back(conflict);
+                }
+            }
+            // The losing side's adds stay out of the merge.
+            if (options_.resolution != ConflictResolution::Theirs) {
+                for (size_t y = b; y < b_end; ++y) {
+                    rejected.insert(theirs_keys[y].second);
+                }
+            }
+            if (options_.resolution != ConflictResolution::Ours) {
+                for (size_t x = a; x < a_end; ++x) {
+                    rejected.insert(ours_keys[x].second);
+                }
+            }
+            a = a_end;
+            b = b_end;
+        }
+    }
+    for (const auto* side : {&ours_only, &theirs_only, &both}) {
+        for (const auto& hash : *side) {
+            if (rejected.count(hash) == 0) {
+                add.push_back(hash);
+                ++result.added;
+            }
+        }
+    }
+
+    if (options_.spatial) {
+        auto envelope_of = [&objects](const HashId& hash) {
+            auto found = objects.find(hash);
+            return found == objects.end() ? Envelope() : found->second.envelope;
+        };
+        auto changes = [&](const std::vector<Touch>& side_touches, const std::vector<HashId>& side_adds) {
+            std::vector<Change> result;
+            result.reserve(side_touches.size() + side_adds.size());
+            for (const auto& touch : side_touches) {
+                Change change{touch.replacement, touch.base_hash, envelope_of(touch.base_hash)};
+                if (!touch.replacement.is_null()) {
+                    change.envelope.expand(envelope_of(touch.replacement));
+                }
+                result.push_back(change);
+            }
+            for (const auto& hash : side_adds) {
+                result.push_back(Change{hash, HashId(), envelope_of(hash)});
+            }
+            return result;
+        };
+        spatial_conflicts(changes(ours_touches, ours_only), changes(theirs_touches, theirs_only),
+                          result.conflicts, result.spatial_cells);
+    }
+
+    result.ok = true;
+    result.clean = result.conflicts.empty() || options_.resolution != ConflictResolution::Fail;
+    if (!result.clean) {
+        return result;
+    }
+    std::sort(drop.begin(), drop.end());
+    std::sort(add.begin(), add.end());
+    std::vector<HashId> kept;
+    kept.reserve(base_refs->size());
+    std::set_difference(base_refs->begin(), base_refs->end(), drop.begin(), drop.end(), std::back_inserter(kept));
+    result.refs.reserve(kept.size() + add.size());
+    std::set_union(kept.begin(), kept.end(), add.begin(), add.end(), std::back_inserter(result.refs));
+    return result;
+}
+
+void VersionMerge::spatial_conflicts(
+    const std::vector<Change>& ours,
+    const std::vector<Change>& theirs,
+    std::vector<MergeConflict>& conflicts,
+    size_t& cells
+) {
+    const double cell_size = options_.cell_size;
+
+    // One entry per cell an envelope covers; envelopes spanning too many
+    // cells are checked against everything instead.
+    struct Entry {
+        int64_t x;
+        int64_t y;
+        uint32_t index;
+        bool theirs;
+    };
+    std::vector<Entry> entries;
+    std::vector<uint32_t> large[2];
+    const std::vector<Change>* sides[2] = {&ours, &theirs};
+    for (int side = 0; side < 2; ++side) {
+        const auto& changes = *sides[side];
+        for (uint32_t k = 0; k < changes.size(); ++k) {
+            const Envelope& box = changes[k].envelope;
+            if (box.is_empty()) {
+                continue;
+            }
+            int64_t x0 = cell_of(box.min_x, cell_size);
+            int64_t x1 = cell_of(box.max_x, cell_size);
+            int64_t y0 = cell_of(box.min_y, cell_size);
+            int64_t y1 = cell_of(box.max_y, cell_size);
+            if (static_cast<uint64_t>(x1 - x0 + 1) * static_cast<uint64_t>(y1 - y0 + 1) > kMaxCellsPerObject) {
+                large[side].push_back(k);
+                continue;
+            }
+            for (int64_t x = x0; x <= x1; ++x) {
+                for (int64_t y = y0; y <= y1; ++y) {
+                    entries.push_back(Entry{x, y, k, side == 1});
+                }
+            }
+        }
+    }
+    std::sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) {
+        return std::tie(a.x, a.y, a.theirs) < std::tie(b.x, b.y, b.theirs);
+    });
+
+    // Cells holding changes from both sides.
+    std::vector<std::pair<size_t, size_t>> runs;
+    for (size_t begin = 0; begin < entries.size();) {
+        size_t end = begin;
+        while (end < entries.size() && entries[end].x == entries[begin].x && entries[end].y == entries[begin].y) {
+            ++end;
+        }
+        if (!entries[begin].theirs && entries[end - 1].theirs) {
+            runs.emplace_back(begin, end);
+        }
+        begin = end;
+    }
+    cells = runs.size();
+
+    // Same base object: a hash-level conflict or the same change.
+    auto related = [](const Change& a, const Change& b) {
+        return (!a.base_hash.is_null() && a.base_hash == b.base_hash) || (!a.hash.is_null() && a.hash == b.hash);
+    };
+    using Pair = std::pair<uint32_t, uint32_t>;
+
+    auto sweep_cell = [&](size_t begin, size_t end, std::vector<Pair>& found) {
+        int64_t cell_x = entries[begin].x;
+        int64_t cell_y = entries[begin].y;
+        std::vector<uint32_t> items[2];
+        for (size_t e = begin; e < end; ++e) {
+            items[entries[e].theirs ? 1 : 0].push_back(entries[e].index);
+        }
+        for (int side = 0; side < 2; ++side) {
+            const auto& changes = *sides[side];
+            std::sort(items[side].begin(), items[side].end(), [&changes](uint32_t a, uint32_t b) {
+                return changes[a].envelope.min_x < changes[b].envelope.min_x;
+            });
+        }
+
+        // Sweep along x; each side keeps the envelopes the line still crosses.
+        std::vector<uint32_t> active[2];
+        size_t next[2] = {0, 0};
+        while (next[0] < items[0].size() || next[1] < items[1].size()) {
+            int side = 0;
+            if (next[0] == items[0].size() ||
+                (next[1] < items[1].size() &&
+                 theirs[items[1][next[1]]].envelope.min_x < ours[items[0][next[0]]].envelope.min_x)) {
+                side = 1;
+            }
+            uint32_t index = items[side][next[side]++];
+            const Change& change = (*sides[side])[index];
+            auto& others = active[1 - side];
+            const auto& other_changes = *sides[1 - side];
+            for (size_t k = 0; k < others.size();) {
+                const Change& other = other_changes[others[k]];
+                if (other.envelope.max_x < change.envelope.min_x) {
+                    others[k] = others.back();
+                    others.pop_back();
+                    continue;
+                }
+                if (change.envelope.intersects(other.envelope) && !related(change, other)) {
+                    double corner_x = std::max(change.envelope.min_x, other.envelope.min_x);
+                    double corner_y = std::max(change.envelope.min_y, other.envelope.min_y);
+                    if (cell_of(corner_x, cell_size) == cell_x && cell_of(corner_y, cell_size) == cell_y) {
+                        found.emplace_back(side == 0 ? index : others[k], side == 0 ? others[k] : index);
+                    }
+                }
+                ++k;
+            }
+            active[side].push_back(index);
+        }
+    };
+
+    std::vector<Pair> pairs;
+    size_t worker_count = options_.threads > 0 ? options_.threads : std::max<unsigned>(1, std::thread::hardware_concurrency());
+    worker_count = std::min(worker_count, runs.size());
+    if (worker_count < 2) {
+        for (const auto& run : runs) {
+            sweep_cell(run.first, run.second, pairs);
+        }
+    } else {
+        std::atomic<size_t> next_run{0};
+        std::vector<std::vector<Pair>> found(worker_count);
+        std::vector<std::thread> workers;
+        workers.reserve(worker_count);
+        for (size_t w = 0; w < worker_count; ++w) {
+            workers.emplace_back([&, w]() {
+                for (size_t run = next_run++; run < runs.size(); run = next_run++) {
+                    sweep_cell(runs[run].first, runs[run].second, found[w]);
+                }
+            });
+        }
+        for (auto& worker : workers) {
+            worker.join();
+        }
+        for (const auto& local : found) {
+            pairs.insert(pairs.end(), local.begin(), local.end());
+        }
+    }
+
+    // Large envelopes against everything on the other side, each pair once.
+    for (uint32_t a : large[0]) {
+        for (uint32_t b = 0; b < theirs.size(); ++b) {
+            if (ours[a].envelope.intersects(theirs[b].envelope) && !related(ours[a], theirs[b])) {
+                pairs.emplace_back(a, b);
+            }
+        }
+    }
+    std::sort(large[0].begin(), large[0].end());
+    for (uint32_t b : large[1]) {
+        for (uint32_t a = 0; a < ours.size(); ++a) {
+            if (!std::binary_search(large[0].begin(), large[0].end(), a) &&
+                ours[a].envelope.intersects(theirs[b].envelope) && !related(ours[a], theirs[b])) {
+                pairs.emplace_back(a, b);
+            }
+        }
+    }
+
+    std::sort(pairs.begin(), pairs.end());
+    for (const auto& pair : pairs) {
+        const Change& a = ours[pair.first];
+        const Change& b = theirs[pair.second];
+        MergeConflict conflict;
+        conflict.kind = MergeConflictKind::Spatial;
+        conflict.ours_hash = a.hash.is_null() ? a.base_hash : a.hash;
+        conflict.theirs_hash = b.hash.is_null() ? b.base_hash : b.hash;
+        conflicts.push_back(conflict);
+    }
+}
+
+CommitResult VersionMerge::commit(const MergeResult& merge, const std::string& commit_message, const std::string& author) {
+    CommitResult result;
+    if (!merge.ok) {
+        result.error = merge.error;
+        return result;
+    }
+    if (!merge.clean) {
+        result.error = "merge has unresolved conflicts";
+        return result;
+    }
+    VersionCommit commit;
+    commit.situation_id = merge.situation_id;
+    commit.parent_version_ids = {merge.ours_version_id, merge.theirs_version_id};
+    commit.commit_message = commit_message;
+    commit.author = author;
+    commit.refs = merge.refs;
+    return repository_.commit_version(std::move(commit));
+}
+
+}
+}
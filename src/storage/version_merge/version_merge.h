@@ -0,0 +1,145 @@
+#pragma once
+
+#include "storage/hash_id/hash_id.h"
+#include "storage/cas/cas.h"
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/situation_repository/situation_repository.h"
+#include "storage/spatial_index/envelope.h"
+#include "storage/version_diff/version_diff.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace geoversion {
+namespace storage {
+
+enum class MergeConflictKind {
+    // Both sides changed the same base object differently.
+    ModifyModify,
+    // One side changed a base object the other removed; ours first.
+    ModifyDelete,
+    DeleteModify,
+    // Both sides added different objects with the same identity.
+    AddAdd,
+    // Different changes on the two sides whose envelopes overlap.
+    Spatial
+};
+
+// Null where a side has nothing: the base of an add, the side that removed.
+// A spatial conflict names the two changed objects, the removed one for a
+// removal, and no base.
+struct MergeConflict {
+    MergeConflictKind kind = MergeConflictKind::ModifyModify;
+    HashId base_hash;
+    HashId ours_hash;
+    HashId theirs_hash;
+};
+
+enum class ConflictResolution {
+    // Conflicts leave the merge uncommittable.
+    Fail,
+    Ours,
+    Theirs
+};
+
+struct VersionMergeOptions {
+    // Spatial conflicts never pick a side: both changes are kept.
+    ConflictResolution resolution = ConflictResolution::Fail;
+    // Also report changes on the two sides whose envelopes overlap.
+    bool spatial = false;
+    // Side of the grid cells, in degrees, that spatial checks run in.
+    double cell_size = 0.01;
+    // Workers for spatial checks; 0 uses every core.
+    size_t threads = 0;
+};
+
+struct MergeResult {
+    bool ok = false;
+    // No conflicts left once the resolution is applied.
+    bool clean = false;
+    std::string situation_id;
+    std::string base_version_id;
+    std::string ours_version_id;
+    std::string theirs_version_id;
+    // Sorted refs of the merged version; empty unless clean.
+    std::vector<HashId> refs;
+    size_t added = 0;
+    size_t removed = 0;
+    size_t modified = 0;
+    std::vector<MergeConflict> conflicts;
+    size_t spatial_cells = 0;
+    std::string error;
+};
+
+// Three-way merge of two versions against their merge base. Changes are
+// read as deltas from the base through VersionDiff, so modified objects
+// are the ones it pairs by identity, and compared per base object.
+// Spatial checks bucket the changed envelopes of each side into grid
+// cells and sweep the cells on several threads; a pair is reported only
+// from the cell holding the lower corner of its overlap.
+class VersionMerge {
+public:
+    VersionMerge(MongoDBConnection& connection, SituationRepository& repository, VersionDiff& differ, CAS& cas,
+                 const VersionMergeOptions& options = VersionMergeOptions());
+
+    VersionMerge(const VersionMerge&) = delete;
+    VersionMerge& operator=(const VersionMerge&) = delete;
+
+    // The common ancestor with the highest generation, the newest on a tie.
+    std::optional<std::string> merge_base(const std::string& ours_version_id, const std::string& theirs_version_id);
+
+    MergeResult merge(const std::string& ours_version_id, const std::string& theirs_version_id);
+    // Commits a clean merge with both versions as parents.
+    CommitResult commit(const MergeResult& merge, const std::string& commit_message, const std::string& author);
+
+    static constexpr size_t kMaxCellsPerObject = 1024;
+
+private:
+    struct Ancestry {
+        std::vector<std::string> parents;
+        uint64_t generation = 0;
+        std::chrono::system_clock::time_point created_at;
+    };
+
+    // A change of one side: the object it brings in, null for a removal,
+    // and the base object it replaces or removes, null for an add.
+    struct Change {
+        HashId hash;
+        HashId base_hash;
+        Envelope envelope;
+    };
+
+    struct ObjectInfo {
+        Envelope envelope;
+        HashId identity;
+        bool has_identity = false;
+    };
+
+    MongoDBConnection& connection_;
+    SituationRepository& repository_;
+    VersionDiff& differ_;
+    CAS& cas_;
+    VersionMergeOptions options_;
+
+    std::mutex ancestry_mutex_;
+    // Loaded a situation at a time; generations are filled on first use.
+    std::unordered_map<std::string, Ancestry> ancestry_;
+
+    bool load_ancestry(const std::string& version_id);
+    bool generation(const std::string& version_id, uint64_t& result);
+    bool lookup_objects(const std::vector<HashId>& hashes, std::unordered_map<HashId, ObjectInfo>& objects);
+    void spatial_conflicts(
+        const std::vector<Change>& ours,
+        const std::vector<Change>& theirs,
+        std::vector<MergeConflict>& conflicts,
+        size_t& cells
+    );
+};
+
+}
+}
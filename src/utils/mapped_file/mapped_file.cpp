@@ -0,0 +1,96 @@
+#include "mapped_file.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace geoversion {
+namespace utils {
+
+MappedFile::MappedFile() : data_(nullptr), size_(0), released_(0), fd_(-1) {
+}
+
+MappedFile::~MappedFile() {
+    close();
+}
+
+bool MappedFile::open(const std::string& path) {
+    close();
+
+    fd_ = ::open(path.c_str(), O_RDONLY);
+    if (fd_ < 0) {
+        error_ = "cannot open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) {
+        error_ = "cannot stat " + path + ": " + std::strerror(errno);
+        close();
+        return false;
+    }
+
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ == 0) {
+        return true;
+    }
+
+    void* mapped = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd_, 0);
+    if (mapped == MAP_FAILED) {
+        error_ = "cannot map " + path + ": " + std::strerror(errno);
+        size_ = 0;
+        close();
+        return false;
+    }
+    ::madvise(mapped, size_, MADV_SEQUENTIAL);
+    data_ = static_cast<const char*>(mapped);
+    return true;
+}
+
+void MappedFile::close() {
+    if (data_) {
+        ::munmap(const_cast<char*>(data_), size_);
+        data_ = nullptr;
+    }
+    if (fd_ >= 0) {
+        ::close(fd_);
+        fd_ = -1;
+    }
+    size_ = 0;
+    released_ = 0;
+}
+
+bool MappedFile::is_open() const {
+    return fd_ >= 0;
+}
+
+const char* MappedFile::data() const {
+    return data_;
+}
+
+size_t MappedFile::size() const {
+    return size_;
+}
+
+const std::string& MappedFile::error() const {
+    return error_;
+}
+
+void MappedFile::release_before(size_t offset) {
+    if (!data_) {
+        return;
+    }
+    size_t page = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    size_t end = std::min(offset, size_) / page * page;
+    if (end <= released_) {
+        return;
+    }
+    ::madvise(const_cast<char*>(data_) + released_, end - released_, MADV_DONTNEED);
+    released_ = end;
+}
+
+}
+}
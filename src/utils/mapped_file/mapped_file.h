@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+#include <string>
+
+namespace geoversion {
+namespace utils {
+
+// Read-only memory mapping of a whole file. Pages already consumed by a
+// sequential reader can be handed back with release_before(), so resident
+// memory stays bounded while walking files far larger than RAM.
+class MappedFile {
+public:
+    MappedFile();
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    bool open(const std::string& path);
+    void close();
+
+    bool is_open() const;
+    const char* data() const;
+    size_t size() const;
+    const std::string& error() const;
+
+    void release_before(size_t offset);
+
+private:
+    const char* data_;
+    size_t size_;
+    size_t released_;
+    int fd_;
+    std::string error_;
+};
+
+}
+}
@@ -10,6 +10,7 @@
 #include "storage/mongodb_connection/mongodb_connection.h"
 #include "storage/cas/cas.h"
 #include "storage/bpo_storage/bpo_storage.h"
+#include "storage/migration/migration.h"
 
 using namespace geoversion;
 using namespace geoversion::storage;
@@ -43,7 +44,7 @@ static BPO make_point_bpo(double lon, double lat, const std::string& cls) {
     bsoncxx::document::value geom_value = geom_builder.extract();
     bsoncxx::document::value attr_value = attr_builder.extract();
 
-    BPO bpo("", geom_value.view(), attr_value.view());
+    BPO bpo(HashId(), geom_value.view(), attr_value.view());
     return bpo;
 }
 
@@ -62,10 +63,10 @@ void test_cas_hash_computation() {
 
     BPO bpo = make_point_bpo(30.0, 60.0, "test_class");
 
-    std::string h1 = cas.compute_hash(bpo);
-    std::string h2 = cas.compute_hash(bpo);
+    HashId h1 = cas.compute_hash(bpo);
+    HashId h2 = cas.compute_hash(bpo);
 
-    assert_true(!h1.empty(), "CAS hash is empty");
+    assert_true(!h1.is_null(), "CAS hash is empty");
     assert_true(h1 == h2, "CAS hash is not deterministic");
 }
 
@@ -80,7 +81,7 @@ void test_cas_store_retrieve() {
 
     BPO bpo = make_point_bpo(30.0, 60.0, "store_retrieve");
 
-    std::string hash = cas.compute_hash(bpo);
+    HashId hash = cas.compute_hash(bpo);
     bpo.set_hash(hash);
 
     bool stored = cas.store(bpo);
@@ -105,8 +106,8 @@ void test_cas_deduplication() {
     BPO bpo1 = make_point_bpo(10.0, 20.0, "dedup");
     BPO bpo2 = make_point_bpo(10.0, 20.0, "dedup");
 
-    std::string h1 = cas.compute_hash(bpo1);
-    std::string h2 = cas.compute_hash(bpo2);
+    HashId h1 = cas.compute_hash(bpo1);
+    HashId h2 = cas.compute_hash(bpo2);
 
     bpo1.set_hash(h1);
     bpo2.set_hash(h2);
@@ -120,7 +121,225 @@ void test_cas_deduplication() {
     size_t c = cas.count();
     assert_true(c == 1, "CAS deduplication failed, count != 1");
 
-    std::vector<std::string> hashes = cas.get_all_hashes();
+    std::vector<HashId> hashes = cas.get_all_hashes();
     assert_true(hashes.size() == 1, "CAS deduplication failed, hashes size != 1");
 }
 
+
+void test_cas_store_many() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    BPO existing = make_point_bpo(1.0, 1.0, "store_many");
+    assert_true(cas.store(existing), "CAS store before store_many failed");
+
+    std::vector<BPO> batch;
+    batch.push_back(make_point_bpo(1.0, 1.0, "store_many"));
+    batch.push_back(make_point_bpo(2.0, 2.0, "store_many"));
+    batch.push_back(make_point_bpo(3.0, 3.0, "store_many"));
+    batch.push_back(make_point_bpo(2.0, 2.0, "store_many"));
+
+    StoreManyResult result = cas.store_many(batch);
+
+    assert_true(result.hashes.size() == 4, "CAS store_many hash count mismatch");
+    assert_true(result.statuses[0] == StoreStatus::Duplicate, "CAS store_many did not detect stored object");
+    assert_true(result.statuses[1] == StoreStatus::Inserted, "CAS store_many did not insert new object");
+    assert_true(result.statuses[2] == StoreStatus::Inserted, "CAS store_many did not insert new object");
+    assert_true(result.statuses[3] == StoreStatus::Duplicate, "CAS store_many did not dedup within batch");
+    assert_true(result.stats.inserted == 2, "CAS store_many inserted count mismatch");
+    assert_true(result.stats.duplicates == 2, "CAS store_many duplicate count mismatch");
+    assert_true(cas.count() == 3, "CAS store_many count != 3");
+
+    size_t produced = 0;
+    StoreManyStats stats = cas.store_stream([&](BPO& out) {
+        if (produced == 5) {
+            return false;
+        }
+        out = make_point_bpo(10.0 + static_cast<double>(produced), 10.0, "store_stream");
+        ++produced;
+        return true;
+    }, 2);
+
+    assert_true(stats.total == 5, "CAS store_stream total mismatch");
+    assert_true(stats.inserted == 5, "CAS store_stream inserted count mismatch");
+    assert_true(cas.count() == 8, "CAS store_stream count != 8");
+}
+
+void test_cas_retrieve_many() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    std::vector<BPO> batch;
+    batch.push_back(make_point_bpo(5.0, 5.0, "retrieve_many"));
+    batch.push_back(make_point_bpo(6.0, 6.0, "retrieve_many"));
+    StoreManyResult stored = cas.store_many(batch);
+
+    std::vector<HashId> query = {
+        stored.hashes[1],
+        HashId(),
+        stored.hashes[0],
+        stored.hashes[1]
+    };
+
+    std::vector<bool> present = cas.exists_many(query);
+    assert_true(present.size() == 4, "CAS exists_many size mismatch");
+    assert_true(present[0] && !present[1] && present[2] && present[3], "CAS exists_many result mismatch");
+
+    auto loaded = cas.retrieve_many(query);
+    assert_true(loaded.size() == 4, "CAS retrieve_many size mismatch");
+    assert_true(loaded[0] && loaded[0]->get_hash() == stored.hashes[1], "CAS retrieve_many order mismatch");
+    assert_true(!loaded[1], "CAS retrieve_many returned missing object");
+    assert_true(loaded[2] && loaded[2]->get_hash() == stored.hashes[0], "CAS retrieve_many order mismatch");
+    assert_true(loaded[3] && loaded[3]->get_hash() == stored.hashes[1], "CAS retrieve_many duplicate slot empty");
+}
+
+void test_cas_canonical_hash() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    CAS cas(conn.get_bpo_cas_collection());
+
+    bsoncxx::builder::basic::array coords;
+    coords.append(30.0);
+    coords.append(60.0);
+    bsoncxx::builder::basic::document geom_builder;
+    geom_builder.append(bsoncxx::builder::basic::kvp("type", "Point"));
+    geom_builder.append(bsoncxx::builder::basic::kvp("coordinates", coords));
+    auto geometry = geom_builder.extract();
+
+    bsoncxx::builder::basic::document attrs_a;
+    attrs_a.append(bsoncxx::builder::basic::kvp("class", "road"));
+    attrs_a.append(bsoncxx::builder::basic::kvp("lanes", 2));
+    auto a = attrs_a.extract();
+
+    bsoncxx::builder::basic::document attrs_b;
+    attrs_b.append(bsoncxx::builder::basic::kvp("lanes", 2.0));
+    attrs_b.append(bsoncxx::builder::basic::kvp("class", "road"));
+    auto b = attrs_b.extract();
+
+    HashId ha = cas.compute_hash(geometry.view(), a.view());
+    HashId hb = cas.compute_hash(geometry.view(), b.view());
+
+    assert_true(!ha.is_null(), "Canonical hash is empty");
+    assert_true(ha == hb, "Canonical hash depends on key order or numeric type");
+    assert_true(ha != cas.compute_legacy_hash(geometry.view(), a.view()), "Canonical hash equals legacy hash");
+
+    CAS legacy_cas(conn.get_bpo_cas_collection(), HashMode::LegacyJson);
+    assert_true(
+        legacy_cas.compute_hash(geometry.view(), a.view()) == cas.compute_legacy_hash(geometry.view(), a.view()),
+        "Legacy hash mode does not use legacy hashing"
+    );
+}
+
+void test_hash_id_encoding() {
+    std::string hex = "00112233445566778899aabbccddeeff00112233445566778899aabbccddeeff";
+    HashId hash = HashId::from_hex(hex);
+
+    assert_true(hash.to_hex() == hex, "HashId hex round trip failed");
+    assert_true(hash.prefix() == 0x0011223344556677ULL, "HashId prefix mismatch");
+    assert_true(HashId() < hash, "HashId ordering mismatch");
+
+    HashId parsed;
+    assert_true(!HashId::from_hex("zz", parsed), "HashId accepted malformed hex");
+
+    bsoncxx::builder::basic::document doc;
+    doc.append(bsoncxx::builder::basic::kvp("hash", hash.to_bson()));
+    auto value = doc.extract();
+    assert_true(HashId::from_bson(value.view()["hash"].get_value(), parsed), "HashId BSON decode failed");
+    assert_true(parsed == hash, "HashId BSON round trip failed");
+}
+
+void test_cas_streaming_cursor() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    std::vector<BPO> batch;
+    for (int i = 0; i < 50; ++i) {
+        batch.push_back(make_point_bpo(10.0 + i * 0.01, 10.0, "cursor"));
+    }
+    cas.store_many(batch);
+
+    size_t hashes = cas.for_each_hash([](const HashId& hash) {
+        return !hash.is_null();
+    });
+    assert_true(hashes == 50, "CAS for_each_hash visited wrong number of hashes");
+
+    CASQueryOptions options;
+    options.batch_size = 7;
+    options.limit = 20;
+    options.projection = CASProjection::GeometryOnly;
+    auto cursor = cas.query_by_geometry_type(GeometryType::Point, options);
+    while (cursor->next()) {
+        HashId hash;
+        assert_true(cursor->current_hash(hash), "CAS cursor lost hash");
+        assert_true(static_cast<bool>(cursor->current()["geometry"]), "CAS cursor lost geometry");
+        assert_true(!cursor->current()["attributes"], "CAS cursor ignored projection");
+    }
+    assert_true(cursor->count() == 20, "CAS cursor ignored limit");
+
+    size_t visited = cas.for_each_in_bbox(9.0, 9.0, 11.0, 11.0, [](const bsoncxx::document::view&) {
+        return false;
+    });
+    assert_true(visited == 1, "CAS visitor did not stop early");
+}
+
+void test_cas_persisted_envelope() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    BPO bpo = make_point_bpo(31.5, 61.25, "envelope");
+    assert_true(bpo.get_envelope() == Envelope(31.5, 61.25, 31.5, 61.25), "BPO envelope mismatch");
+    assert_true(cas.store(bpo), "CAS store for envelope failed");
+    HashId hash = cas.compute_hash(bpo);
+
+    bsoncxx::builder::stream::document filter;
+    filter << "hash" << hash.to_bson();
+    auto raw = collection.find_one(filter.view());
+    assert_true(raw && (*raw).view()["envelope"] && (*raw).view()["centroid"], "CAS did not persist envelope");
+
+    auto loaded = cas.retrieve(hash);
+    assert_true(loaded && loaded->get_envelope() == bpo.get_envelope(), "BPO envelope not read back");
+    assert_true(cas.find_in_bbox(31.0, 61.0, 32.0, 62.0).size() == 1, "CAS envelope prefilter missed object");
+
+    bsoncxx::builder::stream::document unset;
+    unset << "$unset" << bsoncxx::builder::stream::open_document
+          << "envelope" << "" << "centroid" << ""
+          << bsoncxx::builder::stream::close_document;
+    collection.update_one(filter.view(), unset.view());
+    assert_true(cas.find_in_bbox(31.0, 61.0, 32.0, 62.0).size() == 1, "CAS bbox query missed object without envelope");
+    assert_true(cas.find_in_bbox(40.0, 61.0, 41.0, 62.0).empty(), "CAS bbox query matched object outside box");
+
+    BPO indexed = make_point_bpo(31.75, 61.5, "indexed");
+    assert_true(cas.store(indexed), "CAS store for indexed object failed");
+    assert_true(cas.find_in_bbox(31.0, 61.0, 32.0, 62.0).size() == 2, "CAS bbox query did not combine both queries");
+    CASQueryOptions limited;
+    limited.limit = 1;
+    auto cursor = cas.query_in_bbox(31.0, 61.0, 32.0, 62.0, limited);
+    while (cursor->next()) {
+    }
+    assert_true(cursor->count() == 1, "CAS bbox limit not shared by both queries");
+
+    Migration migration(conn);
+    EnvelopeBackfillReport report = migration.backfill_envelopes();
+    assert_true(report.updated == 1 && report.failed == 0, "Envelope backfill did not update object");
+    assert_true(cas.find_in_bbox(31.0, 61.0, 32.0, 62.0).size() == 2, "CAS bbox query missed backfilled object");
+}
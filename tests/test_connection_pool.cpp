@@ -0,0 +1,145 @@
+#include <iostream>
+#include <cstdlib>
+#include <atomic>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/builder/stream/document.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static BPO make_pool_bpo(int worker, int index) {
+    bsoncxx::builder::basic::document geom_builder;
+    bsoncxx::builder::basic::array coords;
+    coords.append(static_cast<double>(worker) - 90.0);
+    coords.append(static_cast<double>(index % 180) - 90.0);
+    geom_builder.append(bsoncxx::builder::basic::kvp("type", "Point"));
+    geom_builder.append(bsoncxx::builder::basic::kvp("coordinates", coords));
+
+    bsoncxx::builder::basic::document attr_builder;
+    attr_builder.append(bsoncxx::builder::basic::kvp("worker", worker));
+    attr_builder.append(bsoncxx::builder::basic::kvp("index", index));
+
+    auto geom_value = geom_builder.extract();
+    auto attr_value = attr_builder.extract();
+    return BPO(HashId(), geom_value.view(), attr_value.view());
+}
+
+void test_connection_pool_leases() {
+    ConnectionPoolOptions options;
+    options.max_pool_size = 3;
+    MongoDBConnection conn(get_mongo_uri(), "geoversion", options);
+    assert_true(conn.is_pooled(), "Pooled connection not reported as pooled");
+
+    {
+        ClientLease lease = conn.acquire();
+        assert_true(lease.database().name() == "geoversion", "ClientLease database mismatch");
+
+        std::optional<ClientLease> second = conn.try_acquire();
+        assert_true(second.has_value(), "try_acquire failed with a free client");
+
+        // One client is held by the connection itself for the legacy getters.
+        std::optional<ClientLease> exhausted = conn.try_acquire();
+        assert_true(!exhausted.has_value(), "try_acquire returned a client from an exhausted pool");
+    }
+
+    std::optional<ClientLease> released = conn.try_acquire();
+    assert_true(released.has_value(), "ClientLease did not return its client to the pool");
+}
+
+void test_connection_uri_pool_size() {
+    std::string uri = get_mongo_uri();
+    uri += uri.find('?') == std::string::npos ? (uri.find('/', uri.find("://") + 3) == std::string::npos ? "/?" : "?") : "&";
+    uri += "maxpoolsize=2";
+
+    ConnectionPoolOptions options;
+    options.max_pool_size = 5;
+    MongoDBConnection conn(uri, "geoversion", options);
+
+    // The URI's own limit wins: one client for the connection, one to lend.
+    std::optional<ClientLease> first = conn.try_acquire();
+    assert_true(first.has_value(), "try_acquire failed with a free client");
+    std::optional<ClientLease> second = conn.try_acquire();
+    assert_true(!second.has_value(), "pool options overrode the URI pool size");
+}
+
+void test_connection_initializes_indexes() {
+    MongoDBConnection conn(get_mongo_uri(), "geoversion");
+    assert_true(conn.initialize_database() && conn.is_initialized(), "Database not initialized");
+
+    // An index added after the database was created must still be created.
+    conn.get_situation_version_refs_collection().indexes().drop_one("version_refs_idx");
+    assert_true(!conn.is_initialized(), "Missing index not detected");
+    assert_true(conn.initialize_database(), "Initialization with a missing index failed");
+    assert_true(conn.is_initialized(), "Missing index not recreated");
+}
+
+void test_cas_concurrent_pool() {
+    ConnectionPoolOptions options;
+    options.max_pool_size = 8;
+    MongoDBConnection conn(get_mongo_uri(), "geoversion", options);
+    CAS cas(conn);
+
+    bsoncxx::builder::stream::document empty_filter;
+    conn.acquire().collection(CAS::kCollectionName).delete_many(empty_filter.view());
+
+    const int workers = 8;
+    const int per_worker = 50;
+    std::atomic<int> failures{0};
+    std::vector<std::thread> threads;
+
+    for (int worker = 0; worker < workers; ++worker) {
+        threads.emplace_back([&, worker]() {
+            std::vector<HashId> hashes;
+            for (int i = 0; i < per_worker; ++i) {
+                BPO bpo = make_pool_bpo(worker, i);
+                HashId hash = cas.compute_hash(bpo);
+                if (!cas.store(bpo) || !cas.exists(hash)) {
+                    ++failures;
+                    continue;
+                }
+                auto retrieved = cas.retrieve(hash);
+                if (!retrieved || retrieved->get_attributes()["index"].get_int32().value != i) {
+                    ++failures;
+                }
+                hashes.push_back(hash);
+            }
+
+            auto batch = cas.retrieve_many(hashes);
+            if (batch.size() != hashes.size()) {
+                ++failures;
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    assert_true(failures.load() == 0, "Concurrent CAS operations on pooled connection failed");
+    assert_true(cas.count() == static_cast<size_t>(workers * per_worker), "Concurrent CAS store count mismatch");
+}
@@ -0,0 +1,130 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/stream/document.hpp>
+#include <bsoncxx/json.hpp>
+#include <bsoncxx/types.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/coordinate_codec/coordinate_codec.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static bool same_bson(const bsoncxx::document::view& a, const bsoncxx::document::view& b) {
+    return a.length() == b.length() && std::memcmp(a.data(), b.data(), a.length()) == 0;
+}
+
+void test_coordinate_codec_roundtrip() {
+    CoordinateCodec codec(1e-7);
+    assert_true(codec.to_fixed(30.1234567) == 301234567, "fixed-point conversion mismatch");
+    assert_true(codec.from_fixed(305000000) == 30.5, "decimal grid is not exact");
+
+    auto noisy = bsoncxx::from_json(R"({"type": "LineString", "coordinates": [[30.12345670000001, 60.5], [30.2, 60.49999999999]]})");
+    auto clean = bsoncxx::from_json(R"({"type": "LineString", "coordinates": [[30.1234567, 60.5], [30.2, 60.5]]})");
+    bsoncxx::document::value snapped_noisy{bsoncxx::document::view()};
+    bsoncxx::document::value snapped_clean{bsoncxx::document::view()};
+    assert_true(codec.quantize(noisy.view(), snapped_noisy), "quantize failed");
+    assert_true(codec.quantize(clean.view(), snapped_clean), "quantize failed on clean input");
+    assert_true(same_bson(snapped_noisy.view(), snapped_clean.view()), "noise below the grid survived quantization");
+    assert_true(same_bson(snapped_clean.view(), clean.view()), "on-grid geometry changed by quantization");
+
+    auto collection = bsoncxx::from_json(R"({"type": "GeometryCollection", "geometries": [
+        {"type": "Point", "coordinates": [-179.9999999, -89.9999999]},
+        {"type": "MultiPolygon", "coordinates": [[[[0.0, 0.0], [1.0, 0.0], [1.0, 1.0], [0.0, 0.0]]], [[[5.0, 5.0], [6.0, 5.0], [6.0, 6.0], [5.0, 5.0]]]]},
+        {"type": "MultiLineString", "coordinates": [[[10.0, 10.0], [10.0000001, 10.0000002]], []]}
+    ]})");
+    bsoncxx::document::value snapped{bsoncxx::document::view()};
+    std::vector<uint8_t> blob;
+    assert_true(codec.quantize(collection.view(), snapped, &blob), "quantize with blob failed");
+    assert_true(!blob.empty() && blob.size() < collection.view().length() / 2, "blob is not compact");
+
+    bsoncxx::document::value decoded{bsoncxx::document::view()};
+    assert_true(CoordinateCodec::decode(blob.data(), blob.size(), decoded), "blob did not decode");
+    assert_true(same_bson(decoded.view(), snapped.view()), "decoded blob differs from quantized GeoJSON");
+
+    std::vector<uint8_t> encoded;
+    assert_true(codec.encode(collection.view(), encoded) && encoded == blob, "encode differs from quantize blob");
+    assert_true(!CoordinateCodec::decode(blob.data(), blob.size() - 1, decoded), "truncated blob decoded");
+    std::vector<uint8_t> corrupt(blob);
+    corrupt[0] = 0x7F;
+    assert_true(!CoordinateCodec::decode(corrupt.data(), corrupt.size(), decoded), "blob with unknown version decoded");
+
+    auto altitude = bsoncxx::from_json(R"({"type": "Point", "coordinates": [1.0, 2.0, 3.0]})");
+    assert_true(!codec.quantize(altitude.view(), snapped), "3D position quantized");
+
+    bsoncxx::builder::stream::document stored;
+    stored << "geometry" << bsoncxx::types::b_document{envelope_geometry(0.0, 0.0, 6.0, 6.0).view()}
+           << CoordinateCodec::kBlobField
+           << bsoncxx::types::b_binary{bsoncxx::binary_sub_type::k_binary, static_cast<uint32_t>(blob.size()), blob.data()}
+           << CoordinateCodec::kEncodingField << CoordinateCodec::kBlobEncoding;
+    auto stored_doc = stored << bsoncxx::builder::stream::finalize;
+    bsoncxx::document::view geometry;
+    std::optional<bsoncxx::document::value> holder;
+    assert_true(read_stored_geometry(stored_doc.view(), geometry, holder) && holder, "blob-only document not decoded");
+    assert_true(same_bson(geometry, snapped.view()), "blob-only document geometry mismatch");
+
+    assert_true(GeoJSONValidator::get_type(envelope_geometry(1.0, 1.0, 1.0, 1.0).view()) == GeometryType::Point, "degenerate envelope is not a Point");
+    assert_true(GeoJSONValidator::get_type(envelope_geometry(1.0, 1.0, 2.0, 1.0).view()) == GeometryType::LineString, "flat envelope is not a LineString");
+    assert_true(GeoJSONValidator::validate(envelope_geometry(1.0, 1.0, 2.0, 2.0).view()), "envelope polygon invalid");
+}
+
+void test_cas_precision_blob() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    PrecisionOptions precision;
+    precision.enabled = true;
+    precision.encoding = GeometryEncoding::Blob;
+    cas.set_precision(precision);
+
+    auto attributes = bsoncxx::from_json(R"({"name": "quantized"})");
+    auto first = bsoncxx::from_json(R"({"type": "LineString", "coordinates": [[30.1, 60.1], [30.2, 60.3]]})");
+    auto second = bsoncxx::from_json(R"({"type": "LineString", "coordinates": [[30.10000000001, 60.1], [30.2, 60.29999999999]]})");
+    BPO a(HashId(), first.view(), attributes.view());
+    BPO b(HashId(), second.view(), attributes.view());
+
+    HashId hash = cas.compute_hash(a);
+    assert_true(hash == cas.compute_hash(b), "sub-grid noise changed the hash");
+    assert_true(cas.store(a) && cas.store(b), "CAS store with precision failed");
+    assert_true(cas.count() == 1, "re-import with noise created a second object");
+
+    bsoncxx::builder::stream::document filter;
+    filter << "hash" << hash.to_bson();
+    auto raw = collection.find_one(filter.view());
+    assert_true(raw && (*raw).view()[CoordinateCodec::kBlobField], "CAS did not store the coordinate blob");
+    assert_true((*raw).view()["geometry"]["type"].get_string().value == std::string("Polygon"),
+                "blob-only document does not index its envelope");
+
+    auto loaded = cas.retrieve(hash);
+    assert_true(loaded && loaded->get_geometry_type() == GeometryType::LineString, "blob-only geometry not decoded");
+    assert_true(cas.compute_hash(*loaded) == hash, "decoded geometry hashes differently");
+    assert_true(cas.query_by_geometry_type(GeometryType::LineString)->next(), "type query missed blob-only object");
+    assert_true(cas.find_in_bbox(30.0, 60.0, 31.0, 61.0).size() == 1, "bbox query missed blob-only object");
+}
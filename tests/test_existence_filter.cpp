@@ -0,0 +1,170 @@
+#include <iostream>
+#include <atomic>
+#include <cstdlib>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/builder/stream/document.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/existence_filter/existence_filter.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static BPO make_filter_bpo(int index) {
+    bsoncxx::builder::basic::document geom_builder;
+    bsoncxx::builder::basic::array coords;
+    coords.append(static_cast<double>(index % 360) - 180.0);
+    coords.append(static_cast<double>(index % 180) - 90.0);
+    geom_builder.append(bsoncxx::builder::basic::kvp("type", "Point"));
+    geom_builder.append(bsoncxx::builder::basic::kvp("coordinates", coords));
+
+    bsoncxx::builder::basic::document attr_builder;
+    attr_builder.append(bsoncxx::builder::basic::kvp("index", index));
+
+    auto geom_value = geom_builder.extract();
+    auto attr_value = attr_builder.extract();
+    return BPO(HashId(), geom_value.view(), attr_value.view());
+}
+
+void test_existence_filter_rebuild() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    std::vector<BPO> stored;
+    for (int i = 0; i < 200; ++i) {
+        stored.push_back(make_filter_bpo(i));
+    }
+    StoreManyResult result = cas.store_many(stored);
+    assert_true(result.stats.failed == 0, "ExistenceFilter setup store failed");
+
+    ExistenceFilterOptions options;
+    options.expected_items = 1000;
+    ExistenceFilter filter(options);
+
+    assert_true(filter.might_contain(cas.compute_hash(make_filter_bpo(100000))), "ExistenceFilter answered before build");
+    assert_true(filter.rebuild(collection), "ExistenceFilter rebuild failed");
+    assert_true(filter.is_ready(), "ExistenceFilter not ready after rebuild");
+
+    for (const HashId& hash : result.hashes) {
+        assert_true(filter.might_contain(hash), "ExistenceFilter false negative");
+    }
+
+    size_t false_positives = 0;
+    for (int i = 1000; i < 3000; ++i) {
+        if (filter.might_contain(cas.compute_hash(make_filter_bpo(i)))) {
+            ++false_positives;
+        }
+    }
+    assert_true(false_positives < 100, "ExistenceFilter false positive rate too high");
+
+    std::string path = "/tmp/geoversion_existence_filter_test.bin";
+    assert_true(filter.save(path), "ExistenceFilter save failed");
+
+    ExistenceFilter loaded(options);
+    assert_true(loaded.load(path), "ExistenceFilter load failed");
+    assert_true(loaded.rebuild(collection), "ExistenceFilter rebuild after load failed");
+    for (const HashId& hash : result.hashes) {
+        assert_true(loaded.might_contain(hash), "ExistenceFilter lost hash after load");
+    }
+    std::remove(path.c_str());
+
+    ExistenceFilterStats stats = filter.get_stats();
+    assert_true(stats.items >= 190 && stats.items <= 200, "ExistenceFilter item count mismatch");
+    assert_true(stats.memory_bytes > 0, "ExistenceFilter reported no memory");
+}
+
+void test_cas_existence_filter() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    auto filter = std::make_shared<ExistenceFilter>();
+    assert_true(filter->rebuild(collection), "ExistenceFilter rebuild on empty collection failed");
+    cas.set_existence_filter(filter);
+
+    BPO bpo = make_filter_bpo(7);
+    HashId hash = cas.compute_hash(bpo);
+
+    assert_true(!cas.exists(hash), "CAS exists before store with filter");
+    assert_true(filter->get_stats().definite_negatives >= 1, "ExistenceFilter did not short-circuit lookup");
+    assert_true(cas.store(bpo), "CAS store with filter failed");
+    assert_true(cas.exists(hash), "ExistenceFilter not updated by store");
+
+    std::vector<BPO> batch = {make_filter_bpo(8), make_filter_bpo(9)};
+    StoreManyResult result = cas.store_many(batch);
+    assert_true(result.stats.inserted == 2, "CAS store_many with filter did not insert");
+    std::vector<bool> found = cas.exists_many(result.hashes);
+    assert_true(found[0] && found[1], "ExistenceFilter not updated by store_many");
+}
+
+void test_existence_filter_concurrent_rebuild() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+
+    auto filter = std::make_shared<ExistenceFilter>(ExistenceFilterOptions());
+    assert_true(filter->rebuild(collection), "ExistenceFilter initial rebuild failed");
+
+    // The writer has its own client; every store lands while a rebuild may
+    // be swapping the bits.
+    std::vector<HashId> hashes;
+    std::atomic<bool> writing(true);
+    std::thread writer([&]() {
+        MongoDBConnection writer_conn(uri, "geoversion");
+        CAS cas(writer_conn.get_bpo_cas_collection());
+        cas.set_existence_filter(filter);
+        for (int i = 20000; i < 20500; ++i) {
+            BPO bpo = make_filter_bpo(i);
+            if (cas.store(bpo)) {
+                hashes.push_back(cas.compute_hash(bpo));
+            }
+        }
+        writing = false;
+    });
+
+    size_t rebuilds = 0;
+    while (writing) {
+        assert_true(filter->rebuild(collection), "ExistenceFilter rebuild during stores failed");
+        ++rebuilds;
+    }
+    writer.join();
+
+    assert_true(rebuilds > 0 && hashes.size() == 500, "ExistenceFilter concurrent setup failed");
+    for (const HashId& hash : hashes) {
+        assert_true(filter->might_contain(hash), "ExistenceFilter lost a hash stored during rebuild");
+    }
+}
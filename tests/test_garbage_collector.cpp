@@ -0,0 +1,227 @@
+#include <iostream>
+#include <chrono>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/json.hpp>
+#include <bsoncxx/types.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/situation_repository/situation_repository.h"
+#include "storage/garbage_collector/garbage_collector.h"
+#include "storage/geometry_cas/geometry_cas.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+using bsoncxx::builder::basic::kvp;
+using bsoncxx::builder::basic::make_document;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static BPO point(int id, const std::string& name) {
+    auto geometry = bsoncxx::from_json(R"({"type": "Point", "coordinates": [)" + std::to_string(id) + ", 1.5]}");
+    auto attributes = bsoncxx::from_json(R"({"id": )" + std::to_string(id) + R"(, "name": ")" + name + R"("})");
+    return BPO(HashId(), geometry.view(), attributes.view());
+}
+
+static BPO line(int id, const std::string& name) {
+    auto geometry = bsoncxx::from_json(
+        R"({"type": "LineString", "coordinates": [[)" + std::to_string(id) + ", 1.5], [" + std::to_string(id) + R"(.5, 2.0]]})"
+    );
+    auto attributes = bsoncxx::from_json(R"({"id": )" + std::to_string(id) + R"(, "name": ")" + name + R"("})");
+    return BPO(HashId(), geometry.view(), attributes.view());
+}
+
+void test_garbage_collector_sweep() {
+    // A zero grace period collects everything unreferenced, so the sweep
+    // gets a database of its own.
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion_gc_test");
+    conn.get_database().drop();
+    assert_true(conn.initialize_database(), "GC test database not initialized");
+    auto objects = conn.get_bpo_cas_collection();
+    CAS cas(objects);
+    SituationRepository repository(conn, cas);
+
+    KeyframePolicy policy;
+    policy.interval = 2;
+    repository.set_keyframe_policy(policy);
+
+    BPO live = point(1, "live");
+    BPO delta_only = point(2, "delta");
+    std::vector<BPO> orphans = {point(3, "orphan"), point(4, "orphan"), point(5, "orphan")};
+    // Imported long ago and never committed; the first two are stored again
+    // by a commit in flight.
+    std::vector<BPO> imported = {point(6, "imported"), point(7, "imported"), point(8, "imported")};
+
+    auto situation = repository.create_situation("gc");
+    assert_true(situation.has_value(), "situation not created");
+
+    VersionCommit first;
+    first.situation_id = situation->situation_id;
+    first.bpos = {live};
+    CommitResult keyframe = repository.commit_version(first);
+    assert_true(keyframe.ok && keyframe.keyframe, "keyframe commit failed: " + keyframe.error);
+
+    // Only version_deltas refers to the object added here.
+    VersionCommit second;
+    second.situation_id = situation->situation_id;
+    second.parent_version_ids = {keyframe.version_id};
+    second.bpos = {delta_only};
+    second.refs = {cas.compute_hash(live)};
+    CommitResult delta = repository.commit_version(second);
+    assert_true(delta.ok && !delta.keyframe, "delta commit failed: " + delta.error);
+
+    std::vector<HashId> orphan_hashes;
+    for (const auto& orphan : orphans) {
+        assert_true(cas.store(orphan), "orphan not stored");
+        orphan_hashes.push_back(cas.compute_hash(orphan));
+    }
+
+    StoreManyResult stored = cas.store_many(imported);
+    assert_true(stored.stats.inserted == imported.size(), "imported objects not stored");
+    bsoncxx::types::b_date long_ago{std::chrono::system_clock::now() - std::chrono::hours(48)};
+    bsoncxx::builder::basic::array imported_hashes;
+    for (const auto& hash : stored.hashes) {
+        imported_hashes.append(hash.to_bson());
+    }
+    objects.update_many(
+        make_document(kvp("hash", make_document(kvp("$in", imported_hashes)))),
+        make_document(kvp("$set", make_document(kvp("created_at", long_ago), kvp(CAS::kLastStoredField, long_ago))))
+    );
+    assert_true(cas.store(imported[0]), "imported object not stored again");
+    StoreManyResult restored = cas.store_many({imported[1]});
+    assert_true(restored.stats.duplicates == 1, "imported object not deduplicated");
+
+    // A duplicate stored within the touch interval costs one lookup and no write.
+    auto live_filter = make_document(kvp("hash", cas.compute_hash(live).to_bson()));
+    auto live_before = objects.find_one(live_filter.view());
+    StoreManyResult again = cas.store_many({live});
+    assert_true(again.stats.duplicates == 1 && again.stats.round_trips == 1, "fresh duplicate not a single lookup");
+    assert_true(cas.store(live), "fresh duplicate not stored");
+    auto live_after = objects.find_one(live_filter.view());
+    assert_true(live_before && live_after &&
+                live_before->view()[CAS::kLastStoredField].get_date().value == live_after->view()[CAS::kLastStoredField].get_date().value,
+                "fresh duplicate rewritten");
+
+    GarbageCollectorOptions options;
+    options.dry_run = true;
+    GarbageCollector estimate(conn, cas, options);
+    GarbageCollectionReport dry = estimate.run();
+    assert_true(dry.ok && dry.late_versions == 2, "new versions not re-marked");
+    assert_true(dry.scanned == 8 && dry.unreachable == 6 && dry.kept_recent == 5, "unreachable objects miscounted");
+    assert_true(dry.deleted == 0 && dry.reclaimed_bytes > 0, "dry run did not size the garbage");
+    assert_true(cas.exists(stored.hashes[2]), "dry run deleted objects");
+
+    options.dry_run = false;
+    GarbageCollector recent(conn, cas, options);
+    GarbageCollectionReport kept = recent.run();
+    assert_true(kept.ok && kept.deleted == 1 && kept.reclaimed_bytes > 0, "stale import not collected");
+    assert_true(!cas.exists(stored.hashes[2]), "stale import survived");
+    assert_true(cas.exists(stored.hashes[0]) && cas.exists(stored.hashes[1]), "object stored again was deleted");
+    for (const auto& hash : orphan_hashes) {
+        assert_true(cas.exists(hash), "object within grace period deleted");
+    }
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    options.grace_period = std::chrono::seconds(0);
+    options.delete_batch_size = 2;
+    GarbageCollector collector(conn, cas, options);
+    GarbageCollectionReport swept = collector.run();
+    assert_true(swept.ok && swept.deleted == orphan_hashes.size() + 2, "unreachable objects not deleted");
+    for (const auto& hash : orphan_hashes) {
+        assert_true(!cas.exists(hash), "unreachable object survived");
+    }
+    assert_true(cas.exists(cas.compute_hash(live)), "keyframe object deleted");
+    assert_true(cas.exists(cas.compute_hash(delta_only)), "delta-only object deleted");
+
+    auto handle = repository.checkout(delta.version_id);
+    assert_true(handle && handle->size() == 2, "delta version unreadable after collection");
+
+    conn.get_database().drop();
+}
+
+void test_garbage_collector_geometries() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion_gc_geometry_test");
+    conn.get_database().drop();
+    assert_true(conn.initialize_database(), "GC geometry test database not initialized");
+    CAS cas(conn);
+    auto geometries = std::make_shared<GeometryCAS>(conn);
+    cas.set_geometry_cas(geometries);
+    SituationRepository repository(conn, cas);
+
+    // The twin shares the geometry of the live object and is never committed.
+    BPO live = line(1, "live");
+    BPO twin = line(1, "twin");
+    BPO orphan = line(2, "orphan");
+
+    auto situation = repository.create_situation("gc");
+    assert_true(situation.has_value(), "situation not created");
+    VersionCommit commit;
+    commit.situation_id = situation->situation_id;
+    commit.bpos = {live};
+    CommitResult result = repository.commit_version(commit);
+    assert_true(result.ok, "commit failed: " + result.error);
+    assert_true(cas.store(twin) && cas.store(orphan), "uncommitted objects not stored");
+
+    // What a failed object insert leaves behind: a chunked geometry no
+    // object refers to.
+    auto stray_geometry = bsoncxx::from_json(R"({"type": "LineString", "coordinates": [[3.0, 1.0], [3.5, 2.0], [4.0, 2.5]]})");
+    GeometryRecord stray;
+    stray.hash = GeometryCAS::compute_hash(stray_geometry.view());
+    stray.geometry = stray_geometry.view();
+    assert_true(geometries->store(stray), "stray geometry not stored");
+
+    auto chunks = conn.get_bpo_geometry_chunks_collection();
+    int64_t chunk_count = chunks.count_documents(make_document());
+    assert_true(geometries->count() == 3 && chunk_count > 0, "geometries not split");
+
+    std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    GarbageCollectorOptions options;
+    options.grace_period = std::chrono::seconds(0);
+    options.dry_run = true;
+    GarbageCollector estimate(conn, cas, options);
+    GarbageCollectionReport dry = estimate.run();
+    assert_true(dry.ok && dry.unreachable == 2 && dry.geometries_unreachable == 1 && dry.chunks_unreachable == 0,
+                "unreachable geometries miscounted");
+    assert_true(dry.geometries_deleted == 0 && geometries->count() == 3, "dry run deleted geometries");
+
+    options.dry_run = false;
+    GarbageCollector collector(conn, cas, options);
+    GarbageCollectionReport swept = collector.run();
+    assert_true(swept.ok && swept.deleted == 2, "unreachable objects not deleted");
+    assert_true(swept.geometries_deleted == 2 && geometries->count() == 1, "unreferenced geometries not deleted");
+    assert_true(swept.chunks_deleted == static_cast<uint64_t>(chunk_count) && chunks.count_documents(make_document()) == 0,
+                "unreferenced chunks not deleted");
+
+    geometries->clear_cache();
+    assert_true(geometries->retrieve(GeometryCAS::compute_hash(live.get_geometry())) != nullptr, "live geometry deleted");
+    auto handle = repository.checkout(result.version_id);
+    assert_true(handle && handle->size() == 1, "version unreadable after collection");
+
+    // A collected geometry is written again by the next store.
+    assert_true(cas.store(orphan) && geometries->count() == 2, "collected geometry not stored again");
+
+    conn.get_database().drop();
+}
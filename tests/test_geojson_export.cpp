@@ -0,0 +1,157 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/builder/stream/document.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/geojson_export/geojson_export.h"
+#include "storage/geojson_export/geojson_writer.h"
+#include "storage/geojson_export/output_sink.h"
+#include "storage/geojson_import/geojson_reader.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+using bsoncxx::builder::basic::kvp;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+class StringSink : public OutputSink {
+public:
+    std::string data;
+    size_t writes = 0;
+    bool finished = false;
+
+    bool write(const char* bytes, size_t size) override {
+        data.append(bytes, size);
+        ++writes;
+        return true;
+    }
+
+    bool finish() override {
+        finished = true;
+        return true;
+    }
+};
+
+static BPO make_export_bpo(int index) {
+    bsoncxx::builder::basic::array coords;
+    coords.append(static_cast<double>(index % 360) - 180.0 + 0.125);
+    coords.append(static_cast<double>(index % 180) - 90.0);
+    bsoncxx::builder::basic::document geometry;
+    geometry.append(kvp("type", "Point"));
+    geometry.append(kvp("coordinates", coords));
+
+    bsoncxx::builder::basic::document attributes;
+    attributes.append(kvp("index", index));
+    attributes.append(kvp("label", "line\n\"quoted\""));
+
+    auto geometry_value = geometry.extract();
+    auto attributes_value = attributes.extract();
+    return BPO(HashId(), geometry_value.view(), attributes_value.view());
+}
+
+void test_geojson_writer_format() {
+    StringSink sink;
+    GeoJSONWriter writer(sink, 4096);
+
+    BPO bpo = make_export_bpo(10);
+    HashId hash = HashId::from_hex(std::string(HashId::kHexLength, 'a'));
+
+    writer.begin();
+    writer.write_feature(hash, bpo.get_geometry(), bpo.get_attributes());
+    for (int i = 0; i < 200; ++i) {
+        BPO extra = make_export_bpo(i);
+        writer.write_feature(HashId(), extra.get_geometry(), extra.get_attributes());
+    }
+    assert_true(writer.end(), "GeoJSONWriter end failed");
+
+    assert_true(sink.finished, "GeoJSONWriter did not finish the sink");
+    assert_true(sink.writes > 1, "GeoJSONWriter did not flush a full buffer");
+    assert_true(writer.features() == 201, "GeoJSONWriter feature count mismatch");
+    assert_true(writer.bytes_written() == sink.data.size(), "GeoJSONWriter byte count mismatch");
+
+    std::string expected_first =
+        "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"id\":\"" +
+        std::string(HashId::kHexLength, 'a') +
+        "\",\"geometry\":{\"type\":\"Point\",\"coordinates\":[-169.875,-80]},"
+        "\"properties\":{\"index\":10,\"label\":\"line\\n\\\"quoted\\\"\"}}";
+    assert_true(sink.data.compare(0, expected_first.size(), expected_first) == 0, "GeoJSONWriter output mismatch");
+
+    GeoJSONReader reader(sink.data.data(), sink.data.size());
+    BPO parsed;
+    size_t count = 0;
+    while (reader.next(parsed)) {
+        ++count;
+    }
+    assert_true(!reader.failed(), "GeoJSONWriter output does not parse: " + reader.error());
+    assert_true(count == 201, "GeoJSONWriter output feature count mismatch");
+}
+
+void test_geojson_export_cas() {
+    MongoDBConnection conn(get_mongo_uri(), "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    std::vector<BPO> bpos;
+    for (int i = 0; i < 50; ++i) {
+        bpos.push_back(make_export_bpo(i));
+    }
+    StoreManyResult stored = cas.store_many(bpos);
+    assert_true(stored.stats.inserted == 50, "Export setup store failed");
+
+    GeoJSONExporter exporter(cas);
+
+    StringSink all_sink;
+    GeoJSONExportReport all = exporter.export_all(all_sink);
+    assert_true(all.ok && all.features == 50, "GeoJSON export_all count mismatch");
+
+    std::vector<HashId> subset(stored.hashes.begin(), stored.hashes.begin() + 10);
+    subset.push_back(stored.hashes[0]);
+    StringSink hash_sink;
+    GeoJSONExportReport by_hash = exporter.export_hashes(subset, hash_sink);
+    assert_true(by_hash.ok && by_hash.features == 10, "GeoJSON export_hashes count mismatch");
+
+    StringSink bbox_sink;
+    GeoJSONExportReport by_bbox = exporter.export_bbox(-180.0, -90.0, -170.0, -80.0, bbox_sink);
+    assert_true(by_bbox.ok && by_bbox.features == 10, "GeoJSON export_bbox count mismatch");
+
+    GeoJSONReader reader(bbox_sink.data.data(), bbox_sink.data.size());
+    BPO parsed;
+    while (reader.next(parsed)) {
+        assert_true(cas.exists(cas.compute_hash(parsed)), "Exported feature does not hash back to a stored object");
+    }
+    assert_true(!reader.failed(), "GeoJSON export output does not parse");
+
+    if (compression_available(ExportCompression::Gzip)) {
+        std::string error;
+        auto gzip = open_output_sink("/tmp/geoversion_export_test.geojson.gz", ExportCompression::Gzip, error);
+        assert_true(gzip != nullptr, "Cannot open gzip export sink: " + error);
+        GeoJSONExportReport compressed = exporter.export_all(*gzip);
+        assert_true(compressed.ok && compressed.features == 50, "GeoJSON gzip export failed");
+        std::remove("/tmp/geoversion_export_test.geojson.gz");
+    }
+}
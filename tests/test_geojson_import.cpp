@@ -0,0 +1,128 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/stream/document.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/geojson_import/geojson_reader.h"
+#include "storage/geojson_import/geojson_import.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static std::vector<BPO> read_all(GeoJSONReader& reader) {
+    std::vector<BPO> bpos;
+    BPO bpo;
+    while (reader.next(bpo)) {
+        bpos.push_back(std::move(bpo));
+    }
+    return bpos;
+}
+
+void test_geojson_reader_features() {
+    std::string json =
+        "{\"type\": \"FeatureCollection\", \"name\": \"test\", \"crs\": {\"type\": \"name\", \"properties\": {\"name\": \"EPSG:4326\"}},\n"
+        " \"features\": [\n"
+        "  {\"type\": \"Feature\", \"id\": 1, \"geometry\": {\"type\": \"Point\", \"coordinates\": [30, 10.5]},\n"
+        "   \"properties\": {\"name\": \"A \\\"quoted\\\" \\u00e9\\ud83d\\ude00\", \"count\": 3, \"big\": 5000000000, \"ratio\": 0.25,\n"
+        "                  \"flag\": true, \"none\": null, \"tags\": [\"x\", {\"y\": 1}]}},\n"
+        "  {\"type\": \"Feature\", \"geometry\": null, \"properties\": {\"skipped\": true}},\n"
+        "  {\"properties\": null, \"type\": \"Feature\", \"geometry\": {\"type\": \"LineString\", \"coordinates\": [[0, 0], [1e1, -2.5E-1]]}}\n"
+        " ],\n"
+        " \"bbox\": [0, 0, 30, 10.5]\n"
+        "}\n";
+
+    GeoJSONReader reader(json.data(), json.size());
+    std::vector<BPO> bpos = read_all(reader);
+
+    assert_true(!reader.failed(), "GeoJSONReader failed on valid input: " + reader.error());
+    assert_true(bpos.size() == 2, "GeoJSONReader feature count mismatch");
+    assert_true(reader.features_read() == 3, "GeoJSONReader read count mismatch");
+    assert_true(reader.features_skipped() == 1, "GeoJSONReader did not skip null geometry");
+    assert_true(reader.offset() == json.size(), "GeoJSONReader did not consume the whole input");
+
+    auto point = bpos[0].get_geometry();
+    assert_true(bpos[0].get_geometry_type() == GeometryType::Point, "GeoJSONReader geometry type mismatch");
+    auto coords = point["coordinates"].get_array().value;
+    assert_true(coords[0].type() == bsoncxx::type::k_double, "GeoJSONReader kept integer coordinate");
+    assert_true(coords[0].get_double().value == 30.0, "GeoJSONReader coordinate mismatch");
+    assert_true(GeoJSONValidator::validate(point), "GeoJSONReader point fails validation");
+
+    auto attributes = bpos[0].get_attributes();
+    assert_true(std::string(attributes["name"].get_string().value) == "A \"quoted\" \xc3\xa9\xf0\x9f\x98\x80", "GeoJSONReader string unescape mismatch");
+    assert_true(attributes["count"].type() == bsoncxx::type::k_int32, "GeoJSONReader integer property type mismatch");
+    assert_true(attributes["big"].type() == bsoncxx::type::k_int64, "GeoJSONReader large integer type mismatch");
+    assert_true(attributes["ratio"].get_double().value == 0.25, "GeoJSONReader double property mismatch");
+    assert_true(attributes["flag"].get_bool().value, "GeoJSONReader bool property mismatch");
+    assert_true(attributes["none"].type() == bsoncxx::type::k_null, "GeoJSONReader null property mismatch");
+    assert_true(attributes["tags"].get_array().value[1].get_document().value["y"].get_int32().value == 1, "GeoJSONReader nested property mismatch");
+
+    assert_true(bpos[1].get_geometry_type() == GeometryType::LineString, "GeoJSONReader second geometry type mismatch");
+    assert_true(bpos[1].get_attributes().empty(), "GeoJSONReader null properties not empty");
+    assert_true(bpos[1].get_envelope().max_x == 10.0, "GeoJSONReader exponent coordinate mismatch");
+
+    std::string broken = "{\"type\": \"FeatureCollection\", \"features\": [{\"type\": \"Feature\", \"geometry\": {\"type\": \"Point\", \"coordinates\": [1, ]}}]}";
+    GeoJSONReader broken_reader(broken.data(), broken.size());
+    std::vector<BPO> partial = read_all(broken_reader);
+    assert_true(partial.empty(), "GeoJSONReader returned a malformed feature");
+    assert_true(broken_reader.failed(), "GeoJSONReader accepted malformed input");
+}
+
+void test_geojson_import_file() {
+    MongoDBConnection conn(get_mongo_uri(), "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    std::string path = "/tmp/geoversion_import_test.geojson";
+    {
+        std::ofstream out(path);
+        out << "{\"type\": \"FeatureCollection\", \"features\": [";
+        for (int i = 0; i < 300; ++i) {
+            if (i > 0) {
+                out << ",";
+            }
+            out << "{\"type\": \"Feature\", \"geometry\": {\"type\": \"Point\", \"coordinates\": ["
+                << (i % 360) - 180 << ", " << (i % 180) - 90 << "]}, \"properties\": {\"index\": " << i << "}}";
+        }
+        out << "]}";
+    }
+
+    GeoJSONImportOptions options;
+    options.pipeline.batch_size = 64;
+    options.release_interval_bytes = 4096;
+    GeoJSONImporter importer(cas, options);
+    GeoJSONImportReport report = importer.import_file(path);
+    std::remove(path.c_str());
+
+    assert_true(report.ok, "GeoJSON import failed: " + report.error);
+    assert_true(report.features == 300, "GeoJSON import feature count mismatch");
+    assert_true(report.pipeline.store.inserted == 300, "GeoJSON import insert count mismatch");
+    assert_true(cas.count() == 300, "GeoJSON import stored count mismatch");
+
+    GeoJSONImportReport missing = importer.import_file("/tmp/geoversion_import_missing.geojson");
+    assert_true(!missing.ok && !missing.error.empty(), "GeoJSON import of a missing file did not fail");
+}
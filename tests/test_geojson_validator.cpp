@@ -0,0 +1,95 @@
+#include <iostream>
+#include <cstdlib>
+#include <cmath>
+#include <string>
+
+#include <bsoncxx/json.hpp>
+
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/bpo_storage/coordinate_kernels.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static bool valid_json(const std::string& json, bool topology = false) {
+    GeoJSONValidationOptions options;
+    options.check_topology = topology;
+    auto geometry = bsoncxx::from_json(json);
+    return GeoJSONValidator::validate(geometry.view(), options);
+}
+
+void test_geojson_validator_types() {
+    assert_true(valid_json(R"({"type": "Point", "coordinates": [30.5, 10.25]})"), "Point rejected");
+    assert_true(valid_json(R"({"type": "MultiPoint", "coordinates": [[1.0, 2.0], [3.0, 4.0]]})"), "MultiPoint rejected");
+    assert_true(valid_json(R"({"type": "LineString", "coordinates": [[1.0, 2.0], [3.0, 4.0]]})"), "LineString rejected");
+    assert_true(valid_json(R"({"type": "MultiLineString", "coordinates": [[[1.0, 2.0], [3.0, 4.0]], [[5.0, 6.0], [7.0, 8.0]]]})"), "MultiLineString rejected");
+    assert_true(valid_json(R"({"type": "Polygon", "coordinates": [[[0.0, 0.0], [1.0, 0.0], [1.0, 1.0], [0.0, 0.0]]]})"), "Polygon rejected");
+    assert_true(valid_json(R"({"type": "MultiPolygon", "coordinates": [[[[0.0, 0.0], [1.0, 0.0], [1.0, 1.0], [0.0, 0.0]]], [[[5.0, 5.0], [6.0, 5.0], [6.0, 6.0], [5.0, 5.0]]]]})"), "MultiPolygon rejected");
+    assert_true(valid_json(R"({"type": "GeometryCollection", "geometries": [
+        {"type": "Point", "coordinates": [1.0, 1.0]},
+        {"type": "GeometryCollection", "geometries": [{"type": "LineString", "coordinates": [[0.0, 0.0], [2.0, 2.0]]}]}
+    ]})"), "nested GeometryCollection rejected");
+
+    assert_true(!valid_json(R"({"type": "Point", "coordinates": [181.0, 0.0]})"), "out-of-range longitude accepted");
+    assert_true(!valid_json(R"({"type": "MultiPoint", "coordinates": [[1.0, 2.0], [3.0, -90.5]]})"), "out-of-range latitude accepted");
+    assert_true(!valid_json(R"({"type": "Point", "coordinates": [1, 2]})"), "integer coordinates accepted");
+    assert_true(!valid_json(R"({"type": "LineString", "coordinates": [[1.0, 2.0]]})"), "single-point LineString accepted");
+    assert_true(!valid_json(R"({"type": "Polygon", "coordinates": [[[0.0, 0.0], [1.0, 0.0], [1.0, 1.0], [0.0, 1.0]]]})"), "open ring accepted");
+    assert_true(!valid_json(R"({"type": "MultiPolygon", "coordinates": []})"), "empty MultiPolygon accepted");
+    assert_true(!valid_json(R"({"type": "GeometryCollection", "geometries": [{"type": "Point", "coordinates": [500.0, 0.0]}]})"), "invalid collection member accepted");
+    assert_true(!valid_json(R"({"type": 7, "coordinates": [1.0, 2.0]})"), "non-string type accepted");
+
+    std::string bowtie = R"({"type": "Polygon", "coordinates": [[[0.0, 0.0], [1.0, 1.0], [1.0, 0.0], [0.0, 1.0], [0.0, 0.0]]]})";
+    assert_true(valid_json(bowtie), "self-intersecting ring rejected without topology check");
+    assert_true(!valid_json(bowtie, true), "self-intersecting ring accepted with topology check");
+    assert_true(valid_json(R"({"type": "Polygon", "coordinates": [[[0.0, 0.0], [1.0, 0.0], [1.0, 1.0], [1.0, 1.0], [0.0, 1.0], [0.0, 0.0]]]})", true), "ring with repeated vertex rejected");
+
+    double xs[] = {0.0, 10.0, 20.0, std::nan(""), 40.0};
+    double ys[] = {0.0, 1.0, 2.0, 3.0, 4.0};
+    assert_true(coordinates_in_range(xs, ys, 3), "coordinate kernel rejected valid positions");
+    assert_true(!coordinates_in_range(xs, ys, 5), "coordinate kernel accepted NaN");
+}
+
+void test_bpo_borrowed_decode() {
+    auto doc = bsoncxx::from_json(R"({
+        "geometry": {"type": "LineString", "coordinates": [[1.0, 2.0], [3.0, 6.0], [5.0, 4.0]]},
+        "attributes": {"name": "road"}
+    })");
+
+    BPO borrowed = BPO::borrow(doc.view());
+    assert_true(borrowed.is_borrowed(), "borrowed BPO owns its documents");
+    assert_true(borrowed.owned_bytes() == 0, "borrowed BPO allocated a buffer");
+    assert_true(borrowed.get_geometry().data() == doc.view()["geometry"].get_document().value.data(),
+                "borrowed geometry does not point into the source");
+    assert_true(borrowed.get_geometry_type() == GeometryType::LineString, "borrowed geometry type mismatch");
+
+    const GeometryExtent& extent = borrowed.get_extent();
+    assert_true(extent.vertex_count == 3, "decoded vertex count mismatch");
+    assert_true(extent.envelope == Envelope(1.0, 2.0, 5.0, 6.0), "decoded envelope mismatch");
+    assert_true(extent.centroid_x == 3.0 && extent.centroid_y == 4.0, "decoded centroid mismatch");
+
+    BPO owned = borrowed;
+    assert_true(!owned.is_borrowed(), "copy of a borrowed BPO is not owned");
+    assert_true(owned.owned_bytes() == owned.get_geometry().length() + owned.get_attributes().length(),
+                "owned BPO is not one contiguous buffer");
+    assert_true(owned.get_attributes()["name"].get_string().value == "road", "owned attributes mismatch");
+
+    borrowed.make_owned();
+    assert_true(!borrowed.is_borrowed(), "make_owned left the BPO borrowed");
+    assert_true(borrowed.get_geometry().data() != doc.view()["geometry"].get_document().value.data(),
+                "make_owned did not copy the geometry");
+
+    BPO moved = std::move(owned);
+    assert_true(moved.get_extent().vertex_count == 3, "moved BPO lost its extent");
+    assert_true(owned.get_geometry().empty(), "moved-from BPO still references the buffer");
+
+    BPO invalid(HashId(), bsoncxx::from_json(R"({"type": "Point", "coordinates": [1, 2]})").view(), bsoncxx::document::view());
+    assert_true(invalid.get_extent().vertex_count == 1, "invalid geometry lost its extent");
+}
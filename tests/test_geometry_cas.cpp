@@ -0,0 +1,257 @@
+#include <iostream>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/core.hpp>
+#include <bsoncxx/builder/stream/document.hpp>
+#include <bsoncxx/json.hpp>
+#include <bsoncxx/types.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/cas/canonical_hash.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/geometry_cas/geometry_cas.h"
+#include "storage/geometry_cas/geometry_chunks.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static bool same_bson(const bsoncxx::document::view& a, const bsoncxx::document::view& b) {
+    return a.length() == b.length() && std::memcmp(a.data(), b.data(), a.length()) == 0;
+}
+
+// Closed ring of `vertices` positions around (30, 60); `moved` shifts one vertex.
+static bsoncxx::document::value make_large_polygon(size_t vertices, size_t moved = 0) {
+    bsoncxx::builder::core builder(false);
+    builder.key_view("type");
+    builder.append("Polygon");
+    builder.key_view("coordinates");
+    builder.open_array();
+    builder.open_array();
+    for (size_t i = 0; i < vertices; ++i) {
+        double angle = 2.0 * M_PI * static_cast<double>(i % (vertices - 1)) / static_cast<double>(vertices - 1);
+        double radius = (i == moved && moved != 0) ? 0.45 : 0.5;
+        builder.open_array();
+        builder.append(30.0 + radius * std::cos(angle));
+        builder.append(60.0 + radius * std::sin(angle));
+        builder.close_array();
+    }
+    builder.close_array();
+    builder.close_array();
+    return builder.extract_document();
+}
+
+void test_geometry_chunker_roundtrip() {
+    auto polygon = make_large_polygon(200000);
+    std::vector<uint8_t> structure;
+    uint64_t positions = 0;
+    std::vector<GeometryChunk> chunks;
+    assert_true(GeometryChunker::split(polygon.view(), structure, positions, [&](GeometryChunk&& chunk) {
+        chunks.push_back(std::move(chunk));
+        return true;
+    }), "chunker rejected a large polygon");
+    assert_true(positions == 200000 && chunks.size() > 2, "polygon was not split into chunks");
+    for (size_t i = 0; i + 1 < chunks.size(); ++i) {
+        assert_true(chunks[i].positions >= GeometryChunker::kMinPositions &&
+                    chunks[i].positions <= GeometryChunker::kMaxPositions, "chunk size out of bounds");
+    }
+
+    size_t next = 0;
+    bsoncxx::document::value assembled{bsoncxx::document::view()};
+    assert_true(GeometryChunker::assemble(structure.data(), structure.size(), positions, [&](GeometryChunk& chunk) {
+        if (next == chunks.size()) {
+            return false;
+        }
+        chunk = chunks[next++];
+        return true;
+    }, assembled), "chunks did not assemble");
+    assert_true(same_bson(assembled.view(), polygon.view()), "assembled geometry differs");
+
+    auto edited = make_large_polygon(200000, 100000);
+    std::vector<HashId> edited_hashes;
+    assert_true(GeometryChunker::split(edited.view(), structure, positions, [&](GeometryChunk&& chunk) {
+        edited_hashes.push_back(chunk.hash);
+        return true;
+    }), "chunker rejected the edited polygon");
+    size_t shared = 0;
+    for (const auto& chunk : chunks) {
+        for (const auto& hash : edited_hashes) {
+            if (hash == chunk.hash) {
+                ++shared;
+                break;
+            }
+        }
+    }
+    assert_true(shared + 2 >= chunks.size(), "a one-vertex edit changed more than its own chunks");
+
+    auto extra = bsoncxx::from_json(R"({"type": "Point", "coordinates": [1.0, 2.0], "bbox": [1.0, 2.0, 1.0, 2.0]})");
+    size_t emitted = 0;
+    auto count_chunks = [&](GeometryChunk&&) {
+        ++emitted;
+        return true;
+    };
+    assert_true(!GeometryChunker::split(extra.view(), structure, positions, count_chunks), "extra member chunked");
+    assert_true(emitted == 0, "rejected geometry emitted chunks");
+}
+
+void test_geometry_chunker_integer_positions() {
+    auto reordered = bsoncxx::from_json(
+        R"({"coordinates": [[1, 2], [3.5, {"$numberLong": "4"}]], "type": "LineString"})"
+    );
+    std::vector<uint8_t> structure;
+    uint64_t positions = 0;
+    std::vector<GeometryChunk> chunks;
+    assert_true(GeometryChunker::split(reordered.view(), structure, positions, [&](GeometryChunk&& chunk) {
+        chunks.push_back(std::move(chunk));
+        return true;
+    }), "chunker rejected reordered keys or integer positions");
+    assert_true(positions == 2 && chunks.size() == 1, "integer positions not chunked");
+
+    size_t next = 0;
+    bsoncxx::document::value assembled{bsoncxx::document::view()};
+    assert_true(GeometryChunker::assemble(structure.data(), structure.size(), positions, [&](GeometryChunk& chunk) {
+        if (next == chunks.size()) {
+            return false;
+        }
+        chunk = chunks[next++];
+        return true;
+    }, assembled), "integer positions did not assemble");
+    auto expected = bsoncxx::from_json(R"({"type": "LineString", "coordinates": [[1.0, 2.0], [3.5, 4.0]]})");
+    assert_true(same_bson(assembled.view(), expected.view()), "integer positions not normalized to doubles");
+    auto canonical = [](const bsoncxx::document::view& geometry) {
+        Sha256Stream stream;
+        CanonicalHasher::append_document(stream, geometry);
+        return stream.finish();
+    };
+    assert_true(canonical(assembled.view()) == canonical(reordered.view()), "normalized geometry hashes differently");
+
+    auto huge = bsoncxx::from_json(R"({"type": "Point", "coordinates": [{"$numberLong": "9007199254740993"}, 0]})");
+    assert_true(!GeometryChunker::split(huge.view(), structure, positions, [](GeometryChunk&&) {
+        return true;
+    }), "inexact integer position chunked");
+}
+
+void test_cas_split_geometry() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    auto geometries = conn.get_bpo_geometries_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+    geometries.delete_many(empty_filter.view());
+
+    auto geometry_cas = std::make_shared<GeometryCAS>(geometries, conn.get_bpo_geometry_chunks_collection());
+    cas.set_geometry_cas(geometry_cas);
+
+    auto polygon = bsoncxx::from_json(R"({"type": "Polygon", "coordinates": [[[30.0, 60.0], [30.5, 60.0], [30.5, 60.5], [30.0, 60.0]]]})");
+    auto before = bsoncxx::from_json(R"({"name": "lake", "version": 1})");
+    auto after = bsoncxx::from_json(R"({"name": "lake", "version": 2})");
+    BPO first(HashId(), polygon.view(), before.view());
+    BPO edited(HashId(), polygon.view(), after.view());
+
+    HashId first_hash = cas.compute_hash(first);
+    HashId edited_hash = cas.compute_hash(edited);
+    assert_true(first_hash != edited_hash, "attribute edit kept the BPO hash");
+    assert_true(cas.store(first), "split store failed");
+    assert_true(cas.store_many(std::vector<BPO>{edited}).stats.inserted == 1, "split batch store failed");
+    assert_true(cas.count() == 2, "both versions should be stored");
+    assert_true(geometry_cas->count() == 1, "attribute-only edit stored a second geometry");
+
+    bsoncxx::builder::stream::document filter;
+    filter << "hash" << edited_hash.to_bson();
+    auto raw = collection.find_one(filter.view());
+    assert_true(raw && is_geometry_reference(raw->view()), "stored object does not reference its geometry");
+    HashId geometry_hash;
+    assert_true(read_geometry_hash(raw->view(), geometry_hash) &&
+                geometry_hash == GeometryCAS::compute_hash(polygon.view()), "geometry reference mismatch");
+    assert_true(raw->view()[kAttributesHashField].type() == bsoncxx::type::k_binary, "attributes hash missing");
+
+    auto loaded = cas.retrieve(edited_hash);
+    assert_true(loaded && same_bson(loaded->get_geometry(), polygon.view()), "retrieve did not reassemble the geometry");
+    assert_true(same_bson(loaded->get_attributes(), after.view()), "retrieve lost the attributes");
+    assert_true(cas.compute_hash(*loaded) == edited_hash, "reassembled object hashes differently");
+
+    auto many = cas.retrieve_many({first_hash, edited_hash, HashId()});
+    assert_true(many[0] && many[1] && !many[2], "retrieve_many mismatch");
+    assert_true(same_bson(many[0]->get_geometry(), polygon.view()), "retrieve_many did not reassemble");
+    assert_true(geometry_cas->get_cache_stats().entries == 1, "geometry not cached independently");
+
+    assert_true(cas.find_by_geometry_type(GeometryType::Polygon).size() == 2, "type query missed split objects");
+    assert_true(cas.find_in_bbox(29.0, 59.0, 31.0, 61.0).size() == 2, "bbox query missed split objects");
+
+    auto cursor = cas.scan();
+    assert_true(cursor->next(), "scan returned nothing");
+    BPO current = cursor->current_bpo();
+    assert_true(!current.is_borrowed() && same_bson(current.get_geometry(), polygon.view()),
+                "cursor did not reassemble the geometry");
+
+    assert_true(cas.remove(first_hash) && geometry_cas->count() == 1, "removing one version dropped the shared geometry");
+    assert_true(cas.retrieve(edited_hash) != nullptr, "remaining version lost its geometry");
+}
+
+void test_cas_chunked_geometry() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    auto geometries = conn.get_bpo_geometries_collection();
+    auto chunks = conn.get_bpo_geometry_chunks_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+    geometries.delete_many(empty_filter.view());
+    chunks.delete_many(empty_filter.view());
+
+    auto geometry_cas = std::make_shared<GeometryCAS>(geometries, chunks);
+    cas.set_geometry_cas(geometry_cas, GeometryCAS::kChunkThreshold);
+
+    auto attributes = bsoncxx::from_json(R"({"name": "region"})");
+    auto small = bsoncxx::from_json(R"({"type": "Point", "coordinates": [30.0, 60.0]})");
+    BPO point(HashId(), small.view(), attributes.view());
+    assert_true(cas.store(point) && geometry_cas->count() == 0, "small geometry left bpo_cas");
+
+    auto polygon = make_large_polygon(400000);
+    assert_true(polygon.view().length() >= GeometryCAS::kChunkThreshold, "test polygon is not oversized");
+    BPO region(HashId(), polygon.view(), attributes.view());
+    HashId hash = cas.compute_hash(region);
+    assert_true(cas.store(region), "oversized geometry not stored");
+    int64_t first_chunks = chunks.count_documents(empty_filter.view());
+    assert_true(first_chunks > 1 && geometry_cas->count() == 1, "oversized geometry not chunked");
+
+    geometry_cas->clear_cache();
+    auto loaded = cas.retrieve(hash);
+    assert_true(loaded && same_bson(loaded->get_geometry(), polygon.view()), "chunked geometry did not round-trip");
+    assert_true(cas.compute_hash(*loaded) == hash, "chunked geometry hashes differently");
+
+    auto edited = make_large_polygon(400000, 200000);
+    BPO next_version(HashId(), edited.view(), attributes.view());
+    assert_true(cas.store_many(std::vector<BPO>{next_version}).stats.inserted == 1, "edited geometry not stored");
+    int64_t added = chunks.count_documents(empty_filter.view()) - first_chunks;
+    assert_true(added >= 1 && added <= 2, "edited version did not reuse unchanged chunks");
+
+    auto both = cas.retrieve_many({hash, cas.compute_hash(next_version)});
+    assert_true(both[0] && both[1] && same_bson(both[1]->get_geometry(), edited.view()), "batch retrieve of chunked geometries failed");
+}
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/json.hpp>
+
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/geometry_store/geometry_store.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static HashId hash_of(uint8_t seed) {
+    HashId hash;
+    hash.data()[0] = seed;
+    return hash;
+}
+
+static bool same_bson(const bsoncxx::document::view& a, const bsoncxx::document::view& b) {
+    return a.length() == b.length() && std::memcmp(a.data(), b.data(), a.length()) == 0;
+}
+
+void test_geometry_store_columns() {
+    std::vector<std::string> geometries = {
+        R"({"type": "Point", "coordinates": [30.5, 10.25]})",
+        R"({"type": "LineString", "coordinates": [[1.0, 2.0], [3.0, 4.0], [5.0, 1.0]]})",
+        R"({"type": "Polygon", "coordinates": [[[0.0, 0.0], [4.0, 0.0], [4.0, 4.0], [0.0, 0.0]], [[1.0, 1.0], [2.0, 1.0], [2.0, 2.0], [1.0, 1.0]]]})",
+        R"({"type": "MultiPoint", "coordinates": [[-10.0, -10.0], [-11.0, -12.0]]})",
+        R"({"type": "MultiLineString", "coordinates": [[[0.0, 0.0], [1.0, 1.0]], [[2.0, 2.0], [3.0, 3.0]]]})",
+        R"({"type": "MultiPolygon", "coordinates": [[[[0.0, 0.0], [1.0, 0.0], [1.0, 1.0], [0.0, 0.0]]], [[[5.0, 5.0], [6.0, 5.0], [6.0, 6.0], [5.0, 5.0]]]]})",
+        R"({"type": "GeometryCollection", "geometries": [{"type": "Point", "coordinates": [7.0, 7.0]}, {"type": "LineString", "coordinates": [[8.0, 8.0], [9.0, 9.0]]}]})"
+    };
+
+    GeometryStore store;
+    std::vector<bsoncxx::document::value> sources;
+    for (size_t i = 0; i < geometries.size(); ++i) {
+        sources.push_back(bsoncxx::from_json(geometries[i]));
+        assert_true(store.append(hash_of(static_cast<uint8_t>(i + 1)), sources.back().view()),
+                    "GeometryStore rejected " + geometries[i]);
+    }
+    assert_true(store.size() == geometries.size(), "GeometryStore size mismatch");
+    assert_true(store.position_count() == 1 + 3 + 8 + 2 + 4 + 8 + 3, "GeometryStore position count mismatch");
+
+    for (size_t i = 0; i < store.size(); ++i) {
+        assert_true(store.hash(i) == hash_of(static_cast<uint8_t>(i + 1)), "GeometryStore hash mismatch");
+        assert_true(store.type(i) == GeoJSONValidator::get_type(sources[i].view()), "GeometryStore type mismatch");
+        assert_true(same_bson(store.to_bson(i).view(), sources[i].view()),
+                    "GeometryStore round trip changed " + geometries[i]);
+        assert_true(store.validate(i), "GeometryStore rejected valid " + geometries[i]);
+    }
+
+    assert_true(store.envelope(2) == Envelope(0.0, 0.0, 4.0, 4.0), "polygon envelope mismatch");
+    auto range = store.position_range(1);
+    assert_true(range.second - range.first == 3 && store.xs()[range.first] == 1.0, "LineString position range mismatch");
+
+    auto within = store.query_within(Envelope(-1.0, -1.0, 5.5, 4.5));
+    assert_true(within == std::vector<size_t>({1, 2, 4}), "query_within mismatch");
+    auto intersects = store.query_intersects(Envelope(5.5, 5.5, 7.5, 7.5));
+    assert_true(intersects == std::vector<size_t>({5, 6}), "query_intersects mismatch");
+    assert_true(store.spatial_entries().size() == store.size(), "spatial entries missing");
+
+    size_t positions = store.position_count();
+    auto nested = bsoncxx::from_json(R"({"type": "GeometryCollection", "geometries": [{"type": "Point", "coordinates": [1.0, 1.0]}, {"type": "GeometryCollection", "geometries": []}]})");
+    auto integer = bsoncxx::from_json(R"({"type": "LineString", "coordinates": [[1.0, 2.0], [3, 4]]})");
+    auto altitude = bsoncxx::from_json(R"({"type": "Point", "coordinates": [1.0, 2.0, 3.0]})");
+    assert_true(!store.append(HashId(), nested.view()), "nested GeometryCollection accepted");
+    assert_true(!store.append(HashId(), integer.view()), "integer coordinates accepted");
+    assert_true(!store.append(HashId(), altitude.view()), "3D position accepted");
+    assert_true(store.size() == geometries.size() && store.position_count() == positions,
+                "rejected geometry left data behind");
+
+    auto open_ring = bsoncxx::from_json(R"({"type": "Polygon", "coordinates": [[[0.0, 0.0], [1.0, 0.0], [1.0, 1.0], [0.0, 1.0]]]})");
+    auto out_of_range = bsoncxx::from_json(R"({"type": "Point", "coordinates": [200.0, 0.0]})");
+    assert_true(store.append(HashId(), open_ring.view()) && !store.validate(store.size() - 1), "open ring passed validation");
+    assert_true(store.append(HashId(), out_of_range.view()) && !store.validate(store.size() - 1), "out-of-range point passed validation");
+    assert_true(store.memory_usage() > 0, "memory usage not reported");
+
+    store.clear();
+    assert_true(store.size() == 0 && store.position_count() == 0, "GeometryStore clear left data");
+}
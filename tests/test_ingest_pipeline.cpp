@@ -0,0 +1,119 @@
+#include <iostream>
+#include <cstdlib>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <bsoncxx/builder/stream/document.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/ingest_pipeline/bounded_queue.h"
+#include "storage/ingest_pipeline/ingest_pipeline.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static std::string make_feature_json(int index) {
+    return "{\"type\": \"Feature\", \"geometry\": {\"type\": \"Point\", \"coordinates\": [" +
+           std::to_string(static_cast<double>(index % 360) - 180.0) + ", " +
+           std::to_string(static_cast<double>(index % 180) - 90.0) + "]}, " +
+           "\"properties\": {\"index\": " + std::to_string(index) + "}}";
+}
+
+void test_bounded_queue_mpmc() {
+    BoundedQueue<int> queue(64);
+    assert_true(queue.capacity() == 64, "BoundedQueue capacity mismatch");
+
+    const int producers = 4;
+    const int per_producer = 10000;
+    std::atomic<long long> sum{0};
+    std::atomic<int> popped{0};
+
+    std::vector<std::thread> consumers;
+    for (int c = 0; c < 3; ++c) {
+        consumers.emplace_back([&]() {
+            int value = 0;
+            while (queue.pop(value)) {
+                sum += value;
+                ++popped;
+            }
+        });
+    }
+
+    std::vector<std::thread> threads;
+    for (int p = 0; p < producers; ++p) {
+        threads.emplace_back([&, p]() {
+            for (int i = 1; i <= per_producer; ++i) {
+                int value = p * per_producer + i;
+                queue.push(value);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    queue.close();
+    for (auto& thread : consumers) {
+        thread.join();
+    }
+
+    long long total = static_cast<long long>(producers) * per_producer;
+    assert_true(popped.load() == total, "BoundedQueue lost items");
+    assert_true(sum.load() == total * (total + 1) / 2, "BoundedQueue corrupted items");
+
+    int value = 7;
+    assert_true(!queue.push(value), "BoundedQueue accepted push after close");
+}
+
+void test_ingest_pipeline_store() {
+    MongoDBConnection conn(get_mongo_uri(), "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    IngestPipelineOptions options;
+    options.queue_capacity = 16;
+    options.batch_size = 64;
+    IngestPipeline pipeline(cas, options);
+
+    size_t batches = 0;
+    pipeline.set_on_batch([&](const StoreManyResult&) { ++batches; });
+    pipeline.start();
+
+    for (int i = 0; i < 500; ++i) {
+        assert_true(pipeline.submit_json(make_feature_json(i)), "IngestPipeline rejected submit");
+    }
+    pipeline.submit_json(make_feature_json(0));
+    pipeline.submit_json("{not json");
+    pipeline.submit_json("{\"type\": \"Feature\", \"geometry\": {\"type\": \"Point\", \"coordinates\": [500.0, 0.0]}}");
+
+    IngestPipelineStats stats = pipeline.finish();
+    assert_true(stats.submitted == 503, "IngestPipeline submitted count mismatch");
+    assert_true(stats.stages.size() == 4, "IngestPipeline stage count mismatch");
+    assert_true(stats.stages[0].rejected == 1, "IngestPipeline parse did not reject bad JSON");
+    assert_true(stats.stages[1].rejected == 1, "IngestPipeline validate did not reject bad geometry");
+    assert_true(stats.store.inserted == 500, "IngestPipeline insert count mismatch");
+    assert_true(stats.store.duplicates == 1, "IngestPipeline duplicate count mismatch");
+    assert_true(stats.store.failed == 0, "IngestPipeline store failures");
+    assert_true(batches >= 500 / options.batch_size, "IngestPipeline wrote too few batches");
+    assert_true(cas.count() == 500, "IngestPipeline stored count mismatch");
+}
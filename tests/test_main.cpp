@@ -5,6 +5,49 @@ extern void test_cas_basic();
 extern void test_cas_hash_computation();
 extern void test_cas_store_retrieve();
 extern void test_cas_deduplication();
+extern void test_cas_store_many();
+extern void test_cas_retrieve_many();
+extern void test_cas_canonical_hash();
+extern void test_cas_streaming_cursor();
+extern void test_cas_persisted_envelope();
+extern void test_hash_id_encoding();
+extern void test_object_cache_eviction();
+extern void test_object_cache_oversized_candidate();
+extern void test_cas_cached_retrieve();
+extern void test_existence_filter_rebuild();
+extern void test_cas_existence_filter();
+extern void test_existence_filter_concurrent_rebuild();
+extern void test_spatial_index_queries();
+extern void test_cas_spatial_index();
+extern void test_connection_pool_leases();
+extern void test_connection_uri_pool_size();
+extern void test_connection_initializes_indexes();
+extern void test_cas_concurrent_pool();
+extern void test_bounded_queue_mpmc();
+extern void test_ingest_pipeline_store();
+extern void test_geojson_reader_features();
+extern void test_geojson_import_file();
+extern void test_geojson_writer_format();
+extern void test_geojson_export_cas();
+extern void test_geojson_validator_types();
+extern void test_bpo_borrowed_decode();
+extern void test_geometry_store_columns();
+extern void test_coordinate_codec_roundtrip();
+extern void test_cas_precision_blob();
+extern void test_cas_split_geometry();
+extern void test_geometry_chunker_roundtrip();
+extern void test_geometry_chunker_integer_positions();
+extern void test_cas_chunked_geometry();
+extern void test_situation_commit_history();
+extern void test_situation_keyframe_checkout();
+extern void test_version_diff_sorted();
+extern void test_version_diff_deltas();
+extern void test_merkle_tree_diff_sync();
+extern void test_version_merge_three_way();
+extern void test_garbage_collector_sweep();
+extern void test_garbage_collector_geometries();
+extern void test_migration_keyframe_and_delta_versions();
+extern void test_migration_merged_delta_versions();
 
 int main() {
     std::cout << "Running GeoVersion Control System tests..." << std::endl;
@@ -13,6 +56,49 @@ int main() {
     test_cas_hash_computation();
     test_cas_store_retrieve();
     test_cas_deduplication();
+    test_cas_store_many();
+    test_cas_retrieve_many();
+    test_cas_canonical_hash();
+    test_cas_streaming_cursor();
+    test_cas_persisted_envelope();
+    test_hash_id_encoding();
+    test_object_cache_eviction();
+    test_object_cache_oversized_candidate();
+    test_cas_cached_retrieve();
+    test_existence_filter_rebuild();
+    test_cas_existence_filter();
+    test_existence_filter_concurrent_rebuild();
+    test_spatial_index_queries();
+    test_cas_spatial_index();
+    test_connection_pool_leases();
+    test_connection_uri_pool_size();
+    test_connection_initializes_indexes();
+    test_cas_concurrent_pool();
+    test_bounded_queue_mpmc();
+    test_ingest_pipeline_store();
+    test_geojson_reader_features();
+    test_geojson_import_file();
+    test_geojson_writer_format();
+    test_geojson_export_cas();
+    test_geojson_validator_types();
+    test_bpo_borrowed_decode();
+    test_geometry_store_columns();
+    test_coordinate_codec_roundtrip();
+    test_cas_precision_blob();
+    test_cas_split_geometry();
+    test_geometry_chunker_roundtrip();
+    test_geometry_chunker_integer_positions();
+    test_cas_chunked_geometry();
+    test_situation_commit_history();
+    test_situation_keyframe_checkout();
+    test_version_diff_sorted();
+    test_version_diff_deltas();
+    test_merkle_tree_diff_sync();
+    test_version_merge_three_way();
+    test_garbage_collector_sweep();
+    test_garbage_collector_geometries();
+    test_migration_keyframe_and_delta_versions();
+    test_migration_merged_delta_versions();
     
     std::cout << "All tests completed." << std::endl;
     return EXIT_SUCCESS;
@@ -0,0 +1,145 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/stream/document.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/merkle_tree/merkle_tree.h"
+#include "storage/situation_repository/situation_repository.h"
+#include "storage/version_diff/version_diff.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static std::vector<HashId> sorted_hashes(size_t count, uint32_t seed) {
+    std::vector<HashId> hashes(count);
+    uint32_t value = seed;
+    for (auto& hash : hashes) {
+        for (size_t i = 0; i < HashId::kSize; ++i) {
+            value = value * 1664525u + 1013904223u;
+            hash.data()[i] = static_cast<uint8_t>(value >> 24);
+        }
+    }
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    return hashes;
+}
+
+void test_merkle_tree_diff_sync() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto nodes = conn.get_merkle_nodes_collection();
+    auto replica_nodes = conn.get_database().collection("merkle_nodes_replica");
+
+    bsoncxx::builder::stream::document empty_filter;
+    nodes.delete_many(empty_filter.view());
+    replica_nodes.delete_many(empty_filter.view());
+
+    MerkleTree tree(nodes);
+    auto first = sorted_hashes(200000, 11);
+
+    HashId first_root;
+    MerkleBuildStats first_stats;
+    assert_true(tree.build(first, first_root, &first_stats), "first tree not stored");
+    assert_true(first_stats.written == first_stats.nodes && first_stats.nodes > 256, "first tree not written whole");
+
+    auto second = first;
+    second.erase(second.begin() + 1000);
+    second.erase(second.begin() + 150000);
+    auto extra = sorted_hashes(2, 12);
+    second.insert(second.end(), extra.begin(), extra.end());
+    std::sort(second.begin(), second.end());
+
+    HashId second_root;
+    MerkleBuildStats second_stats;
+    assert_true(tree.build(second, second_root, &second_stats), "second tree not stored");
+    assert_true(second_root != first_root, "different sets share a root");
+    assert_true(second_stats.written <= 4 * 3, "unchanged subtrees were written again");
+
+    HashId again;
+    MerkleBuildStats again_stats;
+    assert_true(tree.build(second, again, &again_stats) && again == second_root && again_stats.written == 0,
+                "rebuilding the same set wrote nodes");
+
+    std::vector<HashId> added;
+    std::vector<HashId> removed;
+    MerkleDiffStats diff_stats;
+    assert_true(tree.diff(first_root, second_root, added, removed, &diff_stats), "tree diff failed");
+    std::vector<HashId> expected_added;
+    std::vector<HashId> expected_removed;
+    std::set_difference(second.begin(), second.end(), first.begin(), first.end(), std::back_inserter(expected_added));
+    std::set_difference(first.begin(), first.end(), second.begin(), second.end(), std::back_inserter(expected_removed));
+    assert_true(added == expected_added && removed == expected_removed, "tree diff mismatch");
+    assert_true(diff_stats.nodes_loaded <= 2 + 4 * 4, "tree diff loaded unchanged subtrees");
+
+    std::vector<HashId> read;
+    assert_true(tree.read_refs(second_root, read) && read == second, "tree refs mismatch");
+
+    HashId empty;
+    assert_true(tree.build({}, empty) && empty == MerkleTree::empty_root(), "empty tree root mismatch");
+
+    MerkleTree replica(replica_nodes);
+    auto full = tree.sync(first_root, replica);
+    assert_true(full.ok && full.nodes_copied == first_stats.nodes && full.refs_copied == first.size(), "full sync mismatch");
+    size_t new_refs = 0;
+    auto incremental = tree.sync(second_root, replica, [&new_refs](const HashId&) {
+        ++new_refs;
+    });
+    assert_true(incremental.ok && incremental.nodes_copied == second_stats.written, "incremental sync copied shared nodes");
+    assert_true(new_refs == incremental.refs_copied && new_refs < 4 * MerkleTree::kLeafCapacity, "sync reported too many refs");
+    assert_true(replica.read_refs(second_root, read) && read == second, "replica tree mismatch");
+
+    CAS cas(conn.get_bpo_cas_collection());
+    SituationRepository repository(conn, cas);
+    repository.set_merkle_tree(std::make_shared<MerkleTree>(nodes));
+    VersionDiffOptions options;
+    options.store = false;
+    VersionDiff differ(conn, repository, cas, options);
+
+    auto situation = repository.create_situation("merkle");
+    assert_true(situation.has_value(), "situation not created");
+    VersionCommit commit;
+    commit.situation_id = situation->situation_id;
+    commit.refs = first;
+    CommitResult v1 = repository.commit_version(commit);
+    commit.refs = second;
+    CommitResult v2 = repository.commit_version(commit);
+    assert_true(v1.ok && v2.ok && v1.merkle_root == first_root && v2.merkle_root == second_root, "commit roots mismatch");
+    assert_true(v2.merkle.written == 0, "commit rewrote stored nodes");
+
+    bool same = true;
+    assert_true(differ.identical(v1.version_id, v2.version_id, same) && !same, "different versions reported identical");
+    assert_true(differ.identical(v2.version_id, v2.version_id, same) && same, "version differs from itself");
+
+    VersionDelta delta;
+    assert_true(differ.diff(v1.version_id, v2.version_id, delta), "version diff through the tree failed");
+    assert_true(delta.added == expected_added && delta.removed == expected_removed, "version diff through the tree mismatch");
+
+    // Rewriting refs without the tree must not leave the old root behind.
+    SituationRepository untracked(conn, cas);
+    assert_true(untracked.replace_refs(v2.version_id, first), "refs not replaced");
+    auto rewritten = repository.get_version(v2.version_id);
+    assert_true(rewritten && rewritten->merkle_root.is_null(), "stale Merkle root kept after replace_refs");
+    assert_true(differ.identical(v1.version_id, v2.version_id, same) && same, "diff trusted a stale Merkle root");
+}
@@ -0,0 +1,191 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/json.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/situation_repository/situation_repository.h"
+#include "storage/migration/migration.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static BPO feature(double lon, const std::string& attributes_json) {
+    auto geometry = bsoncxx::from_json(R"({"type": "Point", "coordinates": [)" + std::to_string(lon) + ", 2.5]}");
+    auto attributes = bsoncxx::from_json(attributes_json);
+    return BPO(HashId(), geometry.view(), attributes.view());
+}
+
+static std::vector<HashId> canonical_refs(CAS& cas, const std::vector<BPO>& bpos) {
+    std::vector<HashId> refs;
+    for (const auto& bpo : bpos) {
+        refs.push_back(cas.compute_canonical_hash(bpo.get_geometry(), bpo.get_attributes()));
+    }
+    std::sort(refs.begin(), refs.end());
+    refs.erase(std::unique(refs.begin(), refs.end()), refs.end());
+    return refs;
+}
+
+void test_migration_keyframe_and_delta_versions() {
+    // Migration rewrites every version in the database, so it gets one of its own.
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion_migration_test");
+    conn.get_database().drop();
+    assert_true(conn.initialize_database(), "migration test database not initialized");
+
+    CAS legacy(conn, HashMode::LegacyJson);
+    SituationRepository repository(conn, legacy);
+    KeyframePolicy policy;
+    policy.interval = 3;
+    repository.set_keyframe_policy(policy);
+
+    std::vector<BPO> bpos;
+    for (int i = 0; i < 11; ++i) {
+        bpos.push_back(feature(static_cast<double>(i), R"({"id": )" + std::to_string(i) + R"(, "kind": "road"})"));
+    }
+    BPO edited = feature(0.5, R"({"id": 0, "kind": "bridge"})");
+
+    auto situation = repository.create_situation("migration");
+    assert_true(situation.has_value(), "situation not created");
+
+    // Keyframe, two deltas (an addition, then an edit and a removal), and
+    // the next keyframe with one more delta on top.
+    std::vector<BPO> base(bpos.begin(), bpos.begin() + 8);
+    std::vector<std::vector<BPO>> contents = {base};
+    contents.push_back(contents.back());
+    contents.back().push_back(bpos[8]);
+    contents.push_back(std::vector<BPO>(bpos.begin() + 1, bpos.begin() + 7));
+    contents.back().push_back(bpos[8]);
+    contents.back().push_back(edited);
+    contents.push_back(contents.back());
+    contents.back().push_back(bpos[9]);
+    contents.push_back(std::vector<BPO>(contents.back().begin() + 1, contents.back().end()));
+    contents.back().push_back(bpos[10]);
+
+    std::vector<CommitResult> commits;
+    for (const auto& content : contents) {
+        VersionCommit commit;
+        commit.situation_id = situation->situation_id;
+        if (!commits.empty()) {
+            commit.parent_version_ids = {commits.back().version_id};
+        }
+        commit.bpos = content;
+        commits.push_back(repository.commit_version(commit));
+        assert_true(commits.back().ok, "commit failed: " + commits.back().error);
+    }
+    assert_true(commits[0].keyframe && !commits[1].keyframe && !commits[2].keyframe, "first chain not stored as deltas");
+    assert_true(commits[3].keyframe && !commits[4].keyframe, "second chain not stored as deltas");
+
+    Migration migration(conn);
+    HashMigrationReport before = migration.verify_hashes();
+    assert_true(before.scanned == 12 && before.legacy == 12 && before.canonical == 0, "legacy hashes not detected");
+
+    HashMigrationReport report = migration.migrate_hashes();
+    assert_true(report.migrated == 12 && report.failed == 0 && report.references_failed == 0, "legacy hashes not migrated");
+    assert_true(report.references_updated > 0, "version references not rewritten");
+
+    HashMigrationReport after = migration.verify_hashes();
+    assert_true(after.canonical == 12 && after.legacy == 0 && after.unknown == 0, "hashes not canonical after migration");
+
+    CAS cas(conn);
+    SituationRepository migrated(conn, cas);
+    for (size_t i = 0; i < commits.size(); ++i) {
+        auto refs = migrated.checkout(commits[i].version_id);
+        assert_true(refs && *refs == canonical_refs(cas, contents[i]), "version unreadable after migration: " + std::to_string(i));
+        for (const auto& hash : *refs) {
+            assert_true(cas.exists(hash), "migrated version refers to a missing object");
+        }
+    }
+
+    conn.get_database().drop();
+}
+
+void test_migration_merged_delta_versions() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion_migration_test");
+    conn.get_database().drop();
+    assert_true(conn.initialize_database(), "migration test database not initialized");
+
+    CAS legacy(conn, HashMode::LegacyJson);
+    SituationRepository repository(conn, legacy);
+    KeyframePolicy policy;
+    policy.interval = 5;
+    repository.set_keyframe_policy(policy);
+
+    BPO a = feature(1.0, R"({"id": 1})");
+    BPO b = feature(2.0, R"({"id": 2})");
+    // The same object with its attributes in another order: two legacy
+    // hashes that migrate to one canonical hash.
+    BPO first = feature(3.0, R"({"id": 3, "name": "merged"})");
+    BPO second = feature(3.0, R"({"name": "merged", "id": 3})");
+    assert_true(legacy.compute_hash(first) != legacy.compute_hash(second), "legacy hashes collide");
+
+    auto situation = repository.create_situation("migration");
+    assert_true(situation.has_value(), "situation not created");
+
+    VersionCommit commit;
+    commit.situation_id = situation->situation_id;
+    commit.bpos = {a, b};
+    CommitResult keyframe = repository.commit_version(commit);
+    assert_true(keyframe.ok && keyframe.keyframe, "keyframe commit failed: " + keyframe.error);
+
+    commit.parent_version_ids = {keyframe.version_id};
+    commit.bpos = {first};
+    commit.refs = {legacy.compute_hash(a), legacy.compute_hash(b)};
+    CommitResult one = repository.commit_version(commit);
+    assert_true(one.ok && !one.keyframe, "first delta commit failed: " + one.error);
+
+    commit.parent_version_ids = {one.version_id};
+    commit.bpos = {second};
+    commit.refs = {legacy.compute_hash(a), legacy.compute_hash(b), legacy.compute_hash(first)};
+    CommitResult both = repository.commit_version(commit);
+    assert_true(both.ok && !both.keyframe && both.ref_count == 4, "second delta commit failed: " + both.error);
+
+    commit.parent_version_ids = {both.version_id};
+    commit.bpos = {};
+    commit.refs = {legacy.compute_hash(a), legacy.compute_hash(b), legacy.compute_hash(second)};
+    CommitResult last = repository.commit_version(commit);
+    assert_true(last.ok && !last.keyframe, "third delta commit failed: " + last.error);
+
+    Migration migration(conn);
+    HashMigrationReport report = migration.migrate_hashes();
+    assert_true(report.merged == 1 && report.failed == 0, "legacy duplicates not merged");
+    assert_true(report.references_failed == 0, "versions left unreadable by the migration");
+
+    CAS cas(conn);
+    SituationRepository migrated(conn, cas);
+    std::vector<std::pair<std::string, std::vector<BPO>>> expected = {
+        {keyframe.version_id, {a, b}},
+        {one.version_id, {a, b, first}},
+        {both.version_id, {a, b, first}},
+        {last.version_id, {a, b, second}}
+    };
+    for (const auto& entry : expected) {
+        auto refs = migrated.checkout(entry.first);
+        assert_true(refs && *refs == canonical_refs(cas, entry.second), "merged version unreadable: " + entry.first);
+    }
+    auto flattened = migrated.get_version(both.version_id);
+    assert_true(flattened && flattened->delta_chain.empty() && flattened->ref_count == 3, "merged delta version not flattened");
+
+    conn.get_database().drop();
+}
@@ -0,0 +1,165 @@
+#include <iostream>
+#include <cstdlib>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/object_cache/object_cache.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static HashId make_hash(uint8_t seed) {
+    HashId hash;
+    for (size_t i = 0; i < HashId::kSize; ++i) {
+        hash.data()[i] = static_cast<uint8_t>(seed * 31 + i * 7);
+    }
+    return hash;
+}
+
+static std::shared_ptr<const BPO> make_cached_bpo(double lon) {
+    bsoncxx::builder::basic::document geom_builder;
+    bsoncxx::builder::basic::array coords;
+    coords.append(lon);
+    coords.append(0.0);
+    geom_builder.append(bsoncxx::builder::basic::kvp("type", "Point"));
+    geom_builder.append(bsoncxx::builder::basic::kvp("coordinates", coords));
+
+    bsoncxx::builder::basic::document attr_builder;
+    attr_builder.append(bsoncxx::builder::basic::kvp("class", "cache"));
+
+    auto geom_value = geom_builder.extract();
+    auto attr_value = attr_builder.extract();
+    return std::make_shared<const BPO>(HashId(), geom_value.view(), attr_value.view());
+}
+
+void test_object_cache_eviction() {
+    size_t object_size = ObjectCache::estimate_size(*make_cached_bpo(0.0));
+
+    ObjectCacheOptions options;
+    options.shard_count = 1;
+    options.capacity_bytes = object_size * 20;
+    ObjectCache cache(options);
+
+    HashId hot = make_hash(1);
+    cache.put(hot, make_cached_bpo(1.0));
+    for (int i = 0; i < 5; ++i) {
+        assert_true(static_cast<bool>(cache.get(hot)), "ObjectCache lost hot object");
+    }
+
+    for (uint8_t i = 10; i < 200; ++i) {
+        HashId cold = make_hash(i);
+        cache.get(cold);
+        cache.put(cold, make_cached_bpo(static_cast<double>(i) / 10.0));
+    }
+
+    ObjectCacheStats stats = cache.get_stats();
+    assert_true(static_cast<bool>(cache.get(hot)), "ObjectCache scan evicted hot object");
+    assert_true(stats.bytes <= options.capacity_bytes, "ObjectCache exceeded byte capacity");
+    assert_true(stats.evictions + stats.rejections > 0, "ObjectCache did not evict under pressure");
+    assert_true(stats.hits >= 5, "ObjectCache hit counter mismatch");
+
+    HashId absent = make_hash(250);
+    cache.mark_missing(absent);
+    assert_true(cache.is_known_missing(absent), "ObjectCache negative entry missing");
+    cache.put(absent, make_cached_bpo(25.0));
+    assert_true(!cache.is_known_missing(absent), "ObjectCache put did not clear negative entry");
+}
+
+static std::shared_ptr<const BPO> make_large_bpo(size_t points) {
+    bsoncxx::builder::basic::document geom_builder;
+    bsoncxx::builder::basic::array coords;
+    for (size_t i = 0; i < points; ++i) {
+        bsoncxx::builder::basic::array point;
+        point.append(static_cast<double>(i % 360) - 180.0);
+        point.append(static_cast<double>(i % 180) - 90.0);
+        coords.append(point);
+    }
+    geom_builder.append(bsoncxx::builder::basic::kvp("type", "LineString"));
+    geom_builder.append(bsoncxx::builder::basic::kvp("coordinates", coords));
+
+    bsoncxx::builder::basic::document attr_builder;
+    attr_builder.append(bsoncxx::builder::basic::kvp("class", "large"));
+
+    auto geom_value = geom_builder.extract();
+    auto attr_value = attr_builder.extract();
+    return std::make_shared<const BPO>(HashId(), geom_value.view(), attr_value.view());
+}
+
+void test_object_cache_oversized_candidate() {
+    auto large = make_large_bpo(2000);
+
+    // Fits the whole cache but not its main area.
+    ObjectCacheOptions options;
+    options.shard_count = 1;
+    options.capacity_bytes = ObjectCache::estimate_size(*large);
+    ObjectCache cache(options);
+
+    std::vector<HashId> resident;
+    for (uint8_t i = 1; i <= 5; ++i) {
+        resident.push_back(make_hash(i));
+        cache.put(resident.back(), make_cached_bpo(static_cast<double>(i)));
+        cache.get(resident.back());
+    }
+
+    // More popular than any resident, so only its size can reject it.
+    HashId candidate = make_hash(100);
+    for (int i = 0; i < 10; ++i) {
+        cache.get(candidate);
+    }
+    ObjectCacheStats before = cache.get_stats();
+    cache.put(candidate, large);
+
+    ObjectCacheStats after = cache.get_stats();
+    assert_true(after.rejections == before.rejections + 1, "ObjectCache admitted an oversized object");
+    assert_true(after.evictions == before.evictions, "ObjectCache evicted for a rejected object");
+    for (const HashId& hash : resident) {
+        assert_true(static_cast<bool>(cache.get(hash)), "ObjectCache lost an entry to a rejected object");
+    }
+}
+
+void test_cas_cached_retrieve() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+    auto cache = std::make_shared<ObjectCache>();
+    cas.set_cache(cache);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    BPO bpo(*make_cached_bpo(42.0));
+    HashId hash = cas.compute_hash(bpo);
+
+    assert_true(!cas.exists(hash), "CAS exists before store");
+    assert_true(cas.store(bpo), "CAS store with cache failed");
+    assert_true(cas.exists(hash), "CAS negative cache not invalidated by store");
+
+    auto first = cas.retrieve_shared(hash);
+    auto second = cas.retrieve_shared(hash);
+    assert_true(first && first == second, "CAS cache did not share handle");
+    assert_true(cache->get_stats().hits >= 1, "CAS cache recorded no hits");
+}
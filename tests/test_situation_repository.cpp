@@ -0,0 +1,203 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/stream/document.hpp>
+#include <bsoncxx/json.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/situation_repository/situation_repository.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static HashId synthetic_hash(uint32_t seed) {
+    HashId hash;
+    uint32_t value = seed * 2654435761u;
+    for (size_t i = 0; i < HashId::kSize; ++i) {
+        value = value * 1664525u + 1013904223u;
+        hash.data()[i] = static_cast<uint8_t>(value >> 24);
+    }
+    return hash;
+}
+
+void test_situation_commit_history() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    CAS cas(conn.get_bpo_cas_collection());
+    SituationRepository repository(conn, cas);
+
+    bsoncxx::builder::stream::document empty_filter;
+    conn.get_bpo_cas_collection().delete_many(empty_filter.view());
+    conn.get_situations_collection().delete_many(empty_filter.view());
+    conn.get_situation_versions_collection().delete_many(empty_filter.view());
+    conn.get_situation_version_refs_collection().delete_many(empty_filter.view());
+
+    auto situation = repository.create_situation("harbour", "test situation");
+    assert_true(situation && !situation->situation_id.empty(), "situation not created");
+    assert_true(situation->head_version_id.empty(), "new situation has a head");
+
+    auto point = bsoncxx::from_json(R"({"type": "Point", "coordinates": [30.0, 60.0]})");
+    auto buoy = bsoncxx::from_json(R"({"name": "buoy"})");
+    auto pier = bsoncxx::from_json(R"({"name": "pier"})");
+
+    VersionCommit first;
+    first.situation_id = situation->situation_id;
+    first.commit_message = "initial";
+    first.author = "tester";
+    first.bpos.emplace_back(HashId(), point.view(), buoy.view());
+    first.bpos.emplace_back(HashId(), point.view(), pier.view());
+    size_t synthetic = SituationRepository::kRefsPerChunk * 2 + 100;
+    for (uint32_t i = 0; i < synthetic; ++i) {
+        first.refs.push_back(synthetic_hash(i));
+    }
+    first.refs.push_back(synthetic_hash(7));
+
+    CommitResult v1 = repository.commit_version(first);
+    assert_true(v1.ok, "first commit failed: " + v1.error);
+    assert_true(v1.ref_count == synthetic + 2, "duplicate refs were not collapsed");
+    assert_true(v1.ref_chunks == 3, "refs not split into chunks");
+    assert_true(v1.store.inserted == 2, "new objects not stored in the CAS");
+
+    std::vector<HashId> refs;
+    assert_true(repository.read_refs(v1.version_id, refs), "refs not readable");
+    assert_true(refs.size() == v1.ref_count && std::is_sorted(refs.begin(), refs.end()), "refs not sorted");
+    HashId buoy_hash = cas.compute_hash(BPO(HashId(), point.view(), buoy.view()));
+    assert_true(std::binary_search(refs.begin(), refs.end(), buoy_hash), "stored object missing from refs");
+
+    auto head = repository.get_situation(situation->situation_id);
+    assert_true(head && head->head_version_id == v1.version_id, "head not moved to the first version");
+
+    VersionCommit second;
+    second.situation_id = situation->situation_id;
+    second.commit_message = "drop synthetic objects";
+    second.author = "tester";
+    second.refs = {buoy_hash};
+    CommitResult v2 = repository.commit_version(second);
+    assert_true(v2.ok && v2.ref_count == 1 && v2.ref_chunks == 1, "second commit failed");
+
+    auto version = repository.get_version(v2.version_id);
+    assert_true(version && version->parent_version_ids.size() == 1 &&
+                version->parent_version_ids[0] == v1.version_id, "head not used as the parent");
+    assert_true(version->ref_count == 1 && version->commit_message == "drop synthetic objects", "version fields lost");
+
+    auto history = repository.list_history(situation->situation_id);
+    assert_true(history.size() == 2 && history[0].version_id == v2.version_id &&
+                history[1].version_id == v1.version_id, "history not newest first");
+    assert_true(repository.list_history(situation->situation_id, 1).size() == 1, "history limit ignored");
+
+    VersionCommit orphan;
+    orphan.situation_id = situation->situation_id;
+    orphan.parent_version_ids = {"missing"};
+    assert_true(!repository.commit_version(orphan).ok, "unknown parent accepted");
+    orphan.situation_id = "missing";
+    assert_true(!repository.commit_version(orphan).ok, "unknown situation accepted");
+
+    size_t visited = 0;
+    assert_true(repository.for_each_ref(v1.version_id, [&visited](const HashId&) {
+        return ++visited < 10;
+    }) && visited == 10, "for_each_ref did not stop early");
+
+    assert_true(repository.replace_refs(v1.version_id, {buoy_hash, buoy_hash}), "refs not replaced");
+    assert_true(repository.read_refs(v1.version_id, refs) && refs.size() == 1, "replaced refs mismatch");
+}
+
+void test_situation_keyframe_checkout() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    CAS cas(conn.get_bpo_cas_collection());
+    SituationRepository repository(conn, cas);
+    KeyframePolicy policy;
+    policy.interval = 4;
+    policy.max_changes = 1000;
+    repository.set_keyframe_policy(policy);
+
+    auto situation = repository.create_situation("keyframes");
+    assert_true(situation.has_value(), "situation not created");
+
+    std::vector<HashId> current;
+    for (uint32_t i = 0; i < 5000; ++i) {
+        current.push_back(synthetic_hash(100000 + i));
+    }
+    std::sort(current.begin(), current.end());
+
+    // Each version drops ten objects and adds ten new ones.
+    std::vector<CommitResult> versions;
+    std::vector<std::vector<HashId>> expected;
+    uint32_t next = 200000;
+    for (int v = 0; v < 6; ++v) {
+        if (v > 0) {
+            current.erase(current.begin(), current.begin() + 10);
+            for (int i = 0; i < 10; ++i) {
+                current.push_back(synthetic_hash(next++));
+            }
+            std::sort(current.begin(), current.end());
+        }
+        VersionCommit commit;
+        commit.situation_id = situation->situation_id;
+        commit.refs = current;
+        versions.push_back(repository.commit_version(commit));
+        assert_true(versions.back().ok, "keyframe policy commit failed: " + versions.back().error);
+        expected.push_back(current);
+    }
+    bool layout[] = {true, false, false, false, true, false};
+    for (size_t v = 0; v < versions.size(); ++v) {
+        assert_true(versions[v].keyframe == layout[v], "keyframe interval not applied at version " + std::to_string(v));
+    }
+    auto v3 = repository.get_version(versions[3].version_id);
+    assert_true(v3 && v3->delta_chain.size() == 3 && v3->delta_chain[0] == versions[0].version_id &&
+                v3->chain_changes == 60, "delta chain not recorded");
+
+    auto stats = repository.get_storage_stats();
+    assert_true(stats.keyframes == 2 && stats.deltas == 4, "storage counts mismatch");
+    assert_true(stats.refs_written == 2 * 5000 + 4 * 20 && stats.refs_saved == 4 * (5000 - 20), "storage sizes mismatch");
+
+    // A fresh repository has nothing cached and replays the whole chain.
+    SituationRepository reader(conn, cas);
+    std::vector<HashId> refs;
+    assert_true(reader.read_refs(versions[3].version_id, refs) && refs == expected[3], "delta version mismatch");
+    auto handle = reader.checkout(versions[3].version_id);
+    assert_true(handle && *handle == expected[3], "cached checkout mismatch");
+    auto read_stats = reader.get_storage_stats();
+    assert_true(read_stats.checkouts == 2 && read_stats.cache_hits == 1 && read_stats.deltas_applied == 3,
+                "checkout did not replay the chain once");
+
+    handle = reader.checkout(versions[5].version_id);
+    assert_true(handle && *handle == expected[5], "delta after second keyframe mismatch");
+    assert_true(reader.get_storage_stats().deltas_applied == 4, "second keyframe not used");
+
+    VersionCommit large;
+    large.situation_id = situation->situation_id;
+    large.refs = current;
+    for (uint32_t i = 0; i < 1200; ++i) {
+        large.refs.push_back(synthetic_hash(300000 + i));
+    }
+    CommitResult v6 = repository.commit_version(large);
+    assert_true(v6.ok && v6.keyframe, "change budget not applied");
+
+    // Rewriting a chain member makes it a keyframe; later deltas still apply.
+    assert_true(repository.replace_refs(versions[1].version_id, expected[1]), "refs not replaced");
+    auto v1 = repository.get_version(versions[1].version_id);
+    assert_true(v1 && v1->delta_chain.empty(), "replaced version not a keyframe");
+    SituationRepository second_reader(conn, cas);
+    assert_true(second_reader.read_refs(versions[3].version_id, refs) && refs == expected[3], "chain broken by replace_refs");
+}
@@ -0,0 +1,149 @@
+#include <iostream>
+#include <cstdlib>
+#include <algorithm>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/basic/document.hpp>
+#include <bsoncxx/builder/basic/array.hpp>
+#include <bsoncxx/builder/basic/kvp.hpp>
+#include <bsoncxx/builder/stream/document.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/spatial_index/spatial_index.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static HashId make_hash(uint32_t seed) {
+    HashId hash;
+    std::mt19937 rng(seed);
+    for (size_t i = 0; i < HashId::kSize; ++i) {
+        hash.data()[i] = static_cast<uint8_t>(rng());
+    }
+    return hash;
+}
+
+static BPO make_line_bpo(double x, double y, double length) {
+    bsoncxx::builder::basic::array coords;
+    bsoncxx::builder::basic::array start;
+    start.append(x);
+    start.append(y);
+    coords.append(start);
+    bsoncxx::builder::basic::array end;
+    end.append(x + length);
+    end.append(y + length);
+    coords.append(end);
+
+    bsoncxx::builder::basic::document geom_builder;
+    geom_builder.append(bsoncxx::builder::basic::kvp("type", "LineString"));
+    geom_builder.append(bsoncxx::builder::basic::kvp("coordinates", coords));
+
+    bsoncxx::builder::basic::document attr_builder;
+    attr_builder.append(bsoncxx::builder::basic::kvp("class", "spatial"));
+
+    auto geom_value = geom_builder.extract();
+    auto attr_value = attr_builder.extract();
+    return BPO(HashId(), geom_value.view(), attr_value.view());
+}
+
+void test_spatial_index_queries() {
+    std::mt19937 rng(42);
+    std::uniform_real_distribution<double> coord(-50.0, 50.0);
+    std::uniform_real_distribution<double> extent(0.0, 2.0);
+
+    std::vector<SpatialEntry> entries;
+    for (uint32_t i = 0; i < 5000; ++i) {
+        double x = coord(rng);
+        double y = coord(rng);
+        entries.push_back(SpatialEntry{Envelope(x, y, x + extent(rng), y + extent(rng)), make_hash(i)});
+    }
+
+    SpatialIndex index;
+    index.bulk_load(entries);
+
+    Envelope box(-10.0, -10.0, 5.0, 3.0);
+    auto brute_force = [&](bool within) {
+        std::vector<HashId> expected;
+        for (const auto& entry : entries) {
+            if (within ? box.contains(entry.envelope) : box.intersects(entry.envelope)) {
+                expected.push_back(entry.hash);
+            }
+        }
+        std::sort(expected.begin(), expected.end());
+        return expected;
+    };
+
+    auto intersects = index.query_intersects(box);
+    std::sort(intersects.begin(), intersects.end());
+    assert_true(intersects == brute_force(false), "SpatialIndex intersects query mismatch");
+
+    auto within = index.query_within(box);
+    std::sort(within.begin(), within.end());
+    assert_true(within == brute_force(true), "SpatialIndex within query mismatch");
+
+    HashId inserted = make_hash(100000);
+    index.insert(inserted, Envelope(0.0, 0.0, 0.5, 0.5));
+    index.remove(entries[0].hash);
+    auto after = index.query_intersects(Envelope(-100.0, -100.0, 100.0, 100.0));
+    assert_true(after.size() == entries.size(), "SpatialIndex insert/remove size mismatch");
+    assert_true(std::find(after.begin(), after.end(), inserted) != after.end(), "SpatialIndex lost inserted entry");
+    assert_true(std::find(after.begin(), after.end(), entries[0].hash) == after.end(), "SpatialIndex returned removed entry");
+
+    SpatialIndexStats stats = index.get_stats();
+    assert_true(stats.height >= 2, "SpatialIndex tree too shallow");
+    assert_true(stats.memory_bytes > 0, "SpatialIndex reported no memory");
+    assert_true(stats.queries == 3, "SpatialIndex query counter mismatch");
+}
+
+void test_cas_spatial_index() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    auto collection = conn.get_bpo_cas_collection();
+    CAS cas(collection);
+
+    bsoncxx::builder::stream::document empty_filter;
+    collection.delete_many(empty_filter.view());
+
+    std::vector<BPO> batch;
+    for (int i = 0; i < 20; ++i) {
+        batch.push_back(make_line_bpo(i * 1.0, i * 1.0, 0.5));
+    }
+    cas.store_many(batch);
+
+    auto expected = cas.find_in_bbox(2.5, 2.5, 8.0, 8.0);
+
+    auto index = std::make_shared<SpatialIndex>();
+    assert_true(index->build(collection), "SpatialIndex build failed");
+    assert_true(index->size() == 20, "SpatialIndex build size mismatch");
+    cas.set_spatial_index(index);
+
+    auto local = cas.find_in_bbox(2.5, 2.5, 8.0, 8.0);
+    assert_true(local.size() == expected.size(), "SpatialIndex find_in_bbox mismatch");
+
+    BPO extra = make_line_bpo(3.0, 4.0, 0.1);
+    assert_true(cas.store(extra), "CAS store with spatial index failed");
+    assert_true(cas.find_in_bbox(2.5, 2.5, 8.0, 8.0).size() == expected.size() + 1, "SpatialIndex not updated by store");
+
+    auto intersecting = cas.find_intersecting_bbox(0.2, 0.2, 0.3, 0.3);
+    assert_true(intersecting.size() == 1, "SpatialIndex intersects lookup mismatch");
+}
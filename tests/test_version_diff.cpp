@@ -0,0 +1,137 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/builder/stream/document.hpp>
+#include <bsoncxx/json.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/situation_repository/situation_repository.h"
+#include "storage/version_diff/version_diff.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static std::vector<HashId> sorted_hashes(size_t count, uint32_t seed) {
+    std::vector<HashId> hashes(count);
+    uint32_t value = seed;
+    for (auto& hash : hashes) {
+        for (size_t i = 0; i < HashId::kSize; ++i) {
+            value = value * 1664525u + 1013904223u;
+            hash.data()[i] = static_cast<uint8_t>(value >> 24);
+        }
+    }
+    std::sort(hashes.begin(), hashes.end());
+    hashes.erase(std::unique(hashes.begin(), hashes.end()), hashes.end());
+    return hashes;
+}
+
+void test_version_diff_sorted() {
+    auto from = sorted_hashes(20000, 1);
+    std::vector<HashId> to(from.begin() + 100, from.end());
+    auto extra = sorted_hashes(500, 2);
+    to.insert(to.end(), extra.begin(), extra.end());
+    std::sort(to.begin(), to.end());
+
+    std::vector<HashId> added;
+    std::vector<HashId> removed;
+    VersionDiff::diff_sorted(from.data(), from.size(), to.data(), to.size(), added, removed);
+
+    std::vector<HashId> expected_added;
+    std::vector<HashId> expected_removed;
+    std::set_difference(to.begin(), to.end(), from.begin(), from.end(), std::back_inserter(expected_added));
+    std::set_difference(from.begin(), from.end(), to.begin(), to.end(), std::back_inserter(expected_removed));
+    assert_true(added == expected_added, "added hashes mismatch");
+    assert_true(removed == expected_removed, "removed hashes mismatch");
+
+    auto other = sorted_hashes(3000, 3);
+    added.clear();
+    removed.clear();
+    VersionDiff::diff_sorted(from.data(), from.size(), other.data(), other.size(), added, removed);
+    assert_true(added.size() == other.size() && removed.size() == from.size(), "disjoint sets mismatch");
+
+    added.clear();
+    removed.clear();
+    VersionDiff::diff_sorted(from.data(), from.size(), from.data(), from.size(), added, removed);
+    assert_true(added.empty() && removed.empty(), "identical sets differ");
+}
+
+void test_version_diff_deltas() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    CAS cas(conn.get_bpo_cas_collection());
+    SituationRepository repository(conn, cas);
+    VersionDiff differ(conn, repository, cas);
+
+    bsoncxx::builder::stream::document empty_filter;
+    conn.get_bpo_cas_collection().delete_many(empty_filter.view());
+    conn.get_situations_collection().delete_many(empty_filter.view());
+    conn.get_situation_versions_collection().delete_many(empty_filter.view());
+    conn.get_situation_version_refs_collection().delete_many(empty_filter.view());
+    conn.get_version_deltas_collection().delete_many(empty_filter.view());
+
+    auto situation = repository.create_situation("roads");
+    assert_true(situation.has_value(), "situation not created");
+
+    auto line = bsoncxx::from_json(R"({"type": "LineString", "coordinates": [[30.0, 60.0], [30.1, 60.1]]})");
+    auto moved = bsoncxx::from_json(R"({"type": "LineString", "coordinates": [[30.0, 60.0], [30.2, 60.2]]})");
+    auto road_a = bsoncxx::from_json(R"({"id": "a", "lanes": 2})");
+    auto road_b = bsoncxx::from_json(R"({"id": "b", "lanes": 1})");
+    auto road_c = bsoncxx::from_json(R"({"id": "c", "lanes": 4})");
+
+    VersionCommit first;
+    first.situation_id = situation->situation_id;
+    first.bpos.emplace_back(HashId(), line.view(), road_a.view());
+    first.bpos.emplace_back(HashId(), line.view(), road_b.view());
+    CommitResult v1 = repository.commit_version(first);
+    assert_true(v1.ok, "first commit failed");
+
+    HashId a_hash = cas.compute_hash(BPO(HashId(), line.view(), road_a.view()));
+    VersionCommit second;
+    second.situation_id = situation->situation_id;
+    second.refs = {a_hash};
+    second.bpos.emplace_back(HashId(), moved.view(), road_b.view());
+    second.bpos.emplace_back(HashId(), line.view(), road_c.view());
+    CommitResult v2 = repository.commit_version(second);
+    assert_true(v2.ok, "second commit failed");
+
+    HashId old_b = cas.compute_hash(BPO(HashId(), line.view(), road_b.view()));
+    HashId new_b = cas.compute_hash(BPO(HashId(), moved.view(), road_b.view()));
+    HashId c_hash = cas.compute_hash(BPO(HashId(), line.view(), road_c.view()));
+
+    VersionDelta delta;
+    assert_true(differ.diff(v1.version_id, v2.version_id, delta) && !delta.from_cache, "diff failed");
+    assert_true(delta.added.size() == 1 && delta.added[0] == c_hash, "added object mismatch");
+    assert_true(delta.removed.empty(), "modified object reported as removed");
+    assert_true(delta.modified.size() == 1 && delta.modified[0].old_hash == old_b &&
+                delta.modified[0].new_hash == new_b, "modified pair mismatch");
+
+    VersionDelta cached;
+    assert_true(differ.diff(v1.version_id, v2.version_id, cached) && cached.from_cache, "delta not served from version_deltas");
+    assert_true(cached.added == delta.added && cached.modified.size() == 1, "cached delta differs");
+
+    VersionDelta reverse;
+    assert_true(differ.diff(v2.version_id, v1.version_id, reverse) && reverse.from_cache, "reverse delta not served");
+    assert_true(reverse.removed.size() == 1 && reverse.removed[0] == c_hash, "reverse delta not inverted");
+    assert_true(reverse.modified.size() == 1 && reverse.modified[0].old_hash == new_b, "reverse pair not swapped");
+}
@@ -0,0 +1,147 @@
+#include <iostream>
+#include <algorithm>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include <bsoncxx/json.hpp>
+
+#include "storage/mongodb_connection/mongodb_connection.h"
+#include "storage/cas/cas.h"
+#include "storage/bpo_storage/bpo_storage.h"
+#include "storage/situation_repository/situation_repository.h"
+#include "storage/version_diff/version_diff.h"
+#include "storage/version_merge/version_merge.h"
+
+using namespace geoversion;
+using namespace geoversion::storage;
+
+static void assert_true(bool condition, const std::string& message) {
+    if (!condition) {
+        std::cerr << "TEST FAILED: " << message << std::endl;
+        std::exit(EXIT_FAILURE);
+    }
+}
+
+static std::string get_mongo_uri() {
+    const char* uri = std::getenv("MONGODB_URI");
+    if (uri && uri[0] != '\0') {
+        return std::string(uri);
+    }
+    return std::string("mongodb://mongodb:27017");
+}
+
+static BPO feature(int id, const std::string& geometry, const std::string& name) {
+    auto geometry_doc = bsoncxx::from_json(geometry);
+    auto attributes = bsoncxx::from_json(R"({"id": )" + std::to_string(id) + R"(, "name": ")" + name + R"("})");
+    return BPO(HashId(), geometry_doc.view(), attributes.view());
+}
+
+static BPO point(int id, double x, double y, const std::string& name) {
+    return feature(id, R"({"type": "Point", "coordinates": [)" + std::to_string(x) + ", " + std::to_string(y) + "]}", name);
+}
+
+static size_t count_kind(const MergeResult& result, MergeConflictKind kind) {
+    return static_cast<size_t>(std::count_if(result.conflicts.begin(), result.conflicts.end(),
+        [kind](const MergeConflict& conflict) { return conflict.kind == kind; }));
+}
+
+void test_version_merge_three_way() {
+    std::string uri = get_mongo_uri();
+    MongoDBConnection conn(uri, "geoversion");
+    CAS cas(conn.get_bpo_cas_collection());
+    SituationRepository repository(conn, cas);
+    VersionDiff differ(conn, repository, cas);
+
+    std::vector<BPO> base_objects;
+    for (int id = 1; id <= 6; ++id) {
+        base_objects.push_back(point(id, id, id, "base"));
+    }
+    BPO f1 = point(1, 1, 1, "renamed");
+    BPO f2 = point(2, 2, 2, "theirs");
+    BPO f3_ours = point(3, 3, 3, "ours");
+    BPO f3_theirs = point(3, 3, 3, "theirs");
+    BPO f5 = point(5, 5, 5, "both");
+    BPO g_ours = point(100, 10, 10, "ours");
+    BPO g_theirs = point(100, 11, 11, "theirs");
+    BPO road = feature(200, R"({"type": "LineString", "coordinates": [[20.0, 20.0], [20.5, 20.5]]})", "road");
+    BPO path = feature(300, R"({"type": "LineString", "coordinates": [[20.2, 20.0], [20.3, 20.6]]})", "path");
+    auto hash = [&cas](const BPO& bpo) {
+        return cas.compute_hash(bpo);
+    };
+
+    auto situation = repository.create_situation("merge");
+    assert_true(situation.has_value(), "situation not created");
+
+    VersionCommit base_commit;
+    base_commit.situation_id = situation->situation_id;
+    base_commit.bpos = base_objects;
+    CommitResult base = repository.commit_version(base_commit);
+    assert_true(base.ok, "base commit failed: " + base.error);
+    std::vector<HashId> base_refs;
+    for (const auto& bpo : base_objects) {
+        base_refs.push_back(hash(bpo));
+    }
+
+    // Ours renames 1, removes 2, edits 3 and 5, adds a point and a road.
+    VersionCommit ours_commit;
+    ours_commit.situation_id = situation->situation_id;
+    ours_commit.parent_version_ids = {base.version_id};
+    ours_commit.bpos = {f1, f3_ours, f5, g_ours, road};
+    ours_commit.refs = {base_refs[3], base_refs[4], base_refs[5]};
+    CommitResult ours = repository.commit_version(ours_commit);
+
+    // Theirs edits 2, 3 and 5, removes 4, adds a point with the same id and
+    // a path crossing the road.
+    VersionCommit theirs_commit;
+    theirs_commit.situation_id = situation->situation_id;
+    theirs_commit.parent_version_ids = {base.version_id};
+    theirs_commit.bpos = {f2, f3_theirs, f5, g_theirs, path};
+    theirs_commit.refs = {base_refs[0], base_refs[5]};
+    CommitResult theirs = repository.commit_version(theirs_commit);
+    assert_true(ours.ok && theirs.ok, "branch commits failed");
+
+    VersionMergeOptions options;
+    options.spatial = true;
+    options.cell_size = 0.1;
+    options.threads = 4;
+    VersionMerge merger(conn, repository, differ, cas, options);
+
+    auto merge_base = merger.merge_base(ours.version_id, theirs.version_id);
+    assert_true(merge_base && *merge_base == base.version_id, "merge base mismatch");
+
+    MergeResult failed = merger.merge(ours.version_id, theirs.version_id);
+    assert_true(failed.ok && !failed.clean && failed.refs.empty(), "conflicting merge reported clean");
+    assert_true(count_kind(failed, MergeConflictKind::ModifyModify) == 1, "modify/modify conflict missing");
+    assert_true(count_kind(failed, MergeConflictKind::DeleteModify) == 1, "delete/modify conflict missing");
+    assert_true(count_kind(failed, MergeConflictKind::AddAdd) == 1, "add/add conflict missing");
+    assert_true(count_kind(failed, MergeConflictKind::Spatial) == 1, "spatial conflict missing");
+    assert_true(failed.conflicts.size() == 4, "unexpected conflicts");
+    auto spatial = std::find_if(failed.conflicts.begin(), failed.conflicts.end(), [](const MergeConflict& conflict) {
+        return conflict.kind == MergeConflictKind::Spatial;
+    });
+    assert_true(spatial->ours_hash == hash(road) && spatial->theirs_hash == hash(path), "spatial conflict objects mismatch");
+    assert_true(!merger.commit(failed, "merge", "tester").ok, "conflicting merge committed");
+
+    options.spatial = false;
+    options.resolution = ConflictResolution::Ours;
+    VersionMerge ours_wins(conn, repository, differ, cas, options);
+    MergeResult resolved = ours_wins.merge(ours.version_id, theirs.version_id);
+    std::vector<HashId> expected = {
+        hash(f1), hash(f3_ours), hash(f5), base_refs[5], hash(g_ours), hash(road), hash(path)
+    };
+    std::sort(expected.begin(), expected.end());
+    assert_true(resolved.ok && resolved.clean && resolved.refs == expected, "resolved merge refs mismatch");
+    assert_true(resolved.conflicts.size() == 3 && resolved.spatial_cells == 0, "resolved merge conflicts mismatch");
+
+    CommitResult merged = ours_wins.commit(resolved, "merge field teams", "tester");
+    assert_true(merged.ok, "merge commit failed: " + merged.error);
+    auto version = repository.get_version(merged.version_id);
+    assert_true(version && version->parent_version_ids.size() == 2 &&
+                version->parent_version_ids[1] == theirs.version_id, "merge parents not recorded");
+
+    auto fast_forward = ours_wins.merge_base(merged.version_id, theirs.version_id);
+    assert_true(fast_forward && *fast_forward == theirs.version_id, "merged branch not an ancestor");
+    MergeResult up_to_date = ours_wins.merge(merged.version_id, theirs.version_id);
+    assert_true(up_to_date.ok && up_to_date.clean && up_to_date.refs == expected, "merge of an ancestor changed refs");
+}